@@ -0,0 +1,29 @@
+int printf(char *fmt, long a);
+
+int table[256];
+
+int main()
+{
+	int i;
+	int j;
+	int crc;
+	long sum = 0;
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++) {
+			if (crc & 1) {
+				crc = ((crc >> 1) & 2147483647) ^ -306674912;
+			} else {
+				crc = (crc >> 1) & 2147483647;
+			}
+		}
+		table[i] = crc;
+	}
+	crc = -1;
+	for (i = 0; i < 20000000; i++) {
+		crc = table[(crc ^ i) & 255] ^ ((crc >> 8) & 16777215);
+		sum += crc & 4095;
+	}
+	printf("%ld\n", sum + crc);
+	return 0;
+}
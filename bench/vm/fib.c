@@ -0,0 +1,15 @@
+int printf(char *fmt, long a);
+
+long fib(long n)
+{
+	if (n < 2) {
+		return n;
+	}
+	return fib(n - 1) + fib(n - 2);
+}
+
+int main()
+{
+	printf("%ld\n", fib(32));
+	return 0;
+}
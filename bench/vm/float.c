@@ -0,0 +1,20 @@
+int printf(char *fmt, long a);
+
+double f(double x)
+{
+	return 4.0 / (1.0 + x * x);
+}
+
+int main()
+{
+	long n = 5000000;
+	long i;
+	double h = 1.0 / n;
+	double sum = 0.0;
+	for (i = 0; i < n; i++) {
+		double x = (i + 0.5) * h;
+		sum += f(x);
+	}
+	printf("%ld\n", (long)(sum * h * 1000000000.0));
+	return 0;
+}
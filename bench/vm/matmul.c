@@ -0,0 +1,32 @@
+int printf(char *fmt, long a);
+
+long a[40000];
+long b[40000];
+long c[40000];
+
+int main()
+{
+	long n = 200;
+	long i;
+	long j;
+	long k;
+	long sum = 0;
+	for (i = 0; i < n * n; i++) {
+		a[i] = i & 15;
+		b[i] = (i >> 2) & 7;
+	}
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			long s = 0;
+			for (k = 0; k < n; k++) {
+				s += a[i * n + k] * b[k * n + j];
+			}
+			c[i * n + j] = s;
+		}
+	}
+	for (i = 0; i < n * n; i++) {
+		sum += c[i];
+	}
+	printf("%ld\n", sum);
+	return 0;
+}
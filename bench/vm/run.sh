@@ -0,0 +1,10 @@
+#!/bin/sh
+# Time the kernels here on the VM, by switch and by threaded dispatch,
+# with and without the superinstructions. Needs neko_cc built with
+# SELECT_CODE_GEN_FORMAT_VM and the top-down parser.
+cd "$(dirname "$0")"
+NEKO_CC=${NEKO_CC:-../../build/neko_cc}
+for f in ${@:-*.c}; do
+	echo "== $f"
+	"$NEKO_CC" "$f" --bench >/dev/null
+done
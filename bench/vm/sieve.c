@@ -0,0 +1,33 @@
+int printf(char *fmt, long a);
+
+char flags[2000001];
+
+long sieve(long n)
+{
+	long i;
+	long j;
+	long cnt = 0;
+	for (i = 2; i <= n; i++) {
+		flags[i] = 1;
+	}
+	for (i = 2; i <= n; i++) {
+		if (flags[i]) {
+			cnt++;
+			for (j = i + i; j <= n; j += i) {
+				flags[j] = 0;
+			}
+		}
+	}
+	return cnt;
+}
+
+int main()
+{
+	long r;
+	long total = 0;
+	for (r = 0; r < 10; r++) {
+		total += sieve(2000000);
+	}
+	printf("%ld\n", total);
+	return 0;
+}
@@ -12,7 +12,10 @@
 
 #include "parse/parse_base.hh"
 #include <cstddef>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace neko_cc
@@ -21,9 +24,31 @@ namespace neko_cc
 using std::size_t;
 using std::string;
 
+/**
+ * @brief Code emitted and the var it results in. The code is only a view
+ * into the backend's buffer, valid until the next function begins. A
+ * backend keeping the code in memory gives it out as a whole at the end
+ * of the function instead.
+ */
 struct emit_t{
-    string code;
+    std::string_view code;
+    var_t var;
+};
+
+/**
+ * @brief Initial value of an object, one node per scalar or aggregate.
+ * A scalar either holds a constant repr in val, or a runtime var (only
+ * allowed in function scope), which is not part of the constant.
+ * is_zero tells the constant part is all zero, is_const tells there is
+ * no runtime part.
+ */
+struct init_t {
+    std::shared_ptr<type_t> type;
+    bool is_const = true;
+    bool is_zero = true;
+    string val;
     var_t var;
+    std::vector<init_t> inner;
 };
 
 string get_vreg();
@@ -52,11 +77,53 @@ string get_local_name(const string &name);
  */
 string get_type_repr(const type_t &type);
 
+/**
+ * @brief Get the representation of an int constant of type.
+ * 
+ * @param val 
+ * @param type 
+ * @return string 
+ */
+string get_int_repr(long long val, const type_t &type);
+
+/**
+ * @brief Get the representation of a float constant of type.
+ * 
+ * @param val 
+ * @param type 
+ * @return string 
+ */
+string get_float_repr(double val, const type_t &type);
+
+/**
+ * @brief Get the representation of a string constant, padded with
+ * zero up to len.
+ * 
+ * @param val The real value of the string
+ * @param len Length of the char array
+ * @return string 
+ */
+string get_string_repr(const string &val, size_t len);
+
 /**
  * @brief Emit get item in array pointer.
  */
 emit_t get_item_from_arrptr(const var_t &rs, const var_t &arr_offset);
 
+/**
+ * @brief Emit pointer plus an offset in items, the result stays a pointer
+ * into the same object.
+ * 
+ * @param rs The pointer
+ * @param offset The offset, an i64
+ */
+emit_t emit_ptr_add(const var_t &rs, const var_t &offset);
+
+/**
+ * @brief Emit the difference of two pointers to the same type, in items.
+ */
+emit_t emit_ptr_diff(const var_t &v1, const var_t &v2);
+
 /**
  * @brief Emit get item in struct pointer.
  *
@@ -87,6 +154,46 @@ emit_t emit_func_end();
  */
 emit_t emit_label(const string &label);
 
+/**
+ * @brief Enter a block scope. Locals allocated by name until the matching
+ * emit_scope_end() only live inside it.
+ * 
+ */
+void emit_scope_begin();
+
+/**
+ * @brief Leave the innermost block scope, ending the lifetimes of its
+ * locals.
+ * 
+ */
+void emit_scope_end();
+
+/**
+ * @brief End the lifetimes of the locals of every scope deeper than depth,
+ * before a jump out of them. The scopes stay open.
+ * 
+ */
+void emit_scope_leave(size_t depth);
+
+/**
+ * @brief Get the number of open block scopes.
+ * 
+ */
+size_t get_scope_depth();
+
+/**
+ * @brief Begin a region of code that is never run, e.g. the operand of
+ * sizeof. Everything emitted until emit_unevaluated_end() is dropped.
+ * 
+ */
+void emit_unevaluated_begin();
+
+/**
+ * @brief End a region begun by emit_unevaluated_begin().
+ * 
+ */
+void emit_unevaluated_end();
+
 /**
  * @brief Trunc int type to target type.
  * 
@@ -176,6 +283,15 @@ emit_t emit_alloca(const type_t &type, const string &name);
  */
 emit_t emit_global_const_decl(const var_t &var, const string &init_val);
 
+/**
+ * @brief Emit a declare of a global const aggregate.
+ * Trailing zeros are collapsed into zeroinitializer.
+ * 
+ * @param var The variable need to declare
+ * @param init Constant initial value
+ */
+emit_t emit_global_const_decl(const var_t &var, const init_t &init);
+
 /**
  * @brief Emit a declare of a global variable, reutrn a rvalue.
  * 
@@ -191,6 +307,16 @@ emit_t emit_global_decl(const var_t &var);
  */
 emit_t emit_global_decl(const var_t &var, const string &init_val);
 
+/**
+ * @brief Emit a declare of a global variable, reutrn a rvalue.
+ * With constant init value, trailing zeros are collapsed into
+ * zeroinitializer.
+ * 
+ * @param var The variable need to declare
+ * @param init Constant initial value
+ */
+emit_t emit_global_decl(const var_t &var, const init_t &init);
+
 /**
  * @brief Emit a declare of a global function.
  * 
@@ -356,10 +482,27 @@ emit_t emit_load(const var_t &rs);
 /**
  * @brief Emit a store instruction.
  * 
+ * @param rd The lvalue (address) to store to
  * @param rs The rvalue to store
- * @param rd The lvalue to store
  */
-emit_t emit_store(const var_t &rs, const var_t &rd);
+emit_t emit_store(const var_t &rd, const var_t &rs);
+
+/**
+ * @brief Emit a bulk copy between two objects.
+ * 
+ * @param rd The address to copy to
+ * @param rs The address to copy from
+ * @param size Size in byte
+ */
+emit_t emit_memcpy(const var_t &rd, const var_t &rs, size_t size);
+
+/**
+ * @brief Emit a bulk zero fill of an object.
+ * 
+ * @param rd The address to fill
+ * @param size Size in byte
+ */
+emit_t emit_memzero(const var_t &rd, size_t size);
 
 /**
  * @brief Emit equal instruction.
@@ -510,6 +653,22 @@ emit_t emit_ret();
  */
 emit_t emit_ret(const var_t &v);
 
+/**
+ * @brief Ask for the call just emitted to be a tail call, v being its
+ * result, returned next. It becomes one at the end of the function if no
+ * local escapes, and a guaranteed one if the call passes and returns the
+ * types of the function too. Nothing is asked if v is not its result.
+ * 
+ * @param v The value about to be returned
+ */
+void emit_tail_call(const var_t &v);
+
+/**
+ * @brief Make a call asked to be a tail call an error at the end of the
+ * function when it cannot be a guaranteed one. Off by default.
+ */
+extern bool gen_strict_tail_call;
+
 /**
  * @brief Emit a phi instruction.
  * 
@@ -521,6 +680,16 @@ emit_t emit_ret(const var_t &v);
 emit_t emit_phi(const var_t &v1, const string &label1, const var_t &v2,
            const string &label2);
 
+/**
+ * @brief Emit a select instruction, picking one of two values of the same
+ * type without a branch.
+ * 
+ * @param cond The condition, a bool
+ * @param v1 The value if true
+ * @param v2 The value if false
+ */
+emit_t emit_select(const var_t &cond, const var_t &v1, const var_t &v2);
+
 /**
  * @brief Emit a branch instruction, with no condition.
  * 
@@ -537,5 +706,22 @@ emit_t emit_br(const string &label);
 emit_t emit_br(const var_t &cond, const string &label_true,
          const string &label_false);
 
+/**
+ * @brief Emit a multiway branch on an integer value.
+ * 
+ * @param cond The value to switch on
+ * @param label_default The label to jump if no case matches
+ * @param cases The case values and the labels to jump for them
+ */
+emit_t emit_switch(const var_t &cond, const string &label_default,
+		   const std::vector<std::pair<long long, string> > &cases);
+
+/**
+ * @brief Emit the end of a translation unit, with declares of
+ * everything the generated code depends on.
+ * 
+ */
+emit_t emit_module_end();
+
 
 }
\ No newline at end of file
@@ -0,0 +1,467 @@
+/**
+ * @file gen/ir.hh
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Define the in-memory IR the LLVM backend emits into.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#pragma once
+
+#include "writer.hh"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace neko_cc
+{
+
+/**
+ * @brief Opcode of an IR instruction. Operands in ops[] are value ids
+ * unless said otherwise, types are type ids of the module.
+ */
+enum ir_op_t : uint16_t {
+	// dropped instruction, skipped by everything
+	ir_nop = 0,
+
+	// binary, ops[0] ops[1], ty the operand type
+	ir_add,
+	ir_sub,
+	ir_mul,
+	ir_sdiv,
+	ir_udiv,
+	ir_srem,
+	ir_urem,
+	ir_shl,
+	ir_lshr,
+	ir_ashr,
+	ir_and,
+	ir_or,
+	ir_xor,
+	ir_fadd,
+	ir_fsub,
+	ir_fmul,
+	ir_fdiv,
+	ir_frem,
+
+	// compare, ops[0] ops[1], ty the operand type
+	ir_icmp_eq,
+	ir_icmp_ne,
+	ir_icmp_ult,
+	ir_icmp_slt,
+	ir_icmp_ule,
+	ir_icmp_sle,
+	ir_icmp_ugt,
+	ir_icmp_sgt,
+	ir_icmp_uge,
+	ir_icmp_sge,
+	ir_fcmp_oeq,
+	ir_fcmp_one,
+	ir_fcmp_olt,
+	ir_fcmp_ole,
+	ir_fcmp_ogt,
+	ir_fcmp_oge,
+
+	// cast, ops[0] from ty to ty2
+	ir_trunc,
+	ir_zext,
+	ir_sext,
+	ir_fptosi,
+	ir_sitofp,
+	ir_fptrunc,
+	ir_fpext,
+	ir_inttoptr,
+	ir_ptrtoint,
+
+	// ty the allocated type
+	ir_alloca,
+	// ops[0] the address, ty the loaded type
+	ir_load,
+	// ops[0] the value, ops[1] the address, ty the value type
+	ir_store,
+	// ops[0] the base, ty the item type, ops[1] and ops[2] (if not -1)
+	// the indexes of type ty2
+	ir_gep,
+	// ops[0] the aggregate of type ty, ops[1] the member index itself
+	ir_extractvalue,
+	// ops[0] to ops[1] from, ops[2] the size in byte
+	ir_memcpy,
+	// ops[0] to, ops[1] the size in byte
+	ir_memzero,
+	// ops[0] the alloca, ops[1] the size in byte, -1 if unknown
+	ir_lifetime_start,
+	ir_lifetime_end,
+	// ops[0] the callee, ty the return type, args in the pool as pairs
+	// of type and value
+	ir_call,
+	// ty the type, incomings in the pool as pairs of value and block
+	ir_phi,
+	// ops[0] the i1 condition, ops[1] and ops[2] the values of type ty
+	// if true and false
+	ir_select,
+
+	// terminator, ops[0] the block
+	ir_br,
+	// terminator, ops[0] the condition of type ty, ops[1] and ops[2] the
+	// blocks if true and false
+	ir_cond_br,
+	// terminator, ops[0] the value of type ty, ops[1] the default block,
+	// cases in the pool as pairs of constant and block
+	ir_switch,
+	// terminator, ops[0] the value of type ty, -1 for ret void
+	ir_ret,
+
+	ir_op_cnt
+};
+
+enum ir_flag_t : uint16_t {
+	ir_flag_inbounds = 1 << 0,
+	ir_flag_exact = 1 << 1,
+	// on alloca, the object is volatile and must stay in memory, on load
+	// and store, the access is volatile
+	ir_flag_volatile = 1 << 2,
+	// on call, a return of its result in the source asks for a tail call
+	ir_flag_want_tail = 1 << 3,
+	// on call, the callee reaches no local of the caller
+	ir_flag_tail = 1 << 4,
+	// on call, also right before the return of its result, with the
+	// prototype of the caller, so it must not grow the stack
+	ir_flag_musttail = 1 << 5,
+	// on add, sub, mul and shl, signed overflow is undefined
+	ir_flag_nsw = 1 << 6,
+};
+
+/**
+ * @brief An instruction, fixed in size. Anything of variable length
+ * lives in the pool of the function, at [pool_beg, pool_beg + pool_len).
+ */
+struct ir_inst_t {
+	ir_op_t op = ir_nop;
+	uint16_t flags = 0;
+	// value defined here, -1 for none
+	int32_t res = -1;
+	int32_t ty = -1;
+	int32_t ty2 = -1;
+	int32_t ops[3] = { -1, -1, -1 };
+	uint32_t pool_beg = 0;
+	uint32_t pool_len = 0;
+};
+
+/**
+ * @brief A value, every operand refers to one by its id. Constants carry
+ * no type, they take the type of where they are used.
+ */
+struct ir_value_t {
+	enum kind_t : uint8_t {
+		val_inst,
+		val_arg,
+		val_const,
+		val_global,
+	} kind;
+	// defining instruction of a val_inst
+	int32_t def = -1;
+	// index into the strings of the function, the repr of a constant or
+	// global, or the name of a named local. -1 to be numbered on output
+	int32_t name = -1;
+};
+
+/**
+ * @brief A basic block, the instructions at [beg, end).
+ */
+struct ir_block_t {
+	// index into the strings of the function, -1 if unlabeled
+	int32_t name = -1;
+	uint32_t beg = 0;
+	uint32_t end = 0;
+};
+
+struct ir_func_t {
+	std::string name;
+	bool is_internal = false;
+	int32_t ret_ty = -1;
+	std::vector<int32_t> args;
+	std::vector<int32_t> args_ty;
+	// arguments no other pointer reaches the memory of, restrict
+	// pointers, printed noalias
+	std::vector<bool> args_noalias;
+
+	std::vector<ir_inst_t> insts;
+	std::vector<ir_value_t> vals;
+	std::vector<ir_block_t> blocks;
+	// blocks in output order
+	std::vector<int32_t> layout;
+	std::vector<int32_t> pool;
+	std::vector<std::string> strs;
+
+	// values known by name: constants, globals and arguments
+	std::unordered_map<std::string, int32_t> named;
+	std::unordered_map<std::string, int32_t> labels;
+	// block being filled, -1 right after a terminator
+	int32_t cur_block = -1;
+
+	void clear();
+	int32_t add_str(std::string_view str);
+	int32_t new_val(ir_value_t::kind_t kind, int32_t name = -1);
+	/**
+	 * @brief Get the value of a constant, global or argument, it is
+	 * created at first use.
+	 */
+	int32_t get_named(const std::string &name);
+	/**
+	 * @brief Get the block of a label, it is created at first use.
+	 */
+	int32_t get_block(const std::string &label);
+	/**
+	 * @brief Start filling a block. A block still open falls through.
+	 */
+	void start_block(int32_t block);
+	/**
+	 * @brief Append an instruction to the open block. After a terminator
+	 * nothing is open and the instruction is dropped, except an alloca,
+	 * which gets an unlabeled block. Returns the value it defines if
+	 * has_res, otherwise -1.
+	 */
+	int32_t append(ir_inst_t inst, bool has_res);
+};
+
+struct ir_global_t {
+	std::string name;
+	// linkage and kind, e.g. "private constant"
+	std::string attr;
+	std::string type;
+	std::string init;
+};
+
+struct ir_decl_t {
+	std::string name;
+	int32_t ret_ty = -1;
+	std::vector<int32_t> args_ty;
+};
+
+struct ir_module_t {
+	std::vector<std::string> types;
+	std::unordered_map<std::string, int32_t> type_ids;
+	// identified struct types, as pairs of name and body
+	std::vector<std::pair<std::string, std::string> > named_types;
+	size_t named_types_printed = 0;
+	std::vector<ir_global_t> globals;
+	// external function declarations
+	std::vector<ir_decl_t> decls;
+	// finished functions, kept here by an output format that writes the
+	// module as a whole
+	std::vector<ir_func_t> funcs;
+	bool use_memcpy = false;
+	bool use_memset = false;
+	bool use_lifetime = false;
+
+	int32_t get_type(const std::string &repr);
+};
+
+bool is_ir_terminator(ir_op_t op);
+
+/**
+ * @brief Strip the spaces around a repr.
+ */
+std::string_view ir_trim(std::string_view s);
+
+/**
+ * @brief Split a type or constant repr at the commas not inside brackets
+ * or a string, the items trimmed.
+ */
+std::vector<std::string_view> ir_split_items(std::string_view s);
+
+/**
+ * @brief Get the length of the type that starts an item of an aggregate
+ * constant, e.g. "[ 2 x i32 ]" of "[ 2 x i32 ] [ i32 1, i32 2 ]".
+ */
+size_t ir_skip_type(std::string_view s);
+
+/**
+ * @brief Strip the brackets of a struct body, telling if it is packed.
+ */
+std::string_view ir_struct_items(std::string_view s, bool &packed);
+
+/**
+ * @brief Layout of a type in memory, as the System V ABI of x86-64 has
+ * it.
+ */
+struct ir_layout_t {
+	enum kind_t : uint8_t {
+		ty_void,
+		ty_int,
+		ty_float,
+		ty_double,
+		ty_ptr,
+		ty_array,
+		ty_struct,
+	} kind;
+	uint32_t size = 0;
+	uint32_t align = 1;
+	// bits of an int, items of an array
+	uint64_t cnt = 0;
+	// members of a struct or the item of an array, and their offsets
+	std::vector<int32_t> elems;
+	std::vector<uint32_t> offsets;
+};
+
+// every layout computed so far, by its id
+extern std::vector<ir_layout_t> ir_layouts;
+
+/**
+ * @brief Get the layout of a type repr, computed at first use.
+ */
+int32_t ir_get_layout(const ir_module_t &mod, std::string_view repr);
+
+/**
+ * @brief Get the layout of a type id of the module.
+ */
+int32_t ir_mod_layout(const ir_module_t &mod, int32_t ty);
+
+bool is_ir_fp(int32_t lay);
+
+/**
+ * @brief Tell if a layout fits a register, not void nor an aggregate.
+ */
+bool is_ir_scalar(int32_t lay);
+
+/**
+ * @brief Get the bits of a float constant, in hex as a double even for a
+ * float, or in decimal.
+ */
+uint64_t ir_float_bits(std::string_view repr, bool is_float);
+
+/**
+ * @brief Call fn on a reference to each value the instruction uses.
+ */
+template <typename F>
+void ir_for_each_use(ir_func_t &func, ir_inst_t &inst, F fn)
+{
+	int32_t *pool = func.pool.data() + inst.pool_beg;
+	switch (inst.op) {
+	case ir_nop:
+	case ir_alloca:
+	case ir_br:
+		return;
+	case ir_extractvalue:
+		fn(inst.ops[0]);
+		return;
+	case ir_cond_br:
+		fn(inst.ops[0]);
+		return;
+	case ir_switch:
+		fn(inst.ops[0]);
+		for (uint32_t i = 0; i < inst.pool_len; i += 2) {
+			fn(pool[i]);
+		}
+		return;
+	case ir_call:
+		fn(inst.ops[0]);
+		for (uint32_t i = 1; i < inst.pool_len; i += 2) {
+			fn(pool[i]);
+		}
+		return;
+	case ir_phi:
+		for (uint32_t i = 0; i < inst.pool_len; i += 2) {
+			fn(pool[i]);
+		}
+		return;
+	default:
+		for (int i = 0; i < 3; i++) {
+			if (inst.ops[i] >= 0) {
+				fn(inst.ops[i]);
+			}
+		}
+		return;
+	}
+}
+
+/**
+ * @brief Get the blocks a block may jump to, in the order of its
+ * terminator. A block jumping to another twice has it twice.
+ */
+void ir_get_succs(const ir_func_t &func, int32_t block,
+		  std::vector<int32_t> &succs);
+
+/**
+ * @brief Get the predecessors of every block in the layout, indexed by
+ * block id.
+ */
+std::vector<std::vector<int32_t> > ir_get_preds(const ir_func_t &func);
+
+/**
+ * @brief Drop the blocks the entry cannot reach, forward blocks holding
+ * only a branch, and merge a block into its only predecessor when that
+ * falls through to it.
+ */
+void ir_simplify_cfg(ir_func_t &func);
+
+/**
+ * @brief Move every alloca to the head of the entry block, so a local
+ * declared in a loop gets its stack slot once per call instead of once
+ * per iteration.
+ */
+void ir_hoist_allocas(ir_func_t &func);
+
+/**
+ * @brief Local value numbering, within each block an instruction computing
+ * what an earlier one already did is replaced by it. Arithmetic, compares,
+ * casts and address computations are covered, and loads with no store,
+ * call or memory intrinsic in between.
+ */
+void ir_number_values(ir_func_t &func);
+
+/**
+ * @brief Within each block, replace a load by the value last stored to or
+ * loaded from the same address, unless a store that may alias, a call or
+ * a memory intrinsic comes in between.
+ */
+void ir_forward_stores(ir_func_t &func);
+
+/**
+ * @brief Promote locals whose address never escapes to SSA values, with
+ * phis at the joins. Loads and stores of them are removed.
+ */
+void ir_promote_locals(ir_func_t &func);
+
+/**
+ * @brief Make the calls asked to be tail calls ones, when no local of the
+ * function escapes. Lifetime ends between such a call and the return of
+ * its result move before the call, and it becomes a musttail call if its
+ * prototype is the one of the function.
+ */
+void ir_mark_tail_calls(ir_func_t &func);
+
+/**
+ * @brief Write a function in LLVM textual IR.
+ */
+void ir_print_func(writer_t &out, const ir_module_t &mod, const ir_func_t &func);
+
+/**
+ * @brief Write the named types added since the last call. A type must be
+ * defined before the first alloca or getelementptr of it is read.
+ */
+void ir_print_types(writer_t &out, ir_module_t &mod);
+
+/**
+ * @brief Write the globals and declarations of the module in LLVM
+ * textual IR.
+ */
+void ir_print_module(writer_t &out, const ir_module_t &mod);
+
+/**
+ * @brief Output a finished function in the format linked in. Textual IR
+ * and assembly are written at once, bitcode keeps the function until the
+ * module ends.
+ */
+void ir_output_func(writer_t &out, ir_module_t &mod, ir_func_t &func);
+
+/**
+ * @brief Output the rest of the module, at its end.
+ */
+void ir_output_module(writer_t &out, ir_module_t &mod);
+
+}
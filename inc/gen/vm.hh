@@ -0,0 +1,175 @@
+/**
+ * @file gen/vm.hh
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Define the bytecode of the VM backend, and the interpreter
+ * running it where generating native code is not allowed.
+ *
+ * The VM has registers, an operand is an index into the registers of the
+ * frame. A frame holds the arguments first, then the constants of the
+ * function, copied in at the call, then a register for each value. Ints
+ * narrower than 64 bits are kept sign extended, except an i1, which is 0
+ * or 1. A float lives in the low half of its register.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#pragma once
+
+#include "gen/ir.hh"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace neko_cc
+{
+
+/**
+ * @brief Every opcode. The names ending in 32 work on an i32 and sign
+ * extend the result, an s after a float op is for a float instead of a
+ * double. Unless said otherwise a = b op c.
+ */
+#define VM_OPS(X)                                                           \
+	/* a = b */                                                         \
+	X(mov)                                                              \
+	/* a = b if the register imm is not 0, else c */                    \
+	X(sel)                                                              \
+	/* a = the frame memory + imm */                                    \
+	X(faddr)                                                            \
+	X(add) X(sub) X(mul) X(add32) X(sub32) X(mul32)                     \
+	/* a = b + imm */                                                   \
+	X(addi)                                                             \
+	X(band) X(bor) X(bxor) X(shl) X(shl32) X(ashr) X(lshr) X(lshr32)    \
+	X(sdiv) X(srem) X(udiv) X(urem) X(udiv32) X(urem32)                 \
+	/* a = b extended from the size, zext1 masks an i1 */               \
+	X(sext8) X(sext16) X(sext32) X(zext1) X(zext8) X(zext16) X(zext32)  \
+	/* a = -b */                                                        \
+	X(neg)                                                              \
+	X(fadd) X(fsub) X(fmul) X(fdiv) X(frem)                             \
+	X(fadds) X(fsubs) X(fmuls) X(fdivs) X(frems)                        \
+	/* a = b cmp c, 0 or 1 */                                           \
+	X(eq) X(ne) X(slt) X(sle) X(sgt) X(sge) X(ult) X(ule) X(ugt) X(uge) \
+	X(feq) X(fne) X(flt) X(fle) X(fgt) X(fge)                           \
+	X(feqs) X(fnes) X(flts) X(fles) X(fgts) X(fges)                     \
+	/* a = b converted, si an int, d a double, s a float */             \
+	X(si2d) X(si2s) X(d2si) X(s2si) X(s2d) X(d2s)                       \
+	/* a = the memory at b + imm, or store a there */                   \
+	X(ld8) X(ldu8) X(ld16) X(ld32) X(ld64)                              \
+	X(st8) X(st16) X(st32) X(st64)                                      \
+	/* the same at b + c * imm */                                       \
+	X(ldx8) X(ldxu8) X(ldx16) X(ldx32) X(ldx64)                         \
+	X(stx8) X(stx16) X(stx32) X(stx64)                                  \
+	/* a = b + c * imm */                                               \
+	X(index)                                                            \
+	/* add or sub c to the memory at b + imm */                         \
+	X(addm32) X(addm64) X(subm32) X(subm64)                             \
+	/* copy imm bytes from b to a, of an aggregate */                   \
+	X(copy)                                                             \
+	/* copy c bytes from b to a, zero c bytes at a */                   \
+	X(memcpy) X(memset)                                                 \
+	/* jump to the instruction imm, if b, if not b, if b cmp c */       \
+	X(jmp) X(jnz) X(jz)                                                 \
+	X(jeq) X(jne) X(jslt) X(jsle) X(jsgt) X(jsge)                       \
+	X(jult) X(jule) X(jugt) X(juge)                                     \
+	/* a = the function b called with c args, the registers at imm      \
+	 * of the pool, tcall has it take the frame over and return for     \
+	 * the caller */                                                    \
+	X(call) X(tcall)                                                    \
+	/* the same for the extern b, returning an int, a double or a       \
+	 * float */                                                         \
+	X(callx) X(callxd) X(callxs)                                        \
+	/* return b, or nothing */                                          \
+	X(ret) X(retv)
+
+enum vm_op_t : uint16_t {
+#define VM_OP_ENUM(name) vm_##name,
+	VM_OPS(VM_OP_ENUM)
+#undef VM_OP_ENUM
+	vm_op_cnt
+};
+
+struct vm_inst_t {
+	uint16_t op;
+	uint16_t a;
+	uint16_t b;
+	uint16_t c;
+	int32_t imm;
+};
+
+// the symbol of a relocation against the data of the module
+static const uint32_t vm_sym_data = UINT32_MAX;
+
+/**
+ * @brief The address of a symbol plus addend, put at the constant or the
+ * data offset at.
+ */
+struct vm_reloc_t {
+	uint32_t at;
+	// an index into the externs, or vm_sym_data
+	uint32_t sym;
+	int64_t addend;
+};
+
+// an extern call takes each argument in the pool as a register or'ed with
+// its kind
+enum vm_arg_t : uint32_t {
+	vm_arg_int = 0,
+	vm_arg_double = 1 << 16,
+	vm_arg_float = 2 << 16,
+};
+
+struct vm_func_t {
+	std::string name;
+	uint32_t nargs = 0;
+	uint32_t nregs = 0;
+	uint32_t frame_size = 0;
+	std::vector<vm_inst_t> code;
+	// constants, in the registers after the arguments
+	std::vector<uint64_t> consts;
+	std::vector<uint32_t> pool;
+	std::vector<vm_reloc_t> relocs;
+};
+
+struct vm_module_t {
+	std::vector<vm_func_t> funcs;
+	// functions and data the module uses but does not define
+	std::vector<std::string> externs;
+	std::vector<uint8_t> data;
+	std::vector<vm_reloc_t> data_relocs;
+};
+
+/**
+ * @brief Fuse common sequences into superinstructions when lowering: a
+ * compare into its branch, an address into its load or store, and a load,
+ * add and store of the same address. On by default.
+ */
+extern bool vm_use_superinst;
+
+/**
+ * @brief Lower the functions and globals of a module to bytecode.
+ */
+void vm_compile(ir_module_t &mod, vm_module_t &vm);
+
+/**
+ * @brief Write a module as the image the backend outputs.
+ */
+void vm_write(const vm_module_t &vm, std::string &out);
+
+/**
+ * @brief Read an image back.
+ */
+void vm_read(std::string_view image, vm_module_t &vm);
+
+/**
+ * @brief Run main of a module with the arguments. Externs are looked up in
+ * the process with dlsym. threaded picks dispatch by computed goto over
+ * a plain switch.
+ *
+ * @return int What main returns.
+ */
+int vm_run(const vm_module_t &vm, int argc, char **argv,
+	   bool threaded = true);
+
+}
@@ -0,0 +1,177 @@
+/**
+ * @file gen/x86.hh
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Define the x86-64 registers, the assembly backend, and the
+ * assembler turning its output into machine code.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#pragma once
+
+#include "gen/ir.hh"
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace neko_cc
+{
+
+/**
+ * @brief General registers, in the order of their encoding.
+ */
+enum x86_reg_t : int8_t {
+	x86_rax,
+	x86_rcx,
+	x86_rdx,
+	x86_rbx,
+	x86_rsp,
+	x86_rbp,
+	x86_rsi,
+	x86_rdi,
+	x86_r8,
+	x86_r9,
+	x86_r10,
+	x86_r11,
+	x86_r12,
+	x86_r13,
+	x86_r14,
+	x86_r15,
+};
+
+// names of each register, by the log2 of the size
+extern const char *const x86_reg_name[4][16];
+
+/**
+ * @brief Write a finished function as assembly, in GNU as syntax.
+ */
+void x86_output_func(writer_t &out, ir_module_t &mod, ir_func_t &func);
+
+/**
+ * @brief Write the globals of the module and the constants the functions
+ * loaded from memory.
+ */
+void x86_output_module(writer_t &out, ir_module_t &mod);
+
+enum x86_sect_t {
+	x86_sect_text,
+	x86_sect_rodata,
+	x86_sect_data,
+	x86_sect_bss,
+	x86_sect_cnt
+};
+
+struct x86_operand_t {
+	enum kind_t : uint8_t {
+		op_reg,
+		op_xmm,
+		op_imm,
+		op_mem,
+		op_label,
+	} kind;
+	// the register, or the base of a memory operand, -1 for rip
+	int reg = 0;
+	uint32_t size = 0;
+	// the immediate or the displacement
+	int64_t val = 0;
+	// the target of a label, or of a rip-relative memory operand
+	std::string_view sym;
+	// "*%r11" of an indirect call
+	bool indirect = false;
+};
+
+/**
+ * @brief A place to patch once everything is laid out, a 32-bit offset
+ * from the end of the instruction or a 64-bit address.
+ */
+struct x86_fixup_t {
+	int sect;
+	uint32_t at;
+	uint32_t end;
+	std::string sym;
+	bool is_abs;
+	// memory accessed through the symbol, it cannot be a stub
+	bool is_data;
+	// the target of a jmp, jcc or call
+	bool is_branch;
+};
+
+/**
+ * @brief A label, with what .globl, .type and .size told of it.
+ */
+struct x86_label_t {
+	// -1 if only declared
+	int sect = -1;
+	uint32_t off = 0;
+	bool is_global = false;
+	bool is_func = false;
+	uint32_t size = 0;
+};
+
+/**
+ * @brief Assembler for the GNU as syntax the x86 backend writes, into the
+ * bytes of each section. A .bss section holds zeros.
+ */
+struct x86_as_t {
+	std::vector<uint8_t> sects[x86_sect_cnt];
+	// -1 in a section left out
+	int cur = x86_sect_text;
+	std::unordered_map<std::string, x86_label_t> labels;
+	std::vector<x86_fixup_t> fixups;
+
+	void assemble(std::string_view text);
+	/**
+	 * @brief Get a label defined here, nullptr if there is none.
+	 */
+	const x86_label_t *get_label(const std::string &name) const;
+
+	void byte(uint8_t val)
+	{
+		sects[cur].push_back(val);
+	}
+	void bytes(uint64_t val, int n)
+	{
+		for (int i = 0; i < n; i++) {
+			byte(val >> (i * 8));
+		}
+	}
+	void fixup(std::string_view sym, uint32_t end)
+	{
+		uint32_t at = sects[cur].size();
+		fixups.push_back({ cur, at, at + end, std::string(sym), false,
+				   false, true });
+		bytes(0, 4);
+	}
+
+	x86_operand_t operand(std::string_view s);
+	void encode(uint8_t prefix, bool w,
+		    std::initializer_list<uint8_t> opcode, int reg,
+		    const x86_operand_t &rm, uint32_t size, int imm_size = 0,
+		    int64_t imm = 0);
+	void line(std::string_view s);
+	void directive(std::string_view name, std::string_view args);
+	void inst(std::string_view name, std::vector<x86_operand_t> &ops);
+	bool inst_int(std::string_view name, std::vector<x86_operand_t> &ops);
+	bool inst_sse(std::string_view name, std::vector<x86_operand_t> &ops);
+	/**
+	 * @brief Resolve the fixups of branches within a section, they are
+	 * dropped.
+	 */
+	void resolve();
+};
+
+/**
+ * @brief Assemble the text the x86 backend wrote into executable memory,
+ * then call its main with the arguments. Functions the unit does not
+ * define are looked up in the process with dlsym.
+ *
+ * @return int What main returns.
+ */
+int x86_jit_run(std::string_view text, int argc, char **argv);
+
+}
@@ -15,6 +15,7 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <utility>
 #include <ios>
 #include <memory>
 
@@ -43,6 +44,7 @@ struct type_t {
 	bool is_register;
 	bool is_const;
 	bool is_volatile;
+	bool is_restrict;
 	bool is_unnamed;
 
 	enum {
@@ -59,6 +61,9 @@ struct type_t {
 
 	// type_struct/type_union
 	std::vector<var_t> inner_vars;
+	// the definition it comes from, one tag may be defined again in an
+	// inner scope. 0 if not defined yet
+	size_t def_id;
 
 	// type_basic
 	bool has_signed;
@@ -90,8 +95,10 @@ struct type_t {
 		is_register = false;
 		is_const = false;
 		is_volatile = false;
+		is_restrict = false;
 		is_unnamed = false;
 		type = type_unknown;
+		def_id = 0;
 		has_signed = false;
 		is_unsigned = false;
 		is_bool = 0;
@@ -127,6 +134,8 @@ struct var_t {
 	std::string name;
 	std::shared_ptr<type_t> type;
 	bool is_alloced = false;
+	// value id given by the backend, -1 if the var is only known by name
+	int id = -1;
 
 	void output_var(stream *ss, int level = 0) const
 	{
@@ -168,6 +177,13 @@ struct fun_env_t {
 	}
 };
 
+struct switch_env_t {
+	// the switch value, case values are converted to its type
+	var_t cond;
+	std::vector<std::pair<long long, std::string> > cases;
+	std::string default_label = "";
+};
+
 struct context_t {
 	context_t *prev_context;
 
@@ -175,9 +191,13 @@ struct context_t {
 	std::unordered_map<std::string, type_t> types;
 	std::unordered_map<std::string, int> enums;
 	std::shared_ptr<fun_env_t> fun_env;
+	std::shared_ptr<switch_env_t> switch_env;
 
 	std::string beg_label = "";
 	std::string end_label = "";
+	// scope depth at the targets of continue and break
+	size_t beg_depth = 0;
+	size_t end_depth = 0;
 
 	context_t(context_t &rhs) = delete;
 	context_t &operator=(context_t &rhs) = delete;
@@ -191,8 +211,10 @@ struct context_t {
 	{
 		if (_prev != nullptr) {
 			fun_env = _prev->fun_env;
+			switch_env = _prev->switch_env;
 		} else {
 			fun_env = nullptr;
+			switch_env = nullptr;
 		}
 	}
 
@@ -257,6 +279,7 @@ void unget_tok(tok_t tok);
 void match(int tok, stream &ss);
 std::string get_label();
 std::string get_unnamed_var_name();
+size_t get_def_id();
 std::string get_ptr_type_name(std::string base_name);
 std::string get_func_type_name(std::string base_name);
 
@@ -267,10 +290,12 @@ bool is_type_void(const type_t &type);
 bool is_type_i(const type_t &type);
 bool is_type_f(const type_t &type);
 bool is_type_p(const type_t &type);
+size_t get_type_align(const type_t &type);
 void try_regulate_basic(stream &ss, type_t &type);
 bool is_type_qualifier(tok_t tok);
 bool is_selection_statement(tok_t tok);
 bool is_iteration_statement(tok_t tok);
+bool is_labeled_statement(tok_t tok);
 bool is_jump_statement(tok_t tok);
 bool is_assignment_operatior(tok_t tok);
 bool is_specifier_qualifier_list(tok_t tok, context_t &ctx);
@@ -14,6 +14,11 @@
 namespace neko_cc
 {
 
+/**
+ * @brief Parse a whole unit from ss and write the code generated to out.
+ */
+void translation_unit(stream &ss, stream &out);
+
 void top_declaration(stream &ss, context_t &ctx, type_t type, var_t var);
 
 void external_declaration(stream &ss, context_t &ctx);
@@ -63,7 +68,9 @@ void compound_statement(stream &ss, context_t &ctx);
 void declaration_list(stream &ss, context_t &ctx);
 void statement_list(stream &ss, context_t &ctx);
 void statement(stream &ss, context_t &ctx);
+void labeled_statement(stream &ss, context_t &ctx);
 var_t unary_expression(stream &ss, context_t &ctx);
+size_t sizeof_expression(stream &ss, context_t &ctx);
 var_t cast_expression(stream &ss, context_t &ctx);
 type_t type_name(stream &ss, context_t &ctx);
 var_t primary_expression(stream &ss, context_t &ctx);
@@ -79,6 +86,16 @@ var_t exclusive_or_expression(stream &ss, context_t &ctx);
 var_t inclusive_or_expression(stream &ss, context_t &ctx);
 var_t logical_and_expression(stream &ss, context_t &ctx);
 var_t logical_or_expression(stream &ss, context_t &ctx);
+void unary_condition(stream &ss, context_t &ctx, const std::string &label_true,
+		     const std::string &label_false);
+void logical_and_condition(stream &ss, context_t &ctx,
+			   const std::string &label_true,
+			   const std::string &label_false);
+void logical_or_condition(stream &ss, context_t &ctx,
+			  const std::string &label_true,
+			  const std::string &label_false);
+void condition(stream &ss, context_t &ctx, const std::string &label_true,
+	       const std::string &label_false);
 var_t conditional_expression(stream &ss, context_t &ctx);
 void assignment_operator(stream &ss, var_t rd, var_t rs, tok_t op);
 var_t assignment_expression(stream &ss, context_t &ctx);
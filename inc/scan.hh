@@ -126,6 +126,14 @@ std::string get_char(stream &ss);
  */
 std::string get_string(stream &ss);
 
+/**
+ * @brief Turn a string lit got from get_string into its real value
+ * 
+ * @param str String lit, with trans char marked by '\\'
+ * @return std::string Real value of the string
+ */
+std::string get_string_val(const std::string &str);
+
 /**
  * @brief Get the next token
  * 
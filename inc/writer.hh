@@ -0,0 +1,177 @@
+/**
+ * @file writer.hh
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Define the buffered text writer used to output code.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace neko_cc
+{
+
+/**
+ * @brief A text buffer with fmt-style append.
+ *
+ * Attached to an ostream or a file descriptor, it only holds one buffer
+ * and flushes it with a single big write each time it fills up.
+ * Detached, it grows to keep everything, the content is then read with
+ * view(). In arena mode the text is cut into records with take(), a
+ * record never moves once taken, so the views handed out stay valid
+ * until the next clear().
+ */
+class writer_t {
+    public:
+	static constexpr size_t default_cap = 1 << 16;
+
+	writer_t(bool arena = false, size_t cap = default_cap);
+	explicit writer_t(std::ostream &out, size_t cap = default_cap);
+	explicit writer_t(int fd, size_t cap = default_cap);
+	writer_t(const writer_t &) = delete;
+	writer_t &operator=(const writer_t &) = delete;
+	~writer_t();
+
+	void append(const char *s, size_t n)
+	{
+		if (len + n > cap) {
+			make_room(n);
+			if (n > cap) {
+				write_out(s, n);
+				return;
+			}
+		}
+		std::char_traits<char>::copy(buf.get() + len, s, n);
+		len += n;
+	}
+	void append(std::string_view s)
+	{
+		append(s.data(), s.size());
+	}
+	void append(char c)
+	{
+		if (len + 1 > cap) {
+			make_room(1);
+		}
+		buf[len++] = c;
+	}
+	template <typename T> void append_int(T val)
+	{
+		char tmp[24];
+		auto res = std::to_chars(tmp, tmp + sizeof(tmp), val);
+		append(tmp, res.ptr - tmp);
+	}
+
+	/**
+	 * @brief Append by a format, each "{}" is replaced by the next
+	 * argument. Strings, chars and integers are accepted.
+	 */
+	template <typename... Args>
+	void fmt(std::string_view format, const Args &...args)
+	{
+		fmt_next(format, args...);
+	}
+
+	template <typename T> writer_t &operator<<(const T &val)
+	{
+		put(val);
+		return *this;
+	}
+
+	/**
+	 * @brief Cut the text appended since the last take() as a record.
+	 */
+	std::string_view take()
+	{
+		std::string_view ret(buf.get() + rec_start, len - rec_start);
+		rec_start = len;
+		return ret;
+	}
+
+	std::string_view view() const
+	{
+		return { buf.get(), len };
+	}
+	size_t size() const
+	{
+		return len;
+	}
+	/**
+	 * @brief Drop everything after the first len chars, only for a
+	 * detached writer.
+	 */
+	void truncate(size_t _len)
+	{
+		if (_len < len) {
+			len = _len;
+		}
+	}
+	void clear();
+	void flush();
+
+    private:
+	std::unique_ptr<char[]> buf;
+	size_t len = 0;
+	size_t cap;
+	size_t rec_start = 0;
+	bool arena = false;
+	std::vector<std::unique_ptr<char[]> > old_bufs;
+	std::ostream *out = nullptr;
+	int fd = -1;
+
+	void make_room(size_t n);
+	void write_out(const char *s, size_t n);
+
+	void put(std::string_view s)
+	{
+		append(s);
+	}
+	void put(const std::string &s)
+	{
+		append(s.data(), s.size());
+	}
+	void put(const char *s)
+	{
+		append(std::string_view(s));
+	}
+	template <typename T> void put(const T &val)
+	{
+		if constexpr (std::is_same_v<T, char>) {
+			append(val);
+		} else {
+			static_assert(std::is_integral_v<T>,
+				      "writer_t: cannot format this type");
+			append_int(val);
+		}
+	}
+
+	void fmt_next(std::string_view format)
+	{
+		append(format);
+	}
+	template <typename T, typename... Args>
+	void fmt_next(std::string_view format, const T &val,
+		      const Args &...args)
+	{
+		size_t pos = format.find("{}");
+		if (pos == std::string_view::npos) {
+			append(format);
+			return;
+		}
+		append(format.data(), pos);
+		put(val);
+		fmt_next(format.substr(pos + 2), args...);
+	}
+};
+
+}
@@ -14,6 +14,22 @@
 #include <iostream>
 #include <string>
 
+#include "autoconf.h"
+#if defined(CONFIG_SELECT_CODE_GEN_FORMAT_X86_ASM) && \
+	defined(CONFIG_SELECT_PARSER_TOP_DOWN)
+#include "gen/x86.hh"
+#include "parse/parse_top_down.hh"
+#include <sstream>
+#define NEKO_CC_RUN
+#elif defined(CONFIG_SELECT_CODE_GEN_FORMAT_VM) && \
+	defined(CONFIG_SELECT_PARSER_TOP_DOWN)
+#include "gen/vm.hh"
+#include "parse/parse_top_down.hh"
+#include <chrono>
+#include <sstream>
+#define NEKO_CC_VM
+#endif
+
 using namespace neko_cc;
 
 using std::cout, std::endl;
@@ -21,6 +37,50 @@ using std::cout, std::endl;
 void parser_hook_print(deque<size_t> &state, deque<env_t> &env, tok_t &tok,
 		       lex_t &lex, lex_t::action_t &action);
 
+#ifdef NEKO_CC_VM
+static void vm_compile_file(const std::string &file_name, vm_module_t &vm)
+{
+	std::fstream f(file_name, std::ios::in);
+	std::stringstream image;
+	translation_unit(f, image);
+	vm_read(image.str(), vm);
+}
+
+/**
+ * @brief Run main of the file with and without the superinstructions, by
+ * each dispatch, and print how long each run took.
+ */
+static int vm_bench(const std::string &file_name, int argc, char **argv)
+{
+	int ret = 0;
+	for (int super = 0; super < 2; super++) {
+		vm_use_superinst = super;
+		vm_module_t vm;
+		vm_compile_file(file_name, vm);
+		size_t insts = 0;
+		for (const auto &i : vm.funcs) {
+			insts += i.code.size();
+		}
+		for (int threaded = 0; threaded < 2; threaded++) {
+			auto beg = std::chrono::steady_clock::now();
+			ret = vm_run(vm, argc, argv, threaded);
+			std::chrono::duration<double, std::milli> ms =
+				std::chrono::steady_clock::now() - beg;
+			std::cerr << std::left << std::setw(8)
+				  << (threaded ? "threaded" : "switch")
+				  << std::setw(14)
+				  << (super ? " superinst" : " plain")
+				  << std::right << std::setw(6) << insts
+				  << " insts " << std::fixed
+				  << std::setprecision(1) << std::setw(9)
+				  << ms.count() << " ms" << std::endl;
+		}
+	}
+	vm_use_superinst = true;
+	return ret;
+}
+#endif
+
 int main(int argc, char *argv[])
 {
 	log_level = neko_cc::DEBUG;
@@ -31,6 +91,46 @@ int main(int argc, char *argv[])
 	std::fstream f;
 	f.open(file_name, std::ios::in);
 
+	// "neko_cc file --strict-tail ..." makes a return of a call that cannot
+	// be a guaranteed tail call an error, the options after it are taken
+	// as usual
+	if (argc > 2 && std::string(argv[2]) == "--strict-tail") {
+		gen_strict_tail_call = true;
+		argv[2] = argv[1];
+		argc--;
+		argv++;
+	}
+
+#ifdef NEKO_CC_RUN
+	// "neko_cc file --run args..." compiles and runs main in process, the
+	// file name and the args are its argv
+	if (argc > 2 && std::string(argv[2]) == "--run") {
+		log_level = neko_cc::ERROR;
+		std::stringstream code;
+		translation_unit(f, code);
+		argv[2] = argv[1];
+		return x86_jit_run(code.str(), argc - 2, argv + 2);
+	}
+#endif
+
+#ifdef NEKO_CC_VM
+	// "neko_cc file --run args..." runs main of the file on the VM, the
+	// file name and the args are its argv. "--bench" runs it four times,
+	// timing the dispatch and the superinstructions
+	if (argc > 2 && (std::string(argv[2]) == "--run" ||
+			 std::string(argv[2]) == "--bench")) {
+		log_level = neko_cc::ERROR;
+		bool bench = std::string(argv[2]) == "--bench";
+		argv[2] = argv[1];
+		if (bench) {
+			return vm_bench(file_name, argc - 2, argv + 2);
+		}
+		vm_module_t vm;
+		vm_compile_file(file_name, vm);
+		return vm_run(vm, argc - 2, argv + 2);
+	}
+#endif
+
 	std::string path = "test/lex.yml";
 	std::fstream l(path);
 
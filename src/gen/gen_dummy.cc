@@ -0,0 +1,941 @@
+/**
+ * @file gen_dummy.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief A backend generating no code, for timing the front end alone.
+ *
+ * Every emit returns the var the LLVM backend would, typed the same, so
+ * the parser takes exactly the same path, but only the instruction it
+ * stands for is counted. The types asked for are counted as well, with
+ * how many of them are distinct. The counts are all the module gives out,
+ * as comments.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "gen.hh"
+#include "gen/ir.hh"
+#include "parse/parse_base.hh"
+#include "out.hh"
+#include "writer.hh"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unordered_set>
+
+namespace neko_cc
+{
+
+static const char *const dummy_op_name[ir_op_cnt] = {
+	"nop",
+	"add", "sub", "mul", "sdiv", "udiv", "srem", "urem", "shl", "lshr",
+	"ashr", "and", "or", "xor", "fadd", "fsub", "fmul", "fdiv", "frem",
+	"icmp eq", "icmp ne", "icmp ult", "icmp slt", "icmp ule", "icmp sle",
+	"icmp ugt", "icmp sgt", "icmp uge", "icmp sge",
+	"fcmp oeq", "fcmp one", "fcmp olt", "fcmp ole", "fcmp ogt", "fcmp oge",
+	"trunc", "zext", "sext", "fptosi", "sitofp", "fptrunc", "fpext",
+	"inttoptr", "ptrtoint",
+	"alloca", "load", "store", "getelementptr", "extractvalue", "memcpy",
+	"memzero", "lifetime.start", "lifetime.end", "call", "phi", "select",
+	"br", "br cond", "switch", "ret",
+};
+
+typedef std::array<size_t, ir_op_cnt> dummy_cnt_t;
+
+static size_t vreg_cnt = 0;
+static int32_t val_cnt = 0;
+static writer_t code_buf(true);
+
+static dummy_cnt_t inst_cnt;
+static size_t func_cnt = 0;
+static size_t global_cnt = 0;
+static size_t decl_cnt = 0;
+
+static size_t type_repr_cnt = 0;
+static std::unordered_set<string> type_reprs;
+
+/**
+ * @brief The counts when each unevaluated region began, put back at its
+ * end as the code in there is never run.
+ */
+static std::vector<dummy_cnt_t> unevaluated_marks;
+
+/**
+ * @brief Number of locals of each open block scope, their lifetimes end
+ * when it is left.
+ */
+static std::vector<size_t> scopes;
+
+string get_vreg()
+{
+	char buf[24] = "%vr_";
+	auto res = std::to_chars(buf + 4, buf + sizeof(buf), vreg_cnt++);
+	return string(buf, res.ptr);
+}
+
+string get_global_name(const string &name)
+{
+	return "@" + name;
+}
+
+string get_local_name(const string &name)
+{
+	return "%" + name;
+}
+
+/**
+ * @brief Spelled as in the LLVM backend, except a named struct is only
+ * referred to by its name, no body is kept for it.
+ */
+static string get_repr(const type_t &type)
+{
+	if (type.type == type_t::type_unknown ||
+	    type.type == type_t::type_typedef) {
+		std::stringstream ss;
+		type.output_type(&ss);
+		err_msg(string("Cannot emit type in ir, with type: \n" +
+			       ss.str()));
+	}
+
+	if (type.type == type_t::type_func) {
+		string ret = get_repr(*type.ret_type) + " (";
+		for (const auto &i : type.args_type) {
+			ret += get_repr(i);
+			ret += ", ";
+		}
+		if (type.args_type.size()) {
+			ret.pop_back();
+			ret.pop_back();
+		}
+		ret += ')';
+		return ret;
+	}
+	if (type.type == type_t::type_basic) {
+		if (type.is_bool) {
+			return "i1";
+		} else if (type.is_char) {
+			return "i8";
+		} else if (type.is_short) {
+			return "i16";
+		} else if (type.is_int) {
+			return "i32";
+		} else if (type.is_long && !type.is_double) {
+			return "i64";
+		} else if (type.is_float) {
+			return "float";
+		} else if (type.is_double && !type.is_long) {
+			return "double";
+		} else if (type.is_double && type.is_long) {
+			return "fp128";
+		} else {
+			return "void";
+		}
+	}
+	if (type.type == type_t::type_struct && type.def_id) {
+		return "%struct." + type.name;
+	}
+	if (type.type == type_t::type_struct) {
+		string ret = "{";
+		for (const auto &i : type.inner_vars) {
+			ret += get_repr(*i.type);
+			ret += ", ";
+		}
+		if (type.inner_vars.size()) {
+			ret.pop_back();
+			ret.pop_back();
+		}
+		ret += '}';
+		return ret;
+	}
+	if (type.type == type_t::type_union) {
+		size_t max_sz = 0;
+		for (const auto &i : type.inner_vars) {
+			max_sz = std::max(max_sz, i.type->size);
+		}
+		return 'i' + std::to_string(max_sz);
+	}
+	if (type.type == type_t::type_enum) {
+		return "i32";
+	}
+	if (type.type == type_t::type_pointer) {
+		return "ptr";
+	}
+	if (type.type == type_t::type_array) {
+		size_t len = type.size / (type.ptr_to->size);
+		return "[ " + std::to_string(len) + " x " +
+		       get_repr(*type.ptr_to) + " ]";
+	}
+	throw std::logic_error("unreachable");
+}
+
+string get_type_repr(const type_t &type)
+{
+	string ret = get_repr(type);
+	type_repr_cnt++;
+	type_reprs.insert(ret);
+	return ret;
+}
+
+string get_int_repr(long long val, const type_t &type)
+{
+	if (type.is_bool) {
+		return val ? "1" : "0";
+	}
+	size_t bits = type.size * 8;
+	if (bits < 64) {
+		uint64_t mask = ((uint64_t)1 << bits) - 1;
+		uint64_t v = (uint64_t)val & mask;
+		if (v >> (bits - 1)) {
+			v |= ~mask;
+		}
+		val = (long long)v;
+	}
+	return std::to_string(val);
+}
+
+string get_float_repr(double val, const type_t &type)
+{
+	if (type.is_double && type.is_long) {
+		err_msg("long double constant is not supported");
+	}
+	if (type.is_float) {
+		val = (float)val;
+	}
+	uint64_t bits;
+	std::memcpy(&bits, &val, sizeof(bits));
+	char buf[24];
+	std::snprintf(buf, sizeof(buf), "0x%016llX", (unsigned long long)bits);
+	return buf;
+}
+
+string get_string_repr(const string &val, size_t len)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	string ret = "c\"";
+	for (size_t i = 0; i < len; i++) {
+		unsigned char ch = i < val.size() ? val[i] : 0;
+		if (ch >= 0x20 && ch < 0x7f && ch != '"' && ch != '\\') {
+			ret += ch;
+		} else {
+			ret += '\\';
+			ret += hex[ch >> 4];
+			ret += hex[ch & 0xf];
+		}
+	}
+	ret += '"';
+	return ret;
+}
+
+/**
+ * @brief Count an instruction on the types the LLVM backend would ask a
+ * repr of.
+ */
+static void count(ir_op_t op, const type_t *ty = nullptr,
+		  const type_t *ty2 = nullptr)
+{
+	inst_cnt[op]++;
+	if (ty) {
+		get_type_repr(*ty);
+	}
+	if (ty2) {
+		get_type_repr(*ty2);
+	}
+}
+
+static var_t get_res_var(std::shared_ptr<type_t> type,
+			 bool is_alloced = false)
+{
+	var_t ret;
+	ret.id = val_cnt++;
+	ret.is_alloced = is_alloced;
+	ret.type = type;
+	return ret;
+}
+
+static std::shared_ptr<type_t> get_bool_type()
+{
+	type_t type;
+	type.type = type_t::type_basic;
+	type.is_bool = true;
+	type.size = 1;
+	return std::make_shared<type_t>(type);
+}
+
+static emit_t emit_binary(ir_op_t op, const var_t &v1,
+			  std::shared_ptr<type_t> ret_type)
+{
+	count(op, v1.type.get());
+	return { {}, get_res_var(ret_type) };
+}
+
+static emit_t emit_cast(ir_op_t op, const var_t &rs, const type_t &type)
+{
+	count(op, rs.type.get(), &type);
+	return { {}, get_res_var(std::make_shared<type_t>(type)) };
+}
+
+emit_t get_item_from_arrptr(const var_t &rs, const var_t &arr_offset)
+{
+	count(ir_gep, rs.type->ptr_to.get(), arr_offset.type.get());
+	type_t ptr_type;
+	ptr_type.type = type_t::type_pointer;
+	ptr_type.ptr_to = rs.type->ptr_to;
+	return { {}, get_res_var(std::make_shared<type_t>(ptr_type), true) };
+}
+
+/**
+ * @brief Get the item type a pointer steps over, void * steps by byte as
+ * in GNU C
+ */
+static type_t get_step_type(const type_t &ptr_type)
+{
+	if (ptr_type.ptr_to == nullptr || is_type_void(*ptr_type.ptr_to)) {
+		type_t i8_type;
+		i8_type.name = "i8";
+		i8_type.type = type_t::type_basic;
+		i8_type.size = 1;
+		i8_type.is_char = 1;
+		return i8_type;
+	}
+	return *ptr_type.ptr_to;
+}
+
+emit_t emit_ptr_add(const var_t &rs, const var_t &offset)
+{
+	type_t step_type = get_step_type(*rs.type);
+	count(ir_gep, &step_type, offset.type.get());
+	type_t ptr_type;
+	ptr_type.name = rs.type->name;
+	ptr_type.type = type_t::type_pointer;
+	ptr_type.size = 8;
+	ptr_type.ptr_to = rs.type->ptr_to;
+	return { {}, get_res_var(std::make_shared<type_t>(ptr_type)) };
+}
+
+emit_t emit_ptr_diff(const var_t &v1, const var_t &v2)
+{
+	type_t i64_type;
+	i64_type.name = "i64";
+	i64_type.type = type_t::type_basic;
+	i64_type.size = 8;
+	i64_type.is_long = 2;
+
+	var_t addr1 = emit_ptrtoint(v1, i64_type).var;
+	var_t addr2 = emit_ptrtoint(v2, i64_type).var;
+	emit_sub(addr1, addr2);
+	count(ir_sdiv, &i64_type);
+	return { {}, get_res_var(std::make_shared<type_t>(i64_type)) };
+}
+
+emit_t get_item_from_structptr(const var_t &rs, const int &offset)
+{
+	type_t i32_type;
+	i32_type.type = type_t::type_basic;
+	i32_type.size = 4;
+	i32_type.is_int = true;
+	count(ir_gep, rs.type->ptr_to.get(), &i32_type);
+	type_t ptr_type;
+	ptr_type.type = type_t::type_pointer;
+	ptr_type.ptr_to = rs.type->ptr_to->inner_vars[offset].type;
+	return { {}, get_res_var(std::make_shared<type_t>(ptr_type), true) };
+}
+
+emit_t get_item_from_structobj(const var_t &rs, const int &offset)
+{
+	count(ir_extractvalue, rs.type.get());
+	return { {}, get_res_var(rs.type->inner_vars[offset].type) };
+}
+
+emit_t emit_func_begin(const var_t &function, const std::vector<var_t> &args)
+{
+	val_cnt = 0;
+	scopes.clear();
+	func_cnt++;
+	get_type_repr(*function.type->ret_type);
+	for (const auto &i : args) {
+		get_type_repr(*i.type);
+	}
+	return { {}, {} };
+}
+
+emit_t emit_func_end()
+{
+	return { {}, {} };
+}
+
+emit_t emit_label(const string &)
+{
+	return { {}, {} };
+}
+
+void emit_scope_begin()
+{
+	scopes.push_back(0);
+}
+
+void emit_scope_end()
+{
+	emit_scope_leave(scopes.size() - 1);
+	scopes.pop_back();
+}
+
+void emit_scope_leave(size_t depth)
+{
+	for (size_t i = scopes.size(); i-- > depth;) {
+		inst_cnt[ir_lifetime_end] += scopes[i];
+	}
+}
+
+size_t get_scope_depth()
+{
+	return scopes.size();
+}
+
+void emit_unevaluated_begin()
+{
+	unevaluated_marks.push_back(inst_cnt);
+}
+
+void emit_unevaluated_end()
+{
+	inst_cnt = unevaluated_marks.back();
+	unevaluated_marks.pop_back();
+}
+
+emit_t emit_trunc_to(const var_t &rs, const type_t &type)
+{
+	return emit_cast(ir_trunc, rs, type);
+}
+
+emit_t emit_zext_to(const var_t &rs, const type_t &type)
+{
+	return emit_cast(ir_zext, rs, type);
+}
+
+emit_t emit_sext_to(const var_t &rs, const type_t &type)
+{
+	return emit_cast(ir_sext, rs, type);
+}
+
+emit_t emit_fptosi(const var_t &rs, const type_t &type)
+{
+	return emit_cast(ir_fptosi, rs, type);
+}
+
+emit_t emit_sitofp(const var_t &rs, const type_t &type)
+{
+	return emit_cast(ir_sitofp, rs, type);
+}
+
+emit_t emit_fptrunc_to(const var_t &rs, const type_t &type)
+{
+	return emit_cast(ir_fptrunc, rs, type);
+}
+
+emit_t emit_fpext_to(const var_t &rs, const type_t &type)
+{
+	return emit_cast(ir_fpext, rs, type);
+}
+
+emit_t emit_inttoptr(const var_t &rs, const type_t &type)
+{
+	auto ret = emit_cast(ir_inttoptr, rs, type);
+	ret.var.type->ptr_to = rs.type;
+	return ret;
+}
+
+emit_t emit_ptrtoint(const var_t &rs, const type_t &type)
+{
+	auto ret = emit_cast(ir_ptrtoint, rs, type);
+	ret.var.type->ptr_to = rs.type;
+	return ret;
+}
+
+emit_t emit_conv_to(const var_t &rs, const type_t &type)
+{
+	if (is_type_void(type)) {
+		err_msg("emit_conv_to: type is void");
+	}
+
+	if (type == *rs.type) {
+		return { {}, rs };
+	}
+
+	if (is_type_i(type) && is_type_i(*rs.type)) {
+		if (type.size < rs.type->size) {
+			return emit_trunc_to(rs, type);
+		} else if (type.size > rs.type->size) {
+			// a bool is 0 or 1, never -1
+			if (type.is_unsigned || rs.type->is_bool) {
+				return emit_zext_to(rs, type);
+			} else {
+				return emit_sext_to(rs, type);
+			}
+		} else {
+			return { {}, rs };
+		}
+	}
+	if (is_type_i(type) && is_type_f(*rs.type)) {
+		return emit_fptosi(rs, type);
+	}
+	if (is_type_f(type) && is_type_i(*rs.type)) {
+		return emit_sitofp(rs, type);
+	}
+	if (is_type_f(type) && is_type_f(*rs.type)) {
+		if (type.size < rs.type->size) {
+			return emit_fptrunc_to(rs, type);
+		} else if (type.size > rs.type->size) {
+			return emit_fpext_to(rs, type);
+		} else {
+			return { {}, rs };
+		}
+	}
+	if (is_type_p(type) && is_type_i(*rs.type)) {
+		return emit_inttoptr(rs, type);
+	}
+	if (is_type_i(type) && is_type_p(*rs.type)) {
+		return emit_ptrtoint(rs, type);
+	}
+	if (is_type_p(type) && is_type_p(*rs.type)) {
+		return { {}, rs };
+	}
+	err_msg("emit_conv_to: cannot convert type");
+	throw std::logic_error("unreachable");
+}
+
+emit_t emit_match_type(var_t &v1, var_t &v2)
+{
+	bool conv_v1 = false;
+	if (is_type_i(*v1.type) && is_type_i(*v2.type)) {
+		conv_v1 = v1.type->size < v2.type->size;
+	} else if (is_type_f(*v1.type) && is_type_f(*v2.type)) {
+		conv_v1 = v1.type->size < v2.type->size;
+	} else if (is_type_p(*v1.type) && is_type_p(*v2.type)) {
+		return { {}, v1 };
+	} else if (is_type_p(*v1.type) && is_type_i(*v2.type)) {
+		conv_v1 = true;
+	} else if (is_type_i(*v1.type) && is_type_p(*v2.type)) {
+		conv_v1 = false;
+	} else if (is_type_f(*v1.type) && is_type_i(*v2.type)) {
+		conv_v1 = false;
+	} else if (is_type_i(*v1.type) && is_type_f(*v2.type)) {
+		conv_v1 = true;
+	} else {
+		err_msg("emit_match_type: cannot match type");
+	}
+
+	bool is_unsigned = conv_v1 ? v2.type->is_unsigned :
+				     v1.type->is_unsigned;
+
+	if (conv_v1) {
+		v1 = emit_conv_to(v1, *v2.type).var;
+	} else {
+		v2 = emit_conv_to(v2, *v1.type).var;
+	}
+
+	if (is_unsigned) {
+		v1.type->is_unsigned = true;
+		v2.type->is_unsigned = true;
+	}
+	return { {}, {} };
+}
+
+/**
+ * @brief Get the type of the address of a local of type.
+ */
+static std::shared_ptr<type_t> get_addr_type(const type_t &type)
+{
+	type_t ptr_type;
+	if (type.type == type_t::type_array) {
+		ptr_type = type;
+		ptr_type.type = type_t::type_pointer;
+	} else {
+		ptr_type.name = get_ptr_type_name(type.name);
+		ptr_type.type = type_t::type_pointer;
+		ptr_type.size = 8;
+		ptr_type.ptr_to = std::make_shared<type_t>(type);
+	}
+	return std::make_shared<type_t>(ptr_type);
+}
+
+emit_t emit_alloca(const type_t &type)
+{
+	count(ir_alloca, &type);
+	// an array decays to the address of its first item, no load needed
+	return { {}, get_res_var(get_addr_type(type),
+				 type.type != type_t::type_array) };
+}
+
+emit_t emit_alloca(const type_t &type, const string &name)
+{
+	auto ret = emit_alloca(type);
+	if (!scopes.empty()) {
+		inst_cnt[ir_lifetime_start]++;
+		scopes.back()++;
+	}
+	ret.var.name = name;
+	return ret;
+}
+
+/**
+ * @brief Get the address of a global variable, arrays decay to the address
+ * of their first item the same way as local ones
+ */
+static var_t get_global_addr(const var_t &var)
+{
+	var_t ret;
+	type_t ptr_type;
+	if (var.type->type == type_t::type_array) {
+		ptr_type = *var.type;
+		ptr_type.type = type_t::type_pointer;
+		ret.is_alloced = false;
+	} else {
+		ptr_type.type = type_t::type_pointer;
+		ptr_type.ptr_to = var.type;
+		ret.is_alloced = true;
+	}
+	ret.name = var.name;
+	ret.type = std::make_shared<type_t>(ptr_type);
+	return ret;
+}
+
+static emit_t emit_global(const var_t &var)
+{
+	global_cnt++;
+	get_type_repr(*var.type);
+	return { {}, get_global_addr(var) };
+}
+
+emit_t emit_global_const_decl(const var_t &var, const string &)
+{
+	return emit_global(var);
+}
+
+emit_t emit_global_const_decl(const var_t &var, const init_t &)
+{
+	return emit_global(var);
+}
+
+emit_t emit_global_decl(const var_t &var)
+{
+	return emit_global(var);
+}
+
+emit_t emit_global_decl(const var_t &var, const string &)
+{
+	return emit_global(var);
+}
+
+emit_t emit_global_decl(const var_t &var, const init_t &)
+{
+	return emit_global(var);
+}
+
+emit_t emit_global_func_decl(const var_t &var)
+{
+	decl_cnt++;
+	get_type_repr(*var.type);
+	var_t ret;
+	type_t ptr_type;
+	ptr_type.type = type_t::type_pointer;
+	ptr_type.ptr_to = var.type;
+	ret.name = var.name;
+	ret.is_alloced = false;
+	ret.type = std::make_shared<type_t>(ptr_type);
+	return { {}, ret };
+}
+
+emit_t emit_add(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_add, v1, std::make_shared<type_t>(*v1.type));
+}
+
+emit_t emit_sub(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_sub, v1, std::make_shared<type_t>(*v1.type));
+}
+
+emit_t emit_fadd(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_fadd, v1, std::make_shared<type_t>(*v1.type));
+}
+
+emit_t emit_fsub(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_fsub, v1, std::make_shared<type_t>(*v1.type));
+}
+
+emit_t emit_mul(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_mul, v1, std::make_shared<type_t>(*v1.type));
+}
+
+emit_t emit_fmul(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_fmul, v1, std::make_shared<type_t>(*v1.type));
+}
+
+emit_t emit_sdiv(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_sdiv, v1, std::make_shared<type_t>(*v1.type));
+}
+
+emit_t emit_udiv(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_udiv, v1, std::make_shared<type_t>(*v1.type));
+}
+
+emit_t emit_fdiv(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_fdiv, v1, std::make_shared<type_t>(*v1.type));
+}
+
+emit_t emit_srem(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_srem, v1, v1.type);
+}
+
+emit_t emit_urem(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_urem, v1, v1.type);
+}
+
+emit_t emit_frem(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_frem, v1, v1.type);
+}
+
+emit_t emit_shl(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_shl, v1, v1.type);
+}
+
+emit_t emit_lshr(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_lshr, v1, v1.type);
+}
+
+emit_t emit_ashr(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_ashr, v1, v1.type);
+}
+
+emit_t emit_and(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_and, v1, v1.type);
+}
+
+emit_t emit_or(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_or, v1, v1.type);
+}
+
+emit_t emit_xor(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_xor, v1, v1.type);
+}
+
+emit_t emit_load(const var_t &rs)
+{
+	count(ir_load, rs.type->ptr_to.get());
+	return { {}, get_res_var(rs.type->ptr_to) };
+}
+
+emit_t emit_store(const var_t &, const var_t &rs)
+{
+	count(ir_store, rs.type.get());
+	return { {}, {} };
+}
+
+emit_t emit_memcpy(const var_t &, const var_t &, size_t)
+{
+	count(ir_memcpy);
+	return { {}, {} };
+}
+
+emit_t emit_memzero(const var_t &, size_t)
+{
+	count(ir_memzero);
+	return { {}, {} };
+}
+
+emit_t emit_eq(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_icmp_eq, v1, get_bool_type());
+}
+
+emit_t emit_ne(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_icmp_ne, v1, get_bool_type());
+}
+
+emit_t emit_feq(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_fcmp_oeq, v1, get_bool_type());
+}
+
+emit_t emit_fne(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_fcmp_one, v1, get_bool_type());
+}
+
+emit_t emit_ult(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_icmp_ult, v1, get_bool_type());
+}
+
+emit_t emit_slt(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_icmp_slt, v1, get_bool_type());
+}
+
+emit_t emit_flt(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_fcmp_olt, v1, get_bool_type());
+}
+
+emit_t emit_ule(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_icmp_ule, v1, get_bool_type());
+}
+
+emit_t emit_sle(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_icmp_sle, v1, get_bool_type());
+}
+
+emit_t emit_fle(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_fcmp_ole, v1, get_bool_type());
+}
+
+emit_t emit_ugt(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_icmp_ugt, v1, get_bool_type());
+}
+
+emit_t emit_sgt(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_icmp_sgt, v1, get_bool_type());
+}
+
+emit_t emit_fgt(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_fcmp_ogt, v1, get_bool_type());
+}
+
+emit_t emit_uge(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_icmp_uge, v1, get_bool_type());
+}
+
+emit_t emit_sge(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_icmp_sge, v1, get_bool_type());
+}
+
+emit_t emit_fge(const var_t &v1, const var_t &)
+{
+	return emit_binary(ir_fcmp_oge, v1, get_bool_type());
+}
+
+emit_t emit_call(const var_t &callee, const std::vector<var_t> &args)
+{
+	const auto &ret_type = callee.type->ptr_to->ret_type;
+	count(ir_call, ret_type.get());
+	for (const auto &i : args) {
+		get_type_repr(*i.type);
+	}
+	var_t ret = get_res_var(ret_type);
+	if (is_type_void(*ret_type)) {
+		val_cnt--;
+		ret.id = -1;
+	}
+	return { {}, ret };
+}
+
+emit_t emit_ret()
+{
+	count(ir_ret);
+	return { {}, {} };
+}
+
+emit_t emit_ret(const var_t &v)
+{
+	count(ir_ret, v.type.get());
+	return { {}, {} };
+}
+
+// no call is made a tail call here, so none can fail to be one
+bool gen_strict_tail_call = false;
+
+void emit_tail_call(const var_t &)
+{
+}
+
+emit_t emit_phi(const var_t &v1, const string &, const var_t &,
+		const string &)
+{
+	count(ir_phi, v1.type.get());
+	return { {}, get_res_var(v1.type) };
+}
+
+emit_t emit_select(const var_t &, const var_t &v1, const var_t &)
+{
+	count(ir_select, v1.type.get());
+	return { {}, get_res_var(v1.type) };
+}
+
+emit_t emit_br(const string &)
+{
+	count(ir_br);
+	return { {}, {} };
+}
+
+emit_t emit_br(const var_t &cond, const string &, const string &)
+{
+	count(ir_cond_br, cond.type.get());
+	return { {}, {} };
+}
+
+emit_t emit_switch(const var_t &cond, const string &,
+		   const std::vector<std::pair<long long, string> > &)
+{
+	count(ir_switch, cond.type.get());
+	return { {}, {} };
+}
+
+/**
+ * @brief Give out the counts of the whole unit, the busiest opcodes first.
+ */
+emit_t emit_module_end()
+{
+	size_t total = 0;
+	std::vector<int> ops;
+	for (int i = 0; i < ir_op_cnt; i++) {
+		total += inst_cnt[i];
+		if (inst_cnt[i]) {
+			ops.push_back(i);
+		}
+	}
+	std::stable_sort(ops.begin(), ops.end(), [](int a, int b) {
+		return inst_cnt[a] > inst_cnt[b];
+	});
+
+	code_buf.clear();
+	code_buf.fmt("; {} functions, {} globals, {} declares\n", func_cnt,
+		     global_cnt, decl_cnt);
+	code_buf.fmt("; {} instructions\n", total);
+	for (int i : ops) {
+		code_buf.fmt(";   {} {}\n", dummy_op_name[i], inst_cnt[i]);
+	}
+	code_buf.fmt("; {} type reprs, {} distinct\n", type_repr_cnt,
+		     type_reprs.size());
+	return { code_buf.take(), {} };
+}
+
+}
@@ -7,18 +7,65 @@
  */
 
 #include "gen.hh"
+#include "gen/ir.hh"
 #include "parse/parse_base.hh"
 #include "scan.hh"
 #include "out.hh"
+#include "writer.hh"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace neko_cc
 {
 
 static size_t vreg_cnt = 0;
 
+/**
+ * @brief Text of a function is printed in here once it is complete,
+ * emit_t only holds a view of it. Cleared when a new function begins.
+ */
+static writer_t code_buf(true);
+
+static ir_module_t module;
+static ir_func_t func;
+
+/**
+ * @brief Where the code emitted for an unevaluated operand begins, all of
+ * it is dropped at the end.
+ */
+struct ir_mark_t {
+	size_t insts;
+	size_t layout;
+	size_t pool;
+	int32_t cur_block;
+	size_t globals;
+	size_t decls;
+};
+static std::vector<ir_mark_t> unevaluated_marks;
+
+// functions defined so far, a prototype of one is not declared again
+static std::unordered_set<string> funcs_defined;
+
+/**
+ * @brief Locals of a block scope, with their sizes, their lifetimes end
+ * when it is left.
+ */
+struct ir_scope_t {
+	std::vector<std::pair<int32_t, int32_t> > locals;
+};
+static std::vector<ir_scope_t> scopes;
+
 string get_vreg()
 {
-	return "%vr_" + std::to_string(vreg_cnt++);
+	char buf[24] = "%vr_";
+	auto res = std::to_chars(buf + 4, buf + sizeof(buf), vreg_cnt++);
+	return string(buf, res.ptr);
 }
 
 string get_global_name(const string &name)
@@ -31,6 +78,45 @@ string get_local_name(const string &name)
 	return "%" + name;
 }
 
+/**
+ * @brief Names of the struct types already defined in the module, by the
+ * definition they come from.
+ */
+static std::unordered_map<size_t, string> struct_names;
+static std::unordered_set<string> struct_names_used;
+
+/**
+ * @brief Get the name of an identified struct type, its body is added to
+ * the module the first time. Members are only spelled out once, however
+ * often and deeply the struct is used.
+ */
+static const string &get_struct_name(const type_t &type)
+{
+	auto it = struct_names.find(type.def_id);
+	if (it != struct_names.end()) {
+		return it->second;
+	}
+	string name = "%struct." + type.name;
+	for (size_t i = 1; struct_names_used.count(name); i++) {
+		name = "%struct." + type.name + '.' + std::to_string(i);
+	}
+	struct_names_used.insert(name);
+	const string &ret = struct_names[type.def_id] = name;
+
+	string body = "{ ";
+	for (const auto &i : type.inner_vars) {
+		body += get_type_repr(*i.type);
+		body += ", ";
+	}
+	if (type.inner_vars.size()) {
+		body.pop_back();
+		body.pop_back();
+	}
+	body += " }";
+	module.named_types.emplace_back(name, body);
+	return ret;
+}
+
 string get_type_repr(const type_t &type)
 {
 	if (type.type == type_t::type_unknown ||
@@ -79,6 +165,9 @@ string get_type_repr(const type_t &type)
 			return "void";
 		}
 	}
+	if (type.type == type_t::type_struct && type.def_id) {
+		return get_struct_name(type);
+	}
 	if (type.type == type_t::type_struct) {
 		string ret = "";
 		ret += '{';
@@ -119,189 +208,479 @@ string get_type_repr(const type_t &type)
 	throw std::logic_error("unreachable");
 }
 
-emit_t get_item_from_arrptr(const var_t &rs, const var_t &arr_offset)
+string get_int_repr(long long val, const type_t &type)
+{
+	if (type.is_bool) {
+		return val ? "1" : "0";
+	}
+	size_t bits = type.size * 8;
+	if (bits < 64) {
+		uint64_t mask = ((uint64_t)1 << bits) - 1;
+		uint64_t v = (uint64_t)val & mask;
+		if (v >> (bits - 1)) {
+			v |= ~mask;
+		}
+		val = (long long)v;
+	}
+	return std::to_string(val);
+}
+
+string get_float_repr(double val, const type_t &type)
+{
+	if (type.is_double && type.is_long) {
+		err_msg("long double constant is not supported");
+	}
+	if (type.is_float) {
+		val = (float)val;
+	}
+	uint64_t bits;
+	std::memcpy(&bits, &val, sizeof(bits));
+	char buf[24];
+	std::snprintf(buf, sizeof(buf), "0x%016llX", (unsigned long long)bits);
+	return buf;
+}
+
+string get_string_repr(const string &val, size_t len)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	string ret = "c\"";
+	for (size_t i = 0; i < len; i++) {
+		unsigned char ch = i < val.size() ? val[i] : 0;
+		if (ch >= 0x20 && ch < 0x7f && ch != '"' && ch != '\\') {
+			ret += ch;
+		} else {
+			ret += '\\';
+			ret += hex[ch >> 4];
+			ret += hex[ch & 0xf];
+		}
+	}
+	ret += '"';
+	return ret;
+}
+
+static bool is_type_readonly(const type_t &type)
+{
+	if (type.type == type_t::type_array) {
+		return is_type_readonly(*type.ptr_to);
+	}
+	return type.is_const;
+}
+
+static string get_init_repr(const init_t &init)
+{
+	if (init.is_zero) {
+		return "zeroinitializer";
+	}
+	if (init.type->type == type_t::type_struct) {
+		string ret = "{ ";
+		for (const auto &i : init.inner) {
+			ret += get_type_repr(*i.type) + " " + get_init_repr(i);
+			ret += ", ";
+		}
+		ret.pop_back();
+		ret.pop_back();
+		ret += " }";
+		return ret;
+	}
+	if (init.type->type == type_t::type_array) {
+		if (init.type->ptr_to->is_char) {
+			string val;
+			for (const auto &i : init.inner) {
+				val += (char)(i.is_zero ? 0 : std::stoll(i.val));
+			}
+			return get_string_repr(val, val.size());
+		}
+		string ret = "[ ";
+		for (const auto &i : init.inner) {
+			ret += get_type_repr(*i.type) + " " + get_init_repr(i);
+			ret += ", ";
+		}
+		ret.pop_back();
+		ret.pop_back();
+		ret += " ]";
+		return ret;
+	}
+	return init.val;
+}
+
+/**
+ * @brief Get the type and value of a top level constant. An array with
+ * a long zero tail is emitted as a packed pair of its head and a
+ * zeroinitializer, instead of spelling out every zero.
+ */
+static void get_global_init_repr(const init_t &init, string &type_repr,
+				 string &val_repr)
+{
+	type_repr = get_type_repr(*init.type);
+	val_repr = get_init_repr(init);
+	if (init.is_zero || init.type->type != type_t::type_array) {
+		return;
+	}
+	size_t head = init.inner.size();
+	while (head > 0 && init.inner[head - 1].is_zero) {
+		head--;
+	}
+	size_t tail = init.inner.size() - head;
+	if (tail < 8) {
+		return;
+	}
+
+	init_t head_init = init;
+	head_init.inner.resize(head);
+	head_init.type = std::make_shared<type_t>(*init.type);
+	head_init.type->size = init.type->ptr_to->size * head;
+	type_t tail_type = *init.type;
+	tail_type.size = init.type->ptr_to->size * tail;
+
+	string head_type = get_type_repr(*head_init.type);
+	string tail_repr = get_type_repr(tail_type);
+	type_repr = "<{ " + head_type + ", " + tail_repr + " }>";
+	val_repr = "<{ " + head_type + " " + get_init_repr(head_init) + ", " +
+		   tail_repr + " zeroinitializer }>, align " +
+		   std::to_string(get_type_align(*init.type));
+}
+
+/**
+ * @brief Get the id of a type in the module.
+ */
+static int32_t get_type_id(const type_t &type)
+{
+	return module.get_type(get_type_repr(type));
+}
+
+/**
+ * @brief Get the value a var refers to, vars without an id are
+ * constants, globals or arguments known by name.
+ */
+static int32_t get_val(const var_t &var)
+{
+	if (var.id >= 0) {
+		return var.id;
+	}
+	return func.get_named(var.name);
+}
+
+static int32_t get_const(long long val)
+{
+	char buf[24];
+	auto res = std::to_chars(buf, buf + sizeof(buf), val);
+	return func.get_named(string(buf, res.ptr));
+}
+
+static var_t get_res_var(int32_t id, std::shared_ptr<type_t> type,
+			 bool is_alloced = false)
 {
-	string rd = get_vreg();
-	string code = rd + " = getelementptr " +
-		      get_type_repr(*rs.type->ptr_to) + ", " +
-		      get_type_repr(*rs.type) + " " + rs.name + ", " +
-		      get_type_repr(*arr_offset.type) + " " + arr_offset.name;
 	var_t ret;
+	ret.id = id;
+	ret.is_alloced = is_alloced;
+	ret.type = type;
+	return ret;
+}
+
+static std::shared_ptr<type_t> get_bool_type()
+{
+	type_t type;
+	type.type = type_t::type_basic;
+	type.is_bool = true;
+	type.size = 1;
+	return std::make_shared<type_t>(type);
+}
+
+/**
+ * @brief Append an instruction on two operands of the type of v1.
+ */
+static emit_t emit_binary(ir_op_t op, const var_t &v1, const var_t &v2,
+			  std::shared_ptr<type_t> ret_type, uint16_t flags = 0)
+{
+	ir_inst_t inst;
+	inst.op = op;
+	inst.flags = flags;
+	inst.ty = get_type_id(*v1.type);
+	inst.ops[0] = get_val(v1);
+	inst.ops[1] = get_val(v2);
+	return { {}, get_res_var(func.append(inst, true), ret_type) };
+}
+
+static emit_t emit_cast(ir_op_t op, const var_t &rs, const type_t &type)
+{
+	ir_inst_t inst;
+	inst.op = op;
+	inst.ty = get_type_id(*rs.type);
+	inst.ty2 = get_type_id(type);
+	inst.ops[0] = get_val(rs);
+	return { {}, get_res_var(func.append(inst, true),
+				 std::make_shared<type_t>(type)) };
+}
+
+emit_t get_item_from_arrptr(const var_t &rs, const var_t &arr_offset)
+{
+	ir_inst_t inst;
+	inst.op = ir_gep;
+	// an index stays inside the array, or one past its end
+	inst.flags = ir_flag_inbounds;
+	inst.ty = get_type_id(*rs.type->ptr_to);
+	inst.ty2 = get_type_id(*arr_offset.type);
+	inst.ops[0] = get_val(rs);
+	inst.ops[1] = get_val(arr_offset);
 	type_t ptr_type;
 	ptr_type.type = type_t::type_pointer;
 	ptr_type.ptr_to = rs.type->ptr_to;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(ptr_type);
-	return { code, ret };
+	return { {}, get_res_var(func.append(inst, true),
+				 std::make_shared<type_t>(ptr_type), true) };
+}
+
+/**
+ * @brief Get the item type a pointer steps over, void * steps by byte as
+ * in GNU C
+ */
+static type_t get_step_type(const type_t &ptr_type)
+{
+	if (ptr_type.ptr_to == nullptr || is_type_void(*ptr_type.ptr_to)) {
+		type_t i8_type;
+		i8_type.name = "i8";
+		i8_type.type = type_t::type_basic;
+		i8_type.size = 1;
+		i8_type.is_char = 1;
+		return i8_type;
+	}
+	return *ptr_type.ptr_to;
+}
+
+emit_t emit_ptr_add(const var_t &rs, const var_t &offset)
+{
+	ir_inst_t inst;
+	inst.op = ir_gep;
+	inst.flags = ir_flag_inbounds;
+	inst.ty = get_type_id(get_step_type(*rs.type));
+	inst.ty2 = get_type_id(*offset.type);
+	inst.ops[0] = get_val(rs);
+	inst.ops[1] = get_val(offset);
+	// an array decays to a plain pointer to its first item
+	type_t ptr_type;
+	ptr_type.name = rs.type->name;
+	ptr_type.type = type_t::type_pointer;
+	ptr_type.size = 8;
+	ptr_type.ptr_to = rs.type->ptr_to;
+	return { {}, get_res_var(func.append(inst, true),
+				 std::make_shared<type_t>(ptr_type)) };
+}
+
+emit_t emit_ptr_diff(const var_t &v1, const var_t &v2)
+{
+	size_t step = std::max((size_t)1, get_step_type(*v1.type).size);
+	type_t i64_type;
+	i64_type.name = "i64";
+	i64_type.type = type_t::type_basic;
+	i64_type.size = 8;
+	i64_type.is_long = 2;
+	auto i64 = std::make_shared<type_t>(i64_type);
+
+	var_t addr1 = emit_ptrtoint(v1, i64_type).var;
+	var_t addr2 = emit_ptrtoint(v2, i64_type).var;
+	var_t diff = emit_sub(addr1, addr2).var;
+	ir_inst_t inst;
+	inst.op = ir_sdiv;
+	inst.flags = ir_flag_exact;
+	inst.ty = get_type_id(i64_type);
+	inst.ops[0] = get_val(diff);
+	inst.ops[1] = get_const(step);
+	return { {}, get_res_var(func.append(inst, true), i64) };
 }
 
 emit_t get_item_from_structptr(const var_t &rs, const int &offset)
 {
-	string rd = get_vreg();
-	string code = rd + " = getelementptr " +
-		      get_type_repr(*rs.type->ptr_to) + ", " + "ptr " +
-		      rs.name + ", " + "i32 0, " + "i32 " +
-		      std::to_string(offset);
-	var_t ret;
+	ir_inst_t inst;
+	inst.op = ir_gep;
+	inst.flags = ir_flag_inbounds;
+	inst.ty = get_type_id(*rs.type->ptr_to);
+	inst.ty2 = module.get_type("i32");
+	inst.ops[0] = get_val(rs);
+	inst.ops[1] = get_const(0);
+	inst.ops[2] = get_const(offset);
 	type_t ptr_type;
 	ptr_type.type = type_t::type_pointer;
 	ptr_type.ptr_to = rs.type->ptr_to->inner_vars[offset].type;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(ptr_type);
-	return { code, ret };
+	return { {}, get_res_var(func.append(inst, true),
+				 std::make_shared<type_t>(ptr_type), true) };
 }
 
 emit_t get_item_from_structobj(const var_t &rs, const int &offset)
 {
-	string rd = get_vreg();
-	string code = rd + " = extractvalue " + get_type_repr(*rs.type) + " " +
-		      rs.name + ", " + std::to_string(offset);
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = rs.type->inner_vars[offset].type;
-	return { code, ret };
+	ir_inst_t inst;
+	inst.op = ir_extractvalue;
+	inst.ty = get_type_id(*rs.type);
+	inst.ops[0] = get_val(rs);
+	inst.ops[1] = offset;
+	return { {}, get_res_var(func.append(inst, true),
+				 rs.type->inner_vars[offset].type) };
+}
+
+emit_t emit_func_begin(const var_t &function, const std::vector<var_t> &args)
+{
+	// code of the previous function is all written out by now
+	code_buf.clear();
+	func.clear();
+	scopes.clear();
+	func.name = function.name;
+	func.is_internal = function.type->is_static;
+	func.ret_ty = get_type_id(*function.type->ret_type);
+	funcs_defined.insert(function.name);
+	auto &decls = module.decls;
+	decls.erase(std::remove_if(decls.begin(), decls.end(),
+				   [&](const ir_decl_t &i) {
+					   return i.name == function.name;
+				   }),
+		    decls.end());
+	for (const auto &i : args) {
+		int32_t arg = func.new_val(ir_value_t::val_arg,
+					   func.add_str(i.name));
+		func.named.emplace(i.name, arg);
+		func.args.push_back(arg);
+		func.args_ty.push_back(get_type_id(*i.type));
+		func.args_noalias.push_back(i.type->is_restrict);
+	}
+	func.start_block(func.get_block("entry"));
+	return { {}, {} };
 }
 
-emit_t emit_func_begin(const var_t &func, const std::vector<var_t> &args)
+bool gen_strict_tail_call = false;
+
+emit_t emit_func_end()
 {
-	string code = "define ";
-	if (func.type->is_static) {
-		code += "internal ";
-	}
-	code += get_type_repr(*func.type->ret_type) + " " + func.name + "(";
-	for (const auto &i : args) {
-		code += get_type_repr(*i.type) + " " + i.name + ", ";
+	ir_hoist_allocas(func);
+	ir_simplify_cfg(func);
+	ir_promote_locals(func);
+	ir_number_values(func);
+	ir_forward_stores(func);
+	ir_mark_tail_calls(func);
+	for (const auto &i : func.insts) {
+		if (!gen_strict_tail_call || i.op != ir_call ||
+		    !(i.flags & ir_flag_want_tail) ||
+		    (i.flags & ir_flag_musttail)) {
+			continue;
+		}
+		const ir_value_t &callee = func.vals[i.ops[0]];
+		err_msg("Cannot make the call to " +
+			(callee.name >= 0 ? func.strs[callee.name] :
+					    string("a pointer")) +
+			" in " + func.name +
+			" a tail call: a local escapes, or the call does not "
+			"pass and return the types of the caller");
 	}
-	if (args.size()) {
-		code.pop_back();
-		code.pop_back();
+	ir_output_func(code_buf, module, func);
+	return { code_buf.take(), {} };
+}
+
+emit_t emit_label(const string &label)
+{
+	func.start_block(func.get_block(label));
+	return { {}, {} };
+}
+
+void emit_scope_begin()
+{
+	scopes.emplace_back();
+}
+
+void emit_scope_end()
+{
+	emit_scope_leave(scopes.size() - 1);
+	scopes.pop_back();
+}
+
+void emit_scope_leave(size_t depth)
+{
+	for (size_t i = scopes.size(); i-- > depth;) {
+		const auto &locals = scopes[i].locals;
+		for (auto it = locals.rbegin(); it != locals.rend(); it++) {
+			ir_inst_t inst;
+			inst.op = ir_lifetime_end;
+			inst.ops[0] = it->first;
+			inst.ops[1] = it->second;
+			func.append(inst, false);
+		}
 	}
-	code += ") {";
-	vreg_cnt = 0;
-	return { code, {} };
 }
 
-emit_t emit_func_end()
+size_t get_scope_depth()
 {
-	return { "}", {} };
+	return scopes.size();
 }
 
-emit_t emit_label(const string &label)
+void emit_unevaluated_begin()
 {
-	return {label + ":", {}};
+	ir_mark_t mark;
+	mark.insts = func.insts.size();
+	mark.layout = func.layout.size();
+	mark.pool = func.pool.size();
+	mark.cur_block = func.cur_block;
+	mark.globals = module.globals.size();
+	mark.decls = module.decls.size();
+	unevaluated_marks.push_back(mark);
+}
+
+void emit_unevaluated_end()
+{
+	ir_mark_t mark = unevaluated_marks.back();
+	unevaluated_marks.pop_back();
+	func.insts.resize(mark.insts);
+	func.layout.resize(mark.layout);
+	func.pool.resize(mark.pool);
+	func.cur_block = mark.cur_block;
+	if (func.cur_block >= 0) {
+		func.blocks[func.cur_block].end = mark.insts;
+	}
+	module.globals.resize(mark.globals);
+	module.decls.resize(mark.decls);
 }
 
 emit_t emit_trunc_to(const var_t &rs, const type_t &type)
 {
-	string rd = get_vreg();
-	string code = rd + " = trunc " + get_type_repr(*rs.type) + " " +
-		      rs.name + " to " + get_type_repr(type);
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_cast(ir_trunc, rs, type);
 }
 
 emit_t emit_zext_to(const var_t &rs, const type_t &type)
 {
-	string rd = get_vreg();
-	string code = rd + " = zext " + get_type_repr(*rs.type) + " " +
-		      rs.name + " to " + get_type_repr(type);
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_cast(ir_zext, rs, type);
 }
 
 emit_t emit_sext_to(const var_t &rs, const type_t &type)
 {
-	string rd = get_vreg();
-	string code = rd + " = sext " + get_type_repr(*rs.type) + " " +
-		      rs.name + " to " + get_type_repr(type);
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_cast(ir_sext, rs, type);
 }
 
 emit_t emit_fptosi(const var_t &rs, const type_t &type)
 {
-	string rd = get_vreg();
-	string code = rd + " = fptosi " + get_type_repr(*rs.type) + " " +
-		      rs.name + " to " + get_type_repr(type);
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_cast(ir_fptosi, rs, type);
 }
 
 emit_t emit_sitofp(const var_t &rs, const type_t &type)
 {
-	string rd = get_vreg();
-	string code = rd + " = sitofp " + get_type_repr(*rs.type) + " " +
-		      rs.name + " to " + get_type_repr(type);
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_cast(ir_sitofp, rs, type);
 }
 
 emit_t emit_fptrunc_to(const var_t &rs, const type_t &type)
 {
-	string rd = get_vreg();
-	string code = rd + " = fptrunc " + get_type_repr(*rs.type) + " " +
-		      rs.name + " to " + get_type_repr(type);
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_cast(ir_fptrunc, rs, type);
 }
 
 emit_t emit_fpext_to(const var_t &rs, const type_t &type)
 {
-	string rd = get_vreg();
-	string code = rd + " = fpext " + get_type_repr(*rs.type) + " " +
-		      rs.name + " to " + get_type_repr(type);
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_cast(ir_fpext, rs, type);
 }
 
 emit_t emit_inttoptr(const var_t &rs, const type_t &type)
 {
-	string rd = get_vreg();
-	string code = rd + " = inttoptr " + get_type_repr(*rs.type) + " " +
-		      rs.name + " to " + get_type_repr(type);
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(type);
-	ret.type->ptr_to = rs.type;
-	return { code, ret };
+	auto ret = emit_cast(ir_inttoptr, rs, type);
+	ret.var.type->ptr_to = rs.type;
+	return ret;
 }
 
 emit_t emit_ptrtoint(const var_t &rs, const type_t &type)
 {
-	string rd = get_vreg();
-	string code = rd + " = ptrtoint " + get_type_repr(*rs.type) + " " +
-		      rs.name + " to " + get_type_repr(type);
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(type);
-	ret.type->ptr_to = rs.type;
-	return { code, ret };
+	auto ret = emit_cast(ir_ptrtoint, rs, type);
+	ret.var.type->ptr_to = rs.type;
+	return ret;
 }
 
 emit_t emit_conv_to(const var_t &rs, const type_t &type)
@@ -311,20 +690,21 @@ emit_t emit_conv_to(const var_t &rs, const type_t &type)
 	}
 
 	if (type == *rs.type) {
-		return { "", rs };
+		return { {}, rs };
 	}
 
 	if (is_type_i(type) && is_type_i(*rs.type)) {
 		if (type.size < rs.type->size) {
 			return emit_trunc_to(rs, type);
 		} else if (type.size > rs.type->size) {
-			if (type.is_unsigned) {
+			// a bool is 0 or 1, never -1
+			if (type.is_unsigned || rs.type->is_bool) {
 				return emit_zext_to(rs, type);
 			} else {
 				return emit_sext_to(rs, type);
 			}
 		} else {
-			return { "", rs };
+			return { {}, rs };
 		}
 	}
 	if (is_type_i(type) && is_type_f(*rs.type)) {
@@ -339,7 +719,7 @@ emit_t emit_conv_to(const var_t &rs, const type_t &type)
 		} else if (type.size > rs.type->size) {
 			return emit_fpext_to(rs, type);
 		} else {
-			return { "", rs };
+			return { {}, rs };
 		}
 	}
 	if (is_type_p(type) && is_type_i(*rs.type)) {
@@ -349,7 +729,7 @@ emit_t emit_conv_to(const var_t &rs, const type_t &type)
 		return emit_ptrtoint(rs, type);
 	}
 	if (is_type_p(type) && is_type_p(*rs.type)) {
-		return { "", rs };
+		return { {}, rs };
 	}
 	err_msg("emit_conv_to: cannot convert type");
 	throw std::logic_error("unreachable");
@@ -358,7 +738,7 @@ emit_t emit_conv_to(const var_t &rs, const type_t &type)
 emit_t emit_match_type(var_t &v1, var_t &v2)
 {
 	bool conv_v1 = false;
-	string code = "";
+	std::string_view code;
 	if (is_type_i(*v1.type) && is_type_i(*v2.type)) {
 		if (v1.type->size < v2.type->size) {
 			conv_v1 = true;
@@ -405,12 +785,11 @@ emit_t emit_match_type(var_t &v1, var_t &v2)
 	return { code, {} };
 }
 
-emit_t emit_alloca(const type_t &type)
+/**
+ * @brief Get the type of the address of a local of type.
+ */
+static std::shared_ptr<type_t> get_addr_type(const type_t &type)
 {
-	string rd = get_vreg();
-	string code = rd + " = alloca " + get_type_repr(type);
-	var_t ret;
-	ret.name = rd;
 	type_t ptr_type;
 	if (type.type == type_t::type_array) {
 		ptr_type = type;
@@ -421,79 +800,127 @@ emit_t emit_alloca(const type_t &type)
 		ptr_type.size = 8;
 		ptr_type.ptr_to = std::make_shared<type_t>(type);
 	}
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(ptr_type);
-	return { code, ret };
+	return std::make_shared<type_t>(ptr_type);
+}
+
+emit_t emit_alloca(const type_t &type)
+{
+	ir_inst_t inst;
+	inst.op = ir_alloca;
+	inst.ty = get_type_id(type);
+	if (type.is_volatile) {
+		inst.flags |= ir_flag_volatile;
+	}
+	// an array decays to the address of its first item, no load needed
+	return { {}, get_res_var(func.append(inst, true), get_addr_type(type),
+				 type.type != type_t::type_array) };
 }
 
 emit_t emit_alloca(const type_t &type, const string &name)
 {
-	string rd = name;
-	string code = rd + " = alloca " + get_type_repr(type);
+	auto ret = emit_alloca(type);
+	// the same name may be declared again in an inner scope
+	string local_name = name;
+	for (size_t i = 1; func.named.count(local_name); i++) {
+		local_name = name + '.';
+		char buf[24];
+		auto res = std::to_chars(buf, buf + sizeof(buf), i);
+		local_name.append(buf, res.ptr);
+	}
+	func.vals[ret.var.id].name = func.add_str(local_name);
+	func.named.emplace(local_name, ret.var.id);
+	if (!scopes.empty()) {
+		// the slot is hoisted, it only comes to life here
+		module.use_lifetime = true;
+		ir_inst_t inst;
+		inst.op = ir_lifetime_start;
+		inst.ops[0] = ret.var.id;
+		inst.ops[1] = type.size ? get_const(type.size) : get_const(-1);
+		func.append(inst, false);
+		scopes.back().locals.emplace_back(inst.ops[0], inst.ops[1]);
+	}
+	ret.var.name = name;
+	return ret;
+}
+
+/**
+ * @brief Get the address of a global variable, arrays decay to the address
+ * of their first item the same way as local ones
+ */
+static var_t get_global_addr(const var_t &var)
+{
 	var_t ret;
-	ret.name = rd;
 	type_t ptr_type;
-	if (type.type == type_t::type_array) {
-		ptr_type = type;
+	if (var.type->type == type_t::type_array) {
+		ptr_type = *var.type;
 		ptr_type.type = type_t::type_pointer;
+		ret.is_alloced = false;
 	} else {
-		ptr_type.name = get_ptr_type_name(type.name);
 		ptr_type.type = type_t::type_pointer;
-		ptr_type.size = 8;
-		ptr_type.ptr_to = std::make_shared<type_t>(type);
+		ptr_type.ptr_to = var.type;
+		ret.is_alloced = true;
 	}
-	ret.is_alloced = true;
+	ret.name = var.name;
 	ret.type = std::make_shared<type_t>(ptr_type);
-	return { code, ret };
+	return ret;
+}
+
+static emit_t emit_global(const var_t &var, const string &attr,
+			  const string &type_repr, const string &val_repr)
+{
+	module.globals.push_back({ var.name, attr, type_repr, val_repr });
+	return { {}, get_global_addr(var) };
 }
 
 emit_t emit_global_const_decl(const var_t &var, const string &init_val)
 {
-	string code = var.name + " = private constant " +
-		      get_type_repr(*var.type) + " " + init_val;
-	return { code, var };
+	return emit_global(var, "private constant", get_type_repr(*var.type),
+			   init_val);
+}
+
+emit_t emit_global_const_decl(const var_t &var, const init_t &init)
+{
+	string type_repr, val_repr;
+	get_global_init_repr(init, type_repr, val_repr);
+	return emit_global(var, "private unnamed_addr constant", type_repr,
+			   val_repr);
 }
 
 emit_t emit_global_decl(const var_t &var)
 {
-	string code = var.name + " = global " + get_type_repr(*var.type) +
-		      " zeroinitializer";
-	var_t ret;
-	type_t ptr_type;
-	ptr_type.type = type_t::type_pointer;
-	ptr_type.ptr_to = var.type;
-	ret.name = var.name;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(ptr_type);
-	return { code, ret };
+	return emit_global(var, "global", get_type_repr(*var.type),
+			   "zeroinitializer");
 }
 
 emit_t emit_global_decl(const var_t &var, const string &init_val)
 {
-	string code = var.name + " = global " + get_type_repr(*var.type) + " " +
-		      init_val;
-	var_t ret;
-	type_t ptr_type;
-	ptr_type.type = type_t::type_pointer;
-	ptr_type.ptr_to = var.type;
-	ret.name = var.name;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(ptr_type);
-	return { code, ret };
+	return emit_global(var, "global", get_type_repr(*var.type), init_val);
+}
+
+emit_t emit_global_decl(const var_t &var, const init_t &init)
+{
+	string type_repr, val_repr;
+	get_global_init_repr(init, type_repr, val_repr);
+	return emit_global(var,
+			   is_type_readonly(*var.type) ? "constant" : "global",
+			   type_repr, val_repr);
 }
 
 emit_t emit_global_func_decl(const var_t &var)
 {
-	string code =
-		"declare " + get_type_repr(*var.type) + " " + var.name + "(";
+	ir_decl_t decl;
+	decl.name = var.name;
+	decl.ret_ty = get_type_id(*var.type->ret_type);
 	for (const auto &i : var.type->args_type) {
-		code += get_type_repr(i) + ", ";
+		decl.args_ty.push_back(get_type_id(i));
+	}
+	bool known = funcs_defined.count(var.name);
+	for (const auto &i : module.decls) {
+		known |= i.name == var.name;
 	}
-	if (var.type->args_type.size()) {
-		code.pop_back();
-		code.pop_back();
+	if (!known) {
+		module.decls.push_back(std::move(decl));
 	}
-	code += ")";
 	var_t ret;
 	type_t ptr_type;
 	ptr_type.type = type_t::type_pointer;
@@ -501,572 +928,405 @@ emit_t emit_global_func_decl(const var_t &var)
 	ret.name = var.name;
 	ret.is_alloced = false;
 	ret.type = std::make_shared<type_t>(ptr_type);
-	return { code, ret };
+	return { {}, ret };
+}
+
+/**
+ * @brief Tell if signed overflow of an int of the type is undefined in C.
+ * An int narrower than int is promoted first, the op cannot overflow then
+ * and the result is converted back.
+ */
+static bool is_no_wrap(const type_t &type)
+{
+	return is_type_i(type) && !type.is_unsigned && type.size >= 4;
+}
+
+/**
+ * @brief Get the flag of add, sub and mul on v1 and v2, nsw if both are
+ * signed, not if the front end left one unsigned of the same size.
+ */
+static uint16_t get_wrap_flag(const var_t &v1, const var_t &v2)
+{
+	return is_no_wrap(*v1.type) && is_no_wrap(*v2.type) ? ir_flag_nsw : 0;
 }
 
 emit_t emit_add(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = add " + get_type_repr(*v1.type) + " " + v1.name +
-		      ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(*v1.type);
-	return { code, ret };
+	return emit_binary(ir_add, v1, v2, std::make_shared<type_t>(*v1.type),
+			   get_wrap_flag(v1, v2));
 }
 
 emit_t emit_sub(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = sub " + get_type_repr(*v1.type) + " " + v1.name +
-		      ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(*v1.type);
-	return { code, ret };
+	return emit_binary(ir_sub, v1, v2, std::make_shared<type_t>(*v1.type),
+			   get_wrap_flag(v1, v2));
 }
 
 emit_t emit_fadd(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = fadd " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(*v1.type);
-	return { code, ret };
+	return emit_binary(ir_fadd, v1, v2, std::make_shared<type_t>(*v1.type));
 }
 
 emit_t emit_fsub(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = fsub " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(*v1.type);
-	return { code, ret };
+	return emit_binary(ir_fsub, v1, v2, std::make_shared<type_t>(*v1.type));
 }
 
 emit_t emit_mul(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = mul " + get_type_repr(*v1.type) + " " + v1.name +
-		      ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(*v1.type);
-	return { code, ret };
+	return emit_binary(ir_mul, v1, v2, std::make_shared<type_t>(*v1.type),
+			   get_wrap_flag(v1, v2));
 }
 
 emit_t emit_fmul(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = fmul " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(*v1.type);
-	return { code, ret };
+	return emit_binary(ir_fmul, v1, v2, std::make_shared<type_t>(*v1.type));
+}
+
+/**
+ * @brief Get the value of an int constant, false if v is not one.
+ */
+static bool get_const_int(int32_t v, long long &val)
+{
+	if (func.vals[v].kind != ir_value_t::val_const) {
+		return false;
+	}
+	const string &repr = func.strs[func.vals[v].name];
+	auto res = std::from_chars(repr.data(), repr.data() + repr.size(),
+				   val);
+	return res.ec == std::errc() && res.ptr == repr.data() + repr.size();
 }
 
 emit_t emit_sdiv(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = sdiv " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(*v1.type);
-	return { code, ret };
+	// exact if v1 is an nsw product of a multiple of the divisor
+	uint16_t flags = 0;
+	int32_t a = get_val(v1);
+	long long div, mul;
+	const ir_value_t &val = func.vals[a];
+	if (get_const_int(get_val(v2), div) && div != 0 &&
+	    val.kind == ir_value_t::val_inst && val.def >= 0 &&
+	    func.insts[val.def].op == ir_mul &&
+	    (func.insts[val.def].flags & ir_flag_nsw)) {
+		for (auto i : { 0, 1 }) {
+			int32_t op = func.insts[val.def].ops[i];
+			if (get_const_int(op, mul) && mul % div == 0) {
+				flags = ir_flag_exact;
+			}
+		}
+	}
+	return emit_binary(ir_sdiv, v1, v2, std::make_shared<type_t>(*v1.type),
+			   flags);
 }
 
 emit_t emit_udiv(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = udiv " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(*v1.type);
-	return { code, ret };
+	return emit_binary(ir_udiv, v1, v2, std::make_shared<type_t>(*v1.type));
 }
 
 emit_t emit_fdiv(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = fdiv " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = std::make_shared<type_t>(*v1.type);
-	return { code, ret };
+	return emit_binary(ir_fdiv, v1, v2, std::make_shared<type_t>(*v1.type));
 }
 
 emit_t emit_srem(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = srem " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = v1.type;
-	return { code, ret };
+	return emit_binary(ir_srem, v1, v2, v1.type);
 }
 
 emit_t emit_urem(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = urem " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = true;
-	ret.type = v1.type;
-	return { code, ret };
+	return emit_binary(ir_urem, v1, v2, v1.type);
 }
 
 emit_t emit_frem(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = frem " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = v1.type;
-	return { code, ret };
+	return emit_binary(ir_frem, v1, v2, v1.type);
 }
 
 emit_t emit_shl(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = shl " + get_type_repr(*v1.type) + " " + v1.name +
-		      ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = v1.type;
-	return { code, ret };
+	// a signed shift is undefined past the sign bit too
+	return emit_binary(ir_shl, v1, v2, v1.type,
+			   is_no_wrap(*v1.type) ? ir_flag_nsw : 0);
 }
 
 emit_t emit_lshr(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = lshr " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = v1.type;
-	return { code, ret };
+	return emit_binary(ir_lshr, v1, v2, v1.type);
 }
 
 emit_t emit_ashr(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = ashr " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = v1.type;
-	return { code, ret };
+	return emit_binary(ir_ashr, v1, v2, v1.type);
 }
 
 emit_t emit_and(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = and " + get_type_repr(*v1.type) + " " + v1.name +
-		      ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	if (v1.is_alloced && v2.is_alloced) {
-		ret.is_alloced = true;
-	} else {
-		ret.is_alloced = false;
-	}
-	ret.type = v1.type;
-	return { code, ret };
+	return emit_binary(ir_and, v1, v2, v1.type);
 }
 
 emit_t emit_or(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = or " + get_type_repr(*v1.type) + " " + v1.name +
-		      ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	if (v1.is_alloced && v2.is_alloced) {
-		ret.is_alloced = true;
-	} else {
-		ret.is_alloced = false;
-	}
-	ret.type = v1.type;
-	return { code, ret };
+	return emit_binary(ir_or, v1, v2, v1.type);
 }
 
 emit_t emit_xor(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = xor " + get_type_repr(*v1.type) + " " + v1.name +
-		      ", " + v2.name;
-	var_t ret;
-	ret.name = rd;
-	if (v1.is_alloced && v2.is_alloced) {
-		ret.is_alloced = true;
-	} else {
-		ret.is_alloced = false;
-	}
-	ret.type = v1.type;
-	return { code, ret };
+	return emit_binary(ir_xor, v1, v2, v1.type);
 }
 
 emit_t emit_load(const var_t &rs)
 {
-	string rd = get_vreg();
-	string code = rd + " = load " + get_type_repr(*rs.type->ptr_to) + ", " +
-		      get_type_repr(*rs.type) + " " + rs.name;
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = rs.type->ptr_to;
-	return { code, ret };
+	ir_inst_t inst;
+	inst.op = ir_load;
+	inst.ty = get_type_id(*rs.type->ptr_to);
+	inst.ops[0] = get_val(rs);
+	if (rs.type->ptr_to->is_volatile) {
+		inst.flags |= ir_flag_volatile;
+	}
+	return { {}, get_res_var(func.append(inst, true), rs.type->ptr_to) };
 }
 
-emit_t emit_store(const var_t &rs, const var_t &rd)
+emit_t emit_store(const var_t &rd, const var_t &rs)
 {
-	string code = "store " + get_type_repr(*rs.type) + " " + rs.name +
-		      ", " + get_type_repr(*rd.type) + " " + rd.name;
-	return { code, {} };
+	ir_inst_t inst;
+	inst.op = ir_store;
+	inst.ty = get_type_id(*rs.type);
+	inst.ops[0] = get_val(rs);
+	inst.ops[1] = get_val(rd);
+	if (rd.type->ptr_to && rd.type->ptr_to->is_volatile) {
+		inst.flags |= ir_flag_volatile;
+	}
+	func.append(inst, false);
+	return { {}, {} };
+}
+
+emit_t emit_memcpy(const var_t &rd, const var_t &rs, size_t size)
+{
+	module.use_memcpy = true;
+	ir_inst_t inst;
+	inst.op = ir_memcpy;
+	inst.ops[0] = get_val(rd);
+	inst.ops[1] = get_val(rs);
+	inst.ops[2] = get_const(size);
+	func.append(inst, false);
+	return { {}, {} };
+}
+
+emit_t emit_memzero(const var_t &rd, size_t size)
+{
+	module.use_memset = true;
+	ir_inst_t inst;
+	inst.op = ir_memzero;
+	inst.ops[0] = get_val(rd);
+	inst.ops[1] = get_const(size);
+	func.append(inst, false);
+	return { {}, {} };
 }
 
 emit_t emit_eq(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = icmp eq " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_icmp_eq, v1, v2, get_bool_type());
 }
 
 emit_t emit_ne(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = icmp ne " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_icmp_ne, v1, v2, get_bool_type());
 }
 
 emit_t emit_feq(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = fcmp oeq " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_fcmp_oeq, v1, v2, get_bool_type());
 }
 
 emit_t emit_fne(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = fcmp one " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_fcmp_one, v1, v2, get_bool_type());
 }
 
 emit_t emit_ult(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = icmp ult " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_icmp_ult, v1, v2, get_bool_type());
 }
 
 emit_t emit_slt(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = icmp slt " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_icmp_slt, v1, v2, get_bool_type());
 }
 
 emit_t emit_flt(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = fcmp olt " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_fcmp_olt, v1, v2, get_bool_type());
 }
 
 emit_t emit_ule(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = icmp ule " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_icmp_ule, v1, v2, get_bool_type());
 }
 
 emit_t emit_sle(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = icmp sle " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_icmp_sle, v1, v2, get_bool_type());
 }
 
 emit_t emit_fle(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = fcmp ole " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_fcmp_ole, v1, v2, get_bool_type());
 }
 
 emit_t emit_ugt(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = icmp ugt " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_icmp_ugt, v1, v2, get_bool_type());
 }
 
 emit_t emit_sgt(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = icmp sgt " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_icmp_sgt, v1, v2, get_bool_type());
 }
 
 emit_t emit_fgt(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = fcmp ogt " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_fcmp_ogt, v1, v2, get_bool_type());
 }
 
 emit_t emit_uge(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = icmp uge " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_icmp_uge, v1, v2, get_bool_type());
 }
 
 emit_t emit_sge(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = icmp sge " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_icmp_sge, v1, v2, get_bool_type());
 }
 
 emit_t emit_fge(const var_t &v1, const var_t &v2)
 {
-	string rd = get_vreg();
-	string code = rd + " = fcmp oge " + get_type_repr(*v1.type) + " " +
-		      v1.name + ", " + v2.name;
-	var_t ret;
-	type_t type;
-	type.type = type_t::type_basic;
-	type.is_bool = true;
-	type.size = 1;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = std::make_shared<type_t>(type);
-	return { code, ret };
+	return emit_binary(ir_fcmp_oge, v1, v2, get_bool_type());
 }
 
-emit_t emit_call(const var_t &func, const std::vector<var_t> &args)
+emit_t emit_call(const var_t &callee, const std::vector<var_t> &args)
 {
-	string rd = get_vreg();
-	string code = rd + " = call " +
-		      get_type_repr(*func.type->ptr_to->ret_type) + " " +
-		      func.name + "(";
+	ir_inst_t inst;
+	inst.op = ir_call;
+	inst.ty = get_type_id(*callee.type->ptr_to->ret_type);
+	inst.ops[0] = get_val(callee);
+	inst.pool_beg = func.pool.size();
+	inst.pool_len = args.size() * 2;
 	for (const auto &i : args) {
-		code += get_type_repr(*i.type) + " " + i.name + ", ";
+		func.pool.push_back(get_type_id(*i.type));
+		func.pool.push_back(get_val(i));
 	}
-	if (args.size()) {
-		code.pop_back();
-		code.pop_back();
-	}
-	code += ")";
-
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = func.type->ptr_to->ret_type;
-	return { code, ret };
+	bool has_res = !is_type_void(*callee.type->ptr_to->ret_type);
+	return { {}, get_res_var(func.append(inst, has_res),
+				 callee.type->ptr_to->ret_type) };
 }
 
 emit_t emit_ret()
 {
-	string code = "ret void";
-	return { code, {} };
+	ir_inst_t inst;
+	inst.op = ir_ret;
+	func.append(inst, false);
+	return { {}, {} };
 }
 
 emit_t emit_ret(const var_t &v)
 {
-	string code = "ret " + get_type_repr(*v.type) + " " + v.name;
-	return { code, {} };
+	ir_inst_t inst;
+	inst.op = ir_ret;
+	inst.ty = get_type_id(*v.type);
+	inst.ops[0] = get_val(v);
+	func.append(inst, false);
+	return { {}, {} };
+}
+
+void emit_tail_call(const var_t &v)
+{
+	if (func.cur_block < 0) {
+		return;
+	}
+	// only the call just emitted is in tail position
+	const ir_block_t &block = func.blocks[func.cur_block];
+	if (block.end == block.beg) {
+		return;
+	}
+	ir_inst_t &last = func.insts[block.end - 1];
+	if (last.op == ir_call && v.id >= 0 && last.res == v.id) {
+		last.flags |= ir_flag_want_tail;
+	}
 }
 
 emit_t emit_phi(const var_t &v1, const string &label1, const var_t &v2,
 		const string &label2)
 {
-	string rd = get_vreg();
-	string code = rd + " = phi " + get_type_repr(*v1.type) + " [" +
-		      v1.name + ", %" + label1 + "], [" + v2.name + ", %" +
-		      label2 + "]";
-	var_t ret;
-	ret.name = rd;
-	ret.is_alloced = false;
-	ret.type = v1.type;
-	return { code, ret };
+	ir_inst_t inst;
+	inst.op = ir_phi;
+	inst.ty = get_type_id(*v1.type);
+	inst.pool_beg = func.pool.size();
+	inst.pool_len = 4;
+	func.pool.push_back(get_val(v1));
+	func.pool.push_back(func.get_block(label1));
+	func.pool.push_back(get_val(v2));
+	func.pool.push_back(func.get_block(label2));
+	return { {}, get_res_var(func.append(inst, true), v1.type) };
+}
+
+emit_t emit_select(const var_t &cond, const var_t &v1, const var_t &v2)
+{
+	ir_inst_t inst;
+	inst.op = ir_select;
+	inst.ty = get_type_id(*v1.type);
+	inst.ops[0] = get_val(cond);
+	inst.ops[1] = get_val(v1);
+	inst.ops[2] = get_val(v2);
+	return { {}, get_res_var(func.append(inst, true), v1.type) };
 }
 
 emit_t emit_br(const string &label)
 {
-	string code = "br label %" + label;
-	return { code, {} };
+	ir_inst_t inst;
+	inst.op = ir_br;
+	inst.ops[0] = func.get_block(label);
+	func.append(inst, false);
+	return { {}, {} };
 }
 
 emit_t emit_br(const var_t &cond, const string &label_true,
 	       const string &label_false)
 {
-	string code = "br " + get_type_repr(*cond.type) + " " + cond.name +
-		      ", label %" + label_true + ", label %" + label_false;
-	return { code, {} };
+	ir_inst_t inst;
+	inst.op = ir_cond_br;
+	inst.ty = get_type_id(*cond.type);
+	inst.ops[0] = get_val(cond);
+	inst.ops[1] = func.get_block(label_true);
+	inst.ops[2] = func.get_block(label_false);
+	func.append(inst, false);
+	return { {}, {} };
+}
+
+emit_t emit_switch(const var_t &cond, const string &label_default,
+		   const std::vector<std::pair<long long, string> > &cases)
+{
+	ir_inst_t inst;
+	inst.op = ir_switch;
+	inst.ty = get_type_id(*cond.type);
+	inst.ops[0] = get_val(cond);
+	inst.ops[1] = func.get_block(label_default);
+	inst.pool_beg = func.pool.size();
+	inst.pool_len = cases.size() * 2;
+	for (const auto &i : cases) {
+		func.pool.push_back(
+			func.get_named(get_int_repr(i.first, *cond.type)));
+		func.pool.push_back(func.get_block(i.second));
+	}
+	func.append(inst, false);
+	return { {}, {} };
+}
+
+emit_t emit_module_end()
+{
+	ir_output_module(code_buf, module);
+	return { code_buf.take(), {} };
 }
 
-}
\ No newline at end of file
+}
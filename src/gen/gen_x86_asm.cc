@@ -0,0 +1,1736 @@
+/**
+ * @file gen_x86_asm.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Write the IR as x86-64 assembly, in GNU as syntax.
+ *
+ * Each function is written as soon as its passes are done. The SSA values
+ * of the IR are the virtual registers: a linear scan over their live
+ * intervals gives each one a register or a stack slot, then every
+ * instruction is selected to a few x86 instructions on those locations.
+ * Calls follow the System V ABI, structs passed by value are not
+ * supported.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "gen/ir.hh"
+#include "gen/x86.hh"
+#include "out.hh"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+namespace neko_cc
+{
+
+const char *const x86_reg_name[4][16] = {
+	{ "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b",
+	  "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" },
+	{ "ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8w", "r9w",
+	  "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" },
+	{ "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d",
+	  "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" },
+	{ "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9",
+	  "r10", "r11", "r12", "r13", "r14", "r15" },
+};
+
+static const char x86_suffix[4] = { 'b', 'w', 'l', 'q' };
+
+static const x86_reg_t x86_arg_regs[] = {
+	x86_rdi, x86_rsi, x86_rdx, x86_rcx, x86_r8, x86_r9,
+};
+
+// kept by a call, so they may hold a value living across one
+static const x86_reg_t x86_saved_regs[] = {
+	x86_rbx, x86_r12, x86_r13, x86_r14, x86_r15,
+};
+
+// clobbered by a call. Arguments are moved into rdi to r9 right before
+// it, so these only hold values with no call in their interval. rax, rcx,
+// rdx and r11 are left out as scratch, for division, shifts and moves.
+static const x86_reg_t x86_temp_regs[] = {
+	x86_rsi, x86_rdi, x86_r8, x86_r9, x86_r10,
+};
+
+// every xmm is clobbered by a call, xmm0 and xmm1 pass arguments to the
+// calls made for frem, xmm15 is scratch
+static const int x86_xmm_first = 2;
+static const int x86_xmm_last = 14;
+static const int x86_xmm_scratch = 15;
+
+// float constants by bits and if single, to their labels
+static std::map<std::pair<uint64_t, bool>, std::string> x86_fconsts;
+
+// log2 of the size of a scalar, to index the register names
+static int x86_size_idx(uint32_t size)
+{
+	return size >= 8 ? 3 : size >= 4 ? 2 : size >= 2 ? 1 : 0;
+}
+
+static std::string x86_reg(int reg, uint32_t size)
+{
+	return std::string("%") + x86_reg_name[x86_size_idx(size)][reg];
+}
+
+static std::string x86_xmm(int reg)
+{
+	return "%xmm" + std::to_string(reg);
+}
+
+/**
+ * @brief Where a value is. A register, a slot of the frame, or for
+ * constants and addresses, how to make it.
+ */
+struct x86_loc_t {
+	enum kind_t : uint8_t {
+		loc_none,
+		loc_reg,
+		loc_xmm,
+		// the value in the frame, at val from rbp
+		loc_slot,
+		loc_imm,
+		// the address of a symbol
+		loc_sym,
+		// the address of a local, at val from rbp
+		loc_frame,
+		// a float constant at the label
+		loc_fconst,
+	} kind = loc_none;
+	int64_t val = 0;
+	std::string sym;
+
+	bool operator==(const x86_loc_t &rhs) const
+	{
+		return kind == rhs.kind && val == rhs.val && sym == rhs.sym;
+	}
+};
+
+/**
+ * @brief A move of a phi or an incoming argument, all the moves of one
+ * edge are done as if at once.
+ */
+struct x86_move_t {
+	x86_loc_t dst;
+	x86_loc_t src;
+	bool is_fp;
+	uint32_t size;
+};
+
+struct x86_func_t {
+	writer_t &out;
+	const ir_module_t &mod;
+	ir_func_t &func;
+	std::string name;
+
+	// layout type and location of each value
+	std::vector<int32_t> vtys;
+	std::vector<x86_loc_t> locs;
+	std::vector<uint32_t> uses;
+	// interval of each value, -1 if it needs no register
+	std::vector<int32_t> beg;
+	std::vector<int32_t> end;
+	// position of each instruction, of each block
+	std::vector<int32_t> inst_pos;
+	std::vector<int32_t> block_beg;
+	std::vector<int32_t> block_end;
+	std::vector<int32_t> calls;
+	std::vector<x86_reg_t> saved;
+	uint32_t frame_size = 0;
+	// edges into a block with phis from a block with several successors
+	std::vector<std::pair<int32_t, int32_t> > stubs;
+	// the last call jumped to the callee, the return after it is dead
+	bool tail_jumped = false;
+
+	x86_func_t(writer_t &_out, const ir_module_t &_mod, ir_func_t &_func)
+		: out(_out), mod(_mod), func(_func)
+	{
+	}
+
+	int32_t lay(int32_t ty)
+	{
+		return ir_mod_layout(mod, ty);
+	}
+	int32_t res_type(const ir_inst_t &inst);
+	bool is_reg_val(int32_t v);
+	void number();
+	void liveness();
+	void allocate();
+	void layout_frame();
+
+	x86_loc_t loc(int32_t v, int32_t ty);
+	void load(int reg, const x86_loc_t &src, uint32_t size);
+	void load_xmm(int reg, const x86_loc_t &src, int32_t ty);
+	void to_reg(int reg, int32_t v, int32_t ty);
+	void to_reg_ext(int reg, int32_t v, int32_t ty, bool is_signed,
+			uint32_t size);
+	void to_xmm(int reg, int32_t v, int32_t ty);
+	void from_reg(int32_t v, int reg);
+	void from_xmm(int32_t v, int reg);
+	void copy(const x86_loc_t &dst, const x86_loc_t &src, int32_t ty);
+	std::string operand(int32_t v, int32_t ty, uint32_t size);
+	std::string mem(int32_t v);
+	int dst_reg(int32_t v, int32_t avoid);
+	void move(const std::vector<x86_move_t> &moves);
+	std::string label(int32_t block);
+	std::string edge(int32_t from, int32_t to);
+	void phi_moves(int32_t from, int32_t to);
+	void jump(int32_t from, int32_t to, int32_t next);
+
+	void binary(const ir_inst_t &inst);
+	void compare(const ir_inst_t &inst);
+	const char *cond_code(const ir_inst_t &inst, bool &swap);
+	void cast(const ir_inst_t &inst);
+	void gep(const ir_inst_t &inst);
+	void call(const ir_inst_t &inst);
+	void epilogue();
+	void inst(const ir_inst_t &inst, int32_t block, int32_t next,
+		  bool fused);
+	void write();
+};
+
+int32_t x86_func_t::res_type(const ir_inst_t &inst)
+{
+	switch (inst.op) {
+	case ir_alloca:
+	case ir_gep:
+		return ir_get_layout(mod, "ptr");
+	case ir_extractvalue: {
+		const ir_layout_t &type = ir_layouts[lay(inst.ty)];
+		return type.kind == ir_layout_t::ty_array ?
+			       type.elems[0] :
+			       type.elems[inst.ops[1]];
+	}
+	default:
+		if (inst.op >= ir_icmp_eq && inst.op <= ir_fcmp_oge) {
+			return ir_get_layout(mod, "i1");
+		}
+		if (inst.op >= ir_trunc && inst.op <= ir_ptrtoint) {
+			return lay(inst.ty2);
+		}
+		return lay(inst.ty);
+	}
+}
+
+bool x86_func_t::is_reg_val(int32_t v)
+{
+	const ir_value_t &value = func.vals[v];
+	if (value.kind == ir_value_t::val_arg) {
+		return true;
+	}
+	return value.kind == ir_value_t::val_inst && value.def >= 0 &&
+	       func.insts[value.def].op != ir_alloca &&
+	       func.insts[value.def].op != ir_nop;
+}
+
+/**
+ * @brief Number the instructions in layout order, an instruction reads its
+ * operands at an even position and defines its value right after.
+ */
+void x86_func_t::number()
+{
+	inst_pos.assign(func.insts.size(), -1);
+	block_beg.assign(func.blocks.size(), 0);
+	block_end.assign(func.blocks.size(), 0);
+	vtys.assign(func.vals.size(), -1);
+	uses.assign(func.vals.size(), 0);
+	int32_t pos = 0;
+	for (auto b : func.layout) {
+		block_beg[b] = pos;
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			ir_inst_t &inst = func.insts[i];
+			if (inst.op == ir_nop) {
+				continue;
+			}
+			inst_pos[i] = pos;
+			if (inst.op == ir_call || inst.op == ir_memcpy ||
+			    inst.op == ir_memzero || inst.op == ir_frem) {
+				calls.push_back(pos);
+			}
+			if (inst.res >= 0) {
+				vtys[inst.res] = res_type(inst);
+			}
+			ir_for_each_use(func, inst,
+					[&](int32_t &v) { uses[v]++; });
+			pos += 2;
+		}
+		block_end[b] = pos - 1;
+	}
+	for (size_t i = 0; i < func.args.size(); i++) {
+		vtys[func.args[i]] = lay(func.args_ty[i]);
+	}
+}
+
+/**
+ * @brief Find the interval of each value, from live sets found by the
+ * usual backward dataflow. The value of a phi is written at the end of
+ * each predecessor, so its interval reaches there too.
+ */
+void x86_func_t::liveness()
+{
+	size_t n = func.vals.size();
+	size_t words = (n + 63) / 64;
+	size_t nb = func.blocks.size();
+	using set_t = std::vector<uint64_t>;
+	std::vector<set_t> live_in(nb, set_t(words));
+	std::vector<set_t> live_out(nb, set_t(words));
+	std::vector<set_t> gen(nb, set_t(words));
+	std::vector<set_t> kill(nb, set_t(words));
+	std::vector<set_t> phi_use(nb, set_t(words));
+	auto has = [](const set_t &set, int32_t v) {
+		return (set[v / 64] >> (v % 64)) & 1;
+	};
+	auto add = [](set_t &set, int32_t v) {
+		set[v / 64] |= (uint64_t)1 << (v % 64);
+	};
+
+	for (auto b : func.layout) {
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			ir_inst_t &inst = func.insts[i];
+			if (inst.op == ir_nop) {
+				continue;
+			}
+			if (inst.op == ir_phi) {
+				const int32_t *pool =
+					func.pool.data() + inst.pool_beg;
+				for (uint32_t j = 0; j < inst.pool_len;
+				     j += 2) {
+					if (is_reg_val(pool[j])) {
+						add(phi_use[pool[j + 1]],
+						    pool[j]);
+					}
+				}
+			} else {
+				ir_for_each_use(
+					func, inst,
+					[&](int32_t &v) {
+						if (is_reg_val(v) &&
+						    !has(kill[b], v)) {
+							add(gen[b], v);
+						}
+					});
+			}
+			if (inst.res >= 0) {
+				add(kill[b], inst.res);
+			}
+		}
+	}
+
+	std::vector<int32_t> succs;
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (auto it = func.layout.rbegin(); it != func.layout.rend();
+		     it++) {
+			int32_t b = *it;
+			set_t out_set = phi_use[b];
+			ir_get_succs(func, b, succs);
+			for (auto s : succs) {
+				for (size_t w = 0; w < words; w++) {
+					out_set[w] |= live_in[s][w];
+				}
+			}
+			set_t in_set(words);
+			for (size_t w = 0; w < words; w++) {
+				in_set[w] = gen[b][w] |
+					    (out_set[w] & ~kill[b][w]);
+			}
+			if (in_set != live_in[b] || out_set != live_out[b]) {
+				live_in[b] = std::move(in_set);
+				live_out[b] = std::move(out_set);
+				changed = true;
+			}
+		}
+	}
+
+	beg.assign(n, INT_MAX);
+	end.assign(n, -1);
+	auto extend = [&](int32_t v, int32_t pos) {
+		beg[v] = std::min(beg[v], pos);
+		end[v] = std::max(end[v], pos);
+	};
+	for (auto i : func.args) {
+		extend(i, 0);
+	}
+	for (auto b : func.layout) {
+		for (size_t v = 0; v < n; v++) {
+			if (has(live_in[b], v)) {
+				extend(v, block_beg[b]);
+			}
+			if (has(live_out[b], v)) {
+				extend(v, block_end[b]);
+			}
+		}
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			ir_inst_t &inst = func.insts[i];
+			if (inst.op == ir_nop) {
+				continue;
+			}
+			if (inst.res >= 0 && inst.op != ir_alloca) {
+				extend(inst.res, inst_pos[i] + 1);
+			}
+			if (inst.op == ir_phi) {
+				const int32_t *pool =
+					func.pool.data() + inst.pool_beg;
+				for (uint32_t j = 0; j < inst.pool_len;
+				     j += 2) {
+					extend(inst.res,
+					       block_end[pool[j + 1]]);
+				}
+				continue;
+			}
+			ir_for_each_use(func, inst,
+					[&](int32_t &v) {
+						if (is_reg_val(v)) {
+							extend(v, inst_pos[i]);
+						}
+					});
+		}
+	}
+}
+
+/**
+ * @brief Linear scan. When no register is free, the value living the
+ * longest among the active and the new one goes to a stack slot.
+ */
+void x86_func_t::allocate()
+{
+	locs.assign(func.vals.size(), {});
+	std::vector<int32_t> order;
+	// aggregate values are kept in the frame, the location is their address
+	std::vector<int32_t> aggs;
+	size_t stack_args = 0;
+	int int_args = 0, fp_args = 0;
+	for (auto i : func.args) {
+		bool is_fp = is_ir_fp(vtys[i]);
+		if (!is_ir_scalar(vtys[i])) {
+			err_msg("x86: passing a struct by value is not "
+				"supported");
+		}
+		if (is_fp ? fp_args++ < 8 : int_args++ < 6) {
+			continue;
+		}
+		// passed on the stack, it just stays there
+		locs[i].kind = x86_loc_t::loc_slot;
+		locs[i].val = 16 + 8 * stack_args++;
+		beg[i] = INT_MAX;
+	}
+	for (size_t v = 0; v < func.vals.size(); v++) {
+		if (beg[v] != INT_MAX && is_reg_val(v)) {
+			if (is_ir_scalar(vtys[v])) {
+				order.push_back(v);
+			} else {
+				aggs.push_back(v);
+			}
+		}
+	}
+	std::sort(order.begin(), order.end(), [&](int32_t a, int32_t b) {
+		return beg[a] < beg[b];
+	});
+
+	bool reg_used[16] = {};
+	bool xmm_used[16] = {};
+	bool reg_ever[16] = {};
+	std::vector<int32_t> active;
+	std::vector<int32_t> spilled;
+	auto is_saved = [](int64_t reg) {
+		return std::find(std::begin(x86_saved_regs),
+				 std::end(x86_saved_regs),
+				 reg) != std::end(x86_saved_regs);
+	};
+	for (auto v : order) {
+		for (size_t i = 0; i < active.size();) {
+			int32_t u = active[i];
+			if (end[u] >= beg[v]) {
+				i++;
+				continue;
+			}
+			if (locs[u].kind == x86_loc_t::loc_reg) {
+				reg_used[locs[u].val] = false;
+			} else {
+				xmm_used[locs[u].val] = false;
+			}
+			active.erase(active.begin() + i);
+		}
+
+		auto call = std::upper_bound(calls.begin(), calls.end(),
+					     beg[v]);
+		bool crosses = call != calls.end() && *call <= end[v];
+		bool is_fp = is_ir_fp(vtys[v]);
+		x86_loc_t &loc = locs[v];
+		if (is_fp && !crosses) {
+			for (int r = x86_xmm_first; r <= x86_xmm_last; r++) {
+				if (!xmm_used[r]) {
+					loc.kind = x86_loc_t::loc_xmm;
+					loc.val = r;
+					xmm_used[r] = true;
+					break;
+				}
+			}
+		} else if (!is_fp) {
+			if (!crosses) {
+				for (auto r : x86_temp_regs) {
+					if (!reg_used[r]) {
+						loc.kind = x86_loc_t::loc_reg;
+						loc.val = r;
+						break;
+					}
+				}
+			}
+			for (auto r : x86_saved_regs) {
+				if (loc.kind == x86_loc_t::loc_none &&
+				    !reg_used[r]) {
+					loc.kind = x86_loc_t::loc_reg;
+					loc.val = r;
+				}
+			}
+			if (loc.kind == x86_loc_t::loc_reg) {
+				reg_used[loc.val] = true;
+			}
+		}
+		if (loc.kind != x86_loc_t::loc_none) {
+			active.push_back(v);
+			continue;
+		}
+
+		// take the register of the active value living the longest,
+		// if it lives longer than this one and suits it
+		int32_t victim = -1;
+		for (auto u : active) {
+			if (is_ir_fp(vtys[u]) != is_fp || end[u] <= end[v] ||
+			    (victim >= 0 && end[u] <= end[victim])) {
+				continue;
+			}
+			if (crosses && (is_fp || !is_saved(locs[u].val))) {
+				continue;
+			}
+			victim = u;
+		}
+		if (victim < 0) {
+			spilled.push_back(v);
+			continue;
+		}
+		loc = locs[victim];
+		locs[victim] = {};
+		spilled.push_back(victim);
+		std::replace(active.begin(), active.end(), victim, v);
+	}
+
+	for (auto v : order) {
+		if (locs[v].kind == x86_loc_t::loc_reg) {
+			reg_ever[locs[v].val] = true;
+		}
+	}
+	for (auto r : x86_saved_regs) {
+		if (reg_ever[r]) {
+			saved.push_back(r);
+		}
+	}
+
+	// locals and aggregates first, then the spilled values
+	uint32_t size = 8 * saved.size();
+	auto place = [&](int32_t v, int32_t ty) {
+		const ir_layout_t &type = ir_layouts[ty];
+		uint32_t align = std::max<uint32_t>(type.align, 1);
+		size = (size + type.size + align - 1) / align * align;
+		locs[v].kind = x86_loc_t::loc_frame;
+		locs[v].val = -(int64_t)size;
+	};
+	for (auto b : func.layout) {
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			const ir_inst_t &inst = func.insts[i];
+			if (inst.op == ir_alloca) {
+				place(inst.res, lay(inst.ty));
+			}
+		}
+	}
+	for (auto v : aggs) {
+		place(v, vtys[v]);
+	}
+	for (auto v : spilled) {
+		size = (size + 15) / 8 * 8;
+		locs[v].kind = x86_loc_t::loc_slot;
+		locs[v].val = -(int64_t)size;
+	}
+	frame_size = (size + 15) / 16 * 16 - 8 * saved.size();
+}
+
+x86_loc_t x86_func_t::loc(int32_t v, int32_t ty)
+{
+	const ir_value_t &value = func.vals[v];
+	if (value.kind != ir_value_t::val_const &&
+	    value.kind != ir_value_t::val_global) {
+		return locs[v];
+	}
+	std::string_view repr = func.strs[value.name];
+	x86_loc_t ret;
+	if (repr[0] == '@') {
+		ret.kind = x86_loc_t::loc_sym;
+		ret.sym = repr.substr(1);
+		return ret;
+	}
+	ret.kind = x86_loc_t::loc_imm;
+	if (repr[0] == '{' || repr[0] == '<' || repr[0] == '[' ||
+	    repr[0] == 'c') {
+		err_msg("x86: unsupported constant " + std::string(repr));
+	}
+	if (repr == "true") {
+		ret.val = 1;
+	} else if (is_ir_fp(ty) && repr != "undef" &&
+		   repr != "zeroinitializer") {
+		bool is_float = ir_layouts[ty].kind == ir_layout_t::ty_float;
+		uint64_t bits = ir_float_bits(repr, is_float);
+		auto key = std::make_pair(bits, is_float);
+		auto it = x86_fconsts.find(key);
+		if (it == x86_fconsts.end()) {
+			std::string label =
+				".LCF" + std::to_string(x86_fconsts.size());
+			it = x86_fconsts.emplace(key, label).first;
+		}
+		ret.kind = x86_loc_t::loc_fconst;
+		ret.sym = it->second;
+	} else if (repr[0] == '-' || (repr[0] >= '0' && repr[0] <= '9')) {
+		ret.val = std::strtoll(std::string(repr).c_str(), nullptr, 10);
+	}
+	// null, false, undef and zeroinitializer are all zero
+	return ret;
+}
+
+static std::string x86_slot(int64_t off)
+{
+	return std::to_string(off) + "(%rbp)";
+}
+
+/**
+ * @brief Load a location into a general register, floats as their bits.
+ */
+void x86_func_t::load(int reg, const x86_loc_t &src, uint32_t size)
+{
+	uint32_t op_size = std::max<uint32_t>(size, 4);
+	char sfx = x86_suffix[x86_size_idx(op_size)];
+	switch (src.kind) {
+	case x86_loc_t::loc_reg:
+		if (src.val != reg) {
+			out.fmt("\tmov{} {}, {}\n", sfx,
+				x86_reg(src.val, op_size),
+				x86_reg(reg, op_size));
+		}
+		break;
+	case x86_loc_t::loc_xmm:
+		out.fmt("\tmovq {}, {}\n", x86_xmm(src.val), x86_reg(reg, 8));
+		break;
+	case x86_loc_t::loc_slot:
+		out.fmt("\tmov{} {}, {}\n", x86_suffix[x86_size_idx(size)],
+			x86_slot(src.val), x86_reg(reg, size));
+		break;
+	case x86_loc_t::loc_imm:
+		if (src.val == 0) {
+			out.fmt("\txorl {}, {}\n", x86_reg(reg, 4),
+				x86_reg(reg, 4));
+		} else if (src.val >= INT32_MIN && src.val <= INT32_MAX) {
+			out.fmt("\tmov{} ${}, {}\n", sfx, src.val,
+				x86_reg(reg, op_size));
+		} else {
+			out.fmt("\tmovabsq ${}, {}\n", src.val,
+				x86_reg(reg, 8));
+		}
+		break;
+	case x86_loc_t::loc_sym:
+		out.fmt("\tleaq {}(%rip), {}\n", src.sym, x86_reg(reg, 8));
+		break;
+	case x86_loc_t::loc_frame:
+		out.fmt("\tleaq {}, {}\n", x86_slot(src.val), x86_reg(reg, 8));
+		break;
+	case x86_loc_t::loc_fconst:
+		out.fmt("\tmov{} {}(%rip), {}\n", sfx, src.sym,
+			x86_reg(reg, op_size));
+		break;
+	default:
+		break;
+	}
+}
+
+void x86_func_t::load_xmm(int reg, const x86_loc_t &src, int32_t ty)
+{
+	const char *sfx = ir_layouts[ty].size == 4 ? "ss" : "sd";
+	switch (src.kind) {
+	case x86_loc_t::loc_xmm:
+		if (src.val != reg) {
+			out.fmt("\tmovaps {}, {}\n", x86_xmm(src.val),
+				x86_xmm(reg));
+		}
+		break;
+	case x86_loc_t::loc_slot:
+		out.fmt("\tmov{} {}, {}\n", sfx, x86_slot(src.val),
+			x86_xmm(reg));
+		break;
+	case x86_loc_t::loc_fconst:
+		out.fmt("\tmov{} {}(%rip), {}\n", sfx, src.sym, x86_xmm(reg));
+		break;
+	case x86_loc_t::loc_reg:
+		out.fmt("\tmovq {}, {}\n", x86_reg(src.val, 8), x86_xmm(reg));
+		break;
+	default:
+		// zero, undef
+		out.fmt("\txorps {}, {}\n", x86_xmm(reg), x86_xmm(reg));
+		break;
+	}
+}
+
+void x86_func_t::to_reg(int reg, int32_t v, int32_t ty)
+{
+	load(reg, loc(v, ty), ir_layouts[ty].size);
+}
+
+/**
+ * @brief Load an int extended to size, 4 or 8 bytes.
+ */
+void x86_func_t::to_reg_ext(int reg, int32_t v, int32_t ty, bool is_signed,
+			    uint32_t size)
+{
+	x86_loc_t src = loc(v, ty);
+	uint32_t from = ir_layouts[ty].size;
+	if (from >= size || (from == 4 && !is_signed)) {
+		if (from == 4 && size == 8 &&
+		    src.kind != x86_loc_t::loc_imm) {
+			// a 32-bit move clears the upper half
+			load(reg, src, 4);
+		} else {
+			load(reg, src, std::max(from, size));
+		}
+		return;
+	}
+	if (src.kind == x86_loc_t::loc_imm) {
+		int64_t val = src.val;
+		uint64_t mask = ((uint64_t)1 << (from * 8)) - 1;
+		if (!is_signed) {
+			val = (uint64_t)val & mask;
+		}
+		load(reg, { x86_loc_t::loc_imm, val, {} }, size);
+		return;
+	}
+	std::string from_op = src.kind == x86_loc_t::loc_reg ?
+				      x86_reg(src.val, from) :
+				      x86_slot(src.val);
+	if (from == 4) {
+		out.fmt("\tmovslq {}, {}\n", from_op, x86_reg(reg, 8));
+		return;
+	}
+	out.fmt("\tmov{}{}{} {}, {}\n", is_signed ? 's' : 'z',
+		x86_suffix[x86_size_idx(from)], x86_suffix[x86_size_idx(size)],
+		from_op, x86_reg(reg, size));
+}
+
+void x86_func_t::to_xmm(int reg, int32_t v, int32_t ty)
+{
+	load_xmm(reg, loc(v, ty), ty);
+}
+
+void x86_func_t::from_reg(int32_t v, int reg)
+{
+	const x86_loc_t &dst = locs[v];
+	uint32_t size = ir_layouts[vtys[v]].size;
+	if (dst.kind == x86_loc_t::loc_reg && dst.val != reg) {
+		size = std::max<uint32_t>(size, 4);
+		out.fmt("\tmov{} {}, {}\n", x86_suffix[x86_size_idx(size)],
+			x86_reg(reg, size), x86_reg(dst.val, size));
+	} else if (dst.kind == x86_loc_t::loc_slot) {
+		out.fmt("\tmov{} {}, {}\n", x86_suffix[x86_size_idx(size)],
+			x86_reg(reg, size), x86_slot(dst.val));
+	}
+}
+
+void x86_func_t::from_xmm(int32_t v, int reg)
+{
+	const x86_loc_t &dst = locs[v];
+	const char *sfx = ir_layouts[vtys[v]].size == 4 ? "ss" : "sd";
+	if (dst.kind == x86_loc_t::loc_xmm && dst.val != reg) {
+		out.fmt("\tmovaps {}, {}\n", x86_xmm(reg), x86_xmm(dst.val));
+	} else if (dst.kind == x86_loc_t::loc_slot) {
+		out.fmt("\tmov{} {}, {}\n", sfx, x86_xmm(reg),
+			x86_slot(dst.val));
+	}
+}
+
+/**
+ * @brief Copy an aggregate between the addresses, a constant source is
+ * zero.
+ */
+void x86_func_t::copy(const x86_loc_t &dst, const x86_loc_t &src, int32_t ty)
+{
+	uint32_t size = ir_layouts[ty].size;
+	load(x86_rdx, dst, 8);
+	if (src.kind == x86_loc_t::loc_imm) {
+		out << "\txorl %eax, %eax\n";
+	} else {
+		load(x86_r11, src, 8);
+	}
+	for (uint32_t off = 0; off < size;) {
+		uint32_t n = size - off >= 8 ? 8 :
+			     size - off >= 4 ? 4 :
+			     size - off >= 2 ? 2 :
+					       1;
+		char sfx = x86_suffix[x86_size_idx(n)];
+		if (src.kind != x86_loc_t::loc_imm) {
+			out.fmt("\tmov{} {}(%r11), {}\n", sfx, off,
+				x86_reg(x86_rax, n));
+		}
+		out.fmt("\tmov{} {}, {}(%rdx)\n", sfx, x86_reg(x86_rax, n),
+			off);
+		off += n;
+	}
+}
+
+/**
+ * @brief Get a value as the source operand of an instruction of the size.
+ * A constant not fitting an immediate and an address go through r11.
+ */
+std::string x86_func_t::operand(int32_t v, int32_t ty, uint32_t size)
+{
+	x86_loc_t src = loc(v, ty);
+	switch (src.kind) {
+	case x86_loc_t::loc_reg:
+		return x86_reg(src.val, size);
+	case x86_loc_t::loc_xmm:
+		return x86_xmm(src.val);
+	case x86_loc_t::loc_slot:
+		return x86_slot(src.val);
+	case x86_loc_t::loc_fconst:
+		return src.sym + "(%rip)";
+	case x86_loc_t::loc_imm:
+		if (src.val >= INT32_MIN && src.val <= INT32_MAX) {
+			return "$" + std::to_string(src.val);
+		}
+		// fall through
+	default:
+		load(x86_r11, src, 8);
+		return x86_reg(x86_r11, size);
+	}
+}
+
+/**
+ * @brief Get the memory operand at the address a value holds, through r11
+ * if the address itself is in memory.
+ */
+std::string x86_func_t::mem(int32_t v)
+{
+	x86_loc_t src = loc(v, ir_get_layout(mod, "ptr"));
+	switch (src.kind) {
+	case x86_loc_t::loc_frame:
+		return x86_slot(src.val);
+	case x86_loc_t::loc_sym:
+		return src.sym + "(%rip)";
+	case x86_loc_t::loc_reg:
+		return "(" + x86_reg(src.val, 8) + ")";
+	default:
+		load(x86_r11, src, 8);
+		return "(%r11)";
+	}
+}
+
+/**
+ * @brief Get the register to compute a value in, its own if it has one
+ * not holding the other operand, else rax.
+ */
+int x86_func_t::dst_reg(int32_t v, int32_t avoid)
+{
+	const x86_loc_t &dst = locs[v];
+	if (dst.kind != x86_loc_t::loc_reg) {
+		return x86_rax;
+	}
+	if (avoid >= 0 && loc(avoid, vtys[v]) == dst) {
+		return x86_rax;
+	}
+	return dst.val;
+}
+
+/**
+ * @brief Do moves as if at once. When a move overwrites the source of
+ * another, all go through the stack.
+ */
+void x86_func_t::move(const std::vector<x86_move_t> &moves)
+{
+	std::vector<const x86_move_t *> list;
+	for (const auto &i : moves) {
+		if (i.dst.kind != x86_loc_t::loc_none && !(i.dst == i.src)) {
+			list.push_back(&i);
+		}
+	}
+	bool clash = false;
+	for (auto i : list) {
+		for (auto j : list) {
+			clash |= i != j && i->dst == j->src;
+		}
+	}
+	if (!clash) {
+		for (auto i : list) {
+			if (i->is_fp && i->dst.kind == x86_loc_t::loc_xmm) {
+				load_xmm(i->dst.val, i->src,
+					 i->size == 4 ?
+						 ir_get_layout(mod, "float") :
+						 ir_get_layout(mod, "double"));
+			} else if (i->dst.kind == x86_loc_t::loc_reg) {
+				load(i->dst.val, i->src, 8);
+			} else if (i->src.kind == x86_loc_t::loc_reg) {
+				out.fmt("\tmovq {}, {}\n",
+					x86_reg(i->src.val, 8),
+					x86_slot(i->dst.val));
+			} else if (i->src.kind == x86_loc_t::loc_xmm) {
+				out.fmt("\tmovq {}, {}\n", x86_xmm(i->src.val),
+					x86_slot(i->dst.val));
+			} else {
+				load(x86_rax, i->src,
+				     i->src.kind == x86_loc_t::loc_slot ?
+					     8 :
+					     i->size);
+				out.fmt("\tmovq %rax, {}\n",
+					x86_slot(i->dst.val));
+			}
+		}
+		return;
+	}
+	for (auto i : list) {
+		load(x86_rax, i->src,
+		     i->src.kind == x86_loc_t::loc_slot ? 8 : i->size);
+		out << "\tpushq %rax\n";
+	}
+	for (auto it = list.rbegin(); it != list.rend(); it++) {
+		const x86_loc_t &dst = (*it)->dst;
+		if (dst.kind == x86_loc_t::loc_reg) {
+			out.fmt("\tpopq {}\n", x86_reg(dst.val, 8));
+		} else if (dst.kind == x86_loc_t::loc_xmm) {
+			out << "\tpopq %rax\n";
+			out.fmt("\tmovq %rax, {}\n", x86_xmm(dst.val));
+		} else {
+			out.fmt("\tpopq {}\n", x86_slot(dst.val));
+		}
+	}
+}
+
+std::string x86_func_t::label(int32_t block)
+{
+	return ".L" + name + "." + std::to_string(block);
+}
+
+/**
+ * @brief Get the label to jump to for an edge, a stub doing the moves of
+ * the phis if the target has some.
+ */
+std::string x86_func_t::edge(int32_t from, int32_t to)
+{
+	const ir_block_t &b = func.blocks[to];
+	if (b.beg == b.end || func.insts[b.beg].op != ir_phi) {
+		return label(to);
+	}
+	stubs.emplace_back(from, to);
+	return ".L" + name + ".e" + std::to_string(stubs.size() - 1);
+}
+
+void x86_func_t::phi_moves(int32_t from, int32_t to)
+{
+	std::vector<x86_move_t> moves;
+	std::vector<std::pair<int32_t, int32_t> > aggs;
+	const ir_block_t &b = func.blocks[to];
+	for (uint32_t i = b.beg; i < b.end; i++) {
+		const ir_inst_t &inst = func.insts[i];
+		if (inst.op == ir_nop) {
+			continue;
+		}
+		if (inst.op != ir_phi) {
+			break;
+		}
+		const int32_t *pool = func.pool.data() + inst.pool_beg;
+		for (uint32_t j = 0; j < inst.pool_len; j += 2) {
+			if (pool[j + 1] != from) {
+				continue;
+			}
+			int32_t ty = vtys[inst.res];
+			if (!is_ir_scalar(ty)) {
+				aggs.emplace_back(inst.res, pool[j]);
+				break;
+			}
+			moves.push_back({ locs[inst.res], loc(pool[j], ty),
+					  is_ir_fp(ty), ir_layouts[ty].size });
+			break;
+		}
+	}
+	move(moves);
+	for (auto i : aggs) {
+		copy(locs[i.first], loc(i.second, vtys[i.first]),
+		     vtys[i.first]);
+	}
+}
+
+void x86_func_t::jump(int32_t from, int32_t to, int32_t next)
+{
+	phi_moves(from, to);
+	if (to != next) {
+		out.fmt("\tjmp {}\n", label(to));
+	}
+}
+
+void x86_func_t::binary(const ir_inst_t &inst)
+{
+	static const char *const names[] = {
+		"add", "sub", "imul", "", "", "", "", "shl", "shr", "sar",
+		"and", "or", "xor", "adds", "subs", "muls", "divs",
+	};
+	int32_t ty = lay(inst.ty);
+	uint32_t size = std::max<uint32_t>(ir_layouts[ty].size, 4);
+	char sfx = x86_suffix[x86_size_idx(size)];
+	int32_t a = inst.ops[0], b = inst.ops[1];
+
+	if (is_ir_fp(ty)) {
+		const char *fsfx = ir_layouts[ty].size == 4 ? "s" : "d";
+		if (inst.op == ir_frem) {
+			to_xmm(0, a, ty);
+			to_xmm(1, b, ty);
+			out.fmt("\tcall {}@PLT\n",
+				ir_layouts[ty].size == 4 ? "fmodf" : "fmod");
+			from_xmm(inst.res, 0);
+			return;
+		}
+		int x = x86_xmm_scratch;
+		if (locs[inst.res].kind == x86_loc_t::loc_xmm &&
+		    !(loc(b, ty) == locs[inst.res])) {
+			x = locs[inst.res].val;
+		}
+		to_xmm(x, a, ty);
+		out.fmt("\t{}{} {}, {}\n", names[inst.op - ir_add], fsfx,
+			operand(b, ty, 8), x86_xmm(x));
+		from_xmm(inst.res, x);
+		return;
+	}
+
+	bool is_signed = inst.op == ir_sdiv || inst.op == ir_srem;
+	switch (inst.op) {
+	case ir_sdiv:
+	case ir_udiv:
+	case ir_srem:
+	case ir_urem:
+		to_reg_ext(x86_rax, a, ty, is_signed, size);
+		to_reg_ext(x86_r11, b, ty, is_signed, size);
+		if (is_signed) {
+			out << (size == 8 ? "\tcqto\n" : "\tcltd\n");
+		} else {
+			out << "\txorl %edx, %edx\n";
+		}
+		out.fmt("\t{}{} {}\n", is_signed ? "idiv" : "div", sfx,
+			x86_reg(x86_r11, size));
+		from_reg(inst.res, inst.op == ir_sdiv || inst.op == ir_udiv ?
+					   x86_rax :
+					   x86_rdx);
+		return;
+	case ir_shl:
+	case ir_lshr:
+	case ir_ashr: {
+		to_reg(x86_rcx, b, ty);
+		int x = dst_reg(inst.res, -1);
+		to_reg_ext(x, a, ty, inst.op == ir_ashr, size);
+		out.fmt("\t{}{} %cl, {}\n", names[inst.op - ir_add], sfx,
+			x86_reg(x, size));
+		from_reg(inst.res, x);
+		return;
+	}
+	default: {
+		int x = dst_reg(inst.res, b);
+		to_reg(x, a, ty);
+		out.fmt("\t{}{} {}, {}\n", names[inst.op - ir_add], sfx,
+			operand(b, ty, size), x86_reg(x, size));
+		from_reg(inst.res, x);
+		return;
+	}
+	}
+}
+
+/**
+ * @brief Get the condition code of a compare. A float compare less than
+ * swaps its operands, so that unordered is false as for the others.
+ */
+const char *x86_func_t::cond_code(const ir_inst_t &inst, bool &swap)
+{
+	static const char *const codes[] = {
+		"e", "ne", "b", "l", "be", "le", "a", "g", "ae", "ge",
+		"e", "ne", "a", "ae", "a", "ae",
+	};
+	swap = inst.op == ir_fcmp_olt || inst.op == ir_fcmp_ole;
+	return codes[inst.op - ir_icmp_eq];
+}
+
+/**
+ * @brief Compare, leaving the result in the flags.
+ */
+void x86_func_t::compare(const ir_inst_t &inst)
+{
+	int32_t ty = lay(inst.ty);
+	int32_t a = inst.ops[0], b = inst.ops[1];
+	bool swap;
+	cond_code(inst, swap);
+	if (swap) {
+		std::swap(a, b);
+	}
+	if (is_ir_fp(ty)) {
+		to_xmm(x86_xmm_scratch, a, ty);
+		out.fmt("\tucomis{} {}, {}\n",
+			ir_layouts[ty].size == 4 ? 's' : 'd', operand(b, ty, 8),
+			x86_xmm(x86_xmm_scratch));
+		return;
+	}
+	uint32_t size = ir_layouts[ty].size;
+	to_reg(x86_rax, a, ty);
+	out.fmt("\tcmp{} {}, {}\n", x86_suffix[x86_size_idx(size)],
+		operand(b, ty, size), x86_reg(x86_rax, size));
+}
+
+void x86_func_t::cast(const ir_inst_t &inst)
+{
+	int32_t from = lay(inst.ty), to = lay(inst.ty2);
+	uint32_t from_size = ir_layouts[from].size;
+	uint32_t to_size = ir_layouts[to].size;
+	int32_t a = inst.ops[0];
+	int x = dst_reg(inst.res, -1);
+	switch (inst.op) {
+	case ir_trunc:
+		to_reg(x, a, from);
+		if (ir_layouts[to].cnt == 1) {
+			out.fmt("\tandl $1, {}\n", x86_reg(x, 4));
+		}
+		from_reg(inst.res, x);
+		return;
+	case ir_zext:
+	case ir_sext:
+		to_reg_ext(x, a, from, inst.op == ir_sext,
+			   std::max<uint32_t>(to_size, 4));
+		if (inst.op == ir_sext && ir_layouts[from].cnt == 1) {
+			out.fmt("\tneg{} {}\n",
+				x86_suffix[x86_size_idx(
+					std::max<uint32_t>(to_size, 4))],
+				x86_reg(x, std::max<uint32_t>(to_size, 4)));
+		}
+		from_reg(inst.res, x);
+		return;
+	case ir_inttoptr:
+		to_reg_ext(x, a, from, false, 8);
+		from_reg(inst.res, x);
+		return;
+	case ir_ptrtoint:
+		to_reg(x, a, from);
+		from_reg(inst.res, x);
+		return;
+	case ir_fptosi:
+		out.fmt("\tcvtts{}2si{} {}, {}\n", from_size == 4 ? 's' : 'd',
+			to_size == 8 ? 'q' : 'l', operand(a, from, 8),
+			x86_reg(x, std::max<uint32_t>(to_size, 4)));
+		from_reg(inst.res, x);
+		return;
+	case ir_sitofp: {
+		uint32_t size = std::max<uint32_t>(from_size, 4);
+		to_reg_ext(x86_rax, a, from, true, size);
+		out.fmt("\tcvtsi2s{}{} {}, {}\n", to_size == 4 ? 's' : 'd',
+			x86_suffix[x86_size_idx(size)], x86_reg(x86_rax, size),
+			x86_xmm(x86_xmm_scratch));
+		from_xmm(inst.res, x86_xmm_scratch);
+		return;
+	}
+	default:
+		// fptrunc, fpext
+		out.fmt("\tcvts{}2s{} {}, {}\n", from_size == 4 ? 's' : 'd',
+			to_size == 4 ? 's' : 'd', operand(a, from, 8),
+			x86_xmm(x86_xmm_scratch));
+		from_xmm(inst.res, x86_xmm_scratch);
+		return;
+	}
+}
+
+/**
+ * @brief Address computation, constant indexes are folded into the
+ * displacement.
+ */
+void x86_func_t::gep(const ir_inst_t &inst)
+{
+	int32_t ptr = ir_get_layout(mod, "ptr");
+	int32_t ty = lay(inst.ty);
+	int32_t idx_ty = lay(inst.ty2);
+	int64_t disp = 0;
+	to_reg(x86_rax, inst.ops[0], ptr);
+	for (int i = 1; i < 3 && inst.ops[i] >= 0; i++) {
+		x86_loc_t idx = loc(inst.ops[i], idx_ty);
+		if (i == 2 && ir_layouts[ty].kind == ir_layout_t::ty_struct) {
+			disp += ir_layouts[ty].offsets[idx.val];
+			continue;
+		}
+		if (i == 2) {
+			ty = ir_layouts[ty].elems[0];
+		}
+		int64_t size = ir_layouts[ty].size;
+		if (idx.kind == x86_loc_t::loc_imm) {
+			disp += idx.val * size;
+			continue;
+		}
+		to_reg_ext(x86_r11, inst.ops[i], idx_ty, true, 8);
+		if (size != 1) {
+			out.fmt("\timulq ${}, %r11, %r11\n", size);
+		}
+		out << "\taddq %r11, %rax\n";
+	}
+	if (disp) {
+		out.fmt("\tleaq {}(%rax), %rax\n", disp);
+	}
+	from_reg(inst.res, x86_rax);
+}
+
+void x86_func_t::call(const ir_inst_t &inst)
+{
+	const int32_t *pool = func.pool.data() + inst.pool_beg;
+	std::vector<uint32_t> on_stack;
+	int int_args = 0, fp_args = 0;
+	for (uint32_t i = 0; i < inst.pool_len; i += 2) {
+		int32_t ty = lay(pool[i]);
+		if (!is_ir_scalar(ty)) {
+			err_msg("x86: passing a struct by value is not "
+				"supported");
+		}
+		if (is_ir_fp(ty) ? fp_args++ >= 8 : int_args++ >= 6) {
+			on_stack.push_back(i);
+		}
+	}
+	size_t pad = on_stack.size() % 2 ? 8 : 0;
+	if (pad) {
+		out << "\tsubq $8, %rsp\n";
+	}
+	for (auto it = on_stack.rbegin(); it != on_stack.rend(); it++) {
+		int32_t ty = lay(pool[*it]);
+		load(x86_rax, loc(pool[*it + 1], ty), 8);
+		out << "\tpushq %rax\n";
+	}
+	int_args = fp_args = 0;
+	for (uint32_t i = 0; i < inst.pool_len; i += 2) {
+		int32_t ty = lay(pool[i]);
+		if (is_ir_fp(ty)) {
+			if (fp_args < 8) {
+				to_xmm(fp_args, pool[i + 1], ty);
+			}
+			fp_args++;
+		} else {
+			if (int_args < 6) {
+				// extended to the full register, the front end
+				// may pass an int where the callee takes a long
+				to_reg_ext(x86_arg_regs[int_args],
+					   pool[i + 1], ty, true, 8);
+			}
+			int_args++;
+		}
+	}
+	// the count of vector registers, for a variadic callee
+	out.fmt("\tmovl ${}, %eax\n", std::min(fp_args, 8));
+	x86_loc_t callee = loc(inst.ops[0], ir_get_layout(mod, "ptr"));
+	if ((inst.flags & ir_flag_musttail) && on_stack.empty()) {
+		// the callee returns to our caller, in the frame we leave
+		if (callee.kind != x86_loc_t::loc_sym) {
+			load(x86_r11, callee, 8);
+		}
+		epilogue();
+		if (callee.kind == x86_loc_t::loc_sym) {
+			out.fmt("\tjmp {}@PLT\n", callee.sym);
+		} else {
+			out << "\tjmp *%r11\n";
+		}
+		tail_jumped = true;
+		return;
+	}
+	if (callee.kind == x86_loc_t::loc_sym) {
+		out.fmt("\tcall {}@PLT\n", callee.sym);
+	} else {
+		load(x86_r11, callee, 8);
+		out << "\tcall *%r11\n";
+	}
+	if (on_stack.size()) {
+		out.fmt("\taddq ${}, %rsp\n", on_stack.size() * 8 + pad);
+	}
+	if (inst.res < 0) {
+		return;
+	}
+	if (!is_ir_scalar(vtys[inst.res])) {
+		err_msg("x86: returning a struct by value is not supported");
+	}
+	if (is_ir_fp(vtys[inst.res])) {
+		from_xmm(inst.res, 0);
+	} else {
+		from_reg(inst.res, x86_rax);
+	}
+}
+
+/**
+ * @brief Restore the registers saved and the frame of the caller.
+ */
+void x86_func_t::epilogue()
+{
+	if (saved.empty()) {
+		out << "\tleave\n";
+		return;
+	}
+	out.fmt("\tleaq {}, %rsp\n", x86_slot(-8 * (int64_t)saved.size()));
+	for (auto it = saved.rbegin(); it != saved.rend(); it++) {
+		out.fmt("\tpopq {}\n", x86_reg(*it, 8));
+	}
+	out << "\tpopq %rbp\n";
+}
+
+void x86_func_t::inst(const ir_inst_t &inst, int32_t block, int32_t next,
+		      bool fused)
+{
+	int32_t ptr = ir_get_layout(mod, "ptr");
+	int32_t i64 = ir_get_layout(mod, "i64");
+	const int32_t *pool = func.pool.data() + inst.pool_beg;
+	switch (inst.op) {
+	case ir_nop:
+	case ir_alloca:
+	case ir_phi:
+	case ir_lifetime_start:
+	case ir_lifetime_end:
+		return;
+	case ir_load: {
+		int32_t ty = lay(inst.ty);
+		if (!is_ir_scalar(ty)) {
+			copy(locs[inst.res], loc(inst.ops[0], ptr), ty);
+			return;
+		}
+		std::string addr = mem(inst.ops[0]);
+		uint32_t size = ir_layouts[ty].size;
+		if (is_ir_fp(ty)) {
+			int x = locs[inst.res].kind == x86_loc_t::loc_xmm ?
+					locs[inst.res].val :
+					x86_xmm_scratch;
+			out.fmt("\tmovs{} {}, {}\n", size == 4 ? 's' : 'd',
+				addr, x86_xmm(x));
+			from_xmm(inst.res, x);
+			return;
+		}
+		int x = dst_reg(inst.res, -1);
+		out.fmt("\tmov{} {}, {}\n", x86_suffix[x86_size_idx(size)],
+			addr, x86_reg(x, size));
+		from_reg(inst.res, x);
+		return;
+	}
+	case ir_store: {
+		int32_t ty = lay(inst.ty);
+		if (!is_ir_scalar(ty)) {
+			copy(loc(inst.ops[1], ptr), loc(inst.ops[0], ty), ty);
+			return;
+		}
+		uint32_t size = ir_layouts[ty].size;
+		x86_loc_t val = loc(inst.ops[0], ty);
+		std::string src;
+		if (is_ir_fp(ty)) {
+			if (val.kind != x86_loc_t::loc_xmm) {
+				load_xmm(x86_xmm_scratch, val, ty);
+				val = { x86_loc_t::loc_xmm, x86_xmm_scratch,
+					{} };
+			}
+			out.fmt("\tmovs{} {}, {}\n", size == 4 ? 's' : 'd',
+				x86_xmm(val.val), mem(inst.ops[1]));
+			return;
+		}
+		if (val.kind == x86_loc_t::loc_reg) {
+			src = x86_reg(val.val, size);
+		} else if (val.kind == x86_loc_t::loc_imm &&
+			   val.val >= INT32_MIN && val.val <= INT32_MAX) {
+			src = "$" + std::to_string(val.val);
+		} else {
+			load(x86_rax, val, size);
+			src = x86_reg(x86_rax, size);
+		}
+		out.fmt("\tmov{} {}, {}\n", x86_suffix[x86_size_idx(size)],
+			src, mem(inst.ops[1]));
+		return;
+	}
+	case ir_gep:
+		gep(inst);
+		return;
+	case ir_extractvalue: {
+		const ir_layout_t &type = ir_layouts[lay(inst.ty)];
+		int32_t ty = vtys[inst.res];
+		x86_loc_t src = loc(inst.ops[0], lay(inst.ty));
+		if (src.kind == x86_loc_t::loc_frame) {
+			src.val += type.kind == ir_layout_t::ty_array ?
+					   inst.ops[1] * ir_layouts[ty].size :
+					   type.offsets[inst.ops[1]];
+			src.kind = x86_loc_t::loc_slot;
+		}
+		if (!is_ir_scalar(ty)) {
+			if (src.kind == x86_loc_t::loc_slot) {
+				src.kind = x86_loc_t::loc_frame;
+			}
+			copy(locs[inst.res], src, ty);
+		} else if (is_ir_fp(ty)) {
+			load_xmm(x86_xmm_scratch, src, ty);
+			from_xmm(inst.res, x86_xmm_scratch);
+		} else {
+			load(x86_rax, src, ir_layouts[ty].size);
+			from_reg(inst.res, x86_rax);
+		}
+		return;
+	}
+	case ir_memcpy:
+		to_reg(x86_rdi, inst.ops[0], ptr);
+		to_reg(x86_rsi, inst.ops[1], ptr);
+		to_reg(x86_rdx, inst.ops[2], i64);
+		out << "\tcall memcpy@PLT\n";
+		return;
+	case ir_memzero:
+		to_reg(x86_rdi, inst.ops[0], ptr);
+		out << "\txorl %esi, %esi\n";
+		to_reg(x86_rdx, inst.ops[1], i64);
+		out << "\tcall memset@PLT\n";
+		return;
+	case ir_call:
+		call(inst);
+		return;
+	case ir_select: {
+		int32_t ty = lay(inst.ty);
+		if (!is_ir_scalar(ty)) {
+			err_msg("x86: select of an aggregate is not supported");
+		}
+		// with a conditional move, a float by its bits
+		uint32_t size = std::max<uint32_t>(ir_layouts[ty].size, 4);
+		to_reg(x86_rcx, inst.ops[0], ir_get_layout(mod, "i1"));
+		to_reg(x86_rax, inst.ops[2], ty);
+		to_reg(x86_rdx, inst.ops[1], ty);
+		out << "\ttestb %cl, %cl\n";
+		out.fmt("\tcmovne{} {}, {}\n", x86_suffix[x86_size_idx(size)],
+			x86_reg(x86_rdx, size), x86_reg(x86_rax, size));
+		if (is_ir_fp(ty)) {
+			out.fmt("\tmovq %rax, {}\n", x86_xmm(x86_xmm_scratch));
+			from_xmm(inst.res, x86_xmm_scratch);
+		} else {
+			from_reg(inst.res, x86_rax);
+		}
+		return;
+	}
+	case ir_br:
+		jump(block, inst.ops[0], next);
+		return;
+	case ir_cond_br: {
+		std::string on_true = edge(block, inst.ops[1]);
+		std::string on_false = edge(block, inst.ops[2]);
+		const char *code = "ne";
+		if (fused) {
+			bool swap;
+			const ir_inst_t &cmp =
+				func.insts[func.vals[inst.ops[0]].def];
+			compare(cmp);
+			code = cond_code(cmp, swap);
+		} else {
+			int32_t ty = lay(inst.ty);
+			x86_loc_t cond = loc(inst.ops[0], ty);
+			if (cond.kind == x86_loc_t::loc_reg) {
+				out.fmt("\ttestb {}, {}\n",
+					x86_reg(cond.val, 1),
+					x86_reg(cond.val, 1));
+			} else {
+				to_reg(x86_rax, inst.ops[0], ty);
+				out << "\ttestb %al, %al\n";
+			}
+		}
+		out.fmt("\tj{} {}\n", code, on_true);
+		if (on_false != label(next)) {
+			out.fmt("\tjmp {}\n", on_false);
+		}
+		return;
+	}
+	case ir_switch: {
+		int32_t ty = lay(inst.ty);
+		uint32_t size = ir_layouts[ty].size;
+		to_reg(x86_rax, inst.ops[0], ty);
+		for (uint32_t i = 0; i < inst.pool_len; i += 2) {
+			out.fmt("\tcmp{} {}, {}\n",
+				x86_suffix[x86_size_idx(size)],
+				operand(pool[i], ty, size),
+				x86_reg(x86_rax, size));
+			out.fmt("\tje {}\n", edge(block, pool[i + 1]));
+		}
+		std::string def = edge(block, inst.ops[1]);
+		if (def != label(next)) {
+			out.fmt("\tjmp {}\n", def);
+		}
+		return;
+	}
+	case ir_ret:
+		if (tail_jumped) {
+			tail_jumped = false;
+			return;
+		}
+		if (inst.ops[0] >= 0) {
+			int32_t ty = lay(inst.ty);
+			if (!is_ir_scalar(ty)) {
+				err_msg("x86: returning a struct by value is "
+					"not supported");
+			}
+			if (is_ir_fp(ty)) {
+				to_xmm(0, inst.ops[0], ty);
+			} else {
+				to_reg(x86_rax, inst.ops[0], ty);
+			}
+		}
+		epilogue();
+		out << "\tret\n";
+		return;
+	default:
+		break;
+	}
+
+	if (inst.op >= ir_trunc && inst.op <= ir_ptrtoint) {
+		cast(inst);
+		return;
+	}
+	if (inst.op < ir_icmp_eq) {
+		binary(inst);
+		return;
+	}
+	if (fused) {
+		// done by the branch
+		return;
+	}
+	bool swap;
+	const char *code = cond_code(inst, swap);
+	compare(inst);
+	if (inst.op == ir_fcmp_oeq || inst.op == ir_fcmp_one) {
+		// also ordered, no parity
+		out.fmt("\tset{} %al\n", code);
+		out << "\tsetnp %cl\n";
+		out << "\tandb %cl, %al\n";
+	} else {
+		out.fmt("\tset{} %al\n", code);
+	}
+	from_reg(inst.res, x86_rax);
+}
+
+void x86_func_t::write()
+{
+	name = func.name.substr(1);
+	number();
+	liveness();
+	allocate();
+
+	out << "\t.text\n";
+	if (!func.is_internal) {
+		out.fmt("\t.globl {}\n", name);
+	}
+	out.fmt("\t.type {}, @function\n", name);
+	out.fmt("{}:\n", name);
+	out << "\tpushq %rbp\n";
+	out << "\tmovq %rsp, %rbp\n";
+	for (auto r : saved) {
+		out.fmt("\tpushq {}\n", x86_reg(r, 8));
+	}
+	if (frame_size) {
+		out.fmt("\tsubq ${}, %rsp\n", frame_size);
+	}
+
+	// arguments from where they come to where they are kept
+	std::vector<x86_move_t> moves;
+	int int_args = 0, fp_args = 0;
+	for (auto i : func.args) {
+		int32_t ty = vtys[i];
+		bool is_fp = is_ir_fp(ty);
+		x86_loc_t src;
+		if (is_fp && fp_args < 8) {
+			src = { x86_loc_t::loc_xmm, fp_args++, {} };
+		} else if (!is_fp && int_args < 6) {
+			src = { x86_loc_t::loc_reg, x86_arg_regs[int_args++],
+				{} };
+		} else {
+			continue;
+		}
+		moves.push_back({ locs[i], src, is_fp, ir_layouts[ty].size });
+	}
+	move(moves);
+
+	for (size_t k = 0; k < func.layout.size(); k++) {
+		int32_t b = func.layout[k];
+		int32_t next = k + 1 < func.layout.size() ? func.layout[k + 1] :
+							    -1;
+		out.fmt("{}:\n", label(b));
+		const ir_block_t &block = func.blocks[b];
+		for (uint32_t i = block.beg; i < block.end; i++) {
+			const ir_inst_t &cur = func.insts[i];
+			// a compare only feeding the branch right after it
+			// sets the flags for the branch
+			bool fused = false;
+			const ir_inst_t *br = nullptr;
+			if (cur.op == ir_cond_br) {
+				br = &cur;
+			} else if (i + 1 < block.end &&
+				   func.insts[i + 1].op == ir_cond_br) {
+				br = &func.insts[i + 1];
+			}
+			if (br && func.vals[br->ops[0]].kind ==
+					  ir_value_t::val_inst) {
+				int32_t def = func.vals[br->ops[0]].def;
+				const ir_inst_t &cmp = func.insts[def];
+				int32_t at = br - &func.insts[0];
+				fused = def + 1 == at &&
+					uses[br->ops[0]] == 1 &&
+					cmp.op >= ir_icmp_eq &&
+					cmp.op <= ir_fcmp_oge &&
+					cmp.op != ir_fcmp_oeq &&
+					cmp.op != ir_fcmp_one;
+			}
+			inst(cur, b, next, fused);
+		}
+	}
+	for (size_t i = 0; i < stubs.size(); i++) {
+		out.fmt(".L{}.e{}:\n", name, i);
+		phi_moves(stubs[i].first, stubs[i].second);
+		out.fmt("\tjmp {}\n", label(stubs[i].second));
+	}
+	out.fmt("\t.size {}, .-{}\n", name, name);
+}
+
+/**
+ * @brief Write the data of a constant of a type.
+ */
+static void x86_data(writer_t &out, const ir_module_t &mod, int32_t ty,
+		     std::string_view repr)
+{
+	const ir_layout_t &type = ir_layouts[ty];
+	repr = ir_trim(repr);
+	if (repr == "zeroinitializer" || repr == "undef") {
+		if (type.size) {
+			out.fmt("\t.zero {}\n", type.size);
+		}
+		return;
+	}
+	static const char *const directives[] = {
+		".byte", ".short", ".long", ".quad",
+	};
+	std::string str(repr);
+	switch (type.kind) {
+	case ir_layout_t::ty_int:
+	case ir_layout_t::ty_ptr: {
+		const char *dir = directives[x86_size_idx(type.size)];
+		if (repr[0] == '@') {
+			out.fmt("\t{} {}\n", dir, repr.substr(1));
+		} else if (repr == "null" || repr == "false") {
+			out.fmt("\t{} 0\n", dir);
+		} else if (repr == "true") {
+			out.fmt("\t{} 1\n", dir);
+		} else {
+			out.fmt("\t{} {}\n", dir, repr);
+		}
+		return;
+	}
+	case ir_layout_t::ty_float:
+	case ir_layout_t::ty_double: {
+		bool is_float = type.kind == ir_layout_t::ty_float;
+		out.fmt(is_float ? "\t.long {}\n" : "\t.quad {}\n",
+			ir_float_bits(repr, is_float));
+		return;
+	}
+	case ir_layout_t::ty_array:
+		if (repr.substr(0, 2) == "c\"") {
+			out << "\t.byte ";
+			for (size_t i = 2; i + 1 < repr.size(); i++) {
+				unsigned ch = (unsigned char)repr[i];
+				if (ch == '\\') {
+					ch = std::strtoul(
+						str.substr(i + 1, 2).c_str(),
+						nullptr, 16);
+					i += 2;
+				}
+				out.fmt(i + 2 < repr.size() ? "{}," : "{}",
+					ch);
+			}
+			out << '\n';
+			return;
+		}
+		for (auto i : ir_split_items(repr.substr(1, repr.size() - 2))) {
+			x86_data(out, mod, type.elems[0],
+				 i.substr(ir_skip_type(i)));
+		}
+		return;
+	case ir_layout_t::ty_struct: {
+		bool packed;
+		uint32_t cur = 0;
+		size_t idx = 0;
+		for (auto i : ir_split_items(ir_struct_items(repr, packed))) {
+			if (type.offsets[idx] > cur) {
+				out.fmt("\t.zero {}\n",
+					type.offsets[idx] - cur);
+			}
+			x86_data(out, mod, type.elems[idx],
+				 i.substr(ir_skip_type(i)));
+			cur = type.offsets[idx] +
+			      ir_layouts[type.elems[idx]].size;
+			idx++;
+		}
+		if (type.size > cur) {
+			out.fmt("\t.zero {}\n", type.size - cur);
+		}
+		return;
+	}
+	default:
+		err_msg("x86: unsupported constant " + str);
+	}
+}
+
+void x86_output_func(writer_t &out, ir_module_t &mod, ir_func_t &func)
+{
+	x86_func_t x86(out, mod, func);
+	x86.write();
+}
+
+void x86_output_module(writer_t &out, ir_module_t &mod)
+{
+	for (const auto &i : mod.globals) {
+		int32_t ty = ir_get_layout(mod, i.type);
+		auto items = ir_split_items(i.init);
+		uint32_t align = ir_layouts[ty].align;
+		if (items.size() > 1) {
+			// ", align N"
+			align = std::strtoul(std::string(items[1].substr(6))
+						     .c_str(),
+					     nullptr, 10);
+		}
+		bool is_const = i.attr.find("constant") != std::string::npos;
+		bool is_local = i.attr.find("private") != std::string::npos ||
+				i.attr.find("internal") != std::string::npos;
+		bool is_zero = ir_trim(items[0]) == "zeroinitializer";
+		std::string name = i.name.substr(1);
+		if (is_const) {
+			out << "\t.section .rodata\n";
+		} else {
+			out << (is_zero ? "\t.bss\n" : "\t.data\n");
+		}
+		if (!is_local) {
+			out.fmt("\t.globl {}\n", name);
+		}
+		out.fmt("\t.p2align {}\n", __builtin_ctz(std::max(align, 1u)));
+		out.fmt("\t.type {}, @object\n", name);
+		out.fmt("\t.size {}, {}\n", name, ir_layouts[ty].size);
+		out.fmt("{}:\n", name);
+		x86_data(out, mod, ty, items[0]);
+	}
+	if (!x86_fconsts.empty()) {
+		out << "\t.section .rodata\n";
+		out << "\t.p2align 3\n";
+	}
+	for (const auto &i : x86_fconsts) {
+		out.fmt("{}:\n", i.second);
+		if (i.first.second) {
+			out.fmt("\t.long {}\n", i.first.first);
+		} else {
+			out.fmt("\t.quad {}\n", i.first.first);
+		}
+	}
+	out << "\t.section .note.GNU-stack,\"\",@progbits\n";
+	x86_fconsts.clear();
+}
+
+}
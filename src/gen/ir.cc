@@ -0,0 +1,373 @@
+/**
+ * @file ir.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "gen/ir.hh"
+#include "out.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace neko_cc
+{
+
+bool is_ir_terminator(ir_op_t op)
+{
+	return op == ir_br || op == ir_cond_br || op == ir_switch ||
+	       op == ir_ret;
+}
+
+void ir_get_succs(const ir_func_t &func, int32_t block,
+		  std::vector<int32_t> &succs)
+{
+	succs.clear();
+	const ir_block_t &b = func.blocks[block];
+	if (b.beg == b.end) {
+		return;
+	}
+	const ir_inst_t &inst = func.insts[b.end - 1];
+	switch (inst.op) {
+	case ir_br:
+		succs.push_back(inst.ops[0]);
+		break;
+	case ir_cond_br:
+		succs.push_back(inst.ops[1]);
+		succs.push_back(inst.ops[2]);
+		break;
+	case ir_switch:
+		succs.push_back(inst.ops[1]);
+		for (uint32_t i = 1; i < inst.pool_len; i += 2) {
+			succs.push_back(func.pool[inst.pool_beg + i]);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+std::vector<std::vector<int32_t> > ir_get_preds(const ir_func_t &func)
+{
+	std::vector<std::vector<int32_t> > preds(func.blocks.size());
+	std::vector<int32_t> succs;
+	for (auto b : func.layout) {
+		ir_get_succs(func, b, succs);
+		for (auto s : succs) {
+			preds[s].push_back(b);
+		}
+	}
+	return preds;
+}
+
+std::string_view ir_trim(std::string_view s)
+{
+	while (!s.empty() && s.front() == ' ') {
+		s.remove_prefix(1);
+	}
+	while (!s.empty() && s.back() == ' ') {
+		s.remove_suffix(1);
+	}
+	return s;
+}
+
+std::vector<std::string_view> ir_split_items(std::string_view s)
+{
+	std::vector<std::string_view> ret;
+	int depth = 0;
+	bool in_str = false;
+	size_t beg = 0;
+	for (size_t i = 0; i < s.size(); i++) {
+		char ch = s[i];
+		if (ch == '"') {
+			in_str = !in_str;
+		} else if (in_str) {
+			continue;
+		} else if (ch == '[' || ch == '{' || ch == '<') {
+			depth++;
+		} else if (ch == ']' || ch == '}' || ch == '>') {
+			depth--;
+		} else if (ch == ',' && !depth) {
+			ret.push_back(ir_trim(s.substr(beg, i - beg)));
+			beg = i + 1;
+		}
+	}
+	s = ir_trim(s.substr(beg));
+	if (!s.empty()) {
+		ret.push_back(s);
+	}
+	return ret;
+}
+
+size_t ir_skip_type(std::string_view s)
+{
+	if (s.empty() || (s[0] != '[' && s[0] != '{' && s[0] != '<')) {
+		size_t pos = s.find(' ');
+		return pos == std::string_view::npos ? s.size() : pos;
+	}
+	int depth = 0;
+	for (size_t i = 0; i < s.size(); i++) {
+		if (s[i] == '[' || s[i] == '{' || s[i] == '<') {
+			depth++;
+		} else if (s[i] == ']' || s[i] == '}' || s[i] == '>') {
+			depth--;
+		}
+		if (!depth) {
+			return i + 1;
+		}
+	}
+	return s.size();
+}
+
+std::string_view ir_struct_items(std::string_view s, bool &packed)
+{
+	packed = s.size() >= 2 && s[0] == '<';
+	size_t cut = packed ? 2 : 1;
+	return s.substr(cut, s.size() - cut * 2);
+}
+
+void ir_func_t::clear()
+{
+	name.clear();
+	is_internal = false;
+	ret_ty = -1;
+	args.clear();
+	args_ty.clear();
+	args_noalias.clear();
+	insts.clear();
+	vals.clear();
+	blocks.clear();
+	layout.clear();
+	pool.clear();
+	strs.clear();
+	named.clear();
+	labels.clear();
+	cur_block = -1;
+}
+
+int32_t ir_func_t::add_str(std::string_view str)
+{
+	strs.emplace_back(str);
+	return strs.size() - 1;
+}
+
+int32_t ir_func_t::new_val(ir_value_t::kind_t kind, int32_t name)
+{
+	ir_value_t val;
+	val.kind = kind;
+	val.name = name;
+	vals.push_back(val);
+	return vals.size() - 1;
+}
+
+int32_t ir_func_t::get_named(const std::string &name)
+{
+	auto it = named.find(name);
+	if (it != named.end()) {
+		return it->second;
+	}
+	if (name.empty() || name[0] == '%') {
+		err_msg("Unknown value in ir: " + name);
+	}
+	auto kind = name[0] == '@' ? ir_value_t::val_global :
+				     ir_value_t::val_const;
+	int32_t ret = new_val(kind, add_str(name));
+	named.emplace(name, ret);
+	return ret;
+}
+
+int32_t ir_func_t::get_block(const std::string &label)
+{
+	auto it = labels.find(label);
+	if (it != labels.end()) {
+		return it->second;
+	}
+	ir_block_t block;
+	block.name = add_str(label);
+	blocks.push_back(block);
+	labels.emplace(label, blocks.size() - 1);
+	return blocks.size() - 1;
+}
+
+void ir_func_t::start_block(int32_t block)
+{
+	if (cur_block >= 0) {
+		ir_inst_t br;
+		br.op = ir_br;
+		br.ops[0] = block;
+		append(br, false);
+	}
+	blocks[block].beg = insts.size();
+	blocks[block].end = insts.size();
+	layout.push_back(block);
+	cur_block = block;
+}
+
+int32_t ir_func_t::append(ir_inst_t inst, bool has_res)
+{
+	if (cur_block < 0) {
+		if (inst.op != ir_alloca) {
+			// code after a terminator is never run, the value it
+			// defines is only used by code as dead as itself
+			return has_res ? new_val(ir_value_t::val_inst) : -1;
+		}
+		// a local declared there may still be used past a later label,
+		// keep its slot, it is hoisted into the entry block anyway
+		blocks.emplace_back();
+		start_block(blocks.size() - 1);
+	}
+	if (has_res) {
+		inst.res = new_val(ir_value_t::val_inst);
+		vals[inst.res].def = insts.size();
+	}
+	insts.push_back(inst);
+	blocks[cur_block].end = insts.size();
+	if (is_ir_terminator(inst.op)) {
+		cur_block = -1;
+	}
+	return inst.res;
+}
+
+std::vector<ir_layout_t> ir_layouts;
+static std::unordered_map<std::string, int32_t> ir_layout_ids;
+// layout of each type of the module, -1 if not known yet
+static std::vector<int32_t> ir_mod_layouts;
+
+static int32_t ir_add_layout(const std::string &repr, ir_layout_t type)
+{
+	ir_layouts.push_back(std::move(type));
+	ir_layout_ids.emplace(repr, ir_layouts.size() - 1);
+	return ir_layouts.size() - 1;
+}
+
+int32_t ir_get_layout(const ir_module_t &mod, std::string_view repr)
+{
+	repr = ir_trim(repr);
+	std::string key(repr);
+	auto it = ir_layout_ids.find(key);
+	if (it != ir_layout_ids.end()) {
+		return it->second;
+	}
+	ir_layout_t type;
+	if (repr == "void") {
+		type.kind = ir_layout_t::ty_void;
+		return ir_add_layout(key, type);
+	}
+	if (repr == "float" || repr == "double") {
+		type.kind = repr == "float" ? ir_layout_t::ty_float :
+					      ir_layout_t::ty_double;
+		type.size = type.align = repr == "float" ? 4 : 8;
+		return ir_add_layout(key, type);
+	}
+	if (repr == "ptr") {
+		type.kind = ir_layout_t::ty_ptr;
+		type.size = type.align = 8;
+		return ir_add_layout(key, type);
+	}
+	if (repr[0] == 'i') {
+		type.kind = ir_layout_t::ty_int;
+		type.cnt = std::strtoull(key.c_str() + 1, nullptr, 10);
+		type.size = type.align = type.cnt <= 8 ? 1 : type.cnt / 8;
+		return ir_add_layout(key, type);
+	}
+	if (repr[0] == '[') {
+		// "[ N x T ]"
+		std::string_view inner = repr.substr(1, repr.size() - 2);
+		inner = ir_trim(inner);
+		size_t pos = inner.find(" x ");
+		type.kind = ir_layout_t::ty_array;
+		std::string cnt(inner.substr(0, pos));
+		type.cnt = std::strtoull(cnt.c_str(), nullptr, 10);
+		int32_t elem = ir_get_layout(mod, inner.substr(pos + 3));
+		type.elems.push_back(elem);
+		type.size = ir_layouts[elem].size * type.cnt;
+		type.align = ir_layouts[elem].align;
+		return ir_add_layout(key, type);
+	}
+	std::string_view body = repr;
+	if (repr[0] == '%') {
+		body = {};
+		for (const auto &i : mod.named_types) {
+			if (i.first == repr) {
+				body = i.second;
+			}
+		}
+	}
+	if (body.empty()) {
+		err_msg("ir: unsupported type " + key);
+	}
+	bool packed;
+	type.kind = ir_layout_t::ty_struct;
+	for (auto i : ir_split_items(ir_struct_items(body, packed))) {
+		int32_t elem = ir_get_layout(mod, i);
+		uint32_t align = packed ? 1 : ir_layouts[elem].align;
+		type.size = (type.size + align - 1) / align * align;
+		type.align = std::max(type.align, align);
+		type.elems.push_back(elem);
+		type.offsets.push_back(type.size);
+		type.size += ir_layouts[elem].size;
+	}
+	type.size = (type.size + type.align - 1) / type.align * type.align;
+	return ir_add_layout(key, type);
+}
+
+int32_t ir_mod_layout(const ir_module_t &mod, int32_t ty)
+{
+	if (ir_mod_layouts.size() <= (size_t)ty) {
+		ir_mod_layouts.resize(mod.types.size(), -1);
+	}
+	if (ir_mod_layouts[ty] < 0) {
+		ir_mod_layouts[ty] = ir_get_layout(mod, mod.types[ty]);
+	}
+	return ir_mod_layouts[ty];
+}
+
+bool is_ir_fp(int32_t lay)
+{
+	return ir_layouts[lay].kind == ir_layout_t::ty_float ||
+	       ir_layouts[lay].kind == ir_layout_t::ty_double;
+}
+
+bool is_ir_scalar(int32_t lay)
+{
+	return ir_layouts[lay].kind != ir_layout_t::ty_void &&
+	       ir_layouts[lay].kind != ir_layout_t::ty_array &&
+	       ir_layouts[lay].kind != ir_layout_t::ty_struct;
+}
+
+uint64_t ir_float_bits(std::string_view repr, bool is_float)
+{
+	std::string str(repr);
+	double d;
+	if (repr.substr(0, 2) == "0x") {
+		uint64_t bits = std::strtoull(str.c_str() + 2, nullptr, 16);
+		std::memcpy(&d, &bits, sizeof(d));
+	} else {
+		d = std::strtod(str.c_str(), nullptr);
+	}
+	if (is_float) {
+		float f = d;
+		uint32_t bits;
+		std::memcpy(&bits, &f, sizeof(bits));
+		return bits;
+	}
+	uint64_t bits;
+	std::memcpy(&bits, &d, sizeof(bits));
+	return bits;
+}
+
+int32_t ir_module_t::get_type(const std::string &repr)
+{
+	auto it = type_ids.find(repr);
+	if (it != type_ids.end()) {
+		return it->second;
+	}
+	types.push_back(repr);
+	type_ids.emplace(repr, types.size() - 1);
+	return types.size() - 1;
+}
+
+}
@@ -0,0 +1,1224 @@
+/**
+ * @file ir_bitcode.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Write the IR as LLVM bitcode, without the LLVM libraries.
+ *
+ * The module is kept until its end and written as a whole: version 1 of
+ * the module block, with operands relative to the instruction and names
+ * in value symbol tables, and opaque pointers. Types, globals and
+ * constants are parsed back from the reprs the textual printer writes.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "gen/ir.hh"
+#include "out.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+
+namespace neko_cc
+{
+
+// block ids and record codes, numbered as in llvm/Bitcode/LLVMBitCodes.h
+enum : uint32_t {
+	bc_blockinfo_block = 0,
+	bc_module_block = 8,
+	bc_paramattr_block = 9,
+	bc_paramattr_group_block = 10,
+	bc_constants_block = 11,
+	bc_function_block = 12,
+	bc_identification_block = 13,
+	bc_vst_block = 14,
+	bc_type_block = 17,
+};
+
+enum : uint32_t {
+	bc_blockinfo_setbid = 1,
+	bc_ident_string = 1,
+	bc_ident_epoch = 2,
+	bc_module_version = 1,
+	bc_module_globalvar = 7,
+	bc_module_function = 8,
+	bc_paramattr_entry = 2,
+	bc_paramattr_grp_entry = 3,
+	bc_vst_entry = 1,
+	bc_vst_bbentry = 2,
+};
+
+enum : uint32_t {
+	bc_type_numentry = 1,
+	bc_type_void = 2,
+	bc_type_float = 3,
+	bc_type_double = 4,
+	bc_type_integer = 7,
+	bc_type_array = 11,
+	bc_type_fp128 = 14,
+	bc_type_struct_anon = 18,
+	bc_type_struct_name = 19,
+	bc_type_struct_named = 20,
+	bc_type_function = 21,
+	bc_type_opaque_pointer = 25,
+};
+
+// the kind of an enum attribute, and where it goes, an argument from 1
+enum : uint32_t {
+	bc_attr_enum = 0,
+	bc_attr_noalias = 9,
+	bc_attr_arg_beg = 1,
+};
+
+enum : uint32_t {
+	bc_cst_settype = 1,
+	bc_cst_null = 2,
+	bc_cst_undef = 3,
+	bc_cst_integer = 4,
+	bc_cst_float = 6,
+	bc_cst_aggregate = 7,
+	bc_cst_string = 8,
+};
+
+enum : uint32_t {
+	bc_inst_declareblocks = 1,
+	bc_inst_binop = 2,
+	bc_inst_cast = 3,
+	bc_inst_ret = 10,
+	bc_inst_br = 11,
+	bc_inst_switch = 12,
+	bc_inst_phi = 16,
+	bc_inst_alloca = 19,
+	bc_inst_load = 20,
+	bc_inst_extractval = 26,
+	bc_inst_cmp2 = 28,
+	bc_inst_vselect = 29,
+	bc_inst_call = 34,
+	bc_inst_gep = 43,
+	bc_inst_store = 44,
+};
+
+// flags of the cc field of a call, a musttail call is a tail one too
+static constexpr uint64_t bc_call_tail = 1 << 0;
+static constexpr uint64_t bc_call_musttail = 1 << 14;
+static constexpr uint64_t bc_call_explicit_type = 1 << 15;
+// flag of the align field of an alloca, the type is the allocated one
+static constexpr uint64_t bc_alloca_explicit_type = 1 << 6;
+// flags of the binop flags field, exact for divisions and shifts, nsw for
+// add, sub, mul and shl
+static constexpr uint64_t bc_binop_exact = 1 << 0;
+static constexpr uint64_t bc_binop_nsw = 1 << 1;
+
+/**
+ * @brief Opcode in the record of each IR instruction, a binop, cast or
+ * predicate code. Floating point binops share the integer codes.
+ */
+static const uint8_t bc_opcode[ir_op_cnt] = {
+	0,
+	// add sub mul sdiv udiv srem urem shl lshr ashr and or xor
+	0, 1, 2, 4, 3, 6, 5, 7, 8, 9, 10, 11, 12,
+	// fadd fsub fmul fdiv frem
+	0, 1, 2, 4, 6,
+	// icmp eq ne ult slt ule sle ugt sgt uge sge
+	32, 33, 36, 40, 37, 41, 34, 38, 35, 39,
+	// fcmp oeq one olt ole ogt oge
+	1, 6, 4, 5, 2, 3,
+	// trunc zext sext fptosi sitofp fptrunc fpext inttoptr ptrtoint
+	0, 1, 2, 4, 6, 7, 8, 10, 9,
+};
+
+/**
+ * @brief An operand of an abbreviation. An array takes the rest of the
+ * record, each item encoded by the operand after it.
+ */
+struct bc_abbrev_op_t {
+	enum kind_t : uint8_t {
+		op_literal,
+		op_fixed,
+		op_vbr,
+		op_array,
+		op_char6,
+	} kind;
+	uint64_t val = 0;
+};
+
+using bc_abbrev_t = std::vector<bc_abbrev_op_t>;
+
+static bool is_char6(uint64_t ch)
+{
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+	       (ch >= '0' && ch <= '9') || ch == '.' || ch == '_';
+}
+
+static uint64_t get_char6(uint64_t ch)
+{
+	if (ch >= 'a' && ch <= 'z') {
+		return ch - 'a';
+	}
+	if (ch >= 'A' && ch <= 'Z') {
+		return ch - 'A' + 26;
+	}
+	if (ch >= '0' && ch <= '9') {
+		return ch - '0' + 52;
+	}
+	return ch == '.' ? 62 : 63;
+}
+
+/**
+ * @brief The bitstream, bits are packed from the low end of little endian
+ * 32-bit words. Blocks get their abbreviations from the blockinfo.
+ */
+struct bc_stream_t {
+	std::string buf;
+	// abbreviations of each block id, they are numbered from 4
+	std::map<uint32_t, std::vector<bc_abbrev_t> > infos;
+
+	void emit(uint64_t val, unsigned width);
+	void emit_vbr(uint64_t val, unsigned width);
+	void align32();
+	void enter_block(uint32_t id, unsigned abbrev_width);
+	void end_block();
+	void define_abbrev(const bc_abbrev_t &abbrev);
+	/**
+	 * @brief Write a record with the first of the abbreviations that fits
+	 * it, or unabbreviated if none does.
+	 */
+	void record(uint32_t code, const std::vector<uint64_t> &vals,
+		    std::initializer_list<unsigned> abbrevs = {});
+
+    private:
+	struct frame_t {
+		uint32_t id;
+		unsigned width;
+		size_t len_pos;
+	};
+	std::vector<frame_t> frames;
+	unsigned width = 2;
+	uint64_t cur = 0;
+	unsigned cur_bits = 0;
+
+	bool fits(const bc_abbrev_t &abbrev, uint32_t code,
+		  const std::vector<uint64_t> &vals);
+	void emit_op(const bc_abbrev_op_t &op, uint64_t val);
+};
+
+void bc_stream_t::emit(uint64_t val, unsigned width)
+{
+	cur |= val << cur_bits;
+	cur_bits += width;
+	while (cur_bits >= 32) {
+		for (int i = 0; i < 4; i++) {
+			buf += (char)(cur >> (i * 8));
+		}
+		cur >>= 32;
+		cur_bits -= 32;
+	}
+}
+
+void bc_stream_t::emit_vbr(uint64_t val, unsigned width)
+{
+	uint64_t hi = (uint64_t)1 << (width - 1);
+	while (val >= hi) {
+		emit((val & (hi - 1)) | hi, width);
+		val >>= width - 1;
+	}
+	emit(val, width);
+}
+
+void bc_stream_t::align32()
+{
+	if (cur_bits) {
+		emit(0, 32 - cur_bits);
+	}
+}
+
+void bc_stream_t::enter_block(uint32_t id, unsigned abbrev_width)
+{
+	emit(1, width);
+	emit_vbr(id, 8);
+	emit_vbr(abbrev_width, 4);
+	align32();
+	frames.push_back({ id, width, buf.size() });
+	// the length in words, known at the end
+	emit(0, 32);
+	width = abbrev_width;
+}
+
+void bc_stream_t::end_block()
+{
+	emit(0, width);
+	align32();
+	frame_t frame = frames.back();
+	frames.pop_back();
+	uint32_t len = (buf.size() - frame.len_pos) / 4 - 1;
+	for (int i = 0; i < 4; i++) {
+		buf[frame.len_pos + i] = (char)(len >> (i * 8));
+	}
+	width = frame.width;
+}
+
+void bc_stream_t::define_abbrev(const bc_abbrev_t &abbrev)
+{
+	emit(2, width);
+	emit_vbr(abbrev.size(), 5);
+	for (const auto &op : abbrev) {
+		if (op.kind == bc_abbrev_op_t::op_literal) {
+			emit(1, 1);
+			emit_vbr(op.val, 8);
+			continue;
+		}
+		emit(0, 1);
+		emit(op.kind, 3);
+		if (op.kind == bc_abbrev_op_t::op_fixed ||
+		    op.kind == bc_abbrev_op_t::op_vbr) {
+			emit_vbr(op.val, 5);
+		}
+	}
+}
+
+bool bc_stream_t::fits(const bc_abbrev_t &abbrev, uint32_t code,
+		       const std::vector<uint64_t> &vals)
+{
+	auto fit = [](const bc_abbrev_op_t &op, uint64_t val) {
+		switch (op.kind) {
+		case bc_abbrev_op_t::op_literal:
+			return val == op.val;
+		case bc_abbrev_op_t::op_fixed:
+			return op.val >= 64 || val >> op.val == 0;
+		case bc_abbrev_op_t::op_char6:
+			return is_char6(val);
+		default:
+			return true;
+		}
+	};
+	for (size_t i = 0; i < abbrev.size(); i++) {
+		if (abbrev[i].kind == bc_abbrev_op_t::op_array) {
+			for (size_t j = i ? i - 1 : 0; j < vals.size(); j++) {
+				if (!fit(abbrev[i + 1], vals[j])) {
+					return false;
+				}
+			}
+			return true;
+		}
+		if (i > vals.size()) {
+			return false;
+		}
+		if (!fit(abbrev[i], i ? vals[i - 1] : code)) {
+			return false;
+		}
+	}
+	return abbrev.size() == vals.size() + 1;
+}
+
+void bc_stream_t::emit_op(const bc_abbrev_op_t &op, uint64_t val)
+{
+	switch (op.kind) {
+	case bc_abbrev_op_t::op_fixed:
+		emit(val, op.val);
+		break;
+	case bc_abbrev_op_t::op_vbr:
+		emit_vbr(val, op.val);
+		break;
+	case bc_abbrev_op_t::op_char6:
+		emit(get_char6(val), 6);
+		break;
+	default:
+		break;
+	}
+}
+
+void bc_stream_t::record(uint32_t code, const std::vector<uint64_t> &vals,
+			 std::initializer_list<unsigned> abbrevs)
+{
+	const auto &list = infos[frames.back().id];
+	for (auto id : abbrevs) {
+		const bc_abbrev_t &abbrev = list[id - 4];
+		if (!fits(abbrev, code, vals)) {
+			continue;
+		}
+		emit(id, width);
+		for (size_t i = 0; i < abbrev.size(); i++) {
+			if (abbrev[i].kind == bc_abbrev_op_t::op_array) {
+				emit_vbr(vals.size() - i + 1, 6);
+				for (size_t j = i - 1; j < vals.size(); j++) {
+					emit_op(abbrev[i + 1], vals[j]);
+				}
+				return;
+			}
+			emit_op(abbrev[i], i ? vals[i - 1] : code);
+		}
+		return;
+	}
+	emit(3, width);
+	emit_vbr(code, 6);
+	emit_vbr(vals.size(), 6);
+	for (auto i : vals) {
+		emit_vbr(i, 6);
+	}
+}
+
+// abbreviation ids, in the order they are put in the blockinfo
+enum : unsigned {
+	bc_abbrev_vst_entry_8 = 4,
+	bc_abbrev_vst_entry_6,
+	bc_abbrev_vst_bbentry_6,
+};
+
+enum : unsigned {
+	bc_abbrev_cst_settype = 4,
+	bc_abbrev_cst_integer,
+	bc_abbrev_cst_null,
+};
+
+enum : unsigned {
+	bc_abbrev_inst_load = 4,
+	bc_abbrev_inst_binop,
+	bc_abbrev_inst_cast,
+	bc_abbrev_inst_ret_void,
+	bc_abbrev_inst_ret_val,
+};
+
+/**
+ * @brief Constants of a module or a function, each made once per type
+ * and repr. Their value ids start at base.
+ */
+struct bc_consts_t {
+	struct entry_t {
+		uint32_t ty;
+		uint32_t code;
+		std::vector<uint64_t> vals;
+	};
+	uint32_t base = 0;
+	std::map<std::pair<uint32_t, std::string>, uint32_t> ids;
+	std::vector<entry_t> list;
+};
+
+/**
+ * @brief Value ids of a function, its arguments, then its constants and
+ * then the values its instructions define.
+ */
+struct bc_func_t {
+	std::vector<uint32_t> ids;
+	std::vector<uint32_t> bbs;
+	bc_consts_t consts;
+};
+
+struct bc_writer_t {
+	explicit bc_writer_t(const ir_module_t &_mod) : mod(_mod)
+	{
+	}
+
+	const ir_module_t &mod;
+	bc_stream_t bs;
+
+	// records of the type table, a struct name adds no type
+	std::vector<std::pair<uint32_t, std::vector<uint64_t> > > type_recs;
+	std::unordered_map<std::string, uint32_t> type_ids;
+	// record code and member types of each type
+	std::vector<uint32_t> type_codes;
+	std::vector<std::vector<uint32_t> > type_elems;
+	unsigned type_width = 1;
+
+	// globals and functions by name with the '@'
+	std::unordered_map<std::string, uint32_t> globals;
+	std::vector<uint32_t> global_inits;
+	std::vector<std::pair<std::string, uint32_t> > protos;
+	// the noalias arguments of each attribute list, and the list of each
+	// defined function, from 1, 0 if none
+	std::vector<std::vector<uint32_t> > attr_lists;
+	std::vector<uint32_t> func_attrs;
+	uint32_t n_globals = 0;
+	bc_consts_t consts;
+	std::vector<bc_func_t> funcs;
+	uint32_t memcpy_id = 0;
+	uint32_t memset_id = 0;
+	uint32_t lifetime_start_id = 0;
+	uint32_t lifetime_end_id = 0;
+
+	uint32_t type(std::string_view repr);
+	uint32_t func_type(uint32_t ret, const std::vector<uint32_t> &args);
+	uint32_t add_type(std::string key, uint32_t code,
+			  std::vector<uint64_t> vals,
+			  std::vector<uint32_t> elems);
+	uint32_t get_const(bc_consts_t &tab, uint32_t ty,
+			   std::string_view repr);
+	uint32_t get_global(const std::string &name);
+
+	void enumerate();
+	void write();
+	void write_attrs();
+	void write_types();
+	void write_consts(const bc_consts_t &tab);
+	void write_name(uint32_t code, uint32_t id, std::string_view name);
+	void write_func(const ir_func_t &func, bc_func_t &bf, bool dry);
+};
+
+uint32_t bc_writer_t::add_type(std::string key, uint32_t code,
+			       std::vector<uint64_t> vals,
+			       std::vector<uint32_t> elems)
+{
+	uint32_t id = type_codes.size();
+	type_recs.emplace_back(code, std::move(vals));
+	type_codes.push_back(code);
+	type_elems.push_back(std::move(elems));
+	type_ids.emplace(std::move(key), id);
+	return id;
+}
+
+uint32_t bc_writer_t::type(std::string_view repr)
+{
+	repr = ir_trim(repr);
+	auto it = type_ids.find(std::string(repr));
+	if (it != type_ids.end()) {
+		return it->second;
+	}
+	std::string key(repr);
+	if (repr == "void") {
+		return add_type(key, bc_type_void, {}, {});
+	}
+	if (repr == "float") {
+		return add_type(key, bc_type_float, {}, {});
+	}
+	if (repr == "double") {
+		return add_type(key, bc_type_double, {}, {});
+	}
+	if (repr == "fp128") {
+		return add_type(key, bc_type_fp128, {}, {});
+	}
+	if (repr == "ptr") {
+		return add_type(key, bc_type_opaque_pointer, { 0 }, {});
+	}
+	if (repr[0] == 'i') {
+		uint64_t bits = std::strtoull(key.c_str() + 1, nullptr, 10);
+		return add_type(key, bc_type_integer, { bits }, {});
+	}
+	if (repr[0] == '[') {
+		// "[ N x T ]"
+		std::string_view inner = repr.substr(1, repr.size() - 2);
+		inner = ir_trim(inner);
+		size_t pos = inner.find(" x ");
+		uint64_t cnt = std::strtoull(std::string(inner.substr(0, pos))
+						     .c_str(),
+					     nullptr, 10);
+		uint32_t elem = type(inner.substr(pos + 3));
+		return add_type(key, bc_type_array, { cnt, elem }, { elem });
+	}
+	bool packed;
+	std::vector<uint32_t> elems;
+	std::vector<uint64_t> vals;
+	if (repr[0] == '{' || repr[0] == '<') {
+		for (auto i : ir_split_items(ir_struct_items(repr, packed))) {
+			elems.push_back(type(i));
+		}
+		vals.push_back(packed);
+		vals.insert(vals.end(), elems.begin(), elems.end());
+		return add_type(key, bc_type_struct_anon, vals, elems);
+	}
+	if (repr[0] == '%') {
+		for (const auto &i : mod.named_types) {
+			if (i.first != repr) {
+				continue;
+			}
+			for (auto j : ir_split_items(ir_struct_items(i.second,
+							       packed))) {
+				elems.push_back(type(j));
+			}
+			std::vector<uint64_t> name(repr.begin() + 1,
+						   repr.end());
+			type_recs.emplace_back(bc_type_struct_name, name);
+			vals.push_back(packed);
+			vals.insert(vals.end(), elems.begin(), elems.end());
+			return add_type(key, bc_type_struct_named, vals, elems);
+		}
+	}
+	err_msg("bitcode: unsupported type " + key);
+}
+
+uint32_t bc_writer_t::func_type(uint32_t ret, const std::vector<uint32_t> &args)
+{
+	std::string key = "fn " + std::to_string(ret);
+	std::vector<uint64_t> vals{ 0, ret };
+	for (auto i : args) {
+		key += ' ' + std::to_string(i);
+		vals.push_back(i);
+	}
+	auto it = type_ids.find(key);
+	if (it != type_ids.end()) {
+		return it->second;
+	}
+	return add_type(key, bc_type_function, vals, {});
+}
+
+uint32_t bc_writer_t::get_global(const std::string &name)
+{
+	auto it = globals.find(name);
+	if (it == globals.end()) {
+		err_msg("bitcode: unknown global " + name);
+	}
+	return it->second;
+}
+
+uint32_t bc_writer_t::get_const(bc_consts_t &tab, uint32_t ty,
+				std::string_view repr)
+{
+	repr = ir_trim(repr);
+	if (repr[0] == '@') {
+		return get_global(std::string(repr));
+	}
+	auto key = std::make_pair(ty, std::string(repr));
+	auto it = tab.ids.find(key);
+	if (it != tab.ids.end()) {
+		return it->second;
+	}
+
+	bc_consts_t::entry_t entry{ ty, bc_cst_integer, {} };
+	if (repr == "zeroinitializer" || repr == "null") {
+		entry.code = bc_cst_null;
+	} else if (repr == "undef") {
+		entry.code = bc_cst_undef;
+	} else if (repr == "true" || repr == "false") {
+		entry.vals.push_back(repr == "true" ? 2 : 0);
+	} else if (type_codes[ty] == bc_type_float ||
+		   type_codes[ty] == bc_type_double) {
+		// a double in hex even for a float, or a decimal literal
+		entry.code = bc_cst_float;
+		entry.vals.push_back(ir_float_bits(
+			repr, type_codes[ty] == bc_type_float));
+	} else if (repr.substr(0, 2) == "0x") {
+		err_msg("bitcode: unsupported constant " + key.second);
+	} else if (repr.substr(0, 2) == "c\"") {
+		entry.code = bc_cst_string;
+		for (size_t i = 2; i + 1 < repr.size(); i++) {
+			if (repr[i] != '\\') {
+				entry.vals.push_back((unsigned char)repr[i]);
+				continue;
+			}
+			entry.vals.push_back(std::strtoul(
+				std::string(repr.substr(i + 1, 2)).c_str(),
+				nullptr, 16));
+			i += 2;
+		}
+	} else if (repr[0] == '[' || repr[0] == '{' || repr[0] == '<') {
+		bool packed;
+		std::string_view inner = ir_struct_items(repr, packed);
+		if (repr[0] == '[') {
+			inner = repr.substr(1, repr.size() - 2);
+		}
+		const auto &elems = type_elems[ty];
+		size_t idx = 0;
+		entry.code = bc_cst_aggregate;
+		for (auto i : ir_split_items(inner)) {
+			uint32_t elem_ty = elems[elems.size() == 1 ? 0 : idx++];
+			entry.vals.push_back(get_const(
+				tab, elem_ty, i.substr(ir_skip_type(i))));
+		}
+	} else {
+		// signed vbr, the sign in the lowest bit
+		int64_t val = std::strtoll(key.second.c_str(), nullptr, 10);
+		uint64_t mag = val < 0 ? -(uint64_t)val : val;
+		entry.vals.push_back(mag << 1 | (val < 0));
+	}
+	uint32_t id = tab.base + tab.list.size();
+	tab.list.push_back(std::move(entry));
+	tab.ids.emplace(std::move(key), id);
+	return id;
+}
+
+/**
+ * @brief Number the types, globals, functions and constants, walking every
+ * function once to find the types and constants its instructions use.
+ */
+void bc_writer_t::enumerate()
+{
+	for (const auto &i : mod.types) {
+		type(i);
+	}
+	uint32_t ptr = type("ptr");
+	for (const auto &i : mod.globals) {
+		type(i.type);
+		globals.emplace(i.name, n_globals++);
+	}
+	for (const auto &i : mod.funcs) {
+		std::vector<uint32_t> args;
+		for (auto j : i.args_ty) {
+			args.push_back(type(mod.types[j]));
+		}
+		protos.emplace_back(i.name,
+				    func_type(type(mod.types[i.ret_ty]), args));
+		globals.emplace(i.name, n_globals++);
+		std::vector<uint32_t> noalias;
+		for (size_t j = 0; j < i.args_noalias.size(); j++) {
+			if (i.args_noalias[j]) {
+				noalias.push_back(bc_attr_arg_beg + j);
+			}
+		}
+		uint32_t list = 0;
+		if (!noalias.empty()) {
+			auto it = std::find(attr_lists.begin(),
+					    attr_lists.end(), noalias);
+			list = it - attr_lists.begin() + 1;
+			if (it == attr_lists.end()) {
+				attr_lists.push_back(std::move(noalias));
+			}
+		}
+		func_attrs.push_back(list);
+	}
+	for (const auto &i : mod.decls) {
+		// a prototype of a function defined or declared already
+		if (globals.count(i.name)) {
+			continue;
+		}
+		std::vector<uint32_t> args;
+		for (auto j : i.args_ty) {
+			args.push_back(type(mod.types[j]));
+		}
+		protos.emplace_back(i.name,
+				    func_type(type(mod.types[i.ret_ty]), args));
+		globals.emplace(i.name, n_globals++);
+	}
+	uint32_t void_ty = type("void");
+	uint32_t i1 = type("i1"), i8 = type("i8"), i64 = type("i64");
+	auto intrinsic = [&](const char *name,
+			     const std::vector<uint32_t> &args) {
+		protos.emplace_back(name, func_type(void_ty, args));
+		globals.emplace(name, n_globals);
+		return n_globals++;
+	};
+	if (mod.use_memcpy) {
+		memcpy_id = intrinsic("@llvm.memcpy.p0.p0.i64",
+				      { ptr, ptr, i64, i1 });
+	}
+	if (mod.use_memset) {
+		memset_id = intrinsic("@llvm.memset.p0.i64",
+				      { ptr, i8, i64, i1 });
+	}
+	if (mod.use_lifetime) {
+		lifetime_start_id =
+			intrinsic("@llvm.lifetime.start.p0", { i64, ptr });
+		lifetime_end_id =
+			intrinsic("@llvm.lifetime.end.p0", { i64, ptr });
+	}
+
+	consts.base = n_globals;
+	for (const auto &i : mod.globals) {
+		// the init may be followed by ", align N"
+		global_inits.push_back(get_const(
+			consts, type(i.type), ir_split_items(i.init)[0]));
+	}
+	for (const auto &i : mod.funcs) {
+		funcs.emplace_back();
+		write_func(i, funcs.back(), true);
+	}
+
+	type_width = 1;
+	while (((size_t)1 << type_width) < type_codes.size()) {
+		type_width++;
+	}
+}
+
+/**
+ * @brief Write the attribute groups, one noalias for each argument index
+ * used, and the attribute lists made of them.
+ */
+void bc_writer_t::write_attrs()
+{
+	if (attr_lists.empty()) {
+		return;
+	}
+	std::map<uint32_t, uint32_t> groups;
+	for (const auto &i : attr_lists) {
+		for (auto j : i) {
+			groups.emplace(j, 0);
+		}
+	}
+	bs.enter_block(bc_paramattr_group_block, 3);
+	uint32_t id = 0;
+	for (auto &[idx, group] : groups) {
+		group = ++id;
+		// [grpid, paramidx, kind, attr]
+		bs.record(bc_paramattr_grp_entry,
+			  { group, idx, bc_attr_enum, bc_attr_noalias });
+	}
+	bs.end_block();
+	bs.enter_block(bc_paramattr_block, 3);
+	for (const auto &i : attr_lists) {
+		std::vector<uint64_t> vals;
+		for (auto j : i) {
+			vals.push_back(groups[j]);
+		}
+		bs.record(bc_paramattr_entry, vals);
+	}
+	bs.end_block();
+}
+
+void bc_writer_t::write_types()
+{
+	bs.enter_block(bc_type_block, 4);
+	bs.record(bc_type_numentry, { type_codes.size() });
+	for (const auto &i : type_recs) {
+		bs.record(i.first, i.second);
+	}
+	bs.end_block();
+}
+
+void bc_writer_t::write_consts(const bc_consts_t &tab)
+{
+	if (tab.list.empty()) {
+		return;
+	}
+	bs.enter_block(bc_constants_block, 4);
+	uint32_t ty = UINT32_MAX;
+	for (const auto &i : tab.list) {
+		if (i.ty != ty) {
+			ty = i.ty;
+			bs.record(bc_cst_settype, { ty },
+				  { bc_abbrev_cst_settype });
+		}
+		bs.record(i.code, i.vals,
+			  { bc_abbrev_cst_integer, bc_abbrev_cst_null });
+	}
+	bs.end_block();
+}
+
+void bc_writer_t::write_name(uint32_t code, uint32_t id, std::string_view name)
+{
+	std::vector<uint64_t> vals{ id };
+	vals.insert(vals.end(), name.begin(), name.end());
+	if (code == bc_vst_bbentry) {
+		bs.record(code, vals, { bc_abbrev_vst_bbentry_6 });
+	} else {
+		bs.record(code, vals,
+			  { bc_abbrev_vst_entry_6, bc_abbrev_vst_entry_8 });
+	}
+}
+
+/**
+ * @brief Write the block of a function. Dry, only find the types and
+ * constants it uses, so they are numbered before anything is written.
+ */
+void bc_writer_t::write_func(const ir_func_t &func, bc_func_t &bf, bool dry)
+{
+	uint32_t ptr = type("ptr");
+	uint32_t i1 = type("i1"), i8 = type("i8"), i32 = type("i32");
+	uint32_t i64 = type("i64"), void_ty = type("void");
+	if (dry) {
+		bf.ids.assign(func.vals.size(), 0);
+		bf.bbs.assign(func.blocks.size(), 0);
+		uint32_t next = consts.base + consts.list.size();
+		for (auto i : func.args) {
+			bf.ids[i] = next++;
+		}
+		bf.consts.base = next;
+		for (size_t i = 0; i < func.layout.size(); i++) {
+			bf.bbs[func.layout[i]] = i;
+		}
+	}
+
+	uint32_t inst_num = 0;
+	std::vector<uint64_t> vals;
+	auto bt = [&](int32_t ty) { return type(mod.types[ty]); };
+	auto abs = [&](int32_t v, uint32_t ty) -> uint32_t {
+		const ir_value_t &value = func.vals[v];
+		if (value.kind == ir_value_t::val_const ||
+		    value.kind == ir_value_t::val_global) {
+			return get_const(bf.consts, ty, func.strs[value.name]);
+		}
+		return bf.ids[v];
+	};
+	auto val = [&](int32_t v, uint32_t ty) {
+		vals.push_back((uint32_t)(inst_num - abs(v, ty)));
+	};
+	// a value defined later is followed by its type
+	auto val_ty = [&](int32_t v, uint32_t ty) {
+		uint32_t id = abs(v, ty);
+		vals.push_back((uint32_t)(inst_num - id));
+		if (id >= inst_num) {
+			vals.push_back(ty);
+		}
+	};
+	auto lit = [&](const char *repr, uint32_t ty) {
+		vals.push_back(
+			(uint32_t)(inst_num - get_const(bf.consts, ty, repr)));
+	};
+	auto call = [&](uint32_t callee, uint32_t fn_ty) {
+		vals.assign({ 0, bc_call_explicit_type, fn_ty,
+			      (uint32_t)(inst_num - callee) });
+	};
+
+	// named values, in the order they are defined
+	std::vector<int32_t> names;
+	if (!dry) {
+		for (auto i : func.args) {
+			if (func.vals[i].name >= 0) {
+				names.push_back(i);
+			}
+		}
+		bs.enter_block(bc_function_block, 4);
+		bs.record(bc_inst_declareblocks, { func.layout.size() });
+		write_consts(bf.consts);
+		inst_num = bf.consts.base + bf.consts.list.size();
+	}
+	for (auto b : func.layout) {
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			const ir_inst_t &inst = func.insts[i];
+			const int32_t *pool = func.pool.data() + inst.pool_beg;
+			uint32_t len = inst.pool_len;
+			uint32_t idx_ty;
+			uint32_t code = 0;
+			unsigned abbrev = 0;
+			vals.clear();
+			switch (inst.op) {
+			case ir_nop:
+				continue;
+			case ir_alloca:
+				code = bc_inst_alloca;
+				vals.assign({ bt(inst.ty), i32,
+					      get_const(bf.consts, i32, "1"),
+					      bc_alloca_explicit_type });
+				break;
+			case ir_load:
+				code = bc_inst_load;
+				abbrev = bc_abbrev_inst_load;
+				val_ty(inst.ops[0], ptr);
+				vals.push_back(bt(inst.ty));
+				vals.push_back(0);
+				vals.push_back(!!(inst.flags &
+						  ir_flag_volatile));
+				break;
+			case ir_store:
+				code = bc_inst_store;
+				val_ty(inst.ops[1], ptr);
+				val_ty(inst.ops[0], bt(inst.ty));
+				vals.push_back(0);
+				vals.push_back(!!(inst.flags &
+						  ir_flag_volatile));
+				break;
+			case ir_gep:
+				code = bc_inst_gep;
+				idx_ty = bt(inst.ty2);
+				vals.push_back(!!(inst.flags &
+						  ir_flag_inbounds));
+				vals.push_back(bt(inst.ty));
+				val_ty(inst.ops[0], ptr);
+				for (int j = 1; j < 3; j++) {
+					if (inst.ops[j] >= 0) {
+						val_ty(inst.ops[j], idx_ty);
+					}
+				}
+				break;
+			case ir_extractvalue:
+				code = bc_inst_extractval;
+				val_ty(inst.ops[0], bt(inst.ty));
+				vals.push_back(inst.ops[1]);
+				break;
+			case ir_memcpy:
+				code = bc_inst_call;
+				call(memcpy_id,
+				     func_type(void_ty, { ptr, ptr, i64, i1 }));
+				val(inst.ops[0], ptr);
+				val(inst.ops[1], ptr);
+				val(inst.ops[2], i64);
+				lit("false", i1);
+				break;
+			case ir_memzero:
+				code = bc_inst_call;
+				call(memset_id,
+				     func_type(void_ty, { ptr, i8, i64, i1 }));
+				val(inst.ops[0], ptr);
+				lit("0", i8);
+				val(inst.ops[1], i64);
+				lit("false", i1);
+				break;
+			case ir_lifetime_start:
+			case ir_lifetime_end:
+				code = bc_inst_call;
+				call(inst.op == ir_lifetime_start ?
+					     lifetime_start_id :
+					     lifetime_end_id,
+				     func_type(void_ty, { i64, ptr }));
+				val(inst.ops[1], i64);
+				val(inst.ops[0], ptr);
+				break;
+			case ir_call: {
+				code = bc_inst_call;
+				std::vector<uint32_t> args;
+				for (uint32_t j = 0; j < len; j += 2) {
+					args.push_back(bt(pool[j]));
+				}
+				uint32_t callee = abs(inst.ops[0], ptr);
+				call(callee, func_type(bt(inst.ty), args));
+				if (inst.flags & ir_flag_musttail) {
+					vals[1] |= bc_call_tail |
+						   bc_call_musttail;
+				} else if (inst.flags & ir_flag_tail) {
+					vals[1] |= bc_call_tail;
+				}
+				if (callee >= inst_num) {
+					vals.push_back(ptr);
+				}
+				for (uint32_t j = 0; j < len; j += 2) {
+					val(pool[j + 1], bt(pool[j]));
+				}
+				break;
+			}
+			case ir_phi:
+				code = bc_inst_phi;
+				vals.push_back(bt(inst.ty));
+				for (uint32_t j = 0; j < len; j += 2) {
+					// signed, the sign in the lowest bit
+					uint32_t id = abs(pool[j], bt(inst.ty));
+					int64_t diff = (int64_t)inst_num - id;
+					uint64_t mag = diff < 0 ? -diff : diff;
+					vals.push_back(mag << 1 | (diff < 0));
+					vals.push_back(bf.bbs[pool[j + 1]]);
+				}
+				break;
+			case ir_select:
+				code = bc_inst_vselect;
+				val_ty(inst.ops[1], bt(inst.ty));
+				val(inst.ops[2], bt(inst.ty));
+				val_ty(inst.ops[0], i1);
+				break;
+			case ir_br:
+				code = bc_inst_br;
+				vals.push_back(bf.bbs[inst.ops[0]]);
+				break;
+			case ir_cond_br:
+				code = bc_inst_br;
+				vals.push_back(bf.bbs[inst.ops[1]]);
+				vals.push_back(bf.bbs[inst.ops[2]]);
+				val(inst.ops[0], bt(inst.ty));
+				break;
+			case ir_switch:
+				code = bc_inst_switch;
+				vals.push_back(bt(inst.ty));
+				val(inst.ops[0], bt(inst.ty));
+				vals.push_back(bf.bbs[inst.ops[1]]);
+				for (uint32_t j = 0; j < len; j += 2) {
+					uint32_t id = abs(pool[j], bt(inst.ty));
+					vals.push_back(id);
+					vals.push_back(bf.bbs[pool[j + 1]]);
+				}
+				break;
+			case ir_ret:
+				code = bc_inst_ret;
+				abbrev = bc_abbrev_inst_ret_void;
+				if (inst.ops[0] >= 0) {
+					abbrev = bc_abbrev_inst_ret_val;
+					val_ty(inst.ops[0], bt(inst.ty));
+				}
+				break;
+			default:
+				val_ty(inst.ops[0], bt(inst.ty));
+				if (inst.op >= ir_trunc) {
+					code = bc_inst_cast;
+					abbrev = bc_abbrev_inst_cast;
+					vals.push_back(bt(inst.ty2));
+				} else if (inst.op >= ir_icmp_eq) {
+					code = bc_inst_cmp2;
+					val(inst.ops[1], bt(inst.ty));
+				} else {
+					code = bc_inst_binop;
+					abbrev = bc_abbrev_inst_binop;
+					val(inst.ops[1], bt(inst.ty));
+				}
+				vals.push_back(bc_opcode[inst.op]);
+				if (inst.flags & ir_flag_exact) {
+					vals.push_back(bc_binop_exact);
+				} else if (inst.flags & ir_flag_nsw) {
+					vals.push_back(bc_binop_nsw);
+				}
+				break;
+			}
+			if (dry) {
+				continue;
+			}
+			if (abbrev) {
+				bs.record(code, vals, { abbrev });
+			} else {
+				bs.record(code, vals);
+			}
+			if (inst.res >= 0) {
+				bf.ids[inst.res] = inst_num++;
+				if (func.vals[inst.res].name >= 0) {
+					names.push_back(inst.res);
+				}
+			}
+		}
+	}
+	if (dry) {
+		// the values the instructions define come after the constants
+		uint32_t next = bf.consts.base + bf.consts.list.size();
+		for (auto b : func.layout) {
+			for (uint32_t i = func.blocks[b].beg;
+			     i < func.blocks[b].end; i++) {
+				const ir_inst_t &inst = func.insts[i];
+				if (inst.op != ir_nop && inst.res >= 0) {
+					bf.ids[inst.res] = next++;
+				}
+			}
+		}
+		return;
+	}
+
+	// the entry block at least is named
+	bs.enter_block(bc_vst_block, 4);
+	for (auto i : names) {
+		// drop the '%'
+		std::string_view name = func.strs[func.vals[i].name];
+		write_name(bc_vst_entry, bf.ids[i], name.substr(1));
+	}
+	for (auto b : func.layout) {
+		if (func.blocks[b].name >= 0) {
+			write_name(bc_vst_bbentry, bf.bbs[b],
+				   func.strs[func.blocks[b].name]);
+		}
+	}
+	bs.end_block();
+	bs.end_block();
+}
+
+void bc_writer_t::write()
+{
+	using op = bc_abbrev_op_t;
+	const op fixed_ty{ op::op_fixed, type_width };
+	const op vbr6{ op::op_vbr, 6 };
+	bs.infos[bc_vst_block] = {
+		{ { op::op_literal, bc_vst_entry },
+		  { op::op_vbr, 8 },
+		  { op::op_array },
+		  { op::op_fixed, 8 } },
+		{ { op::op_literal, bc_vst_entry },
+		  { op::op_vbr, 8 },
+		  { op::op_array },
+		  { op::op_char6 } },
+		{ { op::op_literal, bc_vst_bbentry },
+		  { op::op_vbr, 8 },
+		  { op::op_array },
+		  { op::op_char6 } },
+	};
+	bs.infos[bc_constants_block] = {
+		{ { op::op_literal, bc_cst_settype }, fixed_ty },
+		{ { op::op_literal, bc_cst_integer }, { op::op_vbr, 8 } },
+		{ { op::op_literal, bc_cst_null } },
+	};
+	bs.infos[bc_function_block] = {
+		{ { op::op_literal, bc_inst_load },
+		  vbr6,
+		  fixed_ty,
+		  { op::op_vbr, 4 },
+		  { op::op_fixed, 1 } },
+		{ { op::op_literal, bc_inst_binop },
+		  vbr6,
+		  vbr6,
+		  { op::op_fixed, 4 } },
+		{ { op::op_literal, bc_inst_cast },
+		  vbr6,
+		  fixed_ty,
+		  { op::op_fixed, 4 } },
+		{ { op::op_literal, bc_inst_ret } },
+		{ { op::op_literal, bc_inst_ret }, vbr6 },
+	};
+
+	// 'BC' 0xC0DE
+	bs.emit('B', 8);
+	bs.emit('C', 8);
+	bs.emit(0x0, 4);
+	bs.emit(0xC, 4);
+	bs.emit(0xE, 4);
+	bs.emit(0xD, 4);
+
+	bs.enter_block(bc_identification_block, 5);
+	bs.record(bc_ident_string, { 'n', 'e', 'k', 'o', '_', 'c', 'c' });
+	bs.record(bc_ident_epoch, { 0 });
+	bs.end_block();
+
+	bs.enter_block(bc_module_block, 3);
+	bs.record(bc_module_version, { 1 });
+
+	bs.enter_block(bc_blockinfo_block, 2);
+	for (const auto &i : bs.infos) {
+		bs.record(bc_blockinfo_setbid, { i.first });
+		for (const auto &j : i.second) {
+			bs.define_abbrev(j);
+		}
+	}
+	bs.end_block();
+
+	write_attrs();
+	write_types();
+
+	for (size_t i = 0; i < mod.globals.size(); i++) {
+		const ir_global_t &global = mod.globals[i];
+		// [type, isconst | explicit type, init + 1, linkage, align,
+		//  section, visibility, threadlocal, unnamed_addr]
+		uint64_t linkage = 0;
+		if (global.attr.find("private") != std::string::npos) {
+			linkage = 9;
+		} else if (global.attr.find("internal") != std::string::npos) {
+			linkage = 3;
+		}
+		uint64_t align = 0;
+		auto items = ir_split_items(global.init);
+		if (items.size() > 1) {
+			uint64_t bytes = std::strtoull(
+				std::string(items[1].substr(6)).c_str(),
+				nullptr, 10);
+			while (((uint64_t)1 << align) < bytes) {
+				align++;
+			}
+			align++;
+		}
+		bool is_const = global.attr.find("constant") !=
+				std::string::npos;
+		bool unnamed = global.attr.find("unnamed_addr") !=
+			       std::string::npos;
+		bs.record(bc_module_globalvar,
+			  { type(global.type), (uint64_t)is_const | 2,
+			    global_inits[i] + 1, linkage, align, 0, 0, 0,
+			    unnamed });
+	}
+	for (size_t i = 0; i < protos.size(); i++) {
+		// [type, callingconv, isproto, linkage, paramattr, alignment,
+		//  section, visibility, gc]
+		bool is_proto = i >= mod.funcs.size();
+		uint64_t linkage = !is_proto && mod.funcs[i].is_internal ? 3 :
+									  0;
+		bs.record(bc_module_function,
+			  { protos[i].second, 0, is_proto, linkage,
+			    is_proto ? 0 : func_attrs[i], 0, 0, 0, 0 });
+	}
+	write_consts(consts);
+
+	bs.enter_block(bc_vst_block, 4);
+	for (size_t i = 0; i < mod.globals.size(); i++) {
+		write_name(bc_vst_entry, i,
+			   std::string_view(mod.globals[i].name).substr(1));
+	}
+	for (size_t i = 0; i < protos.size(); i++) {
+		write_name(bc_vst_entry, mod.globals.size() + i,
+			   std::string_view(protos[i].first).substr(1));
+	}
+	bs.end_block();
+
+	for (size_t i = 0; i < mod.funcs.size(); i++) {
+		write_func(mod.funcs[i], funcs[i], false);
+	}
+	bs.end_block();
+}
+
+void ir_output_func(writer_t &, ir_module_t &mod, ir_func_t &func)
+{
+	mod.funcs.push_back(std::move(func));
+}
+
+void ir_output_module(writer_t &out, ir_module_t &mod)
+{
+	bc_writer_t writer(mod);
+	writer.enumerate();
+	writer.write();
+	out.append(writer.bs.buf);
+}
+
+}
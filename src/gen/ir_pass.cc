@@ -0,0 +1,1033 @@
+/**
+ * @file ir_pass.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Passes run over the IR of a function before it is written.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "gen/ir.hh"
+
+#include <algorithm>
+
+namespace neko_cc
+{
+
+/**
+ * @brief State of the SSA construction, after "Simple and Efficient
+ * Construction of Static Single Assignment Form" by Braun et al.
+ *
+ * Every promoted local is a slot. The current value of a slot is looked
+ * up through the blocks backwards, placing phis where paths join. A block
+ * is sealed once all of its predecessors are filled, phis made in it
+ * before that get their operands when it is sealed.
+ */
+struct ssa_builder_t {
+	struct phi_t {
+		int32_t block;
+		int32_t slot;
+		int32_t res;
+		bool dead = false;
+		std::vector<int32_t> ops;
+		// other phis having this one as an operand
+		std::vector<int32_t> users;
+	};
+
+	ir_func_t &func;
+	std::vector<std::vector<int32_t> > preds;
+	// slot of each value, -1 if the value is not a promoted local
+	std::vector<int32_t> slot_of;
+	std::vector<int32_t> slot_ty;
+	// value each value is replaced by, itself if not replaced
+	std::vector<int32_t> repl;
+	std::unordered_map<uint64_t, int32_t> cur_def;
+	std::vector<phi_t> phis;
+	std::unordered_map<int32_t, int32_t> phi_of;
+	std::vector<std::vector<int32_t> > incomplete;
+	std::vector<bool> sealed;
+	std::vector<bool> filled;
+	int32_t undef = -1;
+
+	explicit ssa_builder_t(ir_func_t &_func)
+		: func(_func)
+	{
+	}
+
+	bool find_slots();
+	void run();
+	void materialize();
+
+	int32_t find(int32_t v)
+	{
+		while (repl[v] != v) {
+			repl[v] = repl[repl[v]];
+			v = repl[v];
+		}
+		return v;
+	}
+	static uint64_t key(int32_t slot, int32_t block)
+	{
+		return (uint64_t)(uint32_t)slot << 32 | (uint32_t)block;
+	}
+	void write(int32_t slot, int32_t block, int32_t val)
+	{
+		cur_def[key(slot, block)] = val;
+	}
+	int32_t read(int32_t slot, int32_t block)
+	{
+		auto it = cur_def.find(key(slot, block));
+		if (it != cur_def.end()) {
+			return find(it->second);
+		}
+		return read_recursive(slot, block);
+	}
+	int32_t read_recursive(int32_t slot, int32_t block);
+	int32_t new_phi(int32_t slot, int32_t block);
+	int32_t add_phi_operands(int32_t phi);
+	int32_t try_remove_trivial_phi(int32_t phi);
+	void seal(int32_t block);
+};
+
+/**
+ * @brief Find the locals that can be promoted: allocas only loaded from
+ * and stored to as a whole, whose address is never taken otherwise.
+ * Returns false if there is none.
+ */
+bool ssa_builder_t::find_slots()
+{
+	std::vector<bool> escaped(func.vals.size(), false);
+	for (auto &inst : func.insts) {
+		ir_for_each_use(func, inst, [&](int32_t &v) {
+			const ir_value_t &val = func.vals[v];
+			if (val.kind != ir_value_t::val_inst ||
+			    func.insts[val.def].op != ir_alloca) {
+				return;
+			}
+			const ir_inst_t &def = func.insts[val.def];
+			if (inst.op == ir_lifetime_start ||
+			    inst.op == ir_lifetime_end) {
+				return;
+			}
+			bool is_addr =
+				(inst.op == ir_load && &v == &inst.ops[0]) ||
+				(inst.op == ir_store && &v == &inst.ops[1]);
+			if (!is_addr || inst.ty != def.ty) {
+				escaped[v] = true;
+			}
+		});
+	}
+
+	bool found = false;
+	slot_of.assign(func.vals.size(), -1);
+	for (auto &inst : func.insts) {
+		if (inst.op == ir_alloca && !(inst.flags & ir_flag_volatile) &&
+		    !escaped[inst.res]) {
+			slot_of[inst.res] = slot_ty.size();
+			slot_ty.push_back(inst.ty);
+			found = true;
+		}
+	}
+	return found;
+}
+
+int32_t ssa_builder_t::new_phi(int32_t slot, int32_t block)
+{
+	phi_t phi;
+	phi.block = block;
+	phi.slot = slot;
+	phi.res = func.new_val(ir_value_t::val_inst);
+	repl.push_back(phi.res);
+	phis.push_back(std::move(phi));
+	phi_of.emplace(phis.back().res, phis.size() - 1);
+	return phis.size() - 1;
+}
+
+int32_t ssa_builder_t::read_recursive(int32_t slot, int32_t block)
+{
+	int32_t val;
+	if (!sealed[block]) {
+		int32_t phi = new_phi(slot, block);
+		incomplete[block].push_back(phi);
+		val = phis[phi].res;
+	} else if (preds[block].size() == 1) {
+		val = read(slot, preds[block][0]);
+	} else if (preds[block].empty()) {
+		// read before any write
+		val = undef;
+	} else {
+		// break cycles through loops with an operandless phi first
+		int32_t phi = new_phi(slot, block);
+		write(slot, block, phis[phi].res);
+		val = add_phi_operands(phi);
+	}
+	write(slot, block, val);
+	return val;
+}
+
+int32_t ssa_builder_t::add_phi_operands(int32_t phi)
+{
+	int32_t block = phis[phi].block;
+	for (auto pred : preds[block]) {
+		int32_t val = read(phis[phi].slot, pred);
+		phis[phi].ops.push_back(val);
+		auto it = phi_of.find(val);
+		if (it != phi_of.end()) {
+			phis[it->second].users.push_back(phi);
+		}
+	}
+	return try_remove_trivial_phi(phi);
+}
+
+/**
+ * @brief Replace a phi merging only one value, other than itself, with
+ * that value. Phis using it may become trivial in turn.
+ */
+int32_t ssa_builder_t::try_remove_trivial_phi(int32_t phi)
+{
+	int32_t res = phis[phi].res;
+	int32_t same = -1;
+	for (auto op : phis[phi].ops) {
+		op = find(op);
+		if (op == same || op == res) {
+			continue;
+		}
+		if (same >= 0) {
+			return res;
+		}
+		same = op;
+	}
+	if (same < 0) {
+		// unreachable, or only reached before any write
+		same = undef;
+	}
+	phis[phi].dead = true;
+	repl[res] = same;
+
+	auto users = std::move(phis[phi].users);
+	auto it = phi_of.find(same);
+	if (it != phi_of.end()) {
+		auto &same_users = phis[it->second].users;
+		same_users.insert(same_users.end(), users.begin(), users.end());
+	}
+	for (auto user : users) {
+		if (user != phi && !phis[user].dead) {
+			try_remove_trivial_phi(user);
+		}
+	}
+	return find(same);
+}
+
+void ssa_builder_t::seal(int32_t block)
+{
+	sealed[block] = true;
+	auto pending = std::move(incomplete[block]);
+	for (auto phi : pending) {
+		add_phi_operands(phi);
+	}
+}
+
+void ssa_builder_t::run()
+{
+	preds = ir_get_preds(func);
+	repl.resize(func.vals.size());
+	for (size_t i = 0; i < repl.size(); i++) {
+		repl[i] = i;
+	}
+	undef = func.get_named("undef");
+	if ((size_t)undef >= repl.size()) {
+		repl.push_back(undef);
+	}
+	incomplete.resize(func.blocks.size());
+	sealed.assign(func.blocks.size(), false);
+	filled.assign(func.blocks.size(), false);
+
+	auto all_preds_filled = [&](int32_t block) {
+		for (auto pred : preds[block]) {
+			if (!filled[pred]) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	std::vector<int32_t> succs;
+	for (auto b : func.layout) {
+		if (!sealed[b] && all_preds_filled(b)) {
+			seal(b);
+		}
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			ir_inst_t &inst = func.insts[i];
+			if (inst.op == ir_alloca && slot_of[inst.res] >= 0) {
+				inst.op = ir_nop;
+			} else if ((inst.op == ir_lifetime_start ||
+				    inst.op == ir_lifetime_end) &&
+				   slot_of[inst.ops[0]] >= 0) {
+				inst.op = ir_nop;
+			} else if (inst.op == ir_store &&
+				   slot_of[inst.ops[1]] >= 0) {
+				write(slot_of[inst.ops[1]], b,
+				      find(inst.ops[0]));
+				inst.op = ir_nop;
+			} else if (inst.op == ir_load &&
+				   slot_of[inst.ops[0]] >= 0) {
+				repl[inst.res] = read(slot_of[inst.ops[0]], b);
+				inst.op = ir_nop;
+			}
+		}
+		filled[b] = true;
+		ir_get_succs(func, b, succs);
+		for (auto s : succs) {
+			if (!sealed[s] && all_preds_filled(s)) {
+				seal(s);
+			}
+		}
+	}
+	for (auto b : func.layout) {
+		if (!sealed[b]) {
+			seal(b);
+		}
+	}
+}
+
+/**
+ * @brief Lay the instructions out again with the live phis at the head of
+ * their blocks and the dropped ones left out, then point every use at the
+ * value it was replaced by.
+ */
+void ssa_builder_t::materialize()
+{
+	std::vector<std::vector<int32_t> > block_phis(func.blocks.size());
+	for (size_t i = 0; i < phis.size(); i++) {
+		if (!phis[i].dead) {
+			block_phis[phis[i].block].push_back(i);
+		}
+	}
+
+	std::vector<ir_inst_t> insts;
+	insts.reserve(func.insts.size());
+	std::vector<ir_block_t> old_blocks = func.blocks;
+	for (auto &block : func.blocks) {
+		block.beg = block.end = 0;
+	}
+	for (auto b : func.layout) {
+		uint32_t beg = insts.size();
+		for (auto i : block_phis[b]) {
+			const phi_t &phi = phis[i];
+			ir_inst_t inst;
+			inst.op = ir_phi;
+			inst.res = phi.res;
+			inst.ty = slot_ty[phi.slot];
+			inst.pool_beg = func.pool.size();
+			inst.pool_len = phi.ops.size() * 2;
+			for (size_t k = 0; k < phi.ops.size(); k++) {
+				func.pool.push_back(phi.ops[k]);
+				func.pool.push_back(preds[b][k]);
+			}
+			insts.push_back(inst);
+		}
+		for (uint32_t i = old_blocks[b].beg; i < old_blocks[b].end;
+		     i++) {
+			if (func.insts[i].op != ir_nop) {
+				insts.push_back(func.insts[i]);
+			}
+		}
+		func.blocks[b].beg = beg;
+		func.blocks[b].end = insts.size();
+	}
+	func.insts = std::move(insts);
+
+	for (size_t i = 0; i < func.insts.size(); i++) {
+		ir_inst_t &inst = func.insts[i];
+		if (inst.res >= 0) {
+			func.vals[inst.res].def = i;
+		}
+		ir_for_each_use(func, inst, [&](int32_t &v) { v = find(v); });
+	}
+}
+
+/**
+ * @brief Call fn on a reference to each block the terminator jumps to.
+ */
+template <typename F>
+static void for_each_target(ir_func_t &func, ir_inst_t &inst, F fn)
+{
+	switch (inst.op) {
+	case ir_br:
+		fn(inst.ops[0]);
+		break;
+	case ir_cond_br:
+		fn(inst.ops[1]);
+		fn(inst.ops[2]);
+		break;
+	case ir_switch:
+		fn(inst.ops[1]);
+		for (uint32_t i = 1; i < inst.pool_len; i += 2) {
+			fn(func.pool[inst.pool_beg + i]);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Point every branch to a block holding only a branch to where
+ * that one goes. Blocks starting with a phi are not jumped to that way,
+ * their phis tell the predecessors apart.
+ */
+static void forward_empty_blocks(ir_func_t &func)
+{
+	int32_t entry = func.layout[0];
+	std::vector<int32_t> fwd(func.blocks.size());
+	for (size_t i = 0; i < fwd.size(); i++) {
+		fwd[i] = i;
+	}
+	for (auto b : func.layout) {
+		const ir_block_t &block = func.blocks[b];
+		if (b == entry || block.end - block.beg != 1 ||
+		    func.insts[block.beg].op != ir_br) {
+			continue;
+		}
+		int32_t to = func.insts[block.beg].ops[0];
+		const ir_block_t &to_block = func.blocks[to];
+		if (to_block.beg < to_block.end &&
+		    func.insts[to_block.beg].op == ir_phi) {
+			continue;
+		}
+		fwd[b] = to;
+	}
+	for (auto b : func.layout) {
+		int32_t to = b;
+		for (size_t i = 0; fwd[to] != to && i < fwd.size(); i++) {
+			to = fwd[to];
+		}
+		if (fwd[to] != to) {
+			// an empty endless loop, one of its blocks has to stay
+			fwd[to] = to;
+		}
+	}
+	for (auto b : func.layout) {
+		ir_inst_t &term = func.insts[func.blocks[b].end - 1];
+		for_each_target(func, term, [&](int32_t &t) {
+			while (fwd[t] != t) {
+				t = fwd[t];
+			}
+		});
+	}
+}
+
+/**
+ * @brief Drop the blocks not reachable from the entry from the layout,
+ * and their incomings from the phis left.
+ */
+static void remove_unreachable(ir_func_t &func)
+{
+	std::vector<bool> reached(func.blocks.size(), false);
+	std::vector<int32_t> stack{ func.layout[0] };
+	std::vector<int32_t> succs;
+	reached[func.layout[0]] = true;
+	while (!stack.empty()) {
+		int32_t b = stack.back();
+		stack.pop_back();
+		ir_get_succs(func, b, succs);
+		for (auto s : succs) {
+			if (!reached[s]) {
+				reached[s] = true;
+				stack.push_back(s);
+			}
+		}
+	}
+
+	std::vector<int32_t> layout;
+	for (auto b : func.layout) {
+		if (!reached[b]) {
+			continue;
+		}
+		layout.push_back(b);
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			ir_inst_t &inst = func.insts[i];
+			if (inst.op != ir_phi) {
+				continue;
+			}
+			int32_t *pool = func.pool.data() + inst.pool_beg;
+			uint32_t len = 0;
+			for (uint32_t k = 0; k < inst.pool_len; k += 2) {
+				if (reached[pool[k + 1]]) {
+					pool[len++] = pool[k];
+					pool[len++] = pool[k + 1];
+				}
+			}
+			inst.pool_len = len;
+		}
+	}
+	func.layout = std::move(layout);
+}
+
+void ir_simplify_cfg(ir_func_t &func)
+{
+	if (func.layout.empty()) {
+		return;
+	}
+	forward_empty_blocks(func);
+	remove_unreachable(func);
+
+	// a block falling through to one with no other predecessor takes it
+	int32_t entry = func.layout[0];
+	auto preds = ir_get_preds(func);
+	std::vector<int32_t> next(func.blocks.size(), -1);
+	std::vector<bool> absorbed(func.blocks.size(), false);
+	for (auto b : func.layout) {
+		const ir_inst_t &term = func.insts[func.blocks[b].end - 1];
+		if (term.op != ir_br) {
+			continue;
+		}
+		int32_t to = term.ops[0];
+		if (to != entry && to != b && preds[to].size() == 1) {
+			next[b] = to;
+			absorbed[to] = true;
+		}
+	}
+
+	// the phis of a block taken in have a single incoming
+	std::vector<int32_t> repl(func.vals.size(), -1);
+	std::vector<int32_t> head(func.blocks.size(), -1);
+	std::vector<ir_inst_t> insts;
+	insts.reserve(func.insts.size());
+	std::vector<int32_t> layout;
+	for (auto b : func.layout) {
+		if (absorbed[b]) {
+			continue;
+		}
+		layout.push_back(b);
+		uint32_t beg = insts.size();
+		for (int32_t cur = b; cur >= 0; cur = next[cur]) {
+			head[cur] = b;
+			const ir_block_t &block = func.blocks[cur];
+			// the branch into the next one goes
+			uint32_t end = block.end - (next[cur] >= 0);
+			for (uint32_t i = block.beg; i < end; i++) {
+				const ir_inst_t &inst = func.insts[i];
+				if (inst.op == ir_phi && absorbed[cur]) {
+					int32_t val = func.pool[inst.pool_beg];
+					repl[inst.res] = val;
+				} else if (inst.op != ir_nop) {
+					insts.push_back(inst);
+				}
+			}
+		}
+		func.blocks[b].beg = beg;
+		func.blocks[b].end = insts.size();
+	}
+	func.insts = std::move(insts);
+	func.layout = std::move(layout);
+
+	for (size_t i = 0; i < func.insts.size(); i++) {
+		ir_inst_t &inst = func.insts[i];
+		if (inst.res >= 0) {
+			func.vals[inst.res].def = i;
+		}
+		ir_for_each_use(func, inst, [&](int32_t &v) {
+			while (repl[v] >= 0) {
+				v = repl[v];
+			}
+		});
+		if (inst.op == ir_phi) {
+			for (uint32_t k = 1; k < inst.pool_len; k += 2) {
+				int32_t &block = func.pool[inst.pool_beg + k];
+				block = head[block];
+			}
+		}
+	}
+}
+
+void ir_hoist_allocas(ir_func_t &func)
+{
+	if (func.layout.empty()) {
+		return;
+	}
+	std::vector<ir_inst_t> insts;
+	insts.reserve(func.insts.size());
+	for (auto b : func.layout) {
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			if (func.insts[i].op == ir_alloca) {
+				insts.push_back(func.insts[i]);
+			}
+		}
+	}
+
+	std::vector<ir_block_t> old_blocks = func.blocks;
+	for (auto b : func.layout) {
+		uint32_t beg = b == func.layout[0] ? 0 : insts.size();
+		for (uint32_t i = old_blocks[b].beg; i < old_blocks[b].end;
+		     i++) {
+			ir_op_t op = func.insts[i].op;
+			if (op != ir_alloca && op != ir_nop) {
+				insts.push_back(func.insts[i]);
+			}
+		}
+		func.blocks[b].beg = beg;
+		func.blocks[b].end = insts.size();
+	}
+	func.insts = std::move(insts);
+
+	for (size_t i = 0; i < func.insts.size(); i++) {
+		if (func.insts[i].res >= 0) {
+			func.vals[func.insts[i].res].def = i;
+		}
+	}
+}
+
+/**
+ * @brief Drop the nops left by a pass and number the definitions again.
+ */
+static void drop_nops(ir_func_t &func)
+{
+	std::vector<ir_inst_t> insts;
+	insts.reserve(func.insts.size());
+	for (auto b : func.layout) {
+		uint32_t beg = insts.size();
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			if (func.insts[i].op != ir_nop) {
+				insts.push_back(func.insts[i]);
+			}
+		}
+		func.blocks[b].beg = beg;
+		func.blocks[b].end = insts.size();
+	}
+	func.insts = std::move(insts);
+	for (size_t i = 0; i < func.insts.size(); i++) {
+		if (func.insts[i].res >= 0) {
+			func.vals[func.insts[i].res].def = i;
+		}
+	}
+}
+
+/**
+ * @brief What is known of the memory of a function: the object each
+ * address points into, and which locals never have their address given
+ * away, so that no pointer of unknown origin or callee can reach them.
+ */
+struct mem_info_t {
+	ir_func_t &func;
+	// alloca or global an address is derived from, -1 if unknown
+	std::vector<int32_t> root;
+	std::vector<bool> escaped;
+
+	explicit mem_info_t(ir_func_t &_func);
+
+	int32_t get_root(int32_t v);
+	bool is_private(int32_t root) const
+	{
+		return root >= 0 &&
+		       func.vals[root].kind == ir_value_t::val_inst &&
+		       !escaped[root];
+	}
+	bool may_alias(int32_t a, int32_t b);
+};
+
+mem_info_t::mem_info_t(ir_func_t &_func)
+	: func(_func)
+	, root(_func.vals.size(), -2)
+	, escaped(_func.vals.size(), false)
+{
+	for (auto &inst : func.insts) {
+		ir_for_each_use(func, inst, [&](int32_t &v) {
+			int32_t r = get_root(v);
+			if (r < 0 ||
+			    func.vals[r].kind != ir_value_t::val_inst) {
+				return;
+			}
+			bool is_addr = false;
+			switch (inst.op) {
+			case ir_load:
+			case ir_gep:
+			case ir_memzero:
+			case ir_lifetime_start:
+			case ir_lifetime_end:
+				is_addr = &v == &inst.ops[0];
+				break;
+			case ir_store:
+				is_addr = &v == &inst.ops[1];
+				break;
+			case ir_memcpy:
+				is_addr = &v != &inst.ops[2];
+				break;
+			default:
+				break;
+			}
+			if (!is_addr) {
+				escaped[r] = true;
+			}
+		});
+	}
+}
+
+int32_t mem_info_t::get_root(int32_t v)
+{
+	if (root[v] != -2) {
+		return root[v];
+	}
+	const ir_value_t &val = func.vals[v];
+	root[v] = -1;
+	if (val.kind == ir_value_t::val_global) {
+		root[v] = v;
+	} else if (val.kind == ir_value_t::val_inst && val.def >= 0) {
+		const ir_inst_t &def = func.insts[val.def];
+		if (def.op == ir_alloca) {
+			root[v] = v;
+		} else if (def.op == ir_gep) {
+			root[v] = get_root(def.ops[0]);
+		}
+	}
+	return root[v];
+}
+
+bool mem_info_t::may_alias(int32_t a, int32_t b)
+{
+	if (a == b) {
+		return true;
+	}
+	int32_t ra = get_root(a), rb = get_root(b);
+	if (ra >= 0 && rb >= 0) {
+		if (ra != rb) {
+			return false;
+		}
+		// items of the same object picked by different constants
+		const ir_value_t &va = func.vals[a], &vb = func.vals[b];
+		if (va.kind != ir_value_t::val_inst || va.def < 0 ||
+		    vb.kind != ir_value_t::val_inst || vb.def < 0) {
+			return true;
+		}
+		const ir_inst_t &ga = func.insts[va.def];
+		const ir_inst_t &gb = func.insts[vb.def];
+		if (ga.op != ir_gep || gb.op != ir_gep ||
+		    ga.ops[0] != gb.ops[0] || ga.ty != gb.ty ||
+		    ga.ty2 != gb.ty2) {
+			return true;
+		}
+		for (int i = 1; i < 3; i++) {
+			int32_t ia = ga.ops[i], ib = gb.ops[i];
+			if (ia >= 0 && ib >= 0 && ia != ib &&
+			    func.vals[ia].kind == ir_value_t::val_const &&
+			    func.vals[ib].kind == ir_value_t::val_const) {
+				return false;
+			}
+		}
+		return true;
+	}
+	// a pointer of unknown origin cannot reach a private local
+	return !is_private(ra) && !is_private(rb);
+}
+
+void ir_forward_stores(ir_func_t &func)
+{
+	struct known_t {
+		int32_t addr;
+		int32_t val;
+		int32_t ty;
+	};
+	mem_info_t mem(func);
+	std::vector<int32_t> repl(func.vals.size(), -1);
+	auto find = [&](int32_t v) {
+		while (repl[v] >= 0) {
+			v = repl[v];
+		}
+		return v;
+	};
+	std::vector<known_t> known;
+	bool changed = false;
+	auto clobber = [&](int32_t addr) {
+		size_t len = 0;
+		for (auto &i : known) {
+			if (!mem.may_alias(i.addr, addr)) {
+				known[len++] = i;
+			}
+		}
+		known.resize(len);
+	};
+
+	for (auto b : func.layout) {
+		known.clear();
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			ir_inst_t &inst = func.insts[i];
+			switch (inst.op) {
+			case ir_load: {
+				int32_t addr = find(inst.ops[0]);
+				if (inst.flags & ir_flag_volatile) {
+					break;
+				}
+				auto it = known.begin();
+				for (; it != known.end(); it++) {
+					if (it->addr == addr &&
+					    it->ty == inst.ty) {
+						break;
+					}
+				}
+				if (it != known.end()) {
+					repl[inst.res] = it->val;
+					inst.op = ir_nop;
+					changed = true;
+				} else {
+					known.push_back(
+						{ addr, inst.res, inst.ty });
+				}
+				break;
+			}
+			case ir_store: {
+				int32_t addr = find(inst.ops[1]);
+				clobber(addr);
+				if (!(inst.flags & ir_flag_volatile)) {
+					int32_t val = find(inst.ops[0]);
+					known.push_back({ addr, val, inst.ty });
+				}
+				break;
+			}
+			case ir_memcpy:
+			case ir_memzero:
+			case ir_lifetime_start:
+			case ir_lifetime_end:
+				clobber(find(inst.ops[0]));
+				break;
+			case ir_call: {
+				// the callee may write all but private locals
+				size_t len = 0;
+				for (auto &k : known) {
+					int32_t root = mem.get_root(k.addr);
+					if (mem.is_private(root)) {
+						known[len++] = k;
+					}
+				}
+				known.resize(len);
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
+	if (!changed) {
+		return;
+	}
+
+	for (auto &inst : func.insts) {
+		ir_for_each_use(func, inst, [&](int32_t &v) { v = find(v); });
+	}
+	drop_nops(func);
+}
+
+/**
+ * @brief What an instruction computes, equal keys give equal values.
+ */
+struct value_key_t {
+	ir_op_t op;
+	uint16_t flags;
+	int32_t ty;
+	int32_t ty2;
+	int32_t ops[3];
+	// stores seen in the block before a load
+	uint32_t mem_gen;
+
+	bool operator==(const value_key_t &rhs) const
+	{
+		return op == rhs.op && flags == rhs.flags && ty == rhs.ty &&
+		       ty2 == rhs.ty2 && ops[0] == rhs.ops[0] &&
+		       ops[1] == rhs.ops[1] && ops[2] == rhs.ops[2] &&
+		       mem_gen == rhs.mem_gen;
+	}
+};
+
+struct value_key_hash_t {
+	size_t operator()(const value_key_t &key) const
+	{
+		size_t h = key.op;
+		for (int32_t i : { (int32_t)key.flags, key.ty, key.ty2,
+				   key.ops[0], key.ops[1], key.ops[2],
+				   (int32_t)key.mem_gen }) {
+			h = h * 0x9e3779b97f4a7c15ull + (uint32_t)i;
+		}
+		return h ^ h >> 32;
+	}
+};
+
+static bool is_commutative(ir_op_t op)
+{
+	switch (op) {
+	case ir_add:
+	case ir_mul:
+	case ir_and:
+	case ir_or:
+	case ir_xor:
+	case ir_fadd:
+	case ir_fmul:
+	case ir_icmp_eq:
+	case ir_icmp_ne:
+	case ir_fcmp_oeq:
+	case ir_fcmp_one:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void ir_number_values(ir_func_t &func)
+{
+	std::vector<int32_t> repl(func.vals.size(), -1);
+	auto find = [&](int32_t v) {
+		while (repl[v] >= 0) {
+			v = repl[v];
+		}
+		return v;
+	};
+	std::unordered_map<value_key_t, int32_t, value_key_hash_t> table;
+	bool changed = false;
+
+	for (auto b : func.layout) {
+		table.clear();
+		uint32_t mem_gen = 0;
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			ir_inst_t &inst = func.insts[i];
+			ir_for_each_use(func, inst,
+					[&](int32_t &v) { v = find(v); });
+			switch (inst.op) {
+			case ir_store:
+			case ir_memcpy:
+			case ir_memzero:
+			case ir_lifetime_start:
+			case ir_lifetime_end:
+			case ir_call:
+				mem_gen++;
+				continue;
+			case ir_load:
+				if (inst.flags & ir_flag_volatile) {
+					continue;
+				}
+				break;
+			case ir_nop:
+			case ir_alloca:
+			case ir_phi:
+				continue;
+			default:
+				if (is_ir_terminator(inst.op)) {
+					continue;
+				}
+				break;
+			}
+
+			value_key_t key;
+			key.op = inst.op;
+			key.flags = inst.flags;
+			key.ty = inst.ty;
+			key.ty2 = inst.ty2;
+			std::copy(inst.ops, inst.ops + 3, key.ops);
+			key.mem_gen = inst.op == ir_load ? mem_gen : 0;
+			if (is_commutative(inst.op) &&
+			    key.ops[0] > key.ops[1]) {
+				std::swap(key.ops[0], key.ops[1]);
+			}
+			auto it = table.emplace(key, inst.res);
+			if (!it.second) {
+				repl[inst.res] = it.first->second;
+				inst.op = ir_nop;
+				changed = true;
+			}
+		}
+	}
+	if (!changed) {
+		return;
+	}
+
+	// phis, and blocks of a loop laid out before its body, use values of
+	// blocks later in the layout
+	for (auto &inst : func.insts) {
+		ir_for_each_use(func, inst, [&](int32_t &v) { v = find(v); });
+	}
+	drop_nops(func);
+}
+
+void ir_promote_locals(ir_func_t &func)
+{
+	ssa_builder_t builder(func);
+	if (!builder.find_slots()) {
+		return;
+	}
+	builder.run();
+	builder.materialize();
+}
+
+/**
+ * @brief Tell if a call passes and returns the types the function takes
+ * and returns.
+ */
+static bool is_caller_proto(const ir_func_t &func, const ir_inst_t &call)
+{
+	if (call.ty != func.ret_ty ||
+	    call.pool_len / 2 != func.args_ty.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < func.args_ty.size(); i++) {
+		if (func.pool[call.pool_beg + i * 2] != func.args_ty[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void ir_mark_tail_calls(ir_func_t &func)
+{
+	bool wanted = false;
+	for (const auto &inst : func.insts) {
+		if (inst.op == ir_call && (inst.flags & ir_flag_want_tail)) {
+			wanted = true;
+		}
+	}
+	if (!wanted) {
+		return;
+	}
+	// the callee takes over the frame, it must not find a local in it
+	mem_info_t mem(func);
+	for (const auto &inst : func.insts) {
+		if (inst.op == ir_alloca && mem.escaped[inst.res]) {
+			return;
+		}
+	}
+
+	for (auto b : func.layout) {
+		const ir_block_t &block = func.blocks[b];
+		for (uint32_t i = block.beg; i < block.end; i++) {
+			ir_inst_t &call = func.insts[i];
+			if (call.op != ir_call ||
+			    !(call.flags & ir_flag_want_tail)) {
+				continue;
+			}
+			call.flags |= ir_flag_tail;
+			uint32_t ret = i + 1;
+			while (ret < block.end &&
+			       func.insts[ret].op == ir_lifetime_end) {
+				ret++;
+			}
+			if (ret == block.end || func.insts[ret].op != ir_ret ||
+			    func.insts[ret].ops[0] != call.res ||
+			    !is_caller_proto(func, call)) {
+				continue;
+			}
+			// the locals are dead once the callee runs
+			std::rotate(func.insts.begin() + i,
+				    func.insts.begin() + i + 1,
+				    func.insts.begin() + ret);
+			i = ret - 1;
+			func.insts[i].flags |= ir_flag_musttail;
+			if (func.insts[i].res >= 0) {
+				func.vals[func.insts[i].res].def = i;
+			}
+		}
+	}
+}
+
+}
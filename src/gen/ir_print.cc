@@ -0,0 +1,337 @@
+/**
+ * @file ir_print.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Write the IR as LLVM textual IR.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "gen/ir.hh"
+
+namespace neko_cc
+{
+
+static const char *const ir_op_name[ir_op_cnt] = {
+	"nop",
+	"add", "sub", "mul", "sdiv", "udiv", "srem", "urem", "shl", "lshr",
+	"ashr", "and", "or", "xor", "fadd", "fsub", "fmul", "fdiv", "frem",
+	"icmp eq", "icmp ne", "icmp ult", "icmp slt", "icmp ule", "icmp sle",
+	"icmp ugt", "icmp sgt", "icmp uge", "icmp sge",
+	"fcmp oeq", "fcmp one", "fcmp olt", "fcmp ole", "fcmp ogt", "fcmp oge",
+	"trunc", "zext", "sext", "fptosi", "sitofp", "fptrunc", "fpext",
+	"inttoptr", "ptrtoint",
+	"alloca", "load", "store", "getelementptr", "extractvalue", "memcpy",
+	"memzero", "lifetime.start", "lifetime.end", "call", "phi", "select",
+	"br", "br", "switch", "ret",
+};
+
+/**
+ * @brief Output state of one function, values without a name are
+ * numbered in the order they are defined.
+ */
+struct ir_printer_t {
+	writer_t &out;
+	const ir_module_t &mod;
+	const ir_func_t &func;
+	std::vector<int32_t> num;
+
+	void val(int32_t v)
+	{
+		const ir_value_t &value = func.vals[v];
+		if (value.name >= 0) {
+			out << func.strs[value.name];
+		} else {
+			out << '%';
+			out.append_int(num[v]);
+		}
+	}
+	void block(int32_t b)
+	{
+		out << '%';
+		block_name(b);
+	}
+	void block_name(int32_t b)
+	{
+		if (func.blocks[b].name >= 0) {
+			out << func.strs[func.blocks[b].name];
+		} else {
+			out << 'B';
+			out.append_int(b);
+		}
+	}
+	void type(int32_t ty)
+	{
+		out << mod.types[ty];
+	}
+	void typed_val(int32_t ty, int32_t v)
+	{
+		type(ty);
+		out << ' ';
+		val(v);
+	}
+	void inst(const ir_inst_t &inst);
+};
+
+void ir_printer_t::inst(const ir_inst_t &inst)
+{
+	const int32_t *pool = func.pool.data() + inst.pool_beg;
+	if (inst.res >= 0) {
+		val(inst.res);
+		out << " = ";
+	}
+	switch (inst.op) {
+	case ir_nop:
+		return;
+	case ir_alloca:
+		out << "alloca ";
+		type(inst.ty);
+		break;
+	case ir_load:
+		out << "load ";
+		if (inst.flags & ir_flag_volatile) {
+			out << "volatile ";
+		}
+		type(inst.ty);
+		out << ", ptr ";
+		val(inst.ops[0]);
+		break;
+	case ir_store:
+		out << "store ";
+		if (inst.flags & ir_flag_volatile) {
+			out << "volatile ";
+		}
+		typed_val(inst.ty, inst.ops[0]);
+		out << ", ptr ";
+		val(inst.ops[1]);
+		break;
+	case ir_gep:
+		out << "getelementptr ";
+		if (inst.flags & ir_flag_inbounds) {
+			out << "inbounds ";
+		}
+		type(inst.ty);
+		out << ", ptr ";
+		val(inst.ops[0]);
+		for (int i = 1; i < 3 && inst.ops[i] >= 0; i++) {
+			out << ", ";
+			typed_val(inst.ty2, inst.ops[i]);
+		}
+		break;
+	case ir_extractvalue:
+		out << "extractvalue ";
+		typed_val(inst.ty, inst.ops[0]);
+		out << ", ";
+		out.append_int(inst.ops[1]);
+		break;
+	case ir_memcpy:
+		out << "call void @llvm.memcpy.p0.p0.i64(ptr ";
+		val(inst.ops[0]);
+		out << ", ptr ";
+		val(inst.ops[1]);
+		out << ", i64 ";
+		val(inst.ops[2]);
+		out << ", i1 false)";
+		break;
+	case ir_memzero:
+		out << "call void @llvm.memset.p0.i64(ptr ";
+		val(inst.ops[0]);
+		out << ", i8 0, i64 ";
+		val(inst.ops[1]);
+		out << ", i1 false)";
+		break;
+	case ir_lifetime_start:
+	case ir_lifetime_end:
+		out.fmt("call void @llvm.{}.p0(i64 ", ir_op_name[inst.op]);
+		val(inst.ops[1]);
+		out << ", ptr ";
+		val(inst.ops[0]);
+		out << ')';
+		break;
+	case ir_call:
+		if (inst.flags & ir_flag_musttail) {
+			out << "musttail ";
+		} else if (inst.flags & ir_flag_tail) {
+			out << "tail ";
+		}
+		out << "call ";
+		type(inst.ty);
+		out << ' ';
+		val(inst.ops[0]);
+		out << '(';
+		for (uint32_t i = 0; i < inst.pool_len; i += 2) {
+			if (i) {
+				out << ", ";
+			}
+			typed_val(pool[i], pool[i + 1]);
+		}
+		out << ')';
+		break;
+	case ir_phi:
+		out << "phi ";
+		type(inst.ty);
+		for (uint32_t i = 0; i < inst.pool_len; i += 2) {
+			out << (i ? ", [" : " [");
+			val(pool[i]);
+			out << ", ";
+			block(pool[i + 1]);
+			out << ']';
+		}
+		break;
+	case ir_select:
+		out << "select i1 ";
+		val(inst.ops[0]);
+		out << ", ";
+		typed_val(inst.ty, inst.ops[1]);
+		out << ", ";
+		typed_val(inst.ty, inst.ops[2]);
+		break;
+	case ir_br:
+		out << "br label ";
+		block(inst.ops[0]);
+		break;
+	case ir_cond_br:
+		out << "br ";
+		typed_val(inst.ty, inst.ops[0]);
+		out << ", label ";
+		block(inst.ops[1]);
+		out << ", label ";
+		block(inst.ops[2]);
+		break;
+	case ir_switch:
+		out << "switch ";
+		typed_val(inst.ty, inst.ops[0]);
+		out << ", label ";
+		block(inst.ops[1]);
+		out << " [\n";
+		for (uint32_t i = 0; i < inst.pool_len; i += 2) {
+			out << "  ";
+			typed_val(inst.ty, pool[i]);
+			out << ", label ";
+			block(pool[i + 1]);
+			out << '\n';
+		}
+		out << ']';
+		break;
+	case ir_ret:
+		if (inst.ops[0] < 0) {
+			out << "ret void";
+		} else {
+			out << "ret ";
+			typed_val(inst.ty, inst.ops[0]);
+		}
+		break;
+	default:
+		out << ir_op_name[inst.op];
+		if (inst.flags & ir_flag_exact) {
+			out << " exact";
+		}
+		if (inst.flags & ir_flag_nsw) {
+			out << " nsw";
+		}
+		out << ' ';
+		typed_val(inst.ty, inst.ops[0]);
+		if (inst.op >= ir_trunc && inst.op <= ir_ptrtoint) {
+			out << " to ";
+			type(inst.ty2);
+		} else {
+			out << ", ";
+			val(inst.ops[1]);
+		}
+		break;
+	}
+	out << '\n';
+}
+
+void ir_print_func(writer_t &out, const ir_module_t &mod, const ir_func_t &func)
+{
+	ir_printer_t printer{ out, mod, func, {} };
+	printer.num.assign(func.vals.size(), -1);
+	int32_t cnt = 0;
+	for (auto b : func.layout) {
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			int32_t res = func.insts[i].res;
+			if (func.insts[i].op != ir_nop && res >= 0 &&
+			    func.vals[res].name < 0) {
+				printer.num[res] = cnt++;
+			}
+		}
+	}
+
+	out << "define ";
+	if (func.is_internal) {
+		out << "internal ";
+	}
+	out.fmt("{} {}(", mod.types[func.ret_ty], func.name);
+	for (size_t i = 0; i < func.args.size(); i++) {
+		if (i) {
+			out << ", ";
+		}
+		printer.type(func.args_ty[i]);
+		if (func.args_noalias[i]) {
+			out << " noalias";
+		}
+		out << ' ';
+		printer.val(func.args[i]);
+	}
+	out << ") {\n";
+	for (auto b : func.layout) {
+		printer.block_name(b);
+		out << ":\n";
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			if (func.insts[i].op != ir_nop) {
+				printer.inst(func.insts[i]);
+			}
+		}
+	}
+	out << "}\n";
+}
+
+void ir_print_types(writer_t &out, ir_module_t &mod)
+{
+	for (; mod.named_types_printed < mod.named_types.size();
+	     mod.named_types_printed++) {
+		const auto &i = mod.named_types[mod.named_types_printed];
+		out.fmt("{} = type {}\n", i.first, i.second);
+	}
+}
+
+void ir_print_module(writer_t &out, const ir_module_t &mod)
+{
+	for (const auto &i : mod.globals) {
+		out.fmt("{} = {} {} {}\n", i.name, i.attr, i.type, i.init);
+	}
+	for (const auto &i : mod.decls) {
+		out.fmt("declare {} {}(", mod.types[i.ret_ty], i.name);
+		for (size_t j = 0; j < i.args_ty.size(); j++) {
+			out << (j ? ", " : "") << mod.types[i.args_ty[j]];
+		}
+		out << ")\n";
+	}
+	if (mod.use_memcpy) {
+		out << "declare void @llvm.memcpy.p0.p0.i64(ptr, ptr, i64, i1)\n";
+	}
+	if (mod.use_memset) {
+		out << "declare void @llvm.memset.p0.i64(ptr, i8, i64, i1)\n";
+	}
+	if (mod.use_lifetime) {
+		out << "declare void @llvm.lifetime.start.p0(i64, ptr)\n";
+		out << "declare void @llvm.lifetime.end.p0(i64, ptr)\n";
+	}
+}
+
+void ir_output_func(writer_t &out, ir_module_t &mod, ir_func_t &func)
+{
+	ir_print_types(out, mod);
+	ir_print_func(out, mod, func);
+}
+
+void ir_output_module(writer_t &out, ir_module_t &mod)
+{
+	ir_print_types(out, mod);
+	ir_print_module(out, mod);
+}
+
+}
@@ -0,0 +1,1399 @@
+/**
+ * @file vm_gen.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Lower the IR to the bytecode of the VM, and write it out.
+ *
+ * The functions are kept until the module ends, as a call may refer to a
+ * function defined later and only then is it known to be internal or an
+ * extern. Every SSA value gets a register of its own, a phi is written by
+ * moves on each edge into its block, through a stub after the function
+ * for an edge from a block with several successors.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "gen/vm.hh"
+#include "out.hh"
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+
+namespace neko_cc
+{
+
+bool vm_use_superinst = true;
+
+/**
+ * @brief Bring an int to the form it has in a register of the width.
+ */
+static int64_t vm_norm_int(int64_t val, uint64_t bits)
+{
+	if (bits == 1) {
+		return val & 1;
+	}
+	if (bits < 64) {
+		return (int64_t)((uint64_t)val << (64 - bits)) >> (64 - bits);
+	}
+	return val;
+}
+
+/**
+ * @brief An instruction before the registers are numbered. A register is
+ * an argument below nargs, a value above, or the constant -(k + 1).
+ */
+struct vm_pending_t {
+	vm_op_t op;
+	int32_t a;
+	int32_t b;
+	int32_t c;
+	int32_t imm;
+	// which of a, b, c and imm are registers, by bit
+	uint8_t regs;
+};
+
+/**
+ * @brief A gep as base + index * scale + disp, index -1 if none.
+ */
+struct vm_addr_t {
+	int32_t base;
+	int32_t index = -1;
+	int64_t scale = 0;
+	int64_t disp = 0;
+	// another variable index, it cannot fold into a load or store
+	bool complex = false;
+};
+
+struct vm_lower_t {
+	const ir_module_t &mod;
+	ir_func_t &func;
+	vm_func_t &out;
+	const std::unordered_map<std::string, uint32_t> &func_ids;
+	const std::unordered_map<std::string, uint32_t> &global_offs;
+	std::unordered_map<std::string, uint32_t> &extern_ids;
+	std::vector<std::string> &externs;
+
+	int32_t nargs;
+	int32_t nvals = 0;
+	int32_t scratch = -1;
+	std::vector<int32_t> regs;
+	std::vector<int32_t> vtys;
+	std::vector<uint32_t> uses;
+	// the instruction using a value used once
+	std::vector<int32_t> user;
+	// instructions done by a later one
+	std::vector<bool> folded;
+	// the store ending a load, add and store sequence, to the add or sub
+	// and its operand other than the load
+	std::unordered_map<int32_t, std::pair<ir_op_t, int32_t> > rmw;
+	// int casts of a constant, done here, to their values
+	std::unordered_map<int32_t, int64_t> const_casts;
+	// constants by bits and symbol, 0 for none, 1 for the data, extern
+	// index + 2 otherwise
+	std::map<std::pair<uint64_t, uint32_t>, int32_t> consts;
+
+	std::vector<vm_pending_t> code;
+	std::vector<std::pair<int32_t, uint32_t> > pool;
+	std::vector<int32_t> block_pc;
+	// edges into a block with phis from a block with several successors
+	std::vector<std::pair<int32_t, int32_t> > stubs;
+	// the last call was a tcall, the return after it is dead
+	bool tail_called = false;
+
+	vm_lower_t(const ir_module_t &_mod, ir_func_t &_func, vm_func_t &_out,
+		   const std::unordered_map<std::string, uint32_t> &_func_ids,
+		   const std::unordered_map<std::string, uint32_t> &_offs,
+		   std::unordered_map<std::string, uint32_t> &_extern_ids,
+		   std::vector<std::string> &_externs)
+		: mod(_mod), func(_func), out(_out), func_ids(_func_ids),
+		  global_offs(_offs), extern_ids(_extern_ids),
+		  externs(_externs)
+	{
+		nargs = func.args.size();
+	}
+
+	int32_t lay(int32_t ty)
+	{
+		return ir_mod_layout(mod, ty);
+	}
+	int32_t new_reg()
+	{
+		return nargs + nvals++;
+	}
+	void emit(vm_op_t op, int32_t a, int32_t b = 0, int32_t c = 0,
+		  int32_t imm = 0, uint8_t regs = 7)
+	{
+		code.push_back({ op, a, b, c, imm, regs });
+	}
+	int32_t res_type(const ir_inst_t &inst);
+	int32_t get_const(uint64_t bits, uint32_t sym = 0);
+	uint32_t get_extern(const std::string &name);
+	bool const_int(int32_t v, int64_t &val);
+	int32_t reg(int32_t v, int32_t ty);
+	void norm(int32_t dst, int32_t src, uint64_t bits);
+	vm_addr_t addr(const ir_inst_t &gep);
+	bool can_fold_addr(int32_t v);
+	bool const_cast_of(const ir_inst_t &inst, int64_t &val);
+	void coalesce();
+	void prepare();
+	void fuse();
+	int32_t target(int32_t from, int32_t to);
+	void phi_moves(int32_t from, int32_t to);
+	void jump(int32_t to, int32_t next);
+
+	void binary(const ir_inst_t &inst);
+	void cast(const ir_inst_t &inst);
+	void gep(const ir_inst_t &inst);
+	void mem(const ir_inst_t &inst, ir_op_t rmw_op = ir_nop,
+		 int32_t other = -1);
+	void call(const ir_inst_t &inst);
+	void cond_br(const ir_inst_t &inst, int32_t block, int32_t next);
+	void inst(int32_t i, int32_t block, int32_t next);
+	void lower();
+	void finish();
+};
+
+int32_t vm_lower_t::res_type(const ir_inst_t &inst)
+{
+	switch (inst.op) {
+	case ir_alloca:
+	case ir_gep:
+		return ir_get_layout(mod, "ptr");
+	case ir_extractvalue: {
+		const ir_layout_t &type = ir_layouts[lay(inst.ty)];
+		return type.kind == ir_layout_t::ty_array ?
+			       type.elems[0] :
+			       type.elems[inst.ops[1]];
+	}
+	default:
+		if (inst.op >= ir_icmp_eq && inst.op <= ir_fcmp_oge) {
+			return ir_get_layout(mod, "i1");
+		}
+		if (inst.op >= ir_trunc && inst.op <= ir_ptrtoint) {
+			return lay(inst.ty2);
+		}
+		return lay(inst.ty);
+	}
+}
+
+int32_t vm_lower_t::get_const(uint64_t bits, uint32_t sym)
+{
+	auto key = std::make_pair(bits, sym);
+	auto it = consts.find(key);
+	if (it != consts.end()) {
+		return it->second;
+	}
+	int32_t k = out.consts.size();
+	out.consts.push_back(sym ? 0 : bits);
+	if (sym) {
+		out.relocs.push_back(
+			{ (uint32_t)k, sym == 1 ? vm_sym_data : sym - 2,
+			  (int64_t)bits });
+	}
+	consts.emplace(key, -(k + 1));
+	return -(k + 1);
+}
+
+static uint32_t vm_extern_id(std::vector<std::string> &externs,
+			     std::unordered_map<std::string, uint32_t> &ids,
+			     const std::string &name)
+{
+	auto it = ids.find(name);
+	if (it != ids.end()) {
+		return it->second;
+	}
+	externs.push_back(name);
+	ids.emplace(name, externs.size() - 1);
+	return externs.size() - 1;
+}
+
+uint32_t vm_lower_t::get_extern(const std::string &name)
+{
+	return vm_extern_id(externs, extern_ids, name);
+}
+
+bool vm_lower_t::const_int(int32_t v, int64_t &val)
+{
+	const ir_value_t &value = func.vals[v];
+	auto it = const_casts.find(v);
+	if (it != const_casts.end()) {
+		val = it->second;
+		return true;
+	}
+	if (value.kind != ir_value_t::val_const) {
+		return false;
+	}
+	const std::string &repr = func.strs[value.name];
+	if (repr == "true") {
+		val = 1;
+	} else if (repr[0] == '-' || (repr[0] >= '0' && repr[0] <= '9')) {
+		val = std::strtoll(repr.c_str(), nullptr, 10);
+	} else {
+		val = 0;
+	}
+	return true;
+}
+
+/**
+ * @brief Get the register of a value used as the type. A constant or the
+ * address of a global is interned as a constant register.
+ */
+int32_t vm_lower_t::reg(int32_t v, int32_t ty)
+{
+	const ir_value_t &value = func.vals[v];
+	if (value.kind == ir_value_t::val_global ||
+	    (value.kind == ir_value_t::val_const &&
+	     func.strs[value.name][0] == '@')) {
+		std::string name = func.strs[value.name];
+		if (func_ids.count(name)) {
+			err_msg("vm: the address of a function is not "
+				"supported");
+		}
+		auto it = global_offs.find(name);
+		if (it != global_offs.end()) {
+			return get_const(it->second, 1);
+		}
+		return get_const(0, get_extern(name.substr(1)) + 2);
+	}
+	if (value.kind != ir_value_t::val_const) {
+		return regs[v];
+	}
+	const std::string &repr = func.strs[value.name];
+	if (repr[0] == '{' || repr[0] == '<' || repr[0] == '[' ||
+	    repr[0] == 'c') {
+		err_msg("vm: unsupported constant " + repr);
+	}
+	if (is_ir_fp(ty) && repr != "undef" && repr != "zeroinitializer") {
+		bool is_float = ir_layouts[ty].kind == ir_layout_t::ty_float;
+		return get_const(ir_float_bits(repr, is_float));
+	}
+	int64_t val;
+	const_int(v, val);
+	if (ir_layouts[ty].kind == ir_layout_t::ty_int) {
+		val = vm_norm_int(val, ir_layouts[ty].cnt);
+	}
+	return get_const(val);
+}
+
+/**
+ * @brief Bring the low bits of src back to the form of an int of the
+ * width.
+ */
+void vm_lower_t::norm(int32_t dst, int32_t src, uint64_t bits)
+{
+	switch (bits) {
+	case 1:
+		emit(vm_zext1, dst, src);
+		return;
+	case 8:
+		emit(vm_sext8, dst, src);
+		return;
+	case 16:
+		emit(vm_sext16, dst, src);
+		return;
+	case 32:
+		emit(vm_sext32, dst, src);
+		return;
+	default:
+		if (dst != src) {
+			emit(vm_mov, dst, src);
+		}
+		return;
+	}
+}
+
+vm_addr_t vm_lower_t::addr(const ir_inst_t &gep)
+{
+	vm_addr_t ret;
+	int32_t ty = lay(gep.ty);
+	int32_t idx_ty = lay(gep.ty2);
+	ret.base = reg(gep.ops[0], ir_get_layout(mod, "ptr"));
+	for (int i = 1; i < 3 && gep.ops[i] >= 0; i++) {
+		int64_t val;
+		bool is_const = const_int(gep.ops[i], val);
+		if (i == 2 && ir_layouts[ty].kind == ir_layout_t::ty_struct) {
+			ret.disp += ir_layouts[ty].offsets[val];
+			continue;
+		}
+		if (i == 2) {
+			ty = ir_layouts[ty].elems[0];
+		}
+		int64_t size = ir_layouts[ty].size;
+		if (is_const) {
+			ret.disp += val * size;
+		} else if (ret.index < 0) {
+			ret.index = reg(gep.ops[i], idx_ty);
+			ret.scale = size;
+		} else {
+			ret.complex = true;
+		}
+	}
+	return ret;
+}
+
+/**
+ * @brief Tell if a gep can be done by its only user, a load or store of
+ * a scalar: with no index, or one with no displacement.
+ */
+bool vm_lower_t::can_fold_addr(int32_t v)
+{
+	const ir_value_t &value = func.vals[v];
+	if (value.kind != ir_value_t::val_inst || uses[v] != 1 ||
+	    func.insts[value.def].op != ir_gep) {
+		return false;
+	}
+	const ir_inst_t &use = func.insts[user[v]];
+	if ((use.op != ir_load && use.op != ir_store) ||
+	    (use.op == ir_load && use.ops[0] != v) ||
+	    (use.op == ir_store && (use.ops[1] != v || use.ops[0] == v)) ||
+	    !is_ir_scalar(lay(use.ty))) {
+		return false;
+	}
+	vm_addr_t a = addr(func.insts[value.def]);
+	return !a.complex && (a.index < 0 || a.disp == 0) &&
+	       a.disp == (int32_t)a.disp && a.scale == (int32_t)a.scale;
+}
+
+/**
+ * @brief Tell if an instruction is an int cast of a constant, and its
+ * value if so.
+ */
+bool vm_lower_t::const_cast_of(const ir_inst_t &inst, int64_t &val)
+{
+	if ((inst.op != ir_trunc && inst.op != ir_zext && inst.op != ir_sext) ||
+	    func.vals[inst.ops[0]].kind != ir_value_t::val_const ||
+	    func.strs[func.vals[inst.ops[0]].name][0] == '@' ||
+	    !const_int(inst.ops[0], val)) {
+		return false;
+	}
+	uint64_t from = ir_layouts[lay(inst.ty)].cnt;
+	uint64_t to = ir_layouts[lay(inst.ty2)].cnt;
+	if (inst.op == ir_trunc) {
+		val = vm_norm_int(val, to);
+	} else if (inst.op == ir_sext) {
+		val = from == 1 ? -(val & 1) : vm_norm_int(val, from);
+	} else {
+		val = from < 64 ? val & ((1ull << from) - 1) : val;
+		val = vm_norm_int(val, to);
+	}
+	return true;
+}
+
+/**
+ * @brief Give a value used only by a phi, on the br ending the block it
+ * is defined in, the register of the phi, so that the edge needs no move.
+ * The phi must not be read after the value is written.
+ */
+void vm_lower_t::coalesce()
+{
+	for (auto b : func.layout) {
+		const ir_block_t &block = func.blocks[b];
+		const ir_inst_t &term = func.insts[block.end - 1];
+		if (term.op != ir_br) {
+			continue;
+		}
+		const ir_block_t &to = func.blocks[term.ops[0]];
+		std::vector<std::pair<int32_t, int32_t> > incomings;
+		for (uint32_t i = to.beg; i < to.end; i++) {
+			const ir_inst_t &phi = func.insts[i];
+			if (phi.op != ir_phi) {
+				continue;
+			}
+			const int32_t *pool = func.pool.data() + phi.pool_beg;
+			for (uint32_t j = 0; j < phi.pool_len; j += 2) {
+				if (pool[j + 1] == b) {
+					incomings.emplace_back(phi.res,
+							       pool[j]);
+				}
+			}
+		}
+		for (const auto &i : incomings) {
+			int32_t phi = i.first, v = i.second;
+			const ir_value_t &value = func.vals[v];
+			if (value.kind != ir_value_t::val_inst ||
+			    uses[v] != 1 ||
+			    (uint32_t)value.def < block.beg ||
+			    (uint32_t)value.def >= block.end ||
+			    folded[value.def] ||
+			    func.insts[value.def].op == ir_phi ||
+			    func.insts[value.def].op == ir_alloca ||
+			    // reads its second index after writing
+			    (func.insts[value.def].op == ir_gep &&
+			     func.insts[value.def].ops[2] >= 0) ||
+			    !is_ir_scalar(vtys[v])) {
+				continue;
+			}
+			bool read = false;
+			for (uint32_t j = value.def + 1; j < block.end; j++) {
+				ir_for_each_use(func, func.insts[j],
+						[&](int32_t &u) {
+							read |= u == phi;
+						});
+			}
+			for (const auto &j : incomings) {
+				read |= j.second == phi;
+			}
+			if (!read) {
+				regs[v] = regs[phi];
+			}
+		}
+	}
+}
+
+/**
+ * @brief Give every value its register and type, and lay out the frame:
+ * the allocas, then a slot for each aggregate value.
+ */
+void vm_lower_t::prepare()
+{
+	out.name = func.name.substr(1);
+	out.nargs = nargs;
+	regs.assign(func.vals.size(), -1);
+	vtys.assign(func.vals.size(), -1);
+	uses.assign(func.vals.size(), 0);
+	user.assign(func.vals.size(), -1);
+	folded.assign(func.insts.size(), false);
+	for (int32_t i = 0; i < nargs; i++) {
+		regs[func.args[i]] = i;
+		vtys[func.args[i]] = lay(func.args_ty[i]);
+		if (!is_ir_scalar(vtys[func.args[i]])) {
+			err_msg("vm: passing a struct by value is not "
+				"supported");
+		}
+	}
+	uint32_t frame = 0;
+	auto slot = [&](int32_t v, int32_t ty) {
+		uint32_t align = std::max<uint32_t>(ir_layouts[ty].align, 1);
+		frame = (frame + align - 1) / align * align;
+		emit(vm_faddr, regs[v], 0, 0, frame, 1);
+		frame += ir_layouts[ty].size;
+	};
+	for (auto b : func.layout) {
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			ir_inst_t &inst = func.insts[i];
+			if (inst.op == ir_nop) {
+				continue;
+			}
+			ir_for_each_use(func, inst, [&](int32_t &v) {
+				uses[v]++;
+				user[v] = i;
+			});
+			if (inst.res < 0) {
+				continue;
+			}
+			vtys[inst.res] = res_type(inst);
+			int64_t val;
+			if (const_cast_of(inst, val)) {
+				const_casts.emplace(inst.res, val);
+				regs[inst.res] = get_const(val);
+				folded[i] = true;
+				continue;
+			}
+			regs[inst.res] = new_reg();
+			if (inst.op == ir_alloca) {
+				slot(inst.res, lay(inst.ty));
+			} else if (!is_ir_scalar(vtys[inst.res])) {
+				slot(inst.res, vtys[inst.res]);
+			}
+		}
+	}
+	out.frame_size = (frame + 15) / 16 * 16;
+	coalesce();
+}
+
+/**
+ * @brief Find what fuses into superinstructions: a compare into the
+ * branch ending its block, a gep into its load or store, and a load, add
+ * or sub, and store back to the same address, each used once.
+ */
+void vm_lower_t::fuse()
+{
+	for (auto b : func.layout) {
+		std::vector<int32_t> seq;
+		for (uint32_t i = func.blocks[b].beg; i < func.blocks[b].end;
+		     i++) {
+			if (func.insts[i].op != ir_nop) {
+				seq.push_back(i);
+			}
+		}
+		for (size_t j = 0; j < seq.size(); j++) {
+			const ir_inst_t &inst = func.insts[seq[j]];
+			if (inst.op == ir_cond_br &&
+			    func.vals[inst.ops[0]].kind ==
+				    ir_value_t::val_inst &&
+			    uses[inst.ops[0]] == 1) {
+				int32_t def = func.vals[inst.ops[0]].def;
+				ir_op_t op = func.insts[def].op;
+				// a phi it reads may be written in between
+				// if in another block
+				if (op >= ir_icmp_eq && op <= ir_icmp_sge &&
+				    (uint32_t)def >= func.blocks[b].beg) {
+					folded[def] = true;
+				}
+			}
+			if (inst.op == ir_gep && inst.res >= 0 &&
+			    can_fold_addr(inst.res)) {
+				folded[seq[j]] = true;
+			}
+			if (inst.op != ir_load || j + 2 >= seq.size()) {
+				continue;
+			}
+			const ir_inst_t &op = func.insts[seq[j + 1]];
+			const ir_inst_t &st = func.insts[seq[j + 2]];
+			int32_t ty = lay(inst.ty);
+			uint32_t size = ir_layouts[ty].size;
+			if (ir_layouts[ty].kind != ir_layout_t::ty_int ||
+			    (size != 4 && size != 8) ||
+			    (op.op != ir_add && op.op != ir_sub) ||
+			    st.op != ir_store || op.ty != inst.ty ||
+			    st.ops[0] != op.res || st.ops[1] != inst.ops[0] ||
+			    uses[inst.res] != 1 || uses[op.res] != 1 ||
+			    ((inst.flags | st.flags) & ir_flag_volatile)) {
+				continue;
+			}
+			int32_t other = op.ops[0] == inst.res ? op.ops[1] :
+					op.op == ir_add	       ? op.ops[0] :
+								 inst.res;
+			if (other == inst.res) {
+				continue;
+			}
+			folded[seq[j]] = folded[seq[j + 1]] = true;
+			rmw.emplace(seq[j + 2], std::make_pair(op.op, other));
+		}
+	}
+}
+
+/**
+ * @brief Get where a branch from a block goes to reach another, the
+ * block itself or a stub doing the phi moves of the edge. A stub is
+ * numbered after the blocks.
+ */
+int32_t vm_lower_t::target(int32_t from, int32_t to)
+{
+	const ir_block_t &b = func.blocks[to];
+	bool has_phi = false;
+	for (uint32_t i = b.beg; i < b.end && !has_phi; i++) {
+		has_phi = func.insts[i].op == ir_phi;
+	}
+	const ir_inst_t &term = func.insts[func.blocks[from].end - 1];
+	if (!has_phi || term.op == ir_br) {
+		return to;
+	}
+	for (size_t i = 0; i < stubs.size(); i++) {
+		if (stubs[i] == std::make_pair(from, to)) {
+			return func.blocks.size() + i;
+		}
+	}
+	stubs.emplace_back(from, to);
+	return func.blocks.size() + stubs.size() - 1;
+}
+
+/**
+ * @brief Write the phis of a block with what they get from a predecessor.
+ * All are written as if at once, through temporaries when a phi is read
+ * by another.
+ */
+void vm_lower_t::phi_moves(int32_t from, int32_t to)
+{
+	struct move_t {
+		int32_t dst;
+		int32_t src;
+		int32_t ty;
+	};
+	std::vector<move_t> moves;
+	const ir_block_t &b = func.blocks[to];
+	for (uint32_t i = b.beg; i < b.end; i++) {
+		const ir_inst_t &inst = func.insts[i];
+		if (inst.op != ir_phi) {
+			continue;
+		}
+		const int32_t *pool = func.pool.data() + inst.pool_beg;
+		for (uint32_t j = 0; j < inst.pool_len; j += 2) {
+			if (pool[j + 1] != from) {
+				continue;
+			}
+			int32_t ty = vtys[inst.res];
+			int32_t src = reg(pool[j], ty);
+			if (src != regs[inst.res]) {
+				moves.push_back({ regs[inst.res], src, ty });
+			}
+			break;
+		}
+	}
+	bool clash = false;
+	for (const auto &i : moves) {
+		for (const auto &j : moves) {
+			clash |= &i != &j && i.src == j.dst;
+		}
+	}
+	for (auto &i : moves) {
+		if (!is_ir_scalar(i.ty)) {
+			if (clash) {
+				err_msg("vm: swapping struct phis is not "
+					"supported");
+			}
+			emit(vm_copy, i.dst, i.src, 0, ir_layouts[i.ty].size,
+			     3);
+		} else if (clash) {
+			int32_t tmp = new_reg();
+			emit(vm_mov, tmp, i.src);
+			i.src = tmp;
+		} else {
+			emit(vm_mov, i.dst, i.src);
+		}
+	}
+	if (clash) {
+		for (const auto &i : moves) {
+			emit(vm_mov, i.dst, i.src);
+		}
+	}
+}
+
+void vm_lower_t::jump(int32_t to, int32_t next)
+{
+	if (to != next) {
+		emit(vm_jmp, 0, 0, 0, to, 0);
+	}
+}
+
+void vm_lower_t::binary(const ir_inst_t &inst)
+{
+	int32_t ty = lay(inst.ty);
+	int32_t a = regs[inst.res];
+	int32_t b = reg(inst.ops[0], ty);
+	int32_t c = reg(inst.ops[1], ty);
+	if (is_ir_fp(ty)) {
+		static const vm_op_t ops[2][5] = {
+			{ vm_fadd, vm_fsub, vm_fmul, vm_fdiv, vm_frem },
+			{ vm_fadds, vm_fsubs, vm_fmuls, vm_fdivs, vm_frems },
+		};
+		bool is_float = ir_layouts[ty].kind == ir_layout_t::ty_float;
+		emit(ops[is_float][inst.op - ir_fadd], a, b, c);
+		return;
+	}
+	uint64_t bits = ir_layouts[ty].cnt;
+	switch (inst.op) {
+	case ir_add:
+	case ir_sub:
+	case ir_mul:
+	case ir_shl: {
+		static const vm_op_t ops[2][4] = {
+			{ vm_add, vm_sub, vm_mul, vm_shl },
+			{ vm_add32, vm_sub32, vm_mul32, vm_shl32 },
+		};
+		int idx = inst.op == ir_shl ? 3 : inst.op - ir_add;
+		emit(ops[bits == 32][idx], a, b, c);
+		if (bits != 32) {
+			norm(a, a, bits);
+		}
+		return;
+	}
+	case ir_lshr:
+	case ir_udiv:
+	case ir_urem: {
+		static const vm_op_t ops[2][3] = {
+			{ vm_lshr, vm_udiv, vm_urem },
+			{ vm_lshr32, vm_udiv32, vm_urem32 },
+		};
+		int idx = inst.op == ir_lshr ? 0 : inst.op == ir_udiv ? 1 : 2;
+		if (bits == 32 || bits == 64) {
+			emit(ops[bits == 32][idx], a, b, c);
+			return;
+		}
+		// on the bits zero extended
+		vm_op_t zext = bits == 8 ? vm_zext8 :
+			       bits == 16 ? vm_zext16 :
+					    vm_zext1;
+		int32_t tb = new_reg(), tc = new_reg();
+		emit(zext, tb, b);
+		emit(zext, tc, c);
+		emit(ops[0][idx], a, tb, tc);
+		norm(a, a, bits);
+		return;
+	}
+	case ir_sdiv:
+		// the minimum over -1 overflows the width
+		emit(vm_sdiv, a, b, c);
+		norm(a, a, bits);
+		return;
+	case ir_srem:
+		emit(vm_srem, a, b, c);
+		return;
+	case ir_ashr:
+		emit(vm_ashr, a, b, c);
+		return;
+	case ir_and:
+		emit(vm_band, a, b, c);
+		return;
+	case ir_or:
+		emit(vm_bor, a, b, c);
+		return;
+	default:
+		emit(vm_bxor, a, b, c);
+		return;
+	}
+}
+
+void vm_lower_t::cast(const ir_inst_t &inst)
+{
+	int32_t from = lay(inst.ty), to = lay(inst.ty2);
+	uint64_t from_bits = ir_layouts[from].cnt;
+	uint64_t to_bits = ir_layouts[to].cnt;
+	int32_t a = regs[inst.res];
+	int32_t b = reg(inst.ops[0], from);
+	bool is_float = ir_layouts[from].kind == ir_layout_t::ty_float;
+	switch (inst.op) {
+	case ir_trunc:
+		norm(a, b, to_bits);
+		return;
+	case ir_zext:
+		if (from_bits == 8 || from_bits == 16 || from_bits == 32) {
+			emit(from_bits == 8  ? vm_zext8 :
+			     from_bits == 16 ? vm_zext16 :
+					       vm_zext32,
+			     a, b);
+		} else {
+			emit(vm_mov, a, b);
+		}
+		return;
+	case ir_sext:
+		emit(from_bits == 1 ? vm_neg : vm_mov, a, b);
+		return;
+	case ir_fptosi:
+		emit(is_float ? vm_s2si : vm_d2si, a, b);
+		norm(a, a, to_bits);
+		return;
+	case ir_sitofp:
+		emit(ir_layouts[to].kind == ir_layout_t::ty_float ? vm_si2s :
+								    vm_si2d,
+		     a, b);
+		return;
+	case ir_fptrunc:
+		emit(vm_d2s, a, b);
+		return;
+	case ir_fpext:
+		emit(vm_s2d, a, b);
+		return;
+	case ir_inttoptr:
+		emit(from_bits == 32 ? vm_zext32 : vm_mov, a, b);
+		return;
+	default:
+		// ptrtoint
+		norm(a, b,
+		     ir_layouts[to].kind == ir_layout_t::ty_ptr ? 64 : to_bits);
+		return;
+	}
+}
+
+void vm_lower_t::gep(const ir_inst_t &inst)
+{
+	int32_t a = regs[inst.res];
+	const int32_t *idx = inst.ops + 1;
+	int32_t ty = lay(inst.ty);
+	int32_t idx_ty = lay(inst.ty2);
+	int32_t cur = reg(inst.ops[0], ir_get_layout(mod, "ptr"));
+	int64_t disp = 0;
+	for (int i = 0; i < 2 && idx[i] >= 0; i++) {
+		int64_t val;
+		bool is_const = const_int(idx[i], val);
+		if (i == 1 && ir_layouts[ty].kind == ir_layout_t::ty_struct) {
+			disp += ir_layouts[ty].offsets[val];
+			continue;
+		}
+		if (i == 1) {
+			ty = ir_layouts[ty].elems[0];
+		}
+		int64_t size = ir_layouts[ty].size;
+		if (is_const) {
+			disp += val * size;
+			continue;
+		}
+		emit(vm_index, a, cur, reg(idx[i], idx_ty), size);
+		cur = a;
+	}
+	if (disp != (int32_t)disp) {
+		err_msg("vm: offset out of range");
+	}
+	if (disp) {
+		emit(vm_addi, a, cur, 0, disp, 3);
+	} else if (cur != a) {
+		emit(vm_mov, a, cur);
+	}
+}
+
+/**
+ * @brief A load or a store. Its address is done here if it is a folded
+ * gep. A store ending a load, add and store sequence comes with the op
+ * and the other operand.
+ */
+void vm_lower_t::mem(const ir_inst_t &inst, ir_op_t rmw_op, int32_t other)
+{
+	static const vm_op_t loads[2][5] = {
+		{ vm_ld8, vm_ldu8, vm_ld16, vm_ld32, vm_ld64 },
+		{ vm_ldx8, vm_ldxu8, vm_ldx16, vm_ldx32, vm_ldx64 },
+	};
+	static const vm_op_t stores[2][5] = {
+		{ vm_st8, vm_st8, vm_st16, vm_st32, vm_st64 },
+		{ vm_stx8, vm_stx8, vm_stx16, vm_stx32, vm_stx64 },
+	};
+	int32_t ptr = ir_get_layout(mod, "ptr");
+	bool is_load = inst.op == ir_load;
+	int32_t ty = lay(inst.ty);
+	int32_t addr_v = is_load ? inst.ops[0] : inst.ops[1];
+	if (!is_ir_scalar(ty)) {
+		int32_t addr = reg(addr_v, ptr);
+		int32_t val = is_load ? regs[inst.res] : reg(inst.ops[0], ty);
+		if (is_load) {
+			emit(vm_copy, val, addr, 0, ir_layouts[ty].size, 3);
+		} else {
+			emit(vm_copy, addr, val, 0, ir_layouts[ty].size, 3);
+		}
+		return;
+	}
+
+	vm_addr_t a;
+	a.base = reg(addr_v, ptr);
+	const ir_value_t &value = func.vals[addr_v];
+	if (value.kind == ir_value_t::val_inst && folded[value.def] &&
+	    func.insts[value.def].op == ir_gep) {
+		a = addr(func.insts[value.def]);
+	}
+	if (rmw_op != ir_nop) {
+		bool is_64 = ir_layouts[ty].size == 8;
+		vm_op_t op = is_64 ? vm_addm64 : vm_addm32;
+		if (rmw_op == ir_sub) {
+			op = is_64 ? vm_subm64 : vm_subm32;
+		}
+		emit(op, 0, a.base, reg(other, ty), a.disp, 6);
+		return;
+	}
+
+	uint32_t size = ir_layouts[ty].size;
+	int idx = size == 8 ? 4 :
+		  size == 4 ? 3 :
+		  size == 2 ? 2 :
+		  ir_layouts[ty].cnt == 1 ? 1 :
+					    0;
+	bool has_index = a.index >= 0;
+	vm_op_t op = is_load ? loads[has_index][idx] : stores[has_index][idx];
+	int32_t val = is_load ? regs[inst.res] : reg(inst.ops[0], ty);
+	if (has_index) {
+		emit(op, val, a.base, a.index, a.scale);
+	} else {
+		emit(op, val, a.base, 0, a.disp, 3);
+	}
+}
+
+void vm_lower_t::call(const ir_inst_t &inst)
+{
+	const int32_t *args = func.pool.data() + inst.pool_beg;
+	const ir_value_t &callee = func.vals[inst.ops[0]];
+	if (callee.kind != ir_value_t::val_global) {
+		err_msg("vm: indirect calls are not supported");
+	}
+	const std::string &name = func.strs[callee.name];
+	int32_t ret_ty = inst.res >= 0 ? vtys[inst.res] : -1;
+	if (ret_ty >= 0 && !is_ir_scalar(ret_ty)) {
+		err_msg("vm: returning a struct by value is not supported");
+	}
+	if (inst.res < 0 && scratch < 0) {
+		scratch = new_reg();
+	}
+	int32_t a = inst.res >= 0 ? regs[inst.res] : scratch;
+	auto it = func_ids.find(name);
+	const ir_func_t *internal =
+		it != func_ids.end() ? &mod.funcs[it->second] : nullptr;
+	int32_t beg = pool.size();
+	int int_args = 0, fp_args = 0;
+	for (uint32_t i = 0; i < inst.pool_len; i += 2) {
+		int32_t ty = lay(args[i]);
+		if (!is_ir_scalar(ty)) {
+			err_msg("vm: passing a struct by value is not "
+				"supported");
+		}
+		uint32_t kind = !is_ir_fp(ty) ? vm_arg_int :
+				ir_layouts[ty].kind == ir_layout_t::ty_float ?
+						vm_arg_float :
+						vm_arg_double;
+		(kind == vm_arg_int ? int_args : fp_args)++;
+		// an int constant is taken as the parameter, wider than the
+		// argument when the front end did not convert it
+		int32_t val_ty = ty;
+		if (internal && i / 2 < internal->args_ty.size()) {
+			int32_t param = lay(internal->args_ty[i / 2]);
+			if (kind == vm_arg_int && !is_ir_fp(param)) {
+				val_ty = param;
+			}
+		}
+		pool.emplace_back(reg(args[i + 1], val_ty), kind);
+	}
+	int32_t nargs = inst.pool_len / 2;
+
+	if (internal && (inst.flags & ir_flag_musttail)) {
+		// the return after it is left to the callee
+		emit(vm_tcall, a, it->second, nargs, beg, 1);
+		tail_called = true;
+		return;
+	}
+	if (internal) {
+		emit(vm_call, a, it->second, nargs, beg, 1);
+		return;
+	}
+	if (int_args > 6 || fp_args > 8) {
+		err_msg("vm: too many arguments to extern " + name);
+	}
+	vm_op_t op = vm_callx;
+	if (ret_ty >= 0 && is_ir_fp(ret_ty)) {
+		op = ir_layouts[ret_ty].kind == ir_layout_t::ty_float ?
+			     vm_callxs :
+			     vm_callxd;
+	}
+	emit(op, a, get_extern(name.substr(1)), nargs, beg, 1);
+	if (op == vm_callx && ret_ty >= 0 &&
+	    ir_layouts[ret_ty].kind == ir_layout_t::ty_int) {
+		// only the low bits of rax are the value
+		norm(a, a, ir_layouts[ret_ty].cnt);
+	}
+}
+
+static vm_op_t vm_branch_op(ir_op_t op, bool invert)
+{
+	// by the compares of the IR, each with its inverse
+	static const vm_op_t ops[][2] = {
+		{ vm_jeq, vm_jne },   { vm_jne, vm_jeq },
+		{ vm_jult, vm_juge }, { vm_jslt, vm_jsge },
+		{ vm_jule, vm_jugt }, { vm_jsle, vm_jsgt },
+		{ vm_jugt, vm_jule }, { vm_jsgt, vm_jsle },
+		{ vm_juge, vm_jult }, { vm_jsge, vm_jslt },
+	};
+	return ops[op - ir_icmp_eq][invert];
+}
+
+void vm_lower_t::cond_br(const ir_inst_t &inst, int32_t block, int32_t next)
+{
+	int32_t on_true = target(block, inst.ops[1]);
+	int32_t on_false = target(block, inst.ops[2]);
+	// branch away on the false side when the true one falls through
+	bool invert = on_true == next && on_false != next;
+	int32_t to = invert ? on_false : on_true;
+	const ir_value_t &cond = func.vals[inst.ops[0]];
+	if (cond.kind == ir_value_t::val_inst && folded[cond.def] &&
+	    func.insts[cond.def].op >= ir_icmp_eq &&
+	    func.insts[cond.def].op <= ir_icmp_sge) {
+		const ir_inst_t &cmp = func.insts[cond.def];
+		int32_t ty = lay(cmp.ty);
+		emit(vm_branch_op(cmp.op, invert), 0, reg(cmp.ops[0], ty),
+		     reg(cmp.ops[1], ty), to, 6);
+	} else {
+		emit(invert ? vm_jz : vm_jnz, 0,
+		     reg(inst.ops[0], lay(inst.ty)), 0, to, 2);
+	}
+	if (!invert) {
+		jump(on_false, next);
+	}
+}
+
+void vm_lower_t::inst(int32_t i, int32_t block, int32_t next)
+{
+	const ir_inst_t &inst = func.insts[i];
+	const int32_t *pool = func.pool.data() + inst.pool_beg;
+	int32_t ptr = ir_get_layout(mod, "ptr");
+	int32_t i64 = ir_get_layout(mod, "i64");
+	if (folded[i]) {
+		return;
+	}
+	switch (inst.op) {
+	case ir_nop:
+	case ir_alloca:
+	case ir_phi:
+	case ir_lifetime_start:
+	case ir_lifetime_end:
+		return;
+	case ir_load:
+	case ir_store: {
+		auto it = rmw.find(i);
+		if (it != rmw.end()) {
+			mem(inst, it->second.first, it->second.second);
+		} else {
+			mem(inst);
+		}
+		return;
+	}
+	case ir_gep:
+		gep(inst);
+		return;
+	case ir_extractvalue: {
+		const ir_layout_t &type = ir_layouts[lay(inst.ty)];
+		int32_t ty = vtys[inst.res];
+		int64_t off = type.kind == ir_layout_t::ty_array ?
+				      inst.ops[1] * ir_layouts[ty].size :
+				      type.offsets[inst.ops[1]];
+		int32_t src = reg(inst.ops[0], lay(inst.ty));
+		if (!is_ir_scalar(ty)) {
+			int32_t tmp = new_reg();
+			emit(vm_addi, tmp, src, 0, off, 3);
+			emit(vm_copy, regs[inst.res], tmp, 0,
+			     ir_layouts[ty].size, 3);
+			return;
+		}
+		uint32_t size = ir_layouts[ty].size;
+		vm_op_t op = size == 8 ? vm_ld64 :
+			     size == 4 ? vm_ld32 :
+			     size == 2 ? vm_ld16 :
+			     ir_layouts[ty].cnt == 1 ? vm_ldu8 :
+						       vm_ld8;
+		emit(op, regs[inst.res], src, 0, off, 3);
+		return;
+	}
+	case ir_memcpy:
+		emit(vm_memcpy, reg(inst.ops[0], ptr), reg(inst.ops[1], ptr),
+		     reg(inst.ops[2], i64));
+		return;
+	case ir_memzero:
+		emit(vm_memset, reg(inst.ops[0], ptr), 0, reg(inst.ops[1], i64),
+		     0, 5);
+		return;
+	case ir_call:
+		call(inst);
+		return;
+	case ir_select: {
+		int32_t ty = lay(inst.ty);
+		if (!is_ir_scalar(ty)) {
+			err_msg("vm: select of an aggregate is not supported");
+		}
+		emit(vm_sel, regs[inst.res], reg(inst.ops[1], ty),
+		     reg(inst.ops[2], ty),
+		     reg(inst.ops[0], ir_get_layout(mod, "i1")), 15);
+		return;
+	}
+	case ir_br:
+		phi_moves(block, inst.ops[0]);
+		jump(inst.ops[0], next);
+		return;
+	case ir_cond_br:
+		cond_br(inst, block, next);
+		return;
+	case ir_switch: {
+		int32_t ty = lay(inst.ty);
+		int32_t v = reg(inst.ops[0], ty);
+		for (uint32_t j = 0; j < inst.pool_len; j += 2) {
+			emit(vm_jeq, 0, v, reg(pool[j], ty),
+			     target(block, pool[j + 1]), 6);
+		}
+		jump(target(block, inst.ops[1]), next);
+		return;
+	}
+	case ir_ret:
+		if (tail_called) {
+			tail_called = false;
+			return;
+		}
+		if (inst.ops[0] < 0) {
+			emit(vm_retv, 0, 0, 0, 0, 0);
+			return;
+		}
+		if (!is_ir_scalar(lay(inst.ty))) {
+			err_msg("vm: returning a struct by value is not "
+				"supported");
+		}
+		emit(vm_ret, 0, reg(inst.ops[0], lay(inst.ty)), 0, 0, 2);
+		return;
+	default:
+		break;
+	}
+
+	if (inst.op >= ir_trunc && inst.op <= ir_ptrtoint) {
+		cast(inst);
+		return;
+	}
+	if (inst.op < ir_icmp_eq) {
+		binary(inst);
+		return;
+	}
+	static const vm_op_t cmps[] = {
+		vm_eq,	vm_ne,	vm_ult, vm_slt, vm_ule, vm_sle, vm_ugt, vm_sgt,
+		vm_uge, vm_sge, vm_feq, vm_fne, vm_flt, vm_fle, vm_fgt, vm_fge,
+	};
+	int32_t ty = lay(inst.ty);
+	int op = cmps[inst.op - ir_icmp_eq];
+	if (ir_layouts[ty].kind == ir_layout_t::ty_float) {
+		// the float ones follow the double ones
+		op += vm_feqs - vm_feq;
+	}
+	emit((vm_op_t)op, regs[inst.res], reg(inst.ops[0], ty),
+	     reg(inst.ops[1], ty));
+}
+
+void vm_lower_t::lower()
+{
+	prepare();
+	if (vm_use_superinst) {
+		fuse();
+	}
+	int32_t nb = func.blocks.size();
+	block_pc.assign(nb, -1);
+	for (size_t i = 0; i < func.layout.size(); i++) {
+		int32_t b = func.layout[i];
+		int32_t next = i + 1 < func.layout.size() ? func.layout[i + 1] :
+							    -1;
+		block_pc[b] = code.size();
+		for (uint32_t j = func.blocks[b].beg; j < func.blocks[b].end;
+		     j++) {
+			inst(j, b, next);
+		}
+	}
+	// the stubs may add more stubs, never for the same edge
+	for (size_t i = 0; i < stubs.size(); i++) {
+		block_pc.push_back(code.size());
+		phi_moves(stubs[i].first, stubs[i].second);
+		emit(vm_jmp, 0, 0, 0, stubs[i].second, 0);
+	}
+	finish();
+}
+
+/**
+ * @brief Number the registers, the constants after the arguments, and
+ * point the jumps at their instructions.
+ */
+void vm_lower_t::finish()
+{
+	int32_t nconsts = out.consts.size();
+	uint64_t nregs = (uint64_t)nargs + nconsts + nvals;
+	if (nregs > UINT16_MAX) {
+		err_msg("vm: too many values in " + func.name);
+	}
+	out.nregs = nregs;
+	auto map = [&](int32_t r) -> uint16_t {
+		return r < 0 ? nargs - r - 1 : r < nargs ? r : r + nconsts;
+	};
+	out.code.reserve(code.size());
+	for (const auto &i : code) {
+		vm_inst_t inst = { (uint16_t)i.op, (uint16_t)i.a,
+				   (uint16_t)i.b, (uint16_t)i.c, i.imm };
+		if (i.regs & 1) {
+			inst.a = map(i.a);
+		}
+		if (i.regs & 2) {
+			inst.b = map(i.b);
+		}
+		if (i.regs & 4) {
+			inst.c = map(i.c);
+		}
+		if (i.regs & 8) {
+			inst.imm = map(i.imm);
+		}
+		if (i.op == vm_jmp || i.op == vm_jnz || i.op == vm_jz ||
+		    (i.op >= vm_jeq && i.op <= vm_juge)) {
+			inst.imm = block_pc[i.imm];
+		}
+		out.code.push_back(inst);
+	}
+	for (const auto &i : pool) {
+		out.pool.push_back(map(i.first) | i.second);
+	}
+}
+
+/**
+ * @brief Write a constant of a type into the data at off, the addresses
+ * of symbols as relocations.
+ */
+static void vm_data(const ir_module_t &mod, vm_module_t &vm,
+		    const std::unordered_map<std::string, uint32_t> &offs,
+		    std::unordered_map<std::string, uint32_t> &extern_ids,
+		    int32_t ty, std::string_view repr, uint32_t off)
+{
+	const ir_layout_t &type = ir_layouts[ty];
+	repr = ir_trim(repr);
+	if (repr == "zeroinitializer" || repr == "undef") {
+		return;
+	}
+	std::string str(repr);
+	uint8_t *at = vm.data.data() + off;
+	switch (type.kind) {
+	case ir_layout_t::ty_int:
+	case ir_layout_t::ty_ptr: {
+		int64_t val = 0;
+		if (repr[0] == '@') {
+			auto it = offs.find(str);
+			uint32_t sym;
+			if (it != offs.end()) {
+				sym = vm_sym_data;
+				val = it->second;
+			} else {
+				sym = vm_extern_id(vm.externs, extern_ids,
+						   str.substr(1));
+			}
+			vm.data_relocs.push_back({ off, sym, val });
+			return;
+		}
+		if (repr == "true") {
+			val = 1;
+		} else if (repr != "null" && repr != "false") {
+			val = std::strtoll(str.c_str(), nullptr, 10);
+		}
+		std::memcpy(at, &val, type.size);
+		return;
+	}
+	case ir_layout_t::ty_float:
+	case ir_layout_t::ty_double: {
+		bool is_float = type.kind == ir_layout_t::ty_float;
+		uint64_t bits = ir_float_bits(repr, is_float);
+		std::memcpy(at, &bits, type.size);
+		return;
+	}
+	case ir_layout_t::ty_array:
+		if (repr.substr(0, 2) == "c\"") {
+			for (size_t i = 2; i + 1 < repr.size(); i++) {
+				unsigned ch = (unsigned char)repr[i];
+				if (ch == '\\') {
+					ch = std::strtoul(
+						str.substr(i + 1, 2).c_str(),
+						nullptr, 16);
+					i += 2;
+				}
+				*at++ = ch;
+			}
+			return;
+		}
+		for (auto i : ir_split_items(repr.substr(1, repr.size() - 2))) {
+			vm_data(mod, vm, offs, extern_ids, type.elems[0],
+				i.substr(ir_skip_type(i)), off);
+			off += ir_layouts[type.elems[0]].size;
+		}
+		return;
+	case ir_layout_t::ty_struct: {
+		bool packed;
+		size_t idx = 0;
+		for (auto i : ir_split_items(ir_struct_items(repr, packed))) {
+			vm_data(mod, vm, offs, extern_ids, type.elems[idx],
+				i.substr(ir_skip_type(i)),
+				off + type.offsets[idx]);
+			idx++;
+		}
+		return;
+	}
+	default:
+		err_msg("vm: unsupported constant " + str);
+	}
+}
+
+void vm_compile(ir_module_t &mod, vm_module_t &vm)
+{
+	std::unordered_map<std::string, uint32_t> func_ids;
+	std::unordered_map<std::string, uint32_t> offs;
+	std::unordered_map<std::string, uint32_t> extern_ids;
+	for (size_t i = 0; i < mod.funcs.size(); i++) {
+		func_ids.emplace(mod.funcs[i].name, i);
+	}
+
+	// lay out every global first, an initializer may point to a later
+	// one
+	std::vector<int32_t> tys;
+	for (const auto &i : mod.globals) {
+		int32_t ty = ir_get_layout(mod, i.type);
+		auto items = ir_split_items(i.init);
+		uint32_t align = ir_layouts[ty].align;
+		if (items.size() > 1) {
+			// ", align N"
+			align = std::strtoul(std::string(items[1].substr(6))
+						     .c_str(),
+					     nullptr, 10);
+		}
+		align = std::max(align, 1u);
+		uint32_t off = (vm.data.size() + align - 1) / align * align;
+		offs.emplace(i.name, off);
+		vm.data.resize(off + ir_layouts[ty].size);
+		tys.push_back(ty);
+	}
+	for (size_t i = 0; i < mod.globals.size(); i++) {
+		const ir_global_t &global = mod.globals[i];
+		vm_data(mod, vm, offs, extern_ids, tys[i],
+			ir_split_items(global.init)[0], offs[global.name]);
+	}
+
+	vm.funcs.resize(mod.funcs.size());
+	for (size_t i = 0; i < mod.funcs.size(); i++) {
+		vm_lower_t lower(mod, mod.funcs[i], vm.funcs[i], func_ids,
+				 offs, extern_ids, vm.externs);
+		lower.lower();
+	}
+}
+
+static void vm_put(std::string &out, uint64_t val, int n)
+{
+	for (int i = 0; i < n; i++) {
+		out.push_back(val >> (i * 8));
+	}
+}
+
+static void vm_put_str(std::string &out, const std::string &s)
+{
+	vm_put(out, s.size(), 4);
+	out.append(s);
+}
+
+static void vm_put_relocs(std::string &out,
+			  const std::vector<vm_reloc_t> &relocs)
+{
+	vm_put(out, relocs.size(), 4);
+	for (const auto &i : relocs) {
+		vm_put(out, i.at, 4);
+		vm_put(out, i.sym, 4);
+		vm_put(out, i.addend, 8);
+	}
+}
+
+void vm_write(const vm_module_t &vm, std::string &out)
+{
+	out.append("NEKOVM\x01", 8);
+	vm_put(out, vm.funcs.size(), 4);
+	for (const auto &f : vm.funcs) {
+		vm_put_str(out, f.name);
+		vm_put(out, f.nargs, 4);
+		vm_put(out, f.nregs, 4);
+		vm_put(out, f.frame_size, 4);
+		vm_put(out, f.code.size(), 4);
+		for (const auto &i : f.code) {
+			vm_put(out, i.op, 2);
+			vm_put(out, i.a, 2);
+			vm_put(out, i.b, 2);
+			vm_put(out, i.c, 2);
+			vm_put(out, (uint32_t)i.imm, 4);
+		}
+		vm_put(out, f.consts.size(), 4);
+		for (auto i : f.consts) {
+			vm_put(out, i, 8);
+		}
+		vm_put(out, f.pool.size(), 4);
+		for (auto i : f.pool) {
+			vm_put(out, i, 4);
+		}
+		vm_put_relocs(out, f.relocs);
+	}
+	vm_put(out, vm.externs.size(), 4);
+	for (const auto &i : vm.externs) {
+		vm_put_str(out, i);
+	}
+	vm_put(out, vm.data.size(), 4);
+	out.append(vm.data.begin(), vm.data.end());
+	vm_put_relocs(out, vm.data_relocs);
+}
+
+void ir_output_func(writer_t &, ir_module_t &mod, ir_func_t &func)
+{
+	mod.funcs.push_back(std::move(func));
+}
+
+void ir_output_module(writer_t &out, ir_module_t &mod)
+{
+	vm_module_t vm;
+	vm_compile(mod, vm);
+	std::string image;
+	vm_write(vm, image);
+	out.append(image);
+}
+
+}
@@ -0,0 +1,540 @@
+/**
+ * @file vm_run.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Read the image of the VM backend back, and interpret it.
+ *
+ * The interpreter is built twice from the same body: once dispatching by
+ * a plain switch, once by computed goto, where each handler jumps to the
+ * next through a table of label addresses and the branch predictor sees
+ * one indirect jump per opcode instead of a single shared one.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "gen/vm.hh"
+#include "out.hh"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <memory>
+
+// labels as values are a GNU extension
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+namespace neko_cc
+{
+
+struct vm_reader_t {
+	std::string_view buf;
+	size_t at = 0;
+
+	uint64_t get(int n)
+	{
+		if (at + n > buf.size()) {
+			err_msg("vm: truncated image");
+		}
+		uint64_t ret = 0;
+		for (int i = 0; i < n; i++) {
+			ret |= (uint64_t)(uint8_t)buf[at++] << (i * 8);
+		}
+		return ret;
+	}
+	std::string get_str()
+	{
+		size_t n = get(4);
+		if (at + n > buf.size()) {
+			err_msg("vm: truncated image");
+		}
+		at += n;
+		return std::string(buf.substr(at - n, n));
+	}
+	void get_relocs(std::vector<vm_reloc_t> &relocs)
+	{
+		relocs.resize(get(4));
+		for (auto &i : relocs) {
+			i.at = get(4);
+			i.sym = get(4);
+			i.addend = get(8);
+		}
+	}
+};
+
+void vm_read(std::string_view image, vm_module_t &vm)
+{
+	vm_reader_t in = { image };
+	if (image.substr(0, 8) != std::string_view("NEKOVM\x01", 8)) {
+		err_msg("vm: not an image of the VM");
+	}
+	in.at = 8;
+	vm.funcs.resize(in.get(4));
+	for (auto &f : vm.funcs) {
+		f.name = in.get_str();
+		f.nargs = in.get(4);
+		f.nregs = in.get(4);
+		f.frame_size = in.get(4);
+		f.code.resize(in.get(4));
+		for (auto &i : f.code) {
+			i.op = in.get(2);
+			i.a = in.get(2);
+			i.b = in.get(2);
+			i.c = in.get(2);
+			i.imm = in.get(4);
+			if (i.op >= vm_op_cnt) {
+				err_msg("vm: bad opcode in " + f.name);
+			}
+		}
+		f.consts.resize(in.get(4));
+		for (auto &i : f.consts) {
+			i = in.get(8);
+		}
+		f.pool.resize(in.get(4));
+		for (auto &i : f.pool) {
+			i = in.get(4);
+		}
+		in.get_relocs(f.relocs);
+	}
+	vm.externs.resize(in.get(4));
+	for (auto &i : vm.externs) {
+		i = in.get_str();
+	}
+	vm.data.resize(in.get(4));
+	for (auto &i : vm.data) {
+		i = in.get(1);
+	}
+	in.get_relocs(vm.data_relocs);
+}
+
+union vm_reg_t {
+	int64_t i;
+	uint64_t u;
+	double d;
+	float f;
+	uint8_t *p;
+};
+
+/**
+ * @brief A function ready to run, its constants relocated.
+ */
+struct vm_lfunc_t {
+	const vm_inst_t *code;
+	uint32_t nargs;
+	uint32_t nregs;
+	uint32_t frame_size;
+	std::vector<vm_reg_t> consts;
+	const uint32_t *pool;
+};
+
+struct vm_frame_t {
+	// the call instruction to return to
+	const vm_inst_t *pc;
+	const vm_lfunc_t *func;
+	vm_reg_t *regs;
+	uint8_t *fp;
+};
+
+struct vm_state_t {
+	std::vector<vm_lfunc_t> funcs;
+	std::vector<void *> externs;
+	std::unique_ptr<uint64_t[]> data;
+	std::unique_ptr<vm_reg_t[]> regs;
+	std::unique_ptr<uint64_t[]> stack;
+	std::unique_ptr<vm_frame_t[]> frames;
+};
+
+static const size_t vm_regs_size = 1 << 20;
+static const size_t vm_stack_size = 8 << 20;
+static const size_t vm_frames_size = 1 << 16;
+
+static void vm_load(const vm_module_t &vm, vm_state_t &st)
+{
+	for (const auto &i : vm.externs) {
+		void *addr = dlsym(RTLD_DEFAULT, i.c_str());
+		if (!addr) {
+			err_msg("vm: undefined symbol " + i);
+		}
+		st.externs.push_back(addr);
+	}
+	auto sym_addr = [&](const vm_reloc_t &r) {
+		uint8_t *base = r.sym == vm_sym_data ?
+					(uint8_t *)st.data.get() :
+					(uint8_t *)st.externs.at(r.sym);
+		return base + r.addend;
+	};
+
+	st.data.reset(new uint64_t[vm.data.size() / 8 + 1]);
+	std::memcpy(st.data.get(), vm.data.data(), vm.data.size());
+	for (const auto &i : vm.data_relocs) {
+		uint8_t *addr = sym_addr(i);
+		uint8_t *at = (uint8_t *)st.data.get() + i.at;
+		std::memcpy(at, &addr, sizeof(addr));
+	}
+	for (const auto &f : vm.funcs) {
+		vm_lfunc_t lf = { f.code.data(), f.nargs, f.nregs,
+				  f.frame_size, {}, f.pool.data() };
+		for (auto i : f.consts) {
+			vm_reg_t r;
+			r.u = i;
+			lf.consts.push_back(r);
+		}
+		for (const auto &i : f.relocs) {
+			lf.consts.at(i.at).p = sym_addr(i);
+		}
+		st.funcs.push_back(std::move(lf));
+	}
+	st.regs.reset(new vm_reg_t[vm_regs_size]);
+	st.stack.reset(new uint64_t[vm_stack_size / 8]);
+	st.frames.reset(new vm_frame_t[vm_frames_size]);
+}
+
+/**
+ * @brief Run the function entry of the loaded module, its arguments
+ * already in the first registers.
+ */
+template <bool threaded>
+static int64_t vm_exec(vm_state_t &st, uint32_t entry)
+{
+	static const void *const labels[] = {
+#define VM_OP_LABEL(name) &&op_##name,
+		VM_OPS(VM_OP_LABEL)
+#undef VM_OP_LABEL
+	};
+	static_assert(sizeof(labels) / sizeof(*labels) == vm_op_cnt,
+		      "a label for each opcode");
+	(void)labels;
+
+	const vm_lfunc_t *func = &st.funcs[entry];
+	const vm_inst_t *code = func->code;
+	const vm_inst_t *pc = code;
+	vm_reg_t *regs = st.regs.get();
+	vm_reg_t *regs_end = regs + vm_regs_size;
+	uint8_t *fp = (uint8_t *)st.stack.get();
+	uint8_t *stack_end = fp + vm_stack_size;
+	vm_frame_t *frame = st.frames.get();
+	vm_frame_t *frames_end = frame + vm_frames_size;
+	vm_reg_t ret;
+	if (func->nregs > vm_regs_size || func->frame_size > vm_stack_size) {
+		err_msg("vm: stack overflow");
+	}
+	std::memcpy(regs + func->nargs, func->consts.data(),
+		    func->consts.size() * sizeof(vm_reg_t));
+
+#define A (regs[pc->a])
+#define B (regs[pc->b])
+#define C (regs[pc->c])
+#define IMM (pc->imm)
+#define MEM (B.p + IMM)
+#define MEMX (B.p + C.i * IMM)
+#define DISPATCH()                            \
+	do {                                  \
+		if (threaded) {               \
+			goto *labels[pc->op]; \
+		}                             \
+		goto dispatch;                \
+	} while (0)
+#define NEXT()              \
+	do {                \
+		++pc;       \
+		DISPATCH(); \
+	} while (0)
+#define OP(name)        \
+	case vm_##name: \
+	op_##name:
+#define LOAD(type, addr)                              \
+	do {                                          \
+		type val;                             \
+		std::memcpy(&val, addr, sizeof(val)); \
+		A.i = val;                            \
+		NEXT();                               \
+	} while (0)
+#define STORE(type, addr)                             \
+	do {                                          \
+		type val = A.u;                       \
+		std::memcpy(addr, &val, sizeof(val)); \
+		NEXT();                               \
+	} while (0)
+#define RMW(type, op)                                \
+	do {                                         \
+		type val;                            \
+		std::memcpy(&val, MEM, sizeof(val)); \
+		val = val op (type)C.u;              \
+		std::memcpy(MEM, &val, sizeof(val)); \
+		NEXT();                              \
+	} while (0)
+#define JUMP_IF(cond)                              \
+	do {                                       \
+		pc = (cond) ? code + IMM : pc + 1; \
+		DISPATCH();                        \
+	} while (0)
+
+	DISPATCH();
+dispatch:
+	switch (pc->op) {
+	OP(mov) A = B; NEXT();
+	OP(sel) A = regs[IMM].u ? B : C; NEXT();
+	OP(faddr) A.p = fp + IMM; NEXT();
+	OP(add) A.u = B.u + C.u; NEXT();
+	OP(sub) A.u = B.u - C.u; NEXT();
+	OP(mul) A.u = B.u * C.u; NEXT();
+	OP(add32) A.i = (int32_t)(uint32_t)(B.u + C.u); NEXT();
+	OP(sub32) A.i = (int32_t)(uint32_t)(B.u - C.u); NEXT();
+	OP(mul32) A.i = (int32_t)((uint32_t)B.u * (uint32_t)C.u); NEXT();
+	OP(addi) A.u = B.u + IMM; NEXT();
+	OP(band) A.u = B.u & C.u; NEXT();
+	OP(bor) A.u = B.u | C.u; NEXT();
+	OP(bxor) A.u = B.u ^ C.u; NEXT();
+	OP(shl) A.u = B.u << (C.u & 63); NEXT();
+	OP(shl32) A.i = (int32_t)((uint32_t)B.u << (C.u & 31)); NEXT();
+	OP(ashr) A.i = B.i >> (C.u & 63); NEXT();
+	OP(lshr) A.u = B.u >> (C.u & 63); NEXT();
+	OP(lshr32) A.i = (int32_t)((uint32_t)B.u >> (C.u & 31)); NEXT();
+	OP(sdiv)
+		if (!C.i) {
+			err_msg("vm: division by zero");
+		}
+		A.u = C.i == -1 ? 0 - B.u : (uint64_t)(B.i / C.i);
+		NEXT();
+	OP(srem)
+		if (!C.i) {
+			err_msg("vm: division by zero");
+		}
+		A.i = C.i == -1 ? 0 : B.i % C.i;
+		NEXT();
+	OP(udiv)
+		if (!C.u) {
+			err_msg("vm: division by zero");
+		}
+		A.u = B.u / C.u;
+		NEXT();
+	OP(urem)
+		if (!C.u) {
+			err_msg("vm: division by zero");
+		}
+		A.u = B.u % C.u;
+		NEXT();
+	OP(udiv32)
+		if (!(uint32_t)C.u) {
+			err_msg("vm: division by zero");
+		}
+		A.i = (int32_t)((uint32_t)B.u / (uint32_t)C.u);
+		NEXT();
+	OP(urem32)
+		if (!(uint32_t)C.u) {
+			err_msg("vm: division by zero");
+		}
+		A.i = (int32_t)((uint32_t)B.u % (uint32_t)C.u);
+		NEXT();
+	OP(sext8) A.i = (int8_t)B.u; NEXT();
+	OP(sext16) A.i = (int16_t)B.u; NEXT();
+	OP(sext32) A.i = (int32_t)B.u; NEXT();
+	OP(zext1) A.u = B.u & 1; NEXT();
+	OP(zext8) A.u = (uint8_t)B.u; NEXT();
+	OP(zext16) A.u = (uint16_t)B.u; NEXT();
+	OP(zext32) A.u = (uint32_t)B.u; NEXT();
+	OP(neg) A.u = 0 - B.u; NEXT();
+	OP(fadd) A.d = B.d + C.d; NEXT();
+	OP(fsub) A.d = B.d - C.d; NEXT();
+	OP(fmul) A.d = B.d * C.d; NEXT();
+	OP(fdiv) A.d = B.d / C.d; NEXT();
+	OP(frem) A.d = std::fmod(B.d, C.d); NEXT();
+	OP(fadds) A.f = B.f + C.f; NEXT();
+	OP(fsubs) A.f = B.f - C.f; NEXT();
+	OP(fmuls) A.f = B.f * C.f; NEXT();
+	OP(fdivs) A.f = B.f / C.f; NEXT();
+	OP(frems) A.f = std::fmod(B.f, C.f); NEXT();
+	OP(eq) A.u = B.u == C.u; NEXT();
+	OP(ne) A.u = B.u != C.u; NEXT();
+	OP(slt) A.u = B.i < C.i; NEXT();
+	OP(sle) A.u = B.i <= C.i; NEXT();
+	OP(sgt) A.u = B.i > C.i; NEXT();
+	OP(sge) A.u = B.i >= C.i; NEXT();
+	OP(ult) A.u = B.u < C.u; NEXT();
+	OP(ule) A.u = B.u <= C.u; NEXT();
+	OP(ugt) A.u = B.u > C.u; NEXT();
+	OP(uge) A.u = B.u >= C.u; NEXT();
+	// ordered, false if either is a NaN
+	OP(feq) A.u = B.d == C.d; NEXT();
+	OP(fne) A.u = B.d < C.d || B.d > C.d; NEXT();
+	OP(flt) A.u = B.d < C.d; NEXT();
+	OP(fle) A.u = B.d <= C.d; NEXT();
+	OP(fgt) A.u = B.d > C.d; NEXT();
+	OP(fge) A.u = B.d >= C.d; NEXT();
+	OP(feqs) A.u = B.f == C.f; NEXT();
+	OP(fnes) A.u = B.f < C.f || B.f > C.f; NEXT();
+	OP(flts) A.u = B.f < C.f; NEXT();
+	OP(fles) A.u = B.f <= C.f; NEXT();
+	OP(fgts) A.u = B.f > C.f; NEXT();
+	OP(fges) A.u = B.f >= C.f; NEXT();
+	OP(si2d) A.d = B.i; NEXT();
+	OP(si2s) A.f = B.i; NEXT();
+	OP(d2si) A.i = B.d; NEXT();
+	OP(s2si) A.i = B.f; NEXT();
+	OP(s2d) A.d = B.f; NEXT();
+	OP(d2s) A.f = B.d; NEXT();
+	OP(ld8) LOAD(int8_t, MEM);
+	OP(ldu8) LOAD(uint8_t, MEM);
+	OP(ld16) LOAD(int16_t, MEM);
+	OP(ld32) LOAD(int32_t, MEM);
+	OP(ld64) LOAD(int64_t, MEM);
+	OP(st8) STORE(uint8_t, MEM);
+	OP(st16) STORE(uint16_t, MEM);
+	OP(st32) STORE(uint32_t, MEM);
+	OP(st64) STORE(uint64_t, MEM);
+	OP(ldx8) LOAD(int8_t, MEMX);
+	OP(ldxu8) LOAD(uint8_t, MEMX);
+	OP(ldx16) LOAD(int16_t, MEMX);
+	OP(ldx32) LOAD(int32_t, MEMX);
+	OP(ldx64) LOAD(int64_t, MEMX);
+	OP(stx8) STORE(uint8_t, MEMX);
+	OP(stx16) STORE(uint16_t, MEMX);
+	OP(stx32) STORE(uint32_t, MEMX);
+	OP(stx64) STORE(uint64_t, MEMX);
+	OP(index) A.p = MEMX; NEXT();
+	OP(addm32) RMW(uint32_t, +);
+	OP(addm64) RMW(uint64_t, +);
+	OP(subm32) RMW(uint32_t, -);
+	OP(subm64) RMW(uint64_t, -);
+	OP(copy) std::memmove(A.p, B.p, IMM); NEXT();
+	OP(memcpy) std::memmove(A.p, B.p, C.u); NEXT();
+	OP(memset) std::memset(A.p, 0, C.u); NEXT();
+	OP(jmp) pc = code + IMM; DISPATCH();
+	OP(jnz) JUMP_IF(B.u);
+	OP(jz) JUMP_IF(!B.u);
+	OP(jeq) JUMP_IF(B.u == C.u);
+	OP(jne) JUMP_IF(B.u != C.u);
+	OP(jslt) JUMP_IF(B.i < C.i);
+	OP(jsle) JUMP_IF(B.i <= C.i);
+	OP(jsgt) JUMP_IF(B.i > C.i);
+	OP(jsge) JUMP_IF(B.i >= C.i);
+	OP(jult) JUMP_IF(B.u < C.u);
+	OP(jule) JUMP_IF(B.u <= C.u);
+	OP(jugt) JUMP_IF(B.u > C.u);
+	OP(juge) JUMP_IF(B.u >= C.u);
+	OP(call) {
+		const vm_lfunc_t *callee = &st.funcs[pc->b];
+		vm_reg_t *to = regs + func->nregs;
+		uint8_t *to_fp = fp + func->frame_size;
+		if (frame == frames_end || to + callee->nregs > regs_end ||
+		    to_fp + callee->frame_size > stack_end) {
+			err_msg("vm: stack overflow");
+		}
+		const uint32_t *args = func->pool + IMM;
+		for (uint32_t i = 0; i < pc->c; i++) {
+			to[i] = regs[args[i] & 0xffff];
+		}
+		std::memcpy(to + callee->nargs, callee->consts.data(),
+			    callee->consts.size() * sizeof(vm_reg_t));
+		*frame++ = { pc, func, regs, fp };
+		func = callee;
+		code = pc = callee->code;
+		regs = to;
+		fp = to_fp;
+		DISPATCH();
+	}
+	OP(tcall) {
+		const vm_lfunc_t *callee = &st.funcs[pc->b];
+		// an argument may be in the register another one goes to
+		vm_reg_t *tmp = regs + func->nregs;
+		if (tmp + pc->c > regs_end || regs + callee->nregs > regs_end ||
+		    fp + callee->frame_size > stack_end) {
+			err_msg("vm: stack overflow");
+		}
+		const uint32_t *args = func->pool + IMM;
+		for (uint32_t i = 0; i < pc->c; i++) {
+			tmp[i] = regs[args[i] & 0xffff];
+		}
+		std::memcpy(regs, tmp, pc->c * sizeof(vm_reg_t));
+		std::memcpy(regs + callee->nargs, callee->consts.data(),
+			    callee->consts.size() * sizeof(vm_reg_t));
+		func = callee;
+		code = pc = callee->code;
+		DISPATCH();
+	}
+	OP(callx)
+	OP(callxd)
+	OP(callxs) {
+		int64_t ints[6] = {};
+		double fps[8] = {};
+		int nint = 0, nfp = 0;
+		const uint32_t *args = func->pool + IMM;
+		for (uint32_t i = 0; i < pc->c; i++) {
+			const vm_reg_t &arg = regs[args[i] & 0xffff];
+			if ((args[i] & ~0xffffu) == vm_arg_int) {
+				ints[nint++] = arg.i;
+			} else {
+				// a float goes in the low half, as is
+				fps[nfp++] = arg.d;
+			}
+		}
+		void *fn = st.externs[pc->b];
+		// variadic so that a variadic callee finds the count of
+		// vector registers used in al
+		if (pc->op == vm_callx) {
+			A.i = ((int64_t(*)(...))fn)(
+				ints[0], ints[1], ints[2], ints[3], ints[4],
+				ints[5], fps[0], fps[1], fps[2], fps[3], fps[4],
+				fps[5], fps[6], fps[7]);
+		} else {
+			A.d = ((double (*)(...))fn)(
+				ints[0], ints[1], ints[2], ints[3], ints[4],
+				ints[5], fps[0], fps[1], fps[2], fps[3], fps[4],
+				fps[5], fps[6], fps[7]);
+		}
+		NEXT();
+	}
+	OP(ret) ret = B; goto do_ret;
+	OP(retv) ret.u = 0; goto do_ret;
+	default:
+		__builtin_unreachable();
+	}
+
+do_ret:
+	if (frame == st.frames.get()) {
+		return ret.i;
+	}
+	--frame;
+	pc = frame->pc;
+	func = frame->func;
+	code = func->code;
+	regs = frame->regs;
+	fp = frame->fp;
+	A = ret;
+	NEXT();
+
+#undef A
+#undef B
+#undef C
+#undef IMM
+#undef MEM
+#undef MEMX
+#undef DISPATCH
+#undef NEXT
+#undef OP
+#undef LOAD
+#undef STORE
+#undef RMW
+#undef JUMP_IF
+}
+
+int vm_run(const vm_module_t &vm, int argc, char **argv, bool threaded)
+{
+	vm_state_t st;
+	vm_load(vm, st);
+	uint32_t entry = 0;
+	while (entry < vm.funcs.size() && vm.funcs[entry].name != "main") {
+		entry++;
+	}
+	if (entry == vm.funcs.size()) {
+		err_msg("vm: no main to run");
+	}
+	vm_reg_t *regs = st.regs.get();
+	regs[0].i = argc;
+	regs[1].p = (uint8_t *)argv;
+	int64_t ret = threaded ? vm_exec<true>(st, entry) :
+				 vm_exec<false>(st, entry);
+	return (int)ret;
+}
+
+}
@@ -0,0 +1,580 @@
+/**
+ * @file x86_as.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Assemble the output of the x86 backend in memory.
+ *
+ * Only the part of GNU as syntax the backend writes is understood. A
+ * branch to a label of its own section is resolved here, every other
+ * reference is left as a fixup for the loader or the object writer.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "gen/x86.hh"
+#include "out.hh"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace neko_cc
+{
+
+static const char as_cond_names[16][3] = {
+	"o", "no", "b", "ae", "e", "ne", "be", "a",
+	"s", "ns", "p", "np", "l", "ge", "le", "g",
+};
+
+static int as_cond(std::string_view name)
+{
+	for (int i = 0; i < 16; i++) {
+		if (name == as_cond_names[i]) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static uint32_t as_size(char suffix)
+{
+	switch (suffix) {
+	case 'b':
+		return 1;
+	case 'w':
+		return 2;
+	case 'l':
+		return 4;
+	case 'q':
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+static bool as_fits8(int64_t val)
+{
+	return val >= -128 && val <= 127;
+}
+
+static std::string_view as_trim(std::string_view s)
+{
+	while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+		s.remove_prefix(1);
+	}
+	while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+		s.remove_suffix(1);
+	}
+	return s;
+}
+
+static int64_t as_number(std::string_view s)
+{
+	std::string str(s);
+	if (str[0] == '-') {
+		return std::strtoll(str.c_str(), nullptr, 10);
+	}
+	return std::strtoull(str.c_str(), nullptr, 10);
+}
+
+x86_operand_t x86_as_t::operand(std::string_view s)
+{
+	x86_operand_t ret;
+	if (s[0] == '*') {
+		ret = operand(s.substr(1));
+		ret.indirect = true;
+		return ret;
+	}
+	if (s[0] == '$') {
+		ret.kind = x86_operand_t::op_imm;
+		ret.val = as_number(s.substr(1));
+		return ret;
+	}
+	if (s[0] == '%') {
+		s.remove_prefix(1);
+		if (s.substr(0, 3) == "xmm") {
+			ret.kind = x86_operand_t::op_xmm;
+			ret.reg = as_number(s.substr(3));
+			ret.size = 16;
+			return ret;
+		}
+		ret.kind = x86_operand_t::op_reg;
+		for (int i = 0; i < 4; i++) {
+			for (int j = 0; j < 16; j++) {
+				if (s == x86_reg_name[i][j]) {
+					ret.reg = j;
+					ret.size = 1 << i;
+					return ret;
+				}
+			}
+		}
+		err_msg("as: unknown register " + std::string(s));
+	}
+	size_t paren = s.find('(');
+	if (paren == std::string_view::npos) {
+		ret.kind = x86_operand_t::op_label;
+		ret.sym = s.substr(0, s.find('@'));
+		return ret;
+	}
+	ret.kind = x86_operand_t::op_mem;
+	std::string_view disp = s.substr(0, paren);
+	std::string_view base = s.substr(paren + 1, s.size() - paren - 2);
+	if (base == "%rip") {
+		ret.reg = -1;
+		ret.sym = disp;
+		return ret;
+	}
+	ret.reg = operand(base).reg;
+	ret.val = disp.empty() ? 0 : as_number(disp);
+	return ret;
+}
+
+/**
+ * @brief Encode an instruction with a ModRM byte: the prefix, REX, the
+ * opcode, then a register or opcode extension and a register or memory
+ * operand, then the immediate.
+ */
+void x86_as_t::encode(uint8_t prefix, bool w,
+		       std::initializer_list<uint8_t> opcode, int reg,
+		       const x86_operand_t &rm, uint32_t size, int imm_size,
+		       int64_t imm)
+{
+	if (prefix) {
+		byte(prefix);
+	}
+	int base = rm.reg < 0 ? 0 : rm.reg;
+	uint8_t rex = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((base & 8) >> 3);
+	// spl, bpl, sil and dil exist only with a REX
+	bool byte_regs = size == 1 && ((reg >= 4 && reg < 8) ||
+				       (rm.kind == x86_operand_t::op_reg &&
+					rm.reg >= 4 && rm.reg < 8));
+	if (rex != 0x40 || byte_regs) {
+		byte(rex);
+	}
+	for (auto i : opcode) {
+		byte(i);
+	}
+	if (rm.kind == x86_operand_t::op_reg ||
+	    rm.kind == x86_operand_t::op_xmm) {
+		byte(0xc0 | (reg & 7) << 3 | (rm.reg & 7));
+	} else if (rm.reg < 0) {
+		byte(0x05 | (reg & 7) << 3);
+		fixup(rm.sym, 4 + imm_size);
+		fixups.back().is_data = true;
+		fixups.back().is_branch = false;
+	} else {
+		int mod = rm.val == 0 && (base & 7) != 5 ? 0 :
+			  as_fits8(rm.val)		 ? 1 :
+							   2;
+		byte(mod << 6 | (reg & 7) << 3 | (base & 7));
+		if ((base & 7) == 4) {
+			// a SIB with no index
+			byte(0x24);
+		}
+		bytes(rm.val, mod == 1 ? 1 : mod == 2 ? 4 : 0);
+	}
+	bytes(imm, imm_size);
+}
+
+void x86_as_t::line(std::string_view s)
+{
+	s = as_trim(s);
+	if (s.empty()) {
+		return;
+	}
+	// only a section directive ends a section left out
+	if (cur < 0 && (s[0] != '.' || s.back() == ':')) {
+		return;
+	}
+	if (s.back() == ':') {
+		std::string name(s.substr(0, s.size() - 1));
+		x86_label_t &label = labels[name];
+		label.sect = cur;
+		label.off = sects[cur].size();
+		return;
+	}
+	size_t space = s.find_first_of(" \t");
+	std::string_view name = s.substr(0, space);
+	std::string_view args = space == std::string_view::npos ?
+					"" :
+					as_trim(s.substr(space));
+	if (name[0] == '.') {
+		directive(name, args);
+		return;
+	}
+	std::vector<x86_operand_t> ops;
+	int depth = 0;
+	size_t beg = 0;
+	for (size_t i = 0; i <= args.size(); i++) {
+		if (i < args.size() && args[i] == '(') {
+			depth++;
+		} else if (i < args.size() && args[i] == ')') {
+			depth--;
+		} else if (i == args.size() || (args[i] == ',' && !depth)) {
+			std::string_view op = args.substr(beg, i - beg);
+			op = as_trim(op);
+			if (!op.empty()) {
+				ops.push_back(operand(op));
+			}
+			beg = i + 1;
+		}
+	}
+	inst(name, ops);
+}
+
+void x86_as_t::directive(std::string_view name, std::string_view args)
+{
+	std::string_view sym = as_trim(args.substr(0, args.find(',')));
+	std::string_view arg;
+	if (args.find(',') != std::string_view::npos) {
+		arg = as_trim(args.substr(args.find(',') + 1));
+	}
+	if (name == ".text") {
+		cur = x86_sect_text;
+	} else if (name == ".data") {
+		cur = x86_sect_data;
+	} else if (name == ".bss") {
+		cur = x86_sect_bss;
+	} else if (name == ".section") {
+		cur = args == ".rodata" ? x86_sect_rodata : -1;
+	} else if (cur < 0) {
+		return;
+	} else if (name == ".globl") {
+		labels[std::string(sym)].is_global = true;
+	} else if (name == ".type") {
+		labels[std::string(sym)].is_func = arg == "@function";
+	} else if (name == ".size") {
+		// a number, or ".-name" for a function ending here
+		x86_label_t &label = labels[std::string(sym)];
+		label.size = arg.substr(0, 2) == ".-" ?
+				     sects[cur].size() - label.off :
+				     as_number(arg);
+	} else if (name == ".p2align") {
+		size_t align = (size_t)1 << as_number(args);
+		while (sects[cur].size() % align) {
+			byte(cur == x86_sect_text ? 0x90 : 0);
+		}
+	} else if (name == ".zero") {
+		sects[cur].resize(sects[cur].size() + as_number(args));
+	} else if (name == ".byte" || name == ".short" || name == ".long" ||
+		   name == ".quad") {
+		int n = name == ".byte" ? 1 : name == ".short" ? 2 :
+				      name == ".long"	       ? 4 :
+								 8;
+		size_t beg = 0;
+		for (size_t i = 0; i <= args.size(); i++) {
+			if (i < args.size() && args[i] != ',') {
+				continue;
+			}
+			std::string_view item = args.substr(beg, i - beg);
+			item = as_trim(item);
+			beg = i + 1;
+			if (item[0] == '-' || std::isdigit(item[0])) {
+				bytes(as_number(item), n);
+				continue;
+			}
+			uint32_t at = sects[cur].size();
+			fixups.push_back({ cur, at, at, std::string(item), true,
+					   false, false });
+			bytes(0, n);
+		}
+	}
+}
+
+/**
+ * @brief Encode the integer instructions, named with a size suffix.
+ */
+bool x86_as_t::inst_int(std::string_view name, std::vector<x86_operand_t> &ops)
+{
+	static const char *const alu[] = {
+		"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp",
+	};
+	uint32_t size = as_size(name.back());
+	std::string_view base = name.substr(0, name.size() - 1);
+	uint8_t prefix = size == 2 ? 0x66 : 0;
+	bool w = size == 8;
+	uint8_t wide = size == 1 ? 0 : 1;
+	if (!size) {
+		return false;
+	}
+	x86_operand_t &dst = ops.back();
+	x86_operand_t &src = ops[0];
+
+	for (int ext = 0; ext < 8; ext++) {
+		if (base != alu[ext]) {
+			continue;
+		}
+		if (src.kind == x86_operand_t::op_imm) {
+			if (size == 1) {
+				encode(0, false, { 0x80 }, ext, dst, 1, 1,
+				       src.val);
+			} else if (as_fits8(src.val)) {
+				encode(prefix, w, { 0x83 }, ext, dst, size, 1,
+				       src.val);
+			} else {
+				encode(prefix, w, { 0x81 }, ext, dst, size,
+				       size == 2 ? 2 : 4, src.val);
+			}
+		} else if (src.kind == x86_operand_t::op_reg) {
+			encode(prefix, w, { (uint8_t)(ext * 8 + wide) },
+			       src.reg, dst, size);
+		} else {
+			encode(prefix, w, { (uint8_t)(ext * 8 + 2 + wide) },
+			       dst.reg, src, size);
+		}
+		return true;
+	}
+	if (base == "mov") {
+		if (src.kind == x86_operand_t::op_imm) {
+			encode(prefix, w, { (uint8_t)(0xc6 + wide) }, 0, dst,
+			       size, std::min<uint32_t>(size, 4), src.val);
+		} else if (src.kind == x86_operand_t::op_xmm) {
+			if (dst.kind == x86_operand_t::op_reg) {
+				encode(0x66, true, { 0x0f, 0x7e }, src.reg,
+				       dst, size);
+			} else {
+				encode(0x66, false, { 0x0f, 0xd6 }, src.reg,
+				       dst, size);
+			}
+		} else if (dst.kind == x86_operand_t::op_xmm) {
+			if (src.kind == x86_operand_t::op_reg) {
+				encode(0x66, true, { 0x0f, 0x6e }, dst.reg,
+				       src, size);
+			} else {
+				encode(0xf3, false, { 0x0f, 0x7e }, dst.reg,
+				       src, size);
+			}
+		} else if (src.kind == x86_operand_t::op_reg) {
+			encode(prefix, w, { (uint8_t)(0x88 + wide) }, src.reg,
+			       dst, size);
+		} else {
+			encode(prefix, w, { (uint8_t)(0x8a + wide) }, dst.reg,
+			       src, size);
+		}
+		return true;
+	}
+	if (base == "movabs") {
+		byte(0x48 | (dst.reg & 8) >> 3);
+		byte(0xb8 + (dst.reg & 7));
+		bytes(src.val, 8);
+		return true;
+	}
+	if (base == "lea") {
+		encode(0, true, { 0x8d }, dst.reg, src, size);
+		if (src.reg < 0) {
+			fixups.back().is_data = false;
+		}
+		return true;
+	}
+	if (base == "test") {
+		encode(prefix, w, { (uint8_t)(0x84 + wide) }, src.reg, dst,
+		       size);
+		return true;
+	}
+	if (base == "imul") {
+		if (src.kind != x86_operand_t::op_imm) {
+			encode(prefix, w, { 0x0f, 0xaf }, dst.reg, src, size);
+			return true;
+		}
+		// "imul $n, %r" is "imul $n, %r, %r"
+		const x86_operand_t &from = ops.size() == 3 ? ops[1] : dst;
+		if (as_fits8(src.val)) {
+			encode(prefix, w, { 0x6b }, dst.reg, from, size, 1,
+			       src.val);
+		} else {
+			encode(prefix, w, { 0x69 }, dst.reg, from, size, 4,
+			       src.val);
+		}
+		return true;
+	}
+	static const std::pair<const char *, int> shifts[] = {
+		{ "shl", 4 }, { "shr", 5 }, { "sar", 7 },
+	};
+	for (auto i : shifts) {
+		if (base != i.first) {
+			continue;
+		}
+		if (src.kind == x86_operand_t::op_imm) {
+			encode(prefix, w, { (uint8_t)(0xc0 + wide) }, i.second,
+			       dst, size, 1, src.val);
+		} else {
+			encode(prefix, w, { (uint8_t)(0xd2 + wide) }, i.second,
+			       dst, size);
+		}
+		return true;
+	}
+	static const std::pair<const char *, int> unary[] = {
+		{ "neg", 3 }, { "div", 6 }, { "idiv", 7 },
+	};
+	for (auto i : unary) {
+		if (base == i.first) {
+			encode(prefix, w, { (uint8_t)(0xf6 + wide) }, i.second,
+			       dst, size);
+			return true;
+		}
+	}
+	if (base == "push" || base == "pop") {
+		bool push = base == "push";
+		if (dst.kind == x86_operand_t::op_reg) {
+			if (dst.reg & 8) {
+				byte(0x41);
+			}
+			byte((push ? 0x50 : 0x58) + (dst.reg & 7));
+		} else {
+			encode(0, false, { (uint8_t)(push ? 0xff : 0x8f) },
+			       push ? 6 : 0, dst, 8);
+		}
+		return true;
+	}
+	// cmovnel and such
+	if (base.substr(0, 4) == "cmov" && as_cond(base.substr(4)) >= 0) {
+		uint8_t op = 0x40 + as_cond(base.substr(4));
+		encode(prefix, w, { 0x0f, op }, dst.reg, src, size);
+		return true;
+	}
+	// movsbl, movzwq, movslq and such, the size of the source first
+	if (base.size() == 5 && (base.substr(0, 4) == "movs" ||
+				 base.substr(0, 4) == "movz")) {
+		uint32_t from = as_size(base[4]);
+		if (from == 4) {
+			encode(0, true, { 0x63 }, dst.reg, src, from);
+			return true;
+		}
+		uint8_t op = (base[3] == 's' ? 0xbe : 0xb6) + (from == 2);
+		encode(prefix, w, { 0x0f, op }, dst.reg, src, from);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Encode the scalar SSE instructions.
+ */
+bool x86_as_t::inst_sse(std::string_view name, std::vector<x86_operand_t> &ops)
+{
+	static const std::pair<const char *, uint8_t> arith[] = {
+		{ "add", 0x58 }, { "mul", 0x59 }, { "sub", 0x5c },
+		{ "div", 0x5e }, { "mov", 0x10 },
+	};
+	x86_operand_t &dst = ops.back();
+	x86_operand_t &src = ops[0];
+	if (name == "movaps" || name == "xorps") {
+		uint8_t op = name[0] == 'm' ? 0x28 : 0x57;
+		encode(0, false, { 0x0f, op }, dst.reg, src, 16);
+		return true;
+	}
+	if (name == "ucomiss" || name == "ucomisd") {
+		encode(name.back() == 'd' ? 0x66 : 0, false, { 0x0f, 0x2e },
+		       dst.reg, src, 16);
+		return true;
+	}
+	if (name == "cvtss2sd" || name == "cvtsd2ss") {
+		encode(name[4] == 's' ? 0xf3 : 0xf2, false, { 0x0f, 0x5a },
+		       dst.reg, src, 16);
+		return true;
+	}
+	// cvttss2sil, cvttsd2siq, cvtsi2ssl, cvtsi2sdq
+	if (name.substr(0, 4) == "cvtt" && name.size() == 10) {
+		encode(name[5] == 's' ? 0xf3 : 0xf2, name[9] == 'q',
+		       { 0x0f, 0x2c }, dst.reg, src, 8);
+		return true;
+	}
+	if (name.substr(0, 5) == "cvtsi" && name.size() == 9) {
+		encode(name[7] == 's' ? 0xf3 : 0xf2, name[8] == 'q',
+		       { 0x0f, 0x2a }, dst.reg, src, 8);
+		return true;
+	}
+	if (name.size() != 5 || name[3] != 's' ||
+	    (name[4] != 's' && name[4] != 'd')) {
+		return false;
+	}
+	uint8_t prefix = name[4] == 's' ? 0xf3 : 0xf2;
+	for (auto i : arith) {
+		if (name.substr(0, 3) != i.first) {
+			continue;
+		}
+		if (i.second == 0x10 && dst.kind == x86_operand_t::op_mem) {
+			encode(prefix, false, { 0x0f, 0x11 }, src.reg, dst, 16);
+		} else {
+			encode(prefix, false, { 0x0f, i.second }, dst.reg, src,
+			       16);
+		}
+		return true;
+	}
+	return false;
+}
+
+void x86_as_t::inst(std::string_view name, std::vector<x86_operand_t> &ops)
+{
+	if (name == "ret") {
+		byte(0xc3);
+	} else if (name == "leave") {
+		byte(0xc9);
+	} else if (name == "cltd") {
+		byte(0x99);
+	} else if (name == "cqto") {
+		bytes(0x9948, 2);
+	} else if (name == "jmp" && ops[0].indirect) {
+		encode(0, false, { 0xff }, 4, ops[0], 8);
+	} else if (name == "jmp") {
+		byte(0xe9);
+		fixup(ops[0].sym, 4);
+	} else if (name == "call") {
+		if (ops[0].indirect) {
+			encode(0, false, { 0xff }, 2, ops[0], 8);
+		} else {
+			byte(0xe8);
+			fixup(ops[0].sym, 4);
+		}
+	} else if (name[0] == 'j' && as_cond(name.substr(1)) >= 0) {
+		byte(0x0f);
+		byte(0x80 + as_cond(name.substr(1)));
+		fixup(ops[0].sym, 4);
+	} else if (name.substr(0, 3) == "set" &&
+		   as_cond(name.substr(3)) >= 0) {
+		uint8_t op = 0x90 + as_cond(name.substr(3));
+		encode(0, false, { 0x0f, op }, 0, ops[0], 1);
+	} else if (!inst_sse(name, ops) && !inst_int(name, ops)) {
+		err_msg("as: unknown instruction " + std::string(name));
+	}
+}
+
+void x86_as_t::assemble(std::string_view text)
+{
+	while (!text.empty()) {
+		size_t eol = text.find('\n');
+		line(text.substr(0, eol));
+		text.remove_prefix(eol == std::string_view::npos ? text.size() :
+								   eol + 1);
+	}
+	resolve();
+}
+
+const x86_label_t *x86_as_t::get_label(const std::string &name) const
+{
+	auto it = labels.find(name);
+	if (it == labels.end() || it->second.sect < 0) {
+		return nullptr;
+	}
+	return &it->second;
+}
+
+void x86_as_t::resolve()
+{
+	size_t n = 0;
+	for (const auto &i : fixups) {
+		const x86_label_t *label = get_label(i.sym);
+		if (i.is_abs || !label || label->sect != i.sect) {
+			fixups[n++] = i;
+			continue;
+		}
+		int32_t rel = label->off - i.end;
+		std::memcpy(sects[i.sect].data() + i.at, &rel, sizeof(rel));
+	}
+	fixups.resize(n);
+}
+
+}
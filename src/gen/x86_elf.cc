@@ -0,0 +1,308 @@
+/**
+ * @file x86_elf.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Output the x86 backend as an ELF64 relocatable object.
+ *
+ * The assembly of each function is kept until the module ends, then the
+ * whole unit is assembled at once and written with its symbol table and
+ * relocations, ready for the linker. The references the assembler could
+ * resolve itself, branches within a section, leave no relocation.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "gen/x86.hh"
+#include "out.hh"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace neko_cc
+{
+
+enum elf_shdr_t {
+	elf_null,
+	// the sections of the assembler, in its order
+	elf_text,
+	elf_rodata,
+	elf_data,
+	elf_bss,
+	elf_note,
+	elf_symtab,
+	elf_strtab,
+	elf_rela_text,
+	elf_rela_rodata,
+	elf_rela_data,
+	elf_shstrtab,
+	elf_shdr_cnt
+};
+
+enum elf_reloc_t {
+	r_x86_64_64 = 1,
+	r_x86_64_pc32 = 2,
+	r_x86_64_plt32 = 4,
+};
+
+struct elf_sym_t {
+	uint32_t name;
+	uint8_t info;
+	uint16_t shndx;
+	uint64_t value;
+	uint64_t size;
+};
+
+struct elf_writer_t {
+	x86_as_t &as;
+	std::string buf;
+	std::string strtab = std::string(1, '\0');
+	std::vector<elf_sym_t> syms;
+	std::unordered_map<std::string, uint32_t> sym_ids;
+	uint32_t first_global = 0;
+	// entries of .rela.text, .rela.rodata and .rela.data
+	std::string relas[3];
+
+	elf_writer_t(x86_as_t &as) : as(as)
+	{
+	}
+
+	static void put(std::string &to, uint64_t val, int n)
+	{
+		for (int i = 0; i < n; i++) {
+			to.push_back(val >> (i * 8));
+		}
+	}
+	uint32_t add_str(std::string &to, std::string_view s)
+	{
+		uint32_t ret = to.size();
+		to.append(s);
+		to.push_back('\0');
+		return ret;
+	}
+	void add_sym(const std::string &name, uint8_t info, uint16_t shndx,
+		     uint64_t value, uint64_t size)
+	{
+		sym_ids.emplace(name, syms.size());
+		uint32_t str = add_str(strtab, name);
+		syms.push_back({ str, info, shndx, value, size });
+	}
+	void symbols();
+	void relocations();
+	void write(writer_t &out);
+};
+
+/**
+ * @brief Lay out the symbols, the locals first as ELF requires: the null
+ * one, one per section, then the labels. Labels starting with ".L" stay
+ * out of the table, as with GNU as.
+ */
+void elf_writer_t::symbols()
+{
+	syms.push_back({ 0, 0, 0, 0, 0 });
+	for (int i = 0; i < x86_sect_cnt; i++) {
+		// local STT_SECTION
+		syms.push_back({ 0, 3, (uint16_t)(elf_text + i), 0, 0 });
+	}
+	typedef std::pair<const std::string, x86_label_t> label_t;
+	std::vector<const label_t *> locals;
+	std::vector<const label_t *> globals;
+	for (const auto &i : as.labels) {
+		if (i.second.sect < 0) {
+			continue;
+		}
+		if (i.second.is_global) {
+			globals.push_back(&i);
+		} else if (i.first.compare(0, 2, ".L")) {
+			locals.push_back(&i);
+		}
+	}
+	auto by_addr = [](const label_t *a, const label_t *b) {
+		if (a->second.sect != b->second.sect) {
+			return a->second.sect < b->second.sect;
+		}
+		return a->second.off < b->second.off;
+	};
+	std::sort(locals.begin(), locals.end(), by_addr);
+	std::sort(globals.begin(), globals.end(), by_addr);
+	for (int bind = 0; bind < 2; bind++) {
+		if (bind) {
+			first_global = syms.size();
+		}
+		for (auto i : bind ? globals : locals) {
+			const x86_label_t &label = i->second;
+			// STT_FUNC, or STT_OBJECT out of the text
+			uint8_t type = label.is_func		 ? 2 :
+				       label.sect != x86_sect_text ? 1 :
+								     0;
+			add_sym(i->first, bind << 4 | type,
+				elf_text + label.sect, label.off, label.size);
+		}
+	}
+	for (const auto &i : as.fixups) {
+		if (!as.get_label(i.sym) && !sym_ids.count(i.sym)) {
+			// global STT_NOTYPE, SHN_UNDEF
+			add_sym(i.sym, 1 << 4, 0, 0, 0);
+		}
+	}
+}
+
+/**
+ * @brief Turn the fixups left by the assembler into relocations. A local
+ * label is referred to by its section, the others by their own symbol.
+ */
+void elf_writer_t::relocations()
+{
+	for (const auto &i : as.fixups) {
+		const x86_label_t *label = as.get_label(i.sym);
+		int64_t addend = i.is_abs ? 0 : -(int64_t)(i.end - i.at);
+		uint32_t sym;
+		if (label && !label->is_global) {
+			sym = 1 + label->sect;
+			addend += label->off;
+		} else {
+			sym = sym_ids[i.sym];
+		}
+		uint32_t type = i.is_abs ? r_x86_64_64 :
+				i.is_branch && !label ? r_x86_64_plt32 :
+							 r_x86_64_pc32;
+		if (i.sect == x86_sect_bss) {
+			err_msg("elf: relocation in .bss");
+		}
+		std::string &to = relas[i.sect];
+		put(to, i.at, 8);
+		put(to, (uint64_t)sym << 32 | type, 8);
+		put(to, addend, 8);
+	}
+}
+
+void elf_writer_t::write(writer_t &out)
+{
+	symbols();
+	relocations();
+
+	std::string symtab;
+	for (const auto &i : syms) {
+		put(symtab, i.name, 4);
+		put(symtab, i.info, 1);
+		put(symtab, 0, 1);
+		put(symtab, i.shndx, 2);
+		put(symtab, i.value, 8);
+		put(symtab, i.size, 8);
+	}
+
+	struct shdr_t {
+		const char *name;
+		uint32_t type;
+		uint64_t flags;
+		const std::string *data;
+		uint64_t size;
+		uint32_t link;
+		uint32_t info;
+		uint64_t align;
+		uint64_t entsize;
+	};
+	// SHT_PROGBITS 1, SHT_SYMTAB 2, SHT_STRTAB 3, SHT_RELA 4, SHT_NOBITS 8
+	// SHF_WRITE 1, SHF_ALLOC 2, SHF_EXECINSTR 4, SHF_INFO_LINK 0x40
+	std::string sect_data[x86_sect_cnt];
+	for (int i = 0; i < x86_sect_cnt; i++) {
+		sect_data[i].assign(as.sects[i].begin(), as.sects[i].end());
+	}
+	std::string empty;
+	std::string shstrtab;
+	const shdr_t shdrs[elf_shdr_cnt] = {
+		{ "", 0, 0, &empty, 0, 0, 0, 0, 0 },
+		{ ".text", 1, 6, &sect_data[x86_sect_text], 0, 0, 0, 16, 0 },
+		{ ".rodata", 1, 2, &sect_data[x86_sect_rodata], 0, 0, 0, 16,
+		  0 },
+		{ ".data", 1, 3, &sect_data[x86_sect_data], 0, 0, 0, 16, 0 },
+		{ ".bss", 8, 3, &empty, as.sects[x86_sect_bss].size(), 0, 0,
+		  16, 0 },
+		{ ".note.GNU-stack", 1, 0, &empty, 0, 0, 0, 1, 0 },
+		{ ".symtab", 2, 0, &symtab, 0, elf_strtab, first_global, 8,
+		  24 },
+		{ ".strtab", 3, 0, &strtab, 0, 0, 0, 1, 0 },
+		{ ".rela.text", 4, 0x40, &relas[x86_sect_text], 0, elf_symtab,
+		  elf_text, 8, 24 },
+		{ ".rela.rodata", 4, 0x40, &relas[x86_sect_rodata], 0,
+		  elf_symtab, elf_rodata, 8, 24 },
+		{ ".rela.data", 4, 0x40, &relas[x86_sect_data], 0, elf_symtab,
+		  elf_data, 8, 24 },
+		{ ".shstrtab", 3, 0, &shstrtab, 0, 0, 0, 1, 0 },
+	};
+	uint32_t shnames[elf_shdr_cnt];
+	shstrtab.push_back('\0');
+	for (int i = 1; i < elf_shdr_cnt; i++) {
+		shnames[i] = add_str(shstrtab, shdrs[i].name);
+	}
+	shnames[0] = 0;
+
+	// the header, then the sections, then their headers
+	buf.assign("\x7f"
+		   "ELF\x02\x01\x01",
+		   7);
+	buf.resize(16, '\0');
+	put(buf, 1, 2); // ET_REL
+	put(buf, 62, 2); // EM_X86_64
+	put(buf, 1, 4);
+	put(buf, 0, 8); // no entry
+	put(buf, 0, 8); // no program headers
+	size_t shoff_at = buf.size();
+	put(buf, 0, 8);
+	put(buf, 0, 4);
+	put(buf, 64, 2);
+	put(buf, 0, 2);
+	put(buf, 0, 2);
+	put(buf, 64, 2);
+	put(buf, elf_shdr_cnt, 2);
+	put(buf, elf_shstrtab, 2);
+
+	uint64_t offs[elf_shdr_cnt] = {};
+	for (int i = 1; i < elf_shdr_cnt; i++) {
+		buf.resize((buf.size() + shdrs[i].align - 1) /
+				   shdrs[i].align * shdrs[i].align,
+			   '\0');
+		offs[i] = buf.size();
+		buf.append(*shdrs[i].data);
+	}
+	buf.resize((buf.size() + 7) / 8 * 8, '\0');
+	uint64_t shoff = buf.size();
+	for (int i = 0; i < 8; i++) {
+		buf[shoff_at + i] = shoff >> (i * 8);
+	}
+	for (int i = 0; i < elf_shdr_cnt; i++) {
+		const shdr_t &s = shdrs[i];
+		put(buf, shnames[i], 4);
+		put(buf, s.type, 4);
+		put(buf, s.flags, 8);
+		put(buf, 0, 8);
+		put(buf, offs[i], 8);
+		put(buf, s.size ? s.size : s.data->size(), 8);
+		put(buf, s.link, 4);
+		put(buf, s.info, 4);
+		put(buf, s.align, 8);
+		put(buf, s.entsize, 8);
+	}
+	out.append(buf);
+}
+
+// the assembly of the functions so far
+static writer_t elf_asm;
+
+void ir_output_func(writer_t &, ir_module_t &mod, ir_func_t &func)
+{
+	x86_output_func(elf_asm, mod, func);
+}
+
+void ir_output_module(writer_t &out, ir_module_t &mod)
+{
+	x86_output_module(elf_asm, mod);
+	x86_as_t as;
+	as.assemble(elf_asm.view());
+	elf_asm.clear();
+	elf_writer_t writer(as);
+	writer.write(out);
+}
+
+}
@@ -0,0 +1,116 @@
+/**
+ * @file x86_jit.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Load the output of the x86 backend in memory and run it.
+ *
+ * The sections are laid out in one mapping, so references between them
+ * are always in reach of a 32-bit displacement. Functions of libc may be
+ * anywhere in the address space, a call or an address taken of one goes
+ * through a stub jumping to what dlsym gives.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "gen/x86.hh"
+#include "out.hh"
+
+#include <cstring>
+#include <dlfcn.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace neko_cc
+{
+
+int x86_jit_run(std::string_view text, int argc, char **argv)
+{
+	x86_as_t as;
+	as.assemble(text);
+
+	// a stub for each symbol not defined here, "jmp *0(%rip)" then the
+	// address
+	std::unordered_map<std::string, uintptr_t> addrs;
+	std::unordered_map<std::string, uint32_t> stubs;
+	as.cur = x86_sect_text;
+	for (const auto &i : as.fixups) {
+		if (as.get_label(i.sym) || stubs.count(i.sym)) {
+			continue;
+		}
+		void *addr = dlsym(RTLD_DEFAULT, i.sym.c_str());
+		if (!addr) {
+			err_msg("jit: undefined symbol " + i.sym);
+		}
+		addrs.emplace(i.sym, (uintptr_t)addr);
+		stubs.emplace(i.sym, as.sects[x86_sect_text].size());
+		as.bytes(0x25ff, 2);
+		as.bytes(0, 4);
+		as.bytes((uintptr_t)addr, 8);
+	}
+
+	// the text in pages of its own, the other sections after it
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t offs[x86_sect_cnt];
+	size_t size = 0;
+	for (int i = 0; i < x86_sect_cnt; i++) {
+		offs[i] = size;
+		size += (as.sects[i].size() + 15) / 16 * 16;
+		if (i == x86_sect_text) {
+			size = (size + page) / page * page;
+		}
+	}
+	void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		err_msg("jit: cannot map memory");
+	}
+	uint8_t *bases[x86_sect_cnt];
+	for (int i = 0; i < x86_sect_cnt; i++) {
+		bases[i] = (uint8_t *)map + offs[i];
+		std::memcpy(bases[i], as.sects[i].data(), as.sects[i].size());
+	}
+	for (const auto &i : as.fixups) {
+		uint8_t *at = bases[i.sect] + i.at;
+		uintptr_t end = (uintptr_t)(bases[i.sect] + i.end);
+		const x86_label_t *label = as.get_label(i.sym);
+		uintptr_t target;
+		if (label) {
+			target = (uintptr_t)(bases[label->sect] + label->off);
+		} else {
+			// straight to the symbol if in reach
+			target = addrs[i.sym];
+			int64_t dist = target - end;
+			if (!i.is_abs && dist != (int32_t)dist) {
+				if (i.is_data) {
+					err_msg("jit: " + i.sym +
+						" is out of reach");
+				}
+				target = (uintptr_t)(bases[x86_sect_text] +
+						     stubs[i.sym]);
+			}
+		}
+		if (i.is_abs) {
+			std::memcpy(at, &target, sizeof(target));
+			continue;
+		}
+		int32_t rel = target - end;
+		std::memcpy(at, &rel, sizeof(rel));
+	}
+	if (mprotect(map, offs[x86_sect_text + 1], PROT_READ | PROT_EXEC)) {
+		err_msg("jit: cannot make the code executable");
+	}
+
+	const x86_label_t *entry = as.get_label("main");
+	if (!entry || entry->sect != x86_sect_text) {
+		err_msg("jit: no main to run");
+	}
+	auto main_fn = (int (*)(int, char **))(bases[x86_sect_text] +
+					       entry->off);
+	// the mapping is left in place, functions in it may still be called
+	// at exit
+	return main_fn(argc, argv);
+}
+
+}
@@ -0,0 +1,25 @@
+/**
+ * @file x86_text.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ * @brief Output the x86 assembly as is.
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "gen/x86.hh"
+
+namespace neko_cc
+{
+
+void ir_output_func(writer_t &out, ir_module_t &mod, ir_func_t &func)
+{
+	x86_output_func(out, mod, func);
+}
+
+void ir_output_module(writer_t &out, ir_module_t &mod)
+{
+	x86_output_module(out, mod);
+}
+
+}
@@ -6,6 +6,8 @@
  * 
  */
 
+#include <algorithm>
+#include <charconv>
 #include <deque>
 
 #include "parse/parse_top_down.hh"
@@ -49,7 +51,9 @@ void match(int tok, stream &ss)
 std::string get_label()
 {
 	static size_t label_cnt = 0;
-	return "L" + std::to_string(++label_cnt);
+	char buf[24] = "L";
+	auto res = std::to_chars(buf + 1, buf + sizeof(buf), ++label_cnt);
+	return std::string(buf, res.ptr);
 }
 
 std::string get_unnamed_var_name()
@@ -58,6 +62,12 @@ std::string get_unnamed_var_name()
 	return std::string("unnamed_var_") + std::to_string(++unnamed_var_cnt);
 }
 
+size_t get_def_id()
+{
+	static size_t def_cnt = 0;
+	return ++def_cnt;
+}
+
 std::string get_ptr_type_name(std::string base_name)
 {
 	return base_name + "_ptr";
@@ -130,6 +140,24 @@ bool is_type_p(const type_t &type)
 	return type.type == type_t::type_pointer ||
 	       type.type == type_t::type_array;
 }
+size_t get_type_align(const type_t &type)
+{
+	if (type.type == type_t::type_array) {
+		return get_type_align(*type.ptr_to);
+	}
+	if (type.type == type_t::type_struct ||
+	    type.type == type_t::type_union) {
+		size_t align = 1;
+		for (const auto &i : type.inner_vars) {
+			align = std::max(align, get_type_align(*i.type));
+		}
+		return align;
+	}
+	if (type.type == type_t::type_pointer) {
+		return 8;
+	}
+	return std::max(type.size, (size_t)1);
+}
 void try_regulate_basic(stream &ss, type_t &type)
 {
 	if (type.has_signed && type.is_unsigned) {
@@ -205,7 +233,8 @@ void try_regulate_basic(stream &ss, type_t &type)
 
 bool is_type_qualifier(tok_t tok)
 {
-	return tok.type == tok_const || tok.type == tok_volatile;
+	return tok.type == tok_const || tok.type == tok_volatile ||
+	       tok.type == tok_restrict;
 }
 
 bool is_selection_statement(tok_t tok)
@@ -219,6 +248,11 @@ bool is_iteration_statement(tok_t tok)
 	       tok.type == tok_for;
 }
 
+bool is_labeled_statement(tok_t tok)
+{
+	return tok.type == tok_case || tok.type == tok_default;
+}
+
 bool is_jump_statement(tok_t tok)
 {
 	return tok.type == tok_continue || tok.type == tok_break ||
@@ -22,6 +22,7 @@
 #include "parse/parse_top_down.hh"
 #include "gen.hh"
 #include "util.hh"
+#include "writer.hh"
 
 namespace neko_cc
 {
@@ -29,8 +30,8 @@ using std::make_shared;
 
 std::unordered_map<size_t, type_t> glbl_type_map;
 
-stream *out_ss;
-string post_decl;
+writer_t *out_ss;
+writer_t post_decl;
 
 /*
 translation_unit
@@ -40,8 +41,9 @@ void translation_unit(stream &ss, stream &out)
 {
 	debug();
 
-	out_ss = &out;
-	post_decl = "";
+	writer_t out_writer(out);
+	out_ss = &out_writer;
+	post_decl.clear();
 
 	context_t ctx(nullptr, {}, {});
 	fun_env_t global_fun_env;
@@ -52,7 +54,11 @@ void translation_unit(stream &ss, stream &out)
 		external_declaration(ss, ctx);
 	}
 
-	*out_ss << post_decl;
+	*out_ss << post_decl.view();
+	auto emit_tmp = emit_module_end();
+	*out_ss << emit_tmp.code;
+	out_ss->flush();
+	out_ss = nullptr;
 }
 
 /*
@@ -153,7 +159,7 @@ void function_definition(stream &ss, context_t &ctx, var_t function,
 	auto emit_tmp = emit_func_begin(function, input_args);
 	*out_ss << emit_tmp.code;
 	for (size_t i = 0; i < args.size(); i++) {
-		auto tmp = emit_alloca(*input_args[i].type, input_args[i].name);
+		auto tmp = emit_alloca(*input_args[i].type, args[i].name);
 		args[i] = tmp.var;
 		*out_ss << tmp.code;
 		emit_tmp = emit_store(args[i], input_args[i]);
@@ -196,6 +202,9 @@ int constant_expression(stream &ss, context_t &ctx)
 		tok_t tok = get_tok(ss);
 		return std::stoi(tok.str);
 	}
+	if (nxt_tok(ss).type == tok_sizeof) {
+		return sizeof_expression(ss, ctx);
+	}
 	if (nxt_tok(ss).type == tok_ident) {
 		tok_t tok = get_tok(ss);
 		int enum_val = ctx.get_enum(tok.str);
@@ -293,6 +302,9 @@ void declaration_specifiers(stream &ss, context_t &ctx, type_t &type)
 	if (type.type == type_t::type_unknown) {
 		error("Type specifier expected", ss, true);
 	}
+	if (type.is_restrict && type.type != type_t::type_pointer) {
+		error("Restrict requires a pointer type", ss, true);
+	}
 	if (type.type == type_t::type_basic) {
 		try_regulate_basic(ss, type);
 	}
@@ -485,6 +497,7 @@ void type_specifier(stream &ss, context_t &ctx, type_t &type)
 		prev_type.is_register = type.is_register;
 		prev_type.is_const = type.is_const;
 		prev_type.is_volatile = type.is_volatile;
+		prev_type.is_restrict = type.is_restrict;
 		type = prev_type;
 	}
 }
@@ -522,6 +535,7 @@ void struct_or_union_specifier(stream &ss, context_t &ctx, type_t &type)
 		type.name = tok.str;
 		if (nxt_tok(ss).type == '{') {
 			match('{', ss);
+			type.def_id = get_def_id();
 			struct_declaration_list(ss, ctx, type);
 			match('}', ss);
 
@@ -536,12 +550,14 @@ void struct_or_union_specifier(stream &ss, context_t &ctx, type_t &type)
 			prev_type.is_register = type.is_register;
 			prev_type.is_const = type.is_const;
 			prev_type.is_volatile = type.is_volatile;
+			prev_type.is_restrict = type.is_restrict;
 			type = prev_type;
 		}
 	} else if (nxt_tok(ss).type == '{') {
 		type.name = get_unnamed_var_name();
 		type.is_unnamed = true;
 		match('{', ss);
+		type.def_id = get_def_id();
 		struct_declaration_list(ss, ctx, type);
 		match('}', ss);
 	}
@@ -549,7 +565,7 @@ void struct_or_union_specifier(stream &ss, context_t &ctx, type_t &type)
 
 /*
 type_qualifier
-	CONST | VOLATILE
+	CONST | VOLATILE | RESTRICT
 */
 void type_qualifier(stream &ss, context_t &unused(ctx), type_t &type)
 {
@@ -564,6 +580,8 @@ void type_qualifier(stream &ss, context_t &unused(ctx), type_t &type)
 		type.is_const = true;
 	} else if (tok.type == tok_volatile) {
 		type.is_volatile = true;
+	} else if (tok.type == tok_restrict) {
+		type.is_restrict = true;
 	}
 }
 
@@ -614,6 +632,7 @@ std::vector<var_t> direct_declarator(stream &ss, context_t &ctx,
 	}
 
 	bool is_arr = false, is_func = false;
+	std::vector<int> arr_lens;
 	while (nxt_tok(ss).type == '[' || nxt_tok(ss).type == '(') {
 		if (nxt_tok(ss).type == '[') {
 			if (is_func) {
@@ -621,26 +640,11 @@ std::vector<var_t> direct_declarator(stream &ss, context_t &ctx,
 			}
 			match('[', ss);
 			is_arr = true;
-			int arr_len = 0;
+			int arr_len = -1;
 			if (nxt_tok(ss).type != ']') {
 				arr_len = constant_expression(ss, ctx);
-				std::shared_ptr<type_t> arr_type =
-					make_shared<type_t>();
-				arr_type->name = get_ptr_type_name(type->name);
-				arr_type->type = type_t::type_array;
-				arr_type->size = type->size * arr_len;
-				arr_type->ptr_to = make_shared<type_t>(*type);
-				*type = *arr_type;
-			} else {
-				std::shared_ptr<type_t> arr_type =
-					make_shared<type_t>();
-				arr_type->name = get_ptr_type_name(type->name);
-				arr_type->type = type_t::type_pointer;
-				arr_type->size = 0;
-				arr_type->ptr_to = make_shared<type_t>(*type);
-				*type = *arr_type;
 			}
-
+			arr_lens.push_back(arr_len);
 			match(']', ss);
 		} else {
 			if (is_arr) {
@@ -672,6 +676,22 @@ std::vector<var_t> direct_declarator(stream &ss, context_t &ctx,
 		}
 	}
 
+	// 'T a[n][m]' is an array of n arrays of m, so the last one is
+	// the innermost
+	for (auto i = arr_lens.rbegin(); i != arr_lens.rend(); i++) {
+		std::shared_ptr<type_t> arr_type = make_shared<type_t>();
+		arr_type->name = get_ptr_type_name(type->name);
+		if (*i >= 0) {
+			arr_type->type = type_t::type_array;
+			arr_type->size = type->size * *i;
+		} else {
+			arr_type->type = type_t::type_pointer;
+			arr_type->size = 0;
+		}
+		arr_type->ptr_to = make_shared<type_t>(*type);
+		*type = *arr_type;
+	}
+
 	if (hit_ident) {
 		var.type = type;
 	}
@@ -782,6 +802,7 @@ std::vector<var_t> direct_abstract_declarator(stream &ss, context_t &ctx,
 	}
 
 	bool is_arr = false, is_func = false;
+	std::vector<int> arr_lens;
 	while (nxt_tok(ss).type == '[' || nxt_tok(ss).type == '(') {
 		if (nxt_tok(ss).type == '[') {
 			if (is_func) {
@@ -789,25 +810,11 @@ std::vector<var_t> direct_abstract_declarator(stream &ss, context_t &ctx,
 			}
 			match('[', ss);
 			is_arr = true;
-			int arr_len = 0;
+			int arr_len = -1;
 			if (nxt_tok(ss).type != ']') {
 				arr_len = constant_expression(ss, ctx);
-				std::shared_ptr<type_t> arr_type =
-					make_shared<type_t>();
-				arr_type->name = get_ptr_type_name(type->name);
-				arr_type->type = type_t::type_array;
-				arr_type->size = type->size * arr_len;
-				arr_type->ptr_to = make_shared<type_t>(*type);
-				*type = *arr_type;
-			} else {
-				std::shared_ptr<type_t> arr_type =
-					make_shared<type_t>();
-				arr_type->name = get_ptr_type_name(type->name);
-				arr_type->type = type_t::type_pointer;
-				arr_type->size = 0;
-				arr_type->ptr_to = make_shared<type_t>(*type);
-				*type = *arr_type;
 			}
+			arr_lens.push_back(arr_len);
 			match(']', ss);
 		} else {
 			if (is_arr) {
@@ -839,6 +846,22 @@ std::vector<var_t> direct_abstract_declarator(stream &ss, context_t &ctx,
 		}
 	}
 
+	// 'T a[n][m]' is an array of n arrays of m, so the last one is
+	// the innermost
+	for (auto i = arr_lens.rbegin(); i != arr_lens.rend(); i++) {
+		std::shared_ptr<type_t> arr_type = make_shared<type_t>();
+		arr_type->name = get_ptr_type_name(type->name);
+		if (*i >= 0) {
+			arr_type->type = type_t::type_array;
+			arr_type->size = type->size * *i;
+		} else {
+			arr_type->type = type_t::type_pointer;
+			arr_type->size = 0;
+		}
+		arr_type->ptr_to = make_shared<type_t>(*type);
+		*type = *arr_type;
+	}
+
 	if (hit_ident) {
 		var.type = type;
 	}
@@ -892,96 +915,462 @@ var_t parameter_declaration(stream &ss, context_t &ctx)
 /*
 initializer
 	{assignment_expression} | '{' initializer_list '}'
+
+Scalars in function scope are stored directly. Anything else is first
+read into an init_t: a global gets it as one constant, and a local
+aggregate is copied from a private constant in bulk, leaving only the
+non-constant parts to be stored one by one.
+*/
+static bool is_init_aggregate(const init_t &init)
+{
+	return init.type->type == type_t::type_array ||
+	       init.type->type == type_t::type_struct;
+}
+
+static init_t make_zero_init(std::shared_ptr<type_t> type)
+{
+	init_t init;
+	init.type = type;
+	if (type->type == type_t::type_array && type->ptr_to->size) {
+		size_t len = type->size / type->ptr_to->size;
+		init.inner.assign(len, make_zero_init(type->ptr_to));
+	} else if (type->type == type_t::type_struct) {
+		for (auto &i : type->inner_vars) {
+			init.inner.push_back(make_zero_init(i.type));
+		}
+	}
+	return init;
+}
+
+static void update_init(init_t &init)
+{
+	if (!is_init_aggregate(init)) {
+		return;
+	}
+	init.is_zero = true;
+	init.is_const = true;
+	for (auto &i : init.inner) {
+		update_init(i);
+		init.is_zero &= i.is_zero;
+		init.is_const &= i.is_const;
+	}
+}
+
+static bool is_init_runtime(const init_t &init)
+{
+	if (!is_init_aggregate(init)) {
+		return !init.is_const;
+	}
+	for (const auto &i : init.inner) {
+		if (!is_init_runtime(i)) {
+			return false;
+		}
+	}
+	return !init.inner.empty();
+}
+
+static var_t string_literal(const string &str)
+{
+	string val = get_string_val(str);
+	type_t char_type;
+	char_type.type = type_t::type_basic;
+	char_type.name = "i8";
+	char_type.size = 1;
+	char_type.is_char = true;
+	type_t arr_type;
+	arr_type.type = type_t::type_array;
+	arr_type.name = get_ptr_type_name(char_type.name);
+	arr_type.size = char_type.size * (val.size() + 1);
+	arr_type.ptr_to = make_shared<type_t>(char_type);
+	var_t var;
+	var.type = make_shared<type_t>(arr_type);
+	var.name = '@' + get_unnamed_var_name();
+	auto tmp = emit_global_const_decl(
+		var, get_string_repr(val, val.size() + 1));
+	post_decl << tmp.code;
+	return tmp.var;
+}
+
+static bool put_back_tok(std::stack<tok_t> &store)
+{
+	while (!store.empty()) {
+		unget_tok(store.top());
+		store.pop();
+	}
+	return false;
+}
+
+/*
+Try to read a constant scalar, which must end right before ',', '}'
+or ';'. Tokens are put back if it is not.
+*/
+static bool const_initializer(stream &ss, context_t &ctx, init_t &init)
+{
+	const type_t &type = *init.type;
+	std::stack<tok_t> store;
+	bool neg = false, has_sign = false;
+	if (nxt_tok(ss).type == '-' || nxt_tok(ss).type == '+') {
+		neg = nxt_tok(ss).type == '-';
+		has_sign = true;
+		store.push(get_tok(ss));
+	}
+	tok_t tok = get_tok(ss);
+	store.push(tok);
+
+	string val;
+	bool is_zero = false;
+	if (tok.type == tok_int_lit ||
+	    (tok.type == tok_ident && ctx.get_enum(tok.str) != -1)) {
+		long long v = tok.type == tok_int_lit ? std::stoll(tok.str) :
+							ctx.get_enum(tok.str);
+		v = neg ? -v : v;
+		is_zero = v == 0;
+		if (is_type_i(type)) {
+			val = get_int_repr(v, type);
+		} else if (is_type_f(type)) {
+			val = get_float_repr((double)v, type);
+		} else if (is_type_p(type) && is_zero) {
+			val = "null";
+		} else {
+			return put_back_tok(store);
+		}
+	} else if (tok.type == tok_float_lit) {
+		double v = std::stod(tok.str);
+		v = neg ? -v : v;
+		if (is_type_i(type)) {
+			is_zero = (long long)v == 0;
+			val = get_int_repr((long long)v, type);
+		} else if (is_type_f(type)) {
+			is_zero = v == 0 && !neg;
+			val = get_float_repr(v, type);
+		} else {
+			return put_back_tok(store);
+		}
+	} else if (has_sign || !is_type_p(type)) {
+		return put_back_tok(store);
+	} else if (tok.type == tok_null) {
+		is_zero = true;
+		val = "null";
+	} else if (tok.type == tok_string_lit) {
+		val = string_literal(tok.str).name;
+	} else if (tok.type == '&' || tok.type == tok_ident) {
+		// address of a global, or a global array / function
+		if (tok.type == '&') {
+			tok = get_tok(ss);
+			store.push(tok);
+		}
+		if (tok.type != tok_ident) {
+			return put_back_tok(store);
+		}
+		var_t var = ctx.get_var('@' + tok.str);
+		if (var.type->type == type_t::type_unknown ||
+		    (store.size() == 1 && var.is_alloced)) {
+			return put_back_tok(store);
+		}
+		val = var.name;
+	} else {
+		return put_back_tok(store);
+	}
+
+	if (nxt_tok(ss).type != ',' && nxt_tok(ss).type != '}' &&
+	    nxt_tok(ss).type != ';') {
+		return put_back_tok(store);
+	}
+	init.val = val;
+	init.is_zero = is_zero;
+	init.is_const = true;
+	return true;
+}
+
+static void scalar_initializer(stream &ss, context_t &ctx, init_t &init)
+{
+	if (init.type->type == type_t::type_union) {
+		error("Union initializer is not supported", ss, true);
+	}
+	if (const_initializer(ss, ctx, init)) {
+		return;
+	}
+	if (!ctx.fun_env->is_func) {
+		error("Initializer must be constant", ss, true);
+	}
+	var_t rs = assignment_expression(ss, ctx);
+	if (rs.is_alloced) {
+		auto emit_tmp = emit_load(rs);
+		*out_ss << emit_tmp.code;
+		rs = emit_tmp.var;
+	}
+	auto emit_tmp = emit_conv_to(rs, *init.type);
+	*out_ss << emit_tmp.code;
+	init.var = emit_tmp.var;
+	init.is_zero = true;
+	init.is_const = false;
+}
+
+static size_t designator(stream &ss, context_t &ctx, init_t &init,
+			 bool is_unsized)
+{
+	if (nxt_tok(ss).type == '[') {
+		match('[', ss);
+		if (init.type->type != type_t::type_array) {
+			error("Array designator on non-array type", ss, true);
+		}
+		int idx = constant_expression(ss, ctx);
+		match(']', ss);
+		if (idx < 0 || ((size_t)idx >= init.inner.size() &&
+				!is_unsized)) {
+			error("Array designator out of bound", ss, true);
+		}
+		if ((size_t)idx >= init.inner.size()) {
+			init.inner.resize(idx + 1,
+					  make_zero_init(init.type->ptr_to));
+		}
+		return idx;
+	}
+	match('.', ss);
+	tok_t tok = get_tok(ss);
+	if (tok.type != tok_ident) {
+		error("Identifier expected", ss, true);
+	}
+	if (init.type->type != type_t::type_struct) {
+		error("Member designator on non-struct type", ss, true);
+	}
+	for (size_t i = 0; i < init.type->inner_vars.size(); i++) {
+		if (init.type->inner_vars[i].name == tok.str) {
+			return i;
+		}
+	}
+	error("Unknown member", ss, true);
+}
+
+static void initializer_elem(stream &ss, context_t &ctx, init_t &init,
+			     bool is_unsized);
+
+/*
+initializer_list
+	designation? initializer {',' designation? initializer}* {','}?
+
+designation
+	{'[' constant_expression ']' | '.' IDENTIFIER}+ '='
+*/
+static void initializer_list(stream &ss, context_t &ctx, init_t &init,
+			     bool is_unsized)
+{
+	size_t pos = 0;
+	while (nxt_tok(ss).type != '}') {
+		if (nxt_tok(ss).type == '[' || nxt_tok(ss).type == '.') {
+			pos = designator(ss, ctx, init, is_unsized);
+			init_t *target = &init.inner[pos];
+			while (nxt_tok(ss).type == '[' ||
+			       nxt_tok(ss).type == '.') {
+				size_t idx = designator(ss, ctx, *target,
+							false);
+				target = &target->inner[idx];
+			}
+			match('=', ss);
+			initializer_elem(ss, ctx, *target, false);
+		} else {
+			if (pos >= init.inner.size() && !is_unsized) {
+				error("Excess elements in initializer", ss,
+				      true);
+			}
+			if (pos >= init.inner.size()) {
+				init.inner.resize(
+					pos + 1,
+					make_zero_init(init.type->ptr_to));
+			}
+			initializer_elem(ss, ctx, init.inner[pos], false);
+		}
+		pos++;
+		if (nxt_tok(ss).type != '}') {
+			match(',', ss);
+		}
+	}
+}
+
+/*
+Whether the next element still belongs to an aggregate whose braces
+are elided.
 */
+static bool nxt_elided_elem(stream &ss)
+{
+	if (nxt_tok(ss).type != ',') {
+		return false;
+	}
+	tok_t tok = get_tok(ss);
+	if (nxt_tok(ss).type == '}' || nxt_tok(ss).type == '[' ||
+	    nxt_tok(ss).type == '.') {
+		unget_tok(tok);
+		return false;
+	}
+	return true;
+}
+
+static void initializer_elem(stream &ss, context_t &ctx, init_t &init,
+			     bool is_unsized)
+{
+	if (nxt_tok(ss).type == '{') {
+		match('{', ss);
+		if (is_init_aggregate(init)) {
+			initializer_list(ss, ctx, init, is_unsized);
+		} else {
+			scalar_initializer(ss, ctx, init);
+			if (nxt_tok(ss).type == ',') {
+				match(',', ss);
+			}
+		}
+		match('}', ss);
+		return;
+	}
+	if (init.type->type == type_t::type_array &&
+	    init.type->ptr_to->is_char &&
+	    nxt_tok(ss).type == tok_string_lit) {
+		string val = get_string_val(get_tok(ss).str);
+		if (is_unsized) {
+			init.inner.resize(val.size() + 1,
+					  make_zero_init(init.type->ptr_to));
+		}
+		for (size_t i = 0; i < val.size() && i < init.inner.size();
+		     i++) {
+			init.inner[i].val = get_int_repr(
+				(unsigned char)val[i], *init.type->ptr_to);
+			init.inner[i].is_zero = val[i] == 0;
+		}
+		return;
+	}
+	if (is_init_aggregate(init)) {
+		if (is_unsized) {
+			error("Initializer of unsized array must be braced", ss,
+			      true);
+		}
+		for (size_t i = 0; i < init.inner.size(); i++) {
+			if (i != 0 && !nxt_elided_elem(ss)) {
+				break;
+			}
+			initializer_elem(ss, ctx, init.inner[i], false);
+		}
+		return;
+	}
+	scalar_initializer(ss, ctx, init);
+}
+
+static void store_runtime_init(const var_t &rd, const init_t &init)
+{
+	if (init.is_const) {
+		return;
+	}
+	if (!is_init_aggregate(init)) {
+		auto emit_tmp = emit_store(rd, init.var);
+		*out_ss << emit_tmp.code;
+		return;
+	}
+	for (size_t i = 0; i < init.inner.size(); i++) {
+		if (init.inner[i].is_const) {
+			continue;
+		}
+		emit_t emit_tmp;
+		if (init.type->type == type_t::type_array) {
+			type_t i64_type;
+			i64_type.name = "i64";
+			i64_type.type = type_t::type_basic;
+			i64_type.size = 8;
+			i64_type.is_long = 2;
+			var_t idx;
+			idx.type = make_shared<type_t>(i64_type);
+			idx.name = std::to_string(i);
+			emit_tmp = get_item_from_arrptr(rd, idx);
+		} else {
+			emit_tmp = get_item_from_structptr(rd, i);
+		}
+		*out_ss << emit_tmp.code;
+		var_t item = emit_tmp.var;
+		if (item.type->ptr_to->type == type_t::type_array) {
+			// address of an array is the address of its first item
+			type_t arr_ptr_type = *item.type->ptr_to;
+			arr_ptr_type.type = type_t::type_pointer;
+			item.type = make_shared<type_t>(arr_ptr_type);
+		}
+		store_runtime_init(item, init.inner[i]);
+	}
+}
+
 void initializer(stream &ss, context_t &ctx, var_t &var)
 {
 	debug();
 
-	if (nxt_tok(ss).type == '{') {
-		throw "not implemented";
-		// match('{', ss);
-		// initializer_list(ss, ctx, var);
-		// match('}', ss);
-	} else {
-		if (ctx.fun_env->is_func) {
-			auto tmp = emit_alloca(*var.type, var.name);
-			*out_ss << tmp.code;
-			var = tmp.var;
-			ctx.vars[var.name] = var;
-			var_t init_var = assignment_expression(ss, ctx);
+	// 'T v[]' is declared as a pointer of size 0
+	bool is_unsized = var.type->type == type_t::type_pointer &&
+			  var.type->size == 0;
+	bool is_aggr = is_unsized || var.type->type == type_t::type_array ||
+		       var.type->type == type_t::type_struct;
+
+	if (ctx.fun_env->is_func && !is_aggr && nxt_tok(ss).type != '{') {
+		auto tmp = emit_alloca(*var.type, var.name);
+		*out_ss << tmp.code;
+		var = tmp.var;
+		ctx.vars[var.name] = var;
+		var_t init_var = assignment_expression(ss, ctx);
+		if (init_var.is_alloced) {
+			auto emit_tmp = emit_load(init_var);
+			*out_ss << emit_tmp.code;
+			init_var = emit_tmp.var;
+		}
+		auto emit_tmp = emit_conv_to(init_var, *var.type->ptr_to);
+		*out_ss << emit_tmp.code;
+		init_var = emit_tmp.var;
+		emit_tmp = emit_store(var, init_var);
+		*out_ss << emit_tmp.code;
+		return;
+	}
+
+	if (is_unsized) {
+		type_t arr_type = *var.type;
+		arr_type.type = type_t::type_array;
+		var.type = make_shared<type_t>(arr_type);
+	}
+	init_t init = make_zero_init(var.type);
+	initializer_elem(ss, ctx, init, is_unsized);
+	update_init(init);
+	if (is_unsized) {
+		var.type->size = var.type->ptr_to->size * init.inner.size();
+	}
+
+	if (!ctx.fun_env->is_func) {
+		auto tmp = emit_global_decl(var, init);
+		*out_ss << tmp.code;
+		var = tmp.var;
+		ctx.vars[var.name] = var;
+		return;
+	}
+
+	auto tmp = emit_alloca(*var.type, var.name);
+	*out_ss << tmp.code;
+	var = tmp.var;
+	ctx.vars[var.name] = var;
+	if (!is_aggr) {
+		store_runtime_init(var, init);
+		if (init.is_const) {
+			var_t init_var;
+			init_var.name = init.val.empty() ? "zeroinitializer" :
+							   init.val;
+			init_var.type = init.type;
 			auto emit_tmp = emit_store(var, init_var);
 			*out_ss << emit_tmp.code;
-		} else {
-			if (nxt_tok(ss).type != tok_int_lit &&
-			    nxt_tok(ss).type != tok_float_lit &&
-			    nxt_tok(ss).type != tok_string_lit &&
-			    nxt_tok(ss).type != tok_ident) {
-				error("Initializer must be constant", ss, true);
-			}
-			if (nxt_tok(ss).type == tok_ident &&
-			    ctx.get_enum(nxt_tok(ss).str) == -1) {
-				error("Initializer must be constant", ss, true);
-			}
-			if (nxt_tok(ss).type == tok_int_lit ||
-			    nxt_tok(ss).type == tok_ident) {
-				int init_val;
-				if (is_type_i(*var.type)) {
-					init_val = std::stoi(get_tok(ss).str);
-				} else {
-					init_val =
-						ctx.get_enum(get_tok(ss).str);
-				}
-				if (is_type_i(*var.type)) {
-					auto tmp = emit_global_decl(
-						var, std::to_string(init_val));
-					*out_ss << tmp.code;
-					var = tmp.var;
-				} else if (is_type_f(*var.type)) {
-					auto tmp = emit_global_decl(
-						var, std::to_string(init_val) +
-							     ".0");
-					*out_ss << tmp.code;
-					var = tmp.var;
-				} else {
-					error("Initializer type mismatch", ss,
-					      true);
-				}
-			} else if (nxt_tok(ss).type == tok_float_lit) {
-				string init_val = get_tok(ss).str;
-				if (is_type_i(*var.type)) {
-					auto tmp = emit_global_decl(
-						var,
-						std::to_string((int)std::stof(
-							init_val)));
-					*out_ss << tmp.code;
-					var = tmp.var;
-				} else if (is_type_f(*var.type)) {
-					auto tmp =
-						emit_global_decl(var, init_val);
-					*out_ss << tmp.code;
-					var = tmp.var;
-				} else {
-					error("Initializer type mismatch", ss,
-					      true);
-				}
-			} else if (nxt_tok(ss).type == tok_string_lit) {
-				std::string init_val = get_tok(ss).str;
-				if (is_type_i(*var.type)) {
-					error("Initializer type mismatch", ss,
-					      true);
-				} else if (is_type_f(*var.type)) {
-					error("Initializer type mismatch", ss,
-					      true);
-				} else {
-					auto tmp =
-						emit_global_decl(var, init_val);
-					*out_ss << tmp.code;
-					var = tmp.var;
-				}
-			}
-			ctx.vars[var.name] = var;
 		}
+		return;
+	}
+	if (!init.is_zero) {
+		var_t const_var;
+		const_var.name = '@' + get_unnamed_var_name();
+		const_var.type = init.type;
+		auto emit_tmp = emit_global_const_decl(const_var, init);
+		post_decl << emit_tmp.code;
+		emit_tmp = emit_memcpy(var, emit_tmp.var, init.type->size);
+		*out_ss << emit_tmp.code;
+	} else if (!is_init_runtime(init)) {
+		auto emit_tmp = emit_memzero(var, init.type->size);
+		*out_ss << emit_tmp.code;
 	}
+	store_runtime_init(var, init);
 }
 
 /*
@@ -996,18 +1385,22 @@ void struct_declaration_list(stream &ss, context_t &ctx, type_t &struct_type)
 		struct_declaration(ss, ctx, struct_type);
 	}
 
-	size_t align_to = 1;
+	// follow the C layout, so the size matches the object in ir
+	size_t align_to = get_type_align(struct_type);
 	for (auto i : struct_type.inner_vars) {
-		struct_type.size += i.type->size;
-		if (i.type->size > align_to) {
-			align_to = i.type->size;
-		}
-		if (align_to > 8) {
-			align_to = 8;
+		size_t align = get_type_align(*i.type);
+		if (struct_type.type == type_t::type_union) {
+			struct_type.size = std::max(struct_type.size,
+						    i.type->size);
+			continue;
 		}
-		if (i.type->size % align_to != 0) {
-			struct_type.size += align_to - i.type->size % align_to;
+		if (struct_type.size % align != 0) {
+			struct_type.size += align - struct_type.size % align;
 		}
+		struct_type.size += i.type->size;
+	}
+	if (struct_type.size % align_to != 0) {
+		struct_type.size += align_to - struct_type.size % align_to;
 	}
 }
 
@@ -1117,6 +1510,7 @@ void enum_specifier(stream &ss, context_t &ctx, type_t &type)
 			prev_type.is_register = type.is_register;
 			prev_type.is_const = type.is_const;
 			prev_type.is_volatile = type.is_volatile;
+			prev_type.is_restrict = type.is_restrict;
 			type = prev_type;
 		}
 	} else {
@@ -1132,6 +1526,7 @@ void enum_specifier(stream &ss, context_t &ctx, type_t &type)
 	i32_type.is_register = type.is_register;
 	i32_type.is_const = type.is_const;
 	i32_type.is_volatile = type.is_volatile;
+	i32_type.is_restrict = type.is_restrict;
 	type = i32_type;
 }
 
@@ -1234,18 +1629,112 @@ void statement(stream &ss, context_t &ctx)
 		context_t nctx(&ctx);
 		nctx.beg_label = ctx.beg_label;
 		nctx.end_label = ctx.end_label;
+		nctx.beg_depth = ctx.beg_depth;
+		nctx.end_depth = ctx.end_depth;
+		emit_scope_begin();
 		compound_statement(ss, nctx);
+		emit_scope_end();
 	} else if (is_selection_statement(nxt_tok(ss))) {
 		selection_statement(ss, ctx);
 	} else if (is_iteration_statement(nxt_tok(ss))) {
 		iteration_statement(ss, ctx);
 	} else if (is_jump_statement(nxt_tok(ss))) {
 		jump_statement(ss, ctx);
+	} else if (is_labeled_statement(nxt_tok(ss))) {
+		labeled_statement(ss, ctx);
 	} else {
 		expression_statement(ss, ctx);
 	}
 }
 
+/*
+labeled_statement
+	{ CASE constant_expression ':' statement
+	| DEFAULT ':' statement
+	}
+*/
+void labeled_statement(stream &ss, context_t &ctx)
+{
+	debug();
+
+	if (ctx.switch_env == nullptr) {
+		error("Case label not within a switch statement", ss, true);
+	}
+	switch_env_t &env = *ctx.switch_env;
+	string label = get_label();
+	if (nxt_tok(ss).type == tok_case) {
+		match(tok_case, ss);
+		long long val = constant_expression(ss, ctx);
+		for (const auto &i : env.cases) {
+			if (i.first == val) {
+				error("Duplicate case value", ss, true);
+			}
+		}
+		env.cases.push_back({ val, label });
+	} else {
+		match(tok_default, ss);
+		if (!env.default_label.empty()) {
+			error("Multiple default labels in one switch", ss,
+			      true);
+		}
+		env.default_label = label;
+	}
+	match(':', ss);
+
+	// falls through from the previous case
+	auto emit_tmp = emit_br(label);
+	*out_ss << emit_tmp.code;
+	emit_tmp = emit_label(label);
+	*out_ss << emit_tmp.code;
+
+	statement(ss, ctx);
+}
+
+/**
+ * @brief Step a pointer by an integer number of items. Lowered to
+ * getelementptr, so the result still points into the same object.
+ */
+static var_t ptr_offset(const var_t &ptr, var_t offset, bool is_sub = false)
+{
+	type_t i64_type;
+	i64_type.name = "i64";
+	i64_type.type = type_t::type_basic;
+	i64_type.size = 8;
+	i64_type.is_long = 2;
+	auto emit_tmp = emit_conv_to(offset, i64_type);
+	*out_ss << emit_tmp.code;
+	offset = emit_tmp.var;
+	if (is_sub) {
+		var_t zero;
+		zero.type = offset.type;
+		zero.name = "0";
+		emit_tmp = emit_sub(zero, offset);
+		*out_ss << emit_tmp.code;
+		offset = emit_tmp.var;
+	}
+	emit_tmp = emit_ptr_add(ptr, offset);
+	*out_ss << emit_tmp.code;
+	return emit_tmp.var;
+}
+
+/**
+ * @brief Step a pointer by a constant number of items
+ */
+static var_t ptr_offset(const var_t &ptr, const string &offset)
+{
+	type_t i64_type;
+	i64_type.name = "i64";
+	i64_type.type = type_t::type_basic;
+	i64_type.size = 8;
+	i64_type.is_long = 2;
+	var_t offset_var;
+	offset_var.type = make_shared<type_t>(i64_type);
+	offset_var.name = offset;
+	auto emit_tmp = emit_ptr_add(ptr, offset_var);
+	*out_ss << emit_tmp.code;
+	return emit_tmp.var;
+}
+
 /*
 unary_expression
 	: postfix_expression
@@ -1285,24 +1774,7 @@ var_t unary_expression(stream &ss, context_t &ctx)
 			*out_ss << emit_tmp.code;
 			tmp = emit_tmp.var;
 		} else if (is_type_p(*tmp.type)) {
-			type_t ori_type = *tmp.type;
-			type_t i64_type;
-			i64_type.name = "i64";
-			i64_type.type = type_t::type_basic;
-			i64_type.size = 8;
-			i64_type.is_long = 2;
-			emit_tmp = emit_ptrtoint(tmp, i64_type);
-			*out_ss << emit_tmp.code;
-			tmp = emit_tmp.var;
-			var_t inc_v;
-			inc_v.type = make_shared<type_t>(i64_type);
-			inc_v.name = '8';
-			emit_tmp = emit_add(tmp, inc_v);
-			*out_ss << emit_tmp.code;
-			tmp = emit_tmp.var;
-			emit_tmp = emit_inttoptr(tmp, ori_type);
-			*out_ss << emit_tmp.code;
-			tmp = emit_tmp.var;
+			tmp = ptr_offset(tmp, "1");
 		} else if (is_type_f(*tmp.type)) {
 			var_t inc_v;
 			inc_v.type = tmp.type;
@@ -1334,25 +1806,8 @@ var_t unary_expression(stream &ss, context_t &ctx)
 			*out_ss << emit_tmp.code;
 			tmp = emit_tmp.var;
 		} else if (is_type_p(*tmp.type)) {
-			type_t ori_type = *tmp.type;
-			type_t i64_type;
-			i64_type.name = "i64";
-			i64_type.type = type_t::type_basic;
-			i64_type.size = 8;
-			i64_type.is_long = 2;
-			auto emit_tmp = emit_ptrtoint(tmp, i64_type);
-			*out_ss << emit_tmp.code;
-			tmp = emit_tmp.var;
-			var_t inc_v;
-			inc_v.type = make_shared<type_t>(i64_type);
-			inc_v.name = '8';
-			emit_tmp = emit_sub(tmp, inc_v);
-			*out_ss << emit_tmp.code;
-			tmp = emit_tmp.var;
-			emit_tmp = emit_inttoptr(tmp, ori_type);
-			*out_ss << emit_tmp.code;
-			tmp = emit_tmp.var;
-		} else if (is_type_f(*tmp.type)) {
+			tmp = ptr_offset(tmp, "-1");
+		} else if (is_type_f(*tmp.type)) {
 			var_t inc_v;
 			inc_v.type = tmp.type;
 			inc_v.name = "1.0";
@@ -1383,9 +1838,11 @@ var_t unary_expression(stream &ss, context_t &ctx)
 		if (nxt_tok(ss).type == '*') {
 			match('*', ss);
 			var_t tmp = cast_expression(ss, ctx);
-			// if (tmp.is_alloced) {
-			// 	emit_tmp =  emit_load(tmp);*out_ss<<emit_tmp.code;tmp=emit_tmp.var;
-			// }
+			if (tmp.is_alloced) {
+				auto emit_tmp = emit_load(tmp);
+				*out_ss << emit_tmp.code;
+				tmp = emit_tmp.var;
+			}
 			if (!is_type_p(*tmp.type)) {
 				error("Cannot dereference non-pointer type", ss,
 				      true);
@@ -1393,10 +1850,14 @@ var_t unary_expression(stream &ss, context_t &ctx)
 			if (tmp.type->ptr_to->type == type_t::type_func) {
 				return tmp;
 			}
-			auto emit_tmp = emit_load(tmp);
-			*out_ss << emit_tmp.code;
-			tmp = emit_tmp.var;
+			// a pointer value is the address of what it points to
 			tmp.is_alloced = true;
+			if (tmp.type->ptr_to->type == type_t::type_array) {
+				type_t arr_ptr_type = *tmp.type->ptr_to;
+				arr_ptr_type.type = type_t::type_pointer;
+				tmp.type = make_shared<type_t>(arr_ptr_type);
+				tmp.is_alloced = false;
+			}
 			return tmp;
 		}
 		if (nxt_tok(ss).type == '+') {
@@ -1414,7 +1875,7 @@ var_t unary_expression(stream &ss, context_t &ctx)
 			return tmp;
 		}
 		if (nxt_tok(ss).type == '-') {
-			match('+', ss);
+			match('-', ss);
 			var_t tmp = cast_expression(ss, ctx);
 			if (tmp.is_alloced) {
 				auto emit_tmp = emit_load(tmp);
@@ -1474,42 +1935,32 @@ var_t unary_expression(stream &ss, context_t &ctx)
 				*out_ss << emit_tmp.code;
 				tmp = emit_tmp.var;
 			}
-			if (!is_type_i(*tmp.type)) {
+			if (!is_type_i(*tmp.type) && !is_type_f(*tmp.type) &&
+			    !is_type_p(*tmp.type)) {
 				error("Cannot use unary '!' on non-basic type",
 				      ss, true);
 			}
 			var_t zero;
 			zero.type = tmp.type;
-			zero.name = '0';
-			auto emit_tmp = emit_eq(tmp, zero);
+			zero.name = "zeroinitializer";
+			auto emit_tmp = is_type_f(*tmp.type) ?
+						emit_feq(tmp, zero) :
+						emit_eq(tmp, zero);
 			*out_ss << emit_tmp.code;
 			tmp = emit_tmp.var;
 			return tmp;
 		}
 	}
 	if (nxt_tok(ss).type == tok_sizeof) {
-		match(tok_sizeof, ss);
-		var_t tmp;
-		if (nxt_tok(ss).type == '(') {
-			match('(', ss);
-			tmp.type = make_shared<type_t>(type_name(ss, ctx));
-			match(')', ss);
-		} else {
-			tmp = unary_expression(ss, ctx);
-		}
-		if (tmp.is_alloced) {
-			auto emit_tmp = emit_load(tmp);
-			*out_ss << emit_tmp.code;
-			tmp = emit_tmp.var;
-		}
-		type_t i64_type;
-		i64_type.name = "i64";
-		i64_type.type = type_t::type_basic;
-		i64_type.size = 8;
-		i64_type.is_long = 2;
+		type_t size_type;
+		size_type.name = "i64";
+		size_type.type = type_t::type_basic;
+		size_type.size = 8;
+		size_type.is_long = 2;
+		size_type.is_unsigned = true;
 		var_t ret;
-		ret.type = make_shared<type_t>(i64_type);
-		ret.name = std::to_string(tmp.type->size);
+		ret.type = make_shared<type_t>(size_type);
+		ret.name = std::to_string(sizeof_expression(ss, ctx));
 		return ret;
 	}
 	return postfix_expression(ss, ctx);
@@ -1540,6 +1991,40 @@ bool is_cast_expression(stream &ss, context_t &ctx)
 	}
 	return true;
 }
+
+/*
+sizeof_expression
+	SIZEOF {unary_expression | '(' type_name ')'}
+
+the operand is only type checked, the code emitted for it is dropped
+*/
+size_t sizeof_expression(stream &ss, context_t &ctx)
+{
+	debug();
+
+	match(tok_sizeof, ss);
+	if (is_cast_expression(ss, ctx)) {
+		match('(', ss);
+		type_t type = type_name(ss, ctx);
+		match(')', ss);
+		return type.size;
+	}
+
+	writer_t *saved_out_ss = out_ss;
+	size_t saved_post_decl = post_decl.size();
+	writer_t unevaluated(false, 1024);
+	out_ss = &unevaluated;
+	emit_unevaluated_begin();
+	var_t tmp = unary_expression(ss, ctx);
+	emit_unevaluated_end();
+	out_ss = saved_out_ss;
+	post_decl.truncate(saved_post_decl);
+
+	if (tmp.is_alloced) {
+		return tmp.type->ptr_to->size;
+	}
+	return tmp.type->size;
+}
 var_t cast_expression(stream &ss, context_t &ctx)
 {
 	debug();
@@ -1576,6 +2061,9 @@ type_t type_name(stream &ss, context_t &ctx)
 
 	type_t type;
 	specifier_qualifier_list(ss, ctx, type);
+	if (type.type == type_t::type_basic) {
+		try_regulate_basic(ss, type);
+	}
 	if (nxt_tok(ss).type != ')') {
 		var_t var;
 		abstract_declarator(ss, ctx, make_shared<type_t>(type), var);
@@ -1657,27 +2145,7 @@ var_t primary_expression(stream &ss, context_t &ctx)
 	}
 	if (nxt_tok(ss).type == tok_string_lit) {
 		tok_t tok = get_tok(ss);
-		type_t char_type;
-		char_type.type = type_t::type_basic;
-		char_type.name = "i8";
-		char_type.size = 1;
-		char_type.is_char = true;
-		type_t arr_type;
-		arr_type.type = type_t::type_array;
-		arr_type.name = get_ptr_type_name(char_type.name);
-		arr_type.size = char_type.size * tok.str.size();
-		arr_type.ptr_to = make_shared<type_t>(char_type);
-		var_t var;
-		var.type = make_shared<type_t>(arr_type);
-		var.name = '@' + get_unnamed_var_name();
-		string init_str;
-		init_str = "c";
-		init_str += "\"";
-		init_str += tok.str;
-		init_str += "\"";
-		auto tmp = emit_global_const_decl(var, init_str);
-		post_decl += tmp.code;
-		return var;
+		return string_literal(tok.str);
 	}
 	if (nxt_tok(ss).type == '(') {
 		match('(', ss);
@@ -1706,7 +2174,17 @@ var_t postfix_expression(stream &ss, context_t &ctx)
 	while (is_postfix_expression_op(nxt_tok(ss))) {
 		if (nxt_tok(ss).type == '[') {
 			match('[', ss);
+			if (tmp.is_alloced) {
+				auto emit_tmp = emit_load(tmp);
+				*out_ss << emit_tmp.code;
+				tmp = emit_tmp.var;
+			}
 			var_t idx = expression(ss, ctx);
+			if (idx.is_alloced) {
+				auto emit_tmp = emit_load(idx);
+				*out_ss << emit_tmp.code;
+				idx = emit_tmp.var;
+			}
 			if (!is_type_i(*idx.type)) {
 				error("Array index must be integer", ss, true);
 			}
@@ -1718,6 +2196,13 @@ var_t postfix_expression(stream &ss, context_t &ctx)
 			auto emit_tmp = get_item_from_arrptr(tmp, idx);
 			*out_ss << emit_tmp.code;
 			tmp = emit_tmp.var;
+			if (tmp.type->ptr_to->type == type_t::type_array) {
+				// an inner array decays to its first item
+				type_t arr_ptr_type = *tmp.type->ptr_to;
+				arr_ptr_type.type = type_t::type_pointer;
+				tmp.type = make_shared<type_t>(arr_ptr_type);
+				tmp.is_alloced = false;
+			}
 		} else if (nxt_tok(ss).type == '(') {
 			match('(', ss);
 			std::vector<var_t> args;
@@ -1840,24 +2325,7 @@ var_t postfix_expression(stream &ss, context_t &ctx)
 				*out_ss << emit_tmp.code;
 				tmp = emit_tmp.var;
 			} else if (is_type_p(*tmp.type)) {
-				type_t ori_type = *tmp.type;
-				type_t i64_type;
-				i64_type.name = "i64";
-				i64_type.type = type_t::type_basic;
-				i64_type.size = 8;
-				i64_type.is_long = 2;
-				emit_tmp = emit_ptrtoint(tmp, i64_type);
-				*out_ss << emit_tmp.code;
-				tmp = emit_tmp.var;
-				var_t inc_v;
-				inc_v.type = make_shared<type_t>(i64_type);
-				inc_v.name = '8';
-				emit_tmp = emit_add(tmp, inc_v);
-				*out_ss << emit_tmp.code;
-				tmp = emit_tmp.var;
-				emit_tmp = emit_inttoptr(tmp, ori_type);
-				*out_ss << emit_tmp.code;
-				tmp = emit_tmp.var;
+				tmp = ptr_offset(tmp, "1");
 			} else if (is_type_f(*tmp.type)) {
 				var_t inc_v;
 				inc_v.type = tmp.type;
@@ -1889,24 +2357,7 @@ var_t postfix_expression(stream &ss, context_t &ctx)
 				*out_ss << emit_tmp.code;
 				tmp = emit_tmp.var;
 			} else if (is_type_p(*tmp.type)) {
-				type_t ori_type = *tmp.type;
-				type_t i64_type;
-				i64_type.name = "i64";
-				i64_type.type = type_t::type_basic;
-				i64_type.size = 8;
-				i64_type.is_long = 2;
-				auto emit_tmp = emit_ptrtoint(tmp, i64_type);
-				*out_ss << emit_tmp.code;
-				tmp = emit_tmp.var;
-				var_t inc_v;
-				inc_v.type = make_shared<type_t>(i64_type);
-				inc_v.name = '8';
-				emit_tmp = emit_sub(tmp, inc_v);
-				*out_ss << emit_tmp.code;
-				tmp = emit_tmp.var;
-				emit_tmp = emit_inttoptr(tmp, ori_type);
-				*out_ss << emit_tmp.code;
-				tmp = emit_tmp.var;
+				tmp = ptr_offset(tmp, "-1");
 			} else if (is_type_f(*tmp.type)) {
 				var_t inc_v;
 				inc_v.type = tmp.type;
@@ -1934,10 +2385,22 @@ std::vector<var_t> argument_expression_list(stream &ss, context_t &ctx)
 	debug();
 
 	std::vector<var_t> args;
-	args.push_back(assignment_expression(ss, ctx));
+	var_t arg = assignment_expression(ss, ctx);
+	if (arg.is_alloced) {
+		auto emit_tmp = emit_load(arg);
+		*out_ss << emit_tmp.code;
+		arg = emit_tmp.var;
+	}
+	args.push_back(arg);
 	while (nxt_tok(ss).type == ',') {
 		match(',', ss);
-		args.push_back(assignment_expression(ss, ctx));
+		arg = assignment_expression(ss, ctx);
+		if (arg.is_alloced) {
+			auto emit_tmp = emit_load(arg);
+			*out_ss << emit_tmp.code;
+			arg = emit_tmp.var;
+		}
+		args.push_back(arg);
 	}
 	return args;
 }
@@ -2088,6 +2551,14 @@ var_t additive_expression(stream &ss, context_t &ctx)
 				*out_ss << emit_tmp.code;
 				rt = emit_tmp.var;
 			}
+			if (is_type_p(*rs.type) && is_type_i(*rt.type)) {
+				rs = ptr_offset(rs, rt);
+				continue;
+			}
+			if (is_type_i(*rs.type) && is_type_p(*rt.type)) {
+				rs = ptr_offset(rt, rs);
+				continue;
+			}
 			if (!is_type_i(*rs.type) && !is_type_f(*rs.type)) {
 				error("Cannot add non-basic type", ss, true);
 			}
@@ -2120,6 +2591,16 @@ var_t additive_expression(stream &ss, context_t &ctx)
 				*out_ss << emit_tmp.code;
 				rt = emit_tmp.var;
 			}
+			if (is_type_p(*rs.type) && is_type_i(*rt.type)) {
+				rs = ptr_offset(rs, rt, true);
+				continue;
+			}
+			if (is_type_p(*rs.type) && is_type_p(*rt.type)) {
+				auto emit_tmp = emit_ptr_diff(rs, rt);
+				*out_ss << emit_tmp.code;
+				rs = emit_tmp.var;
+				continue;
+			}
 			if (!is_type_i(*rs.type) && !is_type_f(*rs.type)) {
 				error("Cannot subtract non-basic type", ss,
 				      true);
@@ -2234,7 +2715,8 @@ var_t relational_expression(stream &ss, context_t &ctx)
 			*out_ss << emit_tmp.code;
 			rs = emit_tmp.var;
 		}
-		if (!is_type_i(*rs.type) && !is_type_f(*rs.type)) {
+		if (!is_type_i(*rs.type) && !is_type_f(*rs.type) &&
+		    !is_type_p(*rs.type)) {
 			error("Cannot compare non-basic type", ss, true);
 		}
 		tok_t ntok = get_tok(ss);
@@ -2244,13 +2726,20 @@ var_t relational_expression(stream &ss, context_t &ctx)
 			*out_ss << emit_tmp.code;
 			rt = emit_tmp.var;
 		}
-		if (!is_type_i(*rt.type) && !is_type_f(*rt.type)) {
+		if (!is_type_i(*rt.type) && !is_type_f(*rt.type) &&
+		    !is_type_p(*rt.type)) {
 			error("Cannot compare non-basic type", ss, true);
 		}
+		if (is_type_p(*rs.type) != is_type_p(*rt.type)) {
+			error("Cannot compare pointer with non-pointer", ss,
+			      true);
+		}
+		// pointers compare as unsigned, with no round trip through int
 		auto emit_tmp = emit_match_type(rs, rt);
 		*out_ss << emit_tmp.code;
 		if (ntok.type == '<') {
-			if (is_type_i(*rs.type) && rs.type->is_unsigned) {
+			if (is_type_p(*rs.type) ||
+			    (is_type_i(*rs.type) && rs.type->is_unsigned)) {
 				emit_tmp = emit_ult(rs, rt);
 				*out_ss << emit_tmp.code;
 				rs = emit_tmp.var;
@@ -2267,7 +2756,8 @@ var_t relational_expression(stream &ss, context_t &ctx)
 				error("Cannot compare this type", ss, true);
 			}
 		} else if (ntok.type == '>') {
-			if (is_type_i(*rs.type) && rs.type->is_unsigned) {
+			if (is_type_p(*rs.type) ||
+			    (is_type_i(*rs.type) && rs.type->is_unsigned)) {
 				emit_tmp = emit_ugt(rs, rt);
 				*out_ss << emit_tmp.code;
 				rs = emit_tmp.var;
@@ -2284,7 +2774,8 @@ var_t relational_expression(stream &ss, context_t &ctx)
 				error("Cannot compare this type", ss, true);
 			}
 		} else if (ntok.type == tok_ge) {
-			if (is_type_i(*rs.type) && rs.type->is_unsigned) {
+			if (is_type_p(*rs.type) ||
+			    (is_type_i(*rs.type) && rs.type->is_unsigned)) {
 				emit_tmp = emit_uge(rs, rt);
 				*out_ss << emit_tmp.code;
 				rs = emit_tmp.var;
@@ -2301,7 +2792,8 @@ var_t relational_expression(stream &ss, context_t &ctx)
 				error("Cannot compare this type", ss, true);
 			}
 		} else if (ntok.type == tok_le) {
-			if (is_type_i(*rs.type) && rs.type->is_unsigned) {
+			if (is_type_p(*rs.type) ||
+			    (is_type_i(*rs.type) && rs.type->is_unsigned)) {
 				emit_tmp = emit_ule(rs, rt);
 				*out_ss << emit_tmp.code;
 				rs = emit_tmp.var;
@@ -2353,18 +2845,19 @@ var_t equality_expression(stream &ss, context_t &ctx)
 			error("Cannot compare non-basic type", ss, true);
 		}
 
+		// a null pointer constant compares with any pointer
+		if (is_type_p(*rs.type) && is_type_i(*rt.type) &&
+		    rt.name == "0") {
+			rt.type = rs.type;
+			rt.name = "null";
+		} else if (is_type_i(*rs.type) && is_type_p(*rt.type) &&
+			   rs.name == "0") {
+			rs.type = rt.type;
+			rs.name = "null";
+		}
+
 		if (is_type_p(*rs.type) && is_type_p(*rt.type)) {
-			type_t i64_type;
-			i64_type.name = "i64";
-			i64_type.type = type_t::type_basic;
-			i64_type.size = 8;
-			i64_type.is_long = 2;
-			auto emit_tmp = emit_ptrtoint(rs, i64_type);
-			*out_ss << emit_tmp.code;
-			rs = emit_tmp.var;
-			emit_tmp = emit_ptrtoint(rt, i64_type);
-			*out_ss << emit_tmp.code;
-			rt = emit_tmp.var;
+			// compared as ptr directly, keeping their provenance
 		} else if (!is_type_p(*rs.type) && !is_type_p(*rt.type)) {
 			auto emit_tmp = emit_match_type(rs, rt);
 			*out_ss << emit_tmp.code;
@@ -2373,7 +2866,7 @@ var_t equality_expression(stream &ss, context_t &ctx)
 			      true);
 		}
 		if (ntok.type == tok_eq) {
-			if (is_type_i(*rs.type)) {
+			if (is_type_i(*rs.type) || is_type_p(*rs.type)) {
 				auto emit_tmp = emit_eq(rs, rt);
 				*out_ss << emit_tmp.code;
 				rs = emit_tmp.var;
@@ -2385,7 +2878,7 @@ var_t equality_expression(stream &ss, context_t &ctx)
 				error("Cannot compare this type", ss, true);
 			}
 		} else if (ntok.type == tok_ne) {
-			if (is_type_i(*rs.type)) {
+			if (is_type_i(*rs.type) || is_type_p(*rs.type)) {
 				auto emit_tmp = emit_ne(rs, rt);
 				*out_ss << emit_tmp.code;
 				rs = emit_tmp.var;
@@ -2512,6 +3005,74 @@ var_t inclusive_or_expression(stream &ss, context_t &ctx)
 	return rs;
 }
 
+/**
+ * @brief Load a scalar and compare it with zero, for use as a condition
+ */
+static var_t to_bool(stream &ss, var_t rs, const string &err)
+{
+	if (rs.is_alloced) {
+		auto emit_tmp = emit_load(rs);
+		*out_ss << emit_tmp.code;
+		rs = emit_tmp.var;
+	}
+	if (rs.type->is_bool) {
+		return rs;
+	}
+	if (!is_type_i(*rs.type) && !is_type_f(*rs.type) &&
+	    !is_type_p(*rs.type)) {
+		error(err, ss, true);
+	}
+	var_t zero;
+	zero.type = rs.type;
+	zero.name = "zeroinitializer";
+	auto emit_tmp = is_type_f(*rs.type) ? emit_fne(rs, zero) :
+					      emit_ne(rs, zero);
+	*out_ss << emit_tmp.code;
+	return emit_tmp.var;
+}
+
+/**
+ * @brief Join the two arms of a short-circuit operator
+ * 
+ * The left side has already branched to label_rhs or label_short. The right
+ * side is evaluated under label_rhs, and the result is the right side or
+ * short_val, depending on which arm reached the end.
+ */
+static var_t short_circuit(stream &ss, context_t &ctx, var_t rs,
+			   const string &label_rhs, const string &label_short,
+			   const string &short_val,
+			   var_t (*operand)(stream &, context_t &),
+			   const string &err)
+{
+	string label_rhs_end = get_label();
+	string label_end = get_label();
+
+	auto emit_tmp = emit_label(label_short);
+	*out_ss << emit_tmp.code;
+	emit_tmp = emit_br(label_end);
+	*out_ss << emit_tmp.code;
+
+	emit_tmp = emit_label(label_rhs);
+	*out_ss << emit_tmp.code;
+	var_t rt = to_bool(ss, operand(ss, ctx), err);
+	emit_tmp = emit_br(label_rhs_end);
+	*out_ss << emit_tmp.code;
+
+	emit_tmp = emit_label(label_rhs_end);
+	*out_ss << emit_tmp.code;
+	emit_tmp = emit_br(label_end);
+	*out_ss << emit_tmp.code;
+
+	emit_tmp = emit_label(label_end);
+	*out_ss << emit_tmp.code;
+	var_t short_var;
+	short_var.type = rs.type;
+	short_var.name = short_val;
+	emit_tmp = emit_phi(short_var, label_short, rt, label_rhs_end);
+	*out_ss << emit_tmp.code;
+	return emit_tmp.var;
+}
+
 /*
 logical_and_expression
 	inclusive_or_expression {AND_OP inclusive_or_expression}*
@@ -2523,44 +3084,14 @@ var_t logical_and_expression(stream &ss, context_t &ctx)
 	var_t rs = inclusive_or_expression(ss, ctx);
 	while (nxt_tok(ss).type == tok_land) {
 		match(tok_land, ss);
-		var_t rt = inclusive_or_expression(ss, ctx);
-		if (rs.is_alloced) {
-			auto emit_tmp = emit_load(rs);
-			*out_ss << emit_tmp.code;
-			rs = emit_tmp.var;
-		}
-		if (rt.is_alloced) {
-			auto emit_tmp = emit_load(rt);
-			*out_ss << emit_tmp.code;
-			rt = emit_tmp.var;
-		}
-		if (!rs.type->is_bool) {
-			if (!is_type_i(*rs.type) && !is_type_f(*rs.type) &&
-			    !is_type_p(*rs.type)) {
-				error("Cannot and non-basic type", ss, true);
-			}
-			var_t zero;
-			zero.type = rs.type;
-			zero.name = "zeroinitializer";
-			auto emit_tmp = emit_ne(rs, zero);
-			*out_ss << emit_tmp.code;
-			rs = emit_tmp.var;
-		}
-		if (!rt.type->is_bool) {
-			if (!is_type_i(*rt.type) && !is_type_f(*rt.type) &&
-			    !is_type_p(*rt.type)) {
-				error("Cannot and non-basic type", ss, true);
-			}
-			var_t zero;
-			zero.type = rt.type;
-			zero.name = "zeroinitializer";
-			auto emit_tmp = emit_ne(rt, zero);
-			*out_ss << emit_tmp.code;
-			rt = emit_tmp.var;
-		}
-		auto emit_tmp = emit_and(rs, rt);
+		rs = to_bool(ss, rs, "Cannot and non-basic type");
+		string label_rhs = get_label();
+		string label_short = get_label();
+		auto emit_tmp = emit_br(rs, label_rhs, label_short);
 		*out_ss << emit_tmp.code;
-		rs = emit_tmp.var;
+		rs = short_circuit(ss, ctx, rs, label_rhs, label_short, "false",
+				   inclusive_or_expression,
+				   "Cannot and non-basic type");
 	}
 	return rs;
 }
@@ -2576,51 +3107,288 @@ var_t logical_or_expression(stream &ss, context_t &ctx)
 	var_t rs = logical_and_expression(ss, ctx);
 	while (nxt_tok(ss).type == tok_lor) {
 		match(tok_lor, ss);
-		var_t rt = logical_and_expression(ss, ctx);
-		if (rs.is_alloced) {
-			auto emit_tmp = emit_load(rs);
-			*out_ss << emit_tmp.code;
-			rs = emit_tmp.var;
-		}
-		if (rt.is_alloced) {
-			auto emit_tmp = emit_load(rt);
-			*out_ss << emit_tmp.code;
-			rt = emit_tmp.var;
+		rs = to_bool(ss, rs, "Cannot or non-basic type");
+		string label_rhs = get_label();
+		string label_short = get_label();
+		auto emit_tmp = emit_br(rs, label_short, label_rhs);
+		*out_ss << emit_tmp.code;
+		rs = short_circuit(ss, ctx, rs, label_rhs, label_short, "true",
+				   logical_and_expression,
+				   "Cannot or non-basic type");
+	}
+	return rs;
+}
+
+/**
+ * @brief Look ahead through the rest of a condition without consuming it
+ * 
+ * @param stop_tok tok_lor / tok_land to check if the current operand of
+ * '||' / '&&' is followed by another one, or 0 to check the whole
+ * condition
+ * @return for 0, true if the condition is a top level '&&' / '||' chain, with
+ * no '?', ',' or assignment turning it into something else
+ */
+static bool chk_logical_ahead(stream &ss, int stop_tok)
+{
+	std::stack<tok_t> store;
+	bool hit = false, ok = true;
+	int depth = 0;
+	while (true) {
+		tok_t tok = nxt_tok(ss);
+		if (tok.type == tok_eof) {
+			break;
 		}
-		if (!rs.type->is_bool) {
-			if (!is_type_i(*rs.type) && !is_type_f(*rs.type) &&
-			    !is_type_p(*rs.type)) {
-				error("Cannot or non-basic type", ss, true);
+		if (depth == 0) {
+			if (tok.type == ')' || tok.type == ';') {
+				break;
 			}
-			var_t zero;
-			zero.type = rs.type;
-			zero.name = "zeroinitializer";
-			auto emit_tmp = emit_ne(rs, zero);
-			*out_ss << emit_tmp.code;
-			rs = emit_tmp.var;
-		}
-		if (!rt.type->is_bool) {
-			if (!is_type_i(*rt.type) && !is_type_f(*rt.type) &&
-			    !is_type_p(*rt.type)) {
-				error("Cannot or non-basic type", ss, true);
+			if (stop_tok != 0 && tok.type == stop_tok) {
+				hit = true;
+				break;
 			}
-			var_t zero;
-			zero.type = rt.type;
-			zero.name = "zeroinitializer";
-			auto emit_tmp = emit_ne(rt, zero);
-			*out_ss << emit_tmp.code;
-			rt = emit_tmp.var;
+			if (stop_tok == tok_land && tok.type == tok_lor) {
+				break;
+			}
+			if (stop_tok == 0 &&
+			    (tok.type == tok_land || tok.type == tok_lor)) {
+				hit = true;
+			}
+			if (tok.type == '?' || tok.type == ',' ||
+			    is_assignment_operatior(tok)) {
+				ok = false;
+				break;
+			}
+		}
+		if (tok.type == '(' || tok.type == '[') {
+			depth++;
+		} else if (tok.type == ')' || tok.type == ']') {
+			depth--;
 		}
-		auto emit_tmp = emit_or(rs, rt);
+		store.push(get_tok(ss));
+	}
+	while (!store.empty()) {
+		unget_tok(store.top());
+		store.pop();
+	}
+	return hit && ok;
+}
+
+/**
+ * @brief Look ahead for an operand of the form {'!'}* '(' expression ')',
+ * which can be lowered as a nested condition
+ */
+static bool chk_cond_group(stream &ss, context_t &ctx)
+{
+	std::stack<tok_t> store;
+	while (nxt_tok(ss).type == '!') {
+		store.push(get_tok(ss));
+	}
+	bool ok = false;
+	if (nxt_tok(ss).type == '(') {
+		store.push(get_tok(ss));
+		// a cast is not a group
+		ok = !is_specifier_qualifier_list(nxt_tok(ss), ctx);
+	}
+	int depth = 1;
+	while (ok && depth > 0) {
+		tok_t tok = nxt_tok(ss);
+		if (tok.type == tok_eof) {
+			ok = false;
+			break;
+		}
+		if (tok.type == '(') {
+			depth++;
+		} else if (tok.type == ')') {
+			depth--;
+		}
+		store.push(get_tok(ss));
+	}
+	if (ok) {
+		int type = nxt_tok(ss).type;
+		ok = type == tok_land || type == tok_lor || type == ')' ||
+		     type == ';';
+	}
+	put_back_tok(store);
+	return ok;
+}
+
+/*
+unary_condition
+	{'!'}* '(' expression ')' | inclusive_or_expression
+
+a negation swaps the targets, and a group is lowered as a nested condition
+*/
+void unary_condition(stream &ss, context_t &ctx, const string &label_true,
+		     const string &label_false)
+{
+	debug();
+
+	if (chk_cond_group(ss, ctx)) {
+		if (nxt_tok(ss).type == '!') {
+			match('!', ss);
+			unary_condition(ss, ctx, label_false, label_true);
+			return;
+		}
+		match('(', ss);
+		condition(ss, ctx, label_true, label_false);
+		match(')', ss);
+		return;
+	}
+	var_t rs = to_bool(ss, inclusive_or_expression(ss, ctx),
+			   "Cannot use non-basic type as condition");
+	auto emit_tmp = emit_br(rs, label_true, label_false);
+	*out_ss << emit_tmp.code;
+}
+
+/*
+logical_and_condition
+	unary_condition {AND_OP unary_condition}*
+
+branch to label_true if all operands hold, or label_false at the first one
+that does not
+*/
+void logical_and_condition(stream &ss, context_t &ctx,
+			   const string &label_true, const string &label_false)
+{
+	debug();
+
+	while (true) {
+		bool is_last = !chk_logical_ahead(ss, tok_land);
+		string label_nxt = is_last ? label_true : get_label();
+		unary_condition(ss, ctx, label_nxt, label_false);
+		if (is_last) {
+			break;
+		}
+		match(tok_land, ss);
+		auto emit_tmp = emit_label(label_nxt);
 		*out_ss << emit_tmp.code;
-		rs = emit_tmp.var;
 	}
-	return rs;
+}
+
+/*
+logical_or_condition
+	logical_and_condition {OR_OP logical_and_condition}*
+
+branch to label_true at the first operand that holds, or label_false if
+none does
+*/
+void logical_or_condition(stream &ss, context_t &ctx, const string &label_true,
+			  const string &label_false)
+{
+	debug();
+
+	while (true) {
+		bool is_last = !chk_logical_ahead(ss, tok_lor);
+		string label_nxt = is_last ? label_false : get_label();
+		logical_and_condition(ss, ctx, label_true, label_nxt);
+		if (is_last) {
+			break;
+		}
+		match(tok_lor, ss);
+		auto emit_tmp = emit_label(label_nxt);
+		*out_ss << emit_tmp.code;
+	}
+}
+
+/*
+condition
+	expression
+
+condition context of expression lowering: branch to label_true or
+label_false on the value of the expression. Comparisons feed the branch
+directly, and logical operators, negations and groups of them jump straight
+to the targets without building a boolean.
+*/
+void condition(stream &ss, context_t &ctx, const string &label_true,
+	       const string &label_false)
+{
+	debug();
+
+	if (chk_logical_ahead(ss, 0) || chk_cond_group(ss, ctx)) {
+		logical_or_condition(ss, ctx, label_true, label_false);
+		return;
+	}
+	var_t rs = to_bool(ss, expression(ss, ctx),
+			   "Cannot use non-basic type as condition");
+	auto emit_tmp = emit_br(rs, label_true, label_false);
+	*out_ss << emit_tmp.code;
+}
+
+/**
+ * @brief Tell if a token alone is an operand that is cheap and has no side
+ * effect: a constant, or a variable that is not volatile.
+ */
+static bool is_pure_operand(const tok_t &tok, context_t &ctx)
+{
+	if (tok.type == tok_int_lit || tok.type == tok_float_lit ||
+	    tok.type == tok_null) {
+		return true;
+	}
+	if (tok.type != tok_ident) {
+		return false;
+	}
+	var_t var = ctx.get_var('%' + tok.str);
+	if (var.type->type == type_t::type_unknown) {
+		var = ctx.get_var('@' + tok.str);
+	}
+	if (var.type->type == type_t::type_unknown) {
+		return ctx.get_enum(tok.str) >= 0;
+	}
+	const type_t &type = var.is_alloced ? *var.type->ptr_to : *var.type;
+	return (is_type_i(type) || is_type_f(type) || is_type_p(type)) &&
+	       !type.is_volatile;
+}
+
+/**
+ * @brief Look ahead for both arms of a conditional expression being a pure
+ * operand, so both can be evaluated and one selected without a branch.
+ */
+static bool chk_pure_arms(stream &ss, context_t &ctx)
+{
+	std::stack<tok_t> store;
+	bool ok = false;
+	if (is_pure_operand(nxt_tok(ss), ctx)) {
+		store.push(get_tok(ss));
+		if (nxt_tok(ss).type == ':') {
+			store.push(get_tok(ss));
+			ok = is_pure_operand(nxt_tok(ss), ctx);
+		}
+	}
+	if (ok) {
+		store.push(get_tok(ss));
+		int type = nxt_tok(ss).type;
+		ok = type == ')' || type == ';' || type == ',' || type == ':' ||
+		     type == ']' || type == '}';
+	}
+	while (!store.empty()) {
+		unget_tok(store.top());
+		store.pop();
+	}
+	return ok;
+}
+
+/**
+ * @brief Tell if the arms of a conditional expression have the type of the
+ * true one in common, or else of the false one. A pointer arm wins over
+ * an int one, which is a null pointer constant.
+ */
+static bool is_arm_type_true(const var_t &rt, const var_t &rr)
+{
+	if (is_type_p(*rt.type) && is_type_i(*rr.type)) {
+		return true;
+	}
+	if (is_type_i(*rt.type) && is_type_p(*rr.type)) {
+		return false;
+	}
+	return should_conv_to_first(rt, rr);
 }
 
 /*
 conditional_expression
 	logical_or_expression {'?' expression ':' conditional_expression}?
+
+Arms that are a constant or a plain variable are both evaluated, and the
+result is selected without a branch.
 */
 var_t conditional_expression(stream &ss, context_t &ctx)
 {
@@ -2628,6 +3396,11 @@ var_t conditional_expression(stream &ss, context_t &ctx)
 
 	var_t rs = logical_or_expression(ss, ctx);
 	if (nxt_tok(ss).type == '?') {
+		if (rs.is_alloced) {
+			auto emit_tmp = emit_load(rs);
+			*out_ss << emit_tmp.code;
+			rs = emit_tmp.var;
+		}
 		if (!is_type_i(*rs.type) && !is_type_f(*rs.type) &&
 		    !is_type_p(*rs.type)) {
 			error("Cannot use non-basic type as condition", ss,
@@ -2642,6 +3415,33 @@ var_t conditional_expression(stream &ss, context_t &ctx)
 			rs = emit_tmp.var;
 		}
 		match('?', ss);
+		if (chk_pure_arms(ss, ctx)) {
+			var_t rt = primary_expression(ss, ctx);
+			if (rt.is_alloced) {
+				auto emit_tmp = emit_load(rt);
+				*out_ss << emit_tmp.code;
+				rt = emit_tmp.var;
+			}
+			match(':', ss);
+			var_t rr = primary_expression(ss, ctx);
+			if (rr.is_alloced) {
+				auto emit_tmp = emit_load(rr);
+				*out_ss << emit_tmp.code;
+				rr = emit_tmp.var;
+			}
+			if (is_arm_type_true(rt, rr)) {
+				auto emit_tmp = emit_conv_to(rr, *rt.type);
+				*out_ss << emit_tmp.code;
+				rr = emit_tmp.var;
+			} else {
+				auto emit_tmp = emit_conv_to(rt, *rr.type);
+				*out_ss << emit_tmp.code;
+				rt = emit_tmp.var;
+			}
+			auto emit_tmp = emit_select(rs, rt, rr);
+			*out_ss << emit_tmp.code;
+			return emit_tmp.var;
+		}
 		string label_true = get_label();
 		string label_false = get_label();
 		string label_true_conv = get_label();
@@ -2675,22 +3475,21 @@ var_t conditional_expression(stream &ss, context_t &ctx)
 		emit_tmp = emit_br(label_false_conv);
 		*out_ss << emit_tmp.code;
 
-		bool conv_to_rt = should_conv_to_first(rt, rr);
-		bool conv_to_rr = should_conv_to_first(rr, rt);
+		bool to_rt = is_arm_type_true(rt, rr);
 
 		emit_tmp = emit_label(label_true_conv);
 		*out_ss << emit_tmp.code;
-		if (conv_to_rt) {
+		if (!to_rt) {
 			emit_tmp = emit_conv_to(rt, *rr.type);
 			*out_ss << emit_tmp.code;
-			rr = emit_tmp.var;
+			rt = emit_tmp.var;
 		}
 		emit_tmp = emit_br(label_end);
 		*out_ss << emit_tmp.code;
 
 		emit_tmp = emit_label(label_false_conv);
 		*out_ss << emit_tmp.code;
-		if (conv_to_rr) {
+		if (to_rt) {
 			emit_tmp = emit_conv_to(rr, *rt.type);
 			*out_ss << emit_tmp.code;
 			rr = emit_tmp.var;
@@ -2738,37 +3537,22 @@ void assignment_operator(stream &ss, var_t rd, var_t rs, tok_t op)
 	auto emit_tmp = emit_load(rd);
 	*out_ss << emit_tmp.code;
 	var_t rt = emit_tmp.var;
-	if (is_type_p(*rs.type)) {
+	if (is_type_p(*rt.type)) {
 		if (op.type != tok_add_assign && op.type != tok_sub_assign) {
 			error("Cannot assign pointer with this operator", ss,
 			      true);
 		}
-		type_t i64_type;
-		i64_type.name = "i64";
-		i64_type.type = type_t::type_basic;
-		i64_type.size = 8;
-		i64_type.is_long = 2;
-		emit_tmp = emit_ptrtoint(rs, i64_type);
+		if (!is_type_i(*rs.type)) {
+			error("Cannot assign non-basic type", ss, true);
+		}
+		rt = ptr_offset(rt, rs, op.type == tok_sub_assign);
+		emit_tmp = emit_store(rd, rt);
 		*out_ss << emit_tmp.code;
-		rs = emit_tmp.var;
+		return;
 	}
 	if (!is_type_i(*rs.type) && !is_type_f(*rs.type)) {
 		error("Cannot assign non-basic type", ss, true);
 	}
-	if (is_type_p(*rt.type)) {
-		if (op.type != tok_add_assign && op.type != tok_sub_assign) {
-			error("Cannot assign pointer with this operator", ss,
-			      true);
-		}
-		type_t i64_type;
-		i64_type.name = "i64";
-		i64_type.type = type_t::type_basic;
-		i64_type.size = 8;
-		i64_type.is_long = 2;
-		emit_tmp = emit_ptrtoint(rt, i64_type);
-		*out_ss << emit_tmp.code;
-		var_t rt = emit_tmp.var;
-	}
 	if (!is_type_i(*rt.type) && !is_type_f(*rt.type)) {
 		error("Cannot assign non-basic type", ss, true);
 	}
@@ -2778,59 +3562,59 @@ void assignment_operator(stream &ss, var_t rd, var_t rs, tok_t op)
 		if (is_type_i(*rs.type)) {
 			emit_tmp = emit_add(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		} else if (is_type_f(*rs.type)) {
 			emit_tmp = emit_fadd(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		}
 	} else if (op.type == tok_sub_assign) {
 		if (is_type_i(*rs.type)) {
 			emit_tmp = emit_sub(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		} else if (is_type_f(*rs.type)) {
 			emit_tmp = emit_fsub(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		}
 	} else if (op.type == tok_mul_assign) {
 		if (is_type_i(*rs.type)) {
 			emit_tmp = emit_mul(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		} else if (is_type_f(*rs.type)) {
 			emit_tmp = emit_fmul(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		}
 	} else if (op.type == tok_div_assign) {
 		if (is_type_i(*rs.type) && rs.type->is_unsigned) {
 			emit_tmp = emit_udiv(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		} else if (is_type_i(*rs.type) && !rs.type->is_unsigned) {
 			emit_tmp = emit_sdiv(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		} else if (is_type_f(*rs.type)) {
 			emit_tmp = emit_fdiv(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		}
 	} else if (op.type == tok_mod_assign) {
 		if (is_type_i(*rs.type) && rs.type->is_unsigned) {
 			emit_tmp = emit_urem(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		} else if (is_type_i(*rs.type) && !rs.type->is_unsigned) {
 			emit_tmp = emit_srem(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		} else if (is_type_f(*rs.type)) {
 			emit_tmp = emit_frem(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		}
 	} else if (op.type == tok_lshift_assign) {
 		if (!is_type_i(*rs.type)) {
@@ -2838,7 +3622,7 @@ void assignment_operator(stream &ss, var_t rd, var_t rs, tok_t op)
 		}
 		emit_tmp = emit_shl(rt, rs);
 		*out_ss << emit_tmp.code;
-		var_t rt = emit_tmp.var;
+		rt = emit_tmp.var;
 	} else if (op.type == tok_rshift_assign) {
 		if (!is_type_i(*rs.type)) {
 			error("Cannot right shift non-int type", ss, true);
@@ -2846,11 +3630,11 @@ void assignment_operator(stream &ss, var_t rd, var_t rs, tok_t op)
 		if (rt.type->is_unsigned) {
 			emit_tmp = emit_lshr(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		} else {
 			emit_tmp = emit_ashr(rt, rs);
 			*out_ss << emit_tmp.code;
-			var_t rt = emit_tmp.var;
+			rt = emit_tmp.var;
 		}
 	} else if (op.type == tok_and_assign) {
 		if (!is_type_i(*rs.type)) {
@@ -2858,21 +3642,21 @@ void assignment_operator(stream &ss, var_t rd, var_t rs, tok_t op)
 		}
 		emit_tmp = emit_and(rt, rs);
 		*out_ss << emit_tmp.code;
-		var_t rt = emit_tmp.var;
+		rt = emit_tmp.var;
 	} else if (op.type == tok_xor_assign) {
 		if (!is_type_i(*rs.type)) {
 			error("Cannot xor non-int type", ss, true);
 		}
 		emit_tmp = emit_xor(rt, rs);
 		*out_ss << emit_tmp.code;
-		var_t rt = emit_tmp.var;
+		rt = emit_tmp.var;
 	} else if (op.type == tok_or_assign) {
 		if (!is_type_i(*rs.type)) {
 			error("Cannot or non-int type", ss, true);
 		}
 		emit_tmp = emit_or(rt, rs);
 		*out_ss << emit_tmp.code;
-		var_t rt = emit_tmp.var;
+		rt = emit_tmp.var;
 	}
 	emit_tmp = emit_conv_to(rt, *rd.type->ptr_to);
 	*out_ss << emit_tmp.code;
@@ -2919,7 +3703,7 @@ var_t expression(stream &ss, context_t &ctx)
 	var_t rs = assignment_expression(ss, ctx);
 	while (nxt_tok(ss).type == ',') {
 		match(',', ss);
-		var_t rs = assignment_expression(ss, ctx);
+		rs = assignment_expression(ss, ctx);
 	}
 	return rs;
 }
@@ -2961,6 +3745,7 @@ void jump_statement(stream &ss, context_t &ctx)
 		if (ctx.beg_label.empty()) {
 			error("Cannot continue outside of loop", ss, true);
 		}
+		emit_scope_leave(ctx.beg_depth);
 		auto emit_tmp = emit_br(ctx.beg_label);
 		*out_ss << emit_tmp.code;
 
@@ -2971,6 +3756,7 @@ void jump_statement(stream &ss, context_t &ctx)
 			error("Cannot break outside of loop or switch", ss,
 			      true);
 		}
+		emit_scope_leave(ctx.end_depth);
 		auto emit_tmp = emit_br(ctx.end_label);
 		*out_ss << emit_tmp.code;
 
@@ -2978,14 +3764,17 @@ void jump_statement(stream &ss, context_t &ctx)
 		match(tok_return, ss);
 		if (nxt_tok(ss).type == ';') {
 			match(';', ss);
+			emit_scope_leave(0);
 			if (is_type_void(ctx.fun_env->ret_type)) {
-				emit_ret();
+				auto emit_tmp = emit_ret();
+				*out_ss << emit_tmp.code;
 			} else {
 				var_t zero;
 				zero.type = std::make_shared<type_t>(
 					ctx.fun_env->ret_type);
 				zero.name = "zeroinitializer";
-				emit_ret(zero);
+				auto emit_tmp = emit_ret(zero);
+				*out_ss << emit_tmp.code;
 			}
 		} else {
 			var_t rs = expression(ss, ctx);
@@ -2995,15 +3784,20 @@ void jump_statement(stream &ss, context_t &ctx)
 				*out_ss << emit_tmp.code;
 				rs = emit_tmp.var;
 			}
+			// return f(...), the call may reuse the frame
+			emit_tail_call(rs);
+			emit_scope_leave(0);
 			if (ctx.fun_env->ret_type.type == type_t::type_basic &&
 			    rs.type->type == type_t::type_basic) {
 				auto emit_tmp =
 					emit_conv_to(rs, ctx.fun_env->ret_type);
 				*out_ss << emit_tmp.code;
 				rs = emit_tmp.var;
-				emit_ret(rs);
+				emit_tmp = emit_ret(rs);
+				*out_ss << emit_tmp.code;
 			} else if (ctx.fun_env->ret_type == *rs.type) {
-				emit_ret(rs);
+				auto emit_tmp = emit_ret(rs);
+				*out_ss << emit_tmp.code;
 			} else {
 				error("Func return type not match.", ss, true);
 			}
@@ -3014,44 +3808,89 @@ void jump_statement(stream &ss, context_t &ctx)
 /*
 selection_statement
 	{ IF '(' expression ')' statement {ELSE statement}?
+	| SWITCH '(' expression ')' statement
 	}
 */
 void selection_statement(stream &ss, context_t &ctx)
 {
 	debug();
 
+	if (nxt_tok(ss).type == tok_switch) {
+		match(tok_switch, ss);
+		match('(', ss);
+		var_t rs = expression(ss, ctx);
+		if (rs.is_alloced) {
+			auto emit_tmp = emit_load(rs);
+			*out_ss << emit_tmp.code;
+			rs = emit_tmp.var;
+		}
+		if (!is_type_i(*rs.type)) {
+			error("Switch quantity must be integer", ss, true);
+		}
+		if (rs.type->size < 4) {
+			type_t i32_type;
+			i32_type.name = "i32";
+			i32_type.type = type_t::type_basic;
+			i32_type.size = 4;
+			i32_type.is_int = 1;
+			auto emit_tmp = emit_conv_to(rs, i32_type);
+			*out_ss << emit_tmp.code;
+			rs = emit_tmp.var;
+		}
+		match(')', ss);
+
+		string label_body = get_label();
+		string label_dispatch = get_label();
+		string label_end = get_label();
+		context_t inner_ctx(&ctx);
+		inner_ctx.beg_label = ctx.beg_label;
+		inner_ctx.end_label = label_end;
+		inner_ctx.beg_depth = ctx.beg_depth;
+		inner_ctx.end_depth = get_scope_depth();
+		inner_ctx.switch_env = make_shared<switch_env_t>();
+		inner_ctx.switch_env->cond = rs;
+
+		// the case labels are only known after the body, so the
+		// switch instruction goes after it
+		auto emit_tmp = emit_br(label_dispatch);
+		*out_ss << emit_tmp.code;
+		emit_tmp = emit_label(label_body);
+		*out_ss << emit_tmp.code;
+		statement(ss, inner_ctx);
+		emit_tmp = emit_br(label_end);
+		*out_ss << emit_tmp.code;
+
+		const switch_env_t &env = *inner_ctx.switch_env;
+		emit_tmp = emit_label(label_dispatch);
+		*out_ss << emit_tmp.code;
+		emit_tmp = emit_switch(rs,
+				       env.default_label.empty() ?
+					       label_end :
+					       env.default_label,
+				       env.cases);
+		*out_ss << emit_tmp.code;
+
+		emit_tmp = emit_label(label_end);
+		*out_ss << emit_tmp.code;
+		return;
+	}
+
 	string label_true = get_label();
 	string label_false = get_label();
 	string label_end = get_label();
 	match(tok_if, ss);
 	match('(', ss);
-	var_t rs = expression(ss, ctx);
-	if (rs.is_alloced) {
-		auto emit_tmp = emit_load(rs);
-		*out_ss << emit_tmp.code;
-		rs = emit_tmp.var;
-	}
-	if (!is_type_i(*rs.type) && !is_type_f(*rs.type) &&
-	    !is_type_p(*rs.type)) {
-		error("Cannot use non-basic type as condition", ss, true);
-	}
-	if (!rs.type->is_bool) {
-		var_t zero;
-		zero.type = rs.type;
-		zero.name = "zeroinitializer";
-		auto emit_tmp = emit_ne(rs, zero);
-		*out_ss << emit_tmp.code;
-		rs = emit_tmp.var;
-	}
+	condition(ss, ctx, label_true, label_false);
 	match(')', ss);
-	auto emit_tmp = emit_br(rs, label_true, label_false);
-	*out_ss << emit_tmp.code;
 
-	emit_tmp = emit_label(label_true);
+	auto emit_tmp = emit_label(label_true);
 	*out_ss << emit_tmp.code;
 
 	statement(ss, ctx);
 	if (nxt_tok(ss).type != tok_else) {
+		emit_tmp = emit_br(label_false);
+		*out_ss << emit_tmp.code;
+
 		emit_tmp = emit_label(label_false);
 		*out_ss << emit_tmp.code;
 
@@ -3088,8 +3927,13 @@ void iteration_statement(stream &ss, context_t &ctx)
 		string label_beg = get_label();
 		string label_rbeg = get_label();
 		string label_end = get_label();
+		string outer_beg_label = ctx.beg_label;
+		string outer_end_label = ctx.end_label;
+		size_t outer_beg_depth = ctx.beg_depth;
+		size_t outer_end_depth = ctx.end_depth;
 		ctx.beg_label = label_beg;
 		ctx.end_label = label_end;
+		ctx.beg_depth = ctx.end_depth = get_scope_depth();
 
 		auto emit_tmp = emit_br(label_beg);
 		*out_ss << emit_tmp.code;
@@ -3098,28 +3942,8 @@ void iteration_statement(stream &ss, context_t &ctx)
 		*out_ss << emit_tmp.code;
 
 		match('(', ss);
-		var_t rs = expression(ss, ctx);
-		if (rs.is_alloced) {
-			emit_tmp = emit_load(rs);
-			*out_ss << emit_tmp.code;
-			rs = emit_tmp.var;
-		}
-		if (!is_type_i(*rs.type) && !is_type_f(*rs.type) &&
-		    !is_type_p(*rs.type)) {
-			error("Cannot use non-basic type as condition", ss,
-			      true);
-		}
-		if (!rs.type->is_bool) {
-			var_t zero;
-			zero.type = rs.type;
-			zero.name = "zeroinitializer";
-			emit_tmp = emit_ne(rs, zero);
-			*out_ss << emit_tmp.code;
-			rs = emit_tmp.var;
-		}
+		condition(ss, ctx, label_rbeg, label_end);
 		match(')', ss);
-		emit_tmp = emit_br(rs, label_rbeg, label_end);
-		*out_ss << emit_tmp.code;
 
 		emit_tmp = emit_label(label_rbeg);
 		*out_ss << emit_tmp.code;
@@ -3131,8 +3955,10 @@ void iteration_statement(stream &ss, context_t &ctx)
 		emit_tmp = emit_label(label_end);
 		*out_ss << emit_tmp.code;
 
-		ctx.beg_label = "";
-		ctx.end_label = "";
+		ctx.beg_label = outer_beg_label;
+		ctx.end_label = outer_end_label;
+		ctx.beg_depth = outer_beg_depth;
+		ctx.end_depth = outer_end_depth;
 		return;
 	}
 
@@ -3140,8 +3966,13 @@ void iteration_statement(stream &ss, context_t &ctx)
 		match(tok_do, ss);
 		string label_beg = get_label();
 		string label_end = get_label();
+		string outer_beg_label = ctx.beg_label;
+		string outer_end_label = ctx.end_label;
+		size_t outer_beg_depth = ctx.beg_depth;
+		size_t outer_end_depth = ctx.end_depth;
 		ctx.beg_label = label_beg;
 		ctx.end_label = label_end;
+		ctx.beg_depth = ctx.end_depth = get_scope_depth();
 
 		auto emit_tmp = emit_br(label_beg);
 		*out_ss << emit_tmp.code;
@@ -3152,35 +3983,17 @@ void iteration_statement(stream &ss, context_t &ctx)
 		statement(ss, ctx);
 		match(tok_while, ss);
 		match('(', ss);
-		var_t rs = expression(ss, ctx);
-		if (rs.is_alloced) {
-			emit_tmp = emit_load(rs);
-			*out_ss << emit_tmp.code;
-			rs = emit_tmp.var;
-		}
-		if (!is_type_i(*rs.type) && !is_type_f(*rs.type) &&
-		    !is_type_p(*rs.type)) {
-			error("Cannot use non-basic type as condition", ss,
-			      true);
-		}
-		if (!rs.type->is_bool) {
-			var_t zero;
-			zero.type = rs.type;
-			zero.name = "zeroinitializer";
-			emit_tmp = emit_ne(rs, zero);
-			*out_ss << emit_tmp.code;
-			rs = emit_tmp.var;
-		}
+		condition(ss, ctx, label_beg, label_end);
 		match(')', ss);
 		match(';', ss);
-		emit_tmp = emit_br(rs, label_beg, label_end);
-		*out_ss << emit_tmp.code;
 
 		emit_tmp = emit_label(label_end);
 		*out_ss << emit_tmp.code;
 
-		ctx.beg_label = "";
-		ctx.end_label = "";
+		ctx.beg_label = outer_beg_label;
+		ctx.end_label = outer_end_label;
+		ctx.beg_depth = outer_beg_depth;
+		ctx.end_depth = outer_end_depth;
 		return;
 	}
 
@@ -3194,6 +4007,7 @@ void iteration_statement(stream &ss, context_t &ctx)
 		context_t inner_ctx(&ctx);
 		inner_ctx.beg_label = label_beg;
 		inner_ctx.end_label = label_end;
+		inner_ctx.beg_depth = inner_ctx.end_depth = get_scope_depth();
 
 		match('(', ss);
 		// init expr
@@ -3211,28 +4025,8 @@ void iteration_statement(stream &ss, context_t &ctx)
 			*out_ss << emit_tmp.code;
 
 		} else {
-			var_t rs = expression(ss, inner_ctx);
-			if (rs.is_alloced) {
-				emit_tmp = emit_load(rs);
-				*out_ss << emit_tmp.code;
-				rs = emit_tmp.var;
-			}
-			if (!is_type_i(*rs.type) && !is_type_f(*rs.type) &&
-			    !is_type_p(*rs.type)) {
-				error("Cannot use non-basic type as condition",
-				      ss, true);
-			}
-			if (!rs.type->is_bool) {
-				var_t zero;
-				zero.type = rs.type;
-				zero.name = "zeroinitializer";
-				emit_tmp = emit_ne(rs, zero);
-				*out_ss << emit_tmp.code;
-				rs = emit_tmp.var;
-			}
+			condition(ss, inner_ctx, label_rbeg, label_end);
 			match(';', ss);
-			emit_tmp = emit_br(rs, label_rbeg, label_end);
-			*out_ss << emit_tmp.code;
 		}
 
 		// begin expr
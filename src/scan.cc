@@ -171,8 +171,8 @@ static std::string get_trans_char(stream &ss)
 		int ch = 0;
 		while (is_digit(ss.peek()) ||
 		       (ss.peek() >= 'a' && ss.peek() <= 'f') ||
-		       (ss.peek() >= 'F' && ss.peek() <= 'F')) {
-			ch *= 10;
+		       (ss.peek() >= 'A' && ss.peek() <= 'F')) {
+			ch *= 16;
 			ch += is_digit(ss.peek()) ? ss.get() - '0' :
 			      (ss.peek() >= 'a' && ss.peek() <= 'f') ?
 						    ss.get() - 'a' + 10 :
@@ -183,7 +183,31 @@ static std::string get_trans_char(stream &ss)
 		}
 		res += ch;
 	} else {
-		res += ss.get();
+		char ch = ss.get();
+		switch (ch) {
+		case 'a':
+			ch = '\a';
+			break;
+		case 'b':
+			ch = '\b';
+			break;
+		case 'f':
+			ch = '\f';
+			break;
+		case 'n':
+			ch = '\n';
+			break;
+		case 'r':
+			ch = '\r';
+			break;
+		case 't':
+			ch = '\t';
+			break;
+		case 'v':
+			ch = '\v';
+			break;
+		}
+		res += ch;
 	}
 	return res;
 }
@@ -212,13 +236,27 @@ std::string get_string(stream &ss)
 		}
 		if (ss.peek() == '\\') {
 			res += ss.get();
+			res += get_trans_char(ss);
+		} else {
+			res += ss.get();
 		}
-		res += get_trans_char(ss);
 	}
 	match_ss('"', ss);
 	return res;
 }
 
+std::string get_string_val(const std::string &str)
+{
+	std::string res = "";
+	for (size_t i = 0; i < str.length(); i++) {
+		if (str[i] == '\\' && i + 1 < str.length()) {
+			i++;
+		}
+		res += str[i];
+	}
+	return res;
+}
+
 tok_t scan(stream &ss)
 {
 	skip_white(ss);
@@ -255,7 +293,7 @@ tok_t scan(stream &ss)
 	}
 
 	if (ss.peek() == '\'') {
-		str = get_char(ss);
+		str = std::to_string((unsigned char)get_char(ss)[0]);
 		type = tok_int_lit;
 		return { type, str };
 	}
@@ -0,0 +1,108 @@
+/**
+ * @file writer.cc
+ * @author 泠妄 (lingwang@wcysite.com)
+ *
+ * @copyright Copyright (c) 2023 lingwang with MIT License.
+ *
+ */
+
+#include "writer.hh"
+#include "out.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+
+namespace neko_cc
+{
+
+writer_t::writer_t(bool _arena, size_t _cap)
+	: buf(new char[_cap])
+	, cap(_cap)
+	, arena(_arena)
+{
+}
+
+writer_t::writer_t(std::ostream &_out, size_t _cap)
+	: buf(new char[_cap])
+	, cap(_cap)
+	, out(&_out)
+{
+}
+
+writer_t::writer_t(int _fd, size_t _cap)
+	: buf(new char[_cap])
+	, cap(_cap)
+	, fd(_fd)
+{
+}
+
+writer_t::~writer_t()
+{
+	flush();
+}
+
+void writer_t::clear()
+{
+	len = 0;
+	rec_start = 0;
+	old_bufs.clear();
+}
+
+void writer_t::flush()
+{
+	if (out == nullptr && fd < 0) {
+		return;
+	}
+	write_out(buf.get(), len);
+	len = 0;
+	rec_start = 0;
+	if (out != nullptr) {
+		out->flush();
+	}
+}
+
+void writer_t::write_out(const char *s, size_t n)
+{
+	if (out != nullptr) {
+		out->write(s, n);
+		return;
+	}
+	while (n > 0) {
+		ssize_t ret = ::write(fd, s, n);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			err_msg("Cannot write the output");
+		}
+		s += ret;
+		n -= ret;
+	}
+}
+
+/**
+ * @brief Make room for n more chars. An attached writer flushes, a
+ * detached one grows. In arena mode the old buffer is kept alive for the
+ * records taken from it, and only the pending record moves.
+ */
+void writer_t::make_room(size_t n)
+{
+	if (out != nullptr || fd >= 0) {
+		flush();
+		return;
+	}
+	size_t keep = arena ? len - rec_start : len;
+	size_t new_cap = std::max(cap * 2, keep + n);
+	std::unique_ptr<char[]> new_buf(new char[new_cap]);
+	std::copy(buf.get() + len - keep, buf.get() + len, new_buf.get());
+	if (arena) {
+		old_bufs.push_back(std::move(buf));
+		rec_start = 0;
+	}
+	buf = std::move(new_buf);
+	len = keep;
+	cap = new_cap;
+}
+
+}